@@ -0,0 +1,39 @@
+//	Benchmarks that need the platform core: the buffer pool and the block
+//	I/O engines. Each platform has its own version of these
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+//	What one benchmark measured. Throughput is zero for a benchmark that
+//	doesn't move data, e.g. taking a buffer from the pool
+struct BenchResult
+{
+	std::string	name;
+	double		gbPerSecond;
+	double		nsPerBlock;
+};
+
+//	What a benchmark that moved bytes in blocks of blockSize in seconds
+//	measured
+BenchResult MakeResult (const char* name, const uint64_t bytes, const size_t blockSize, const double seconds);
+
+//	Time taking a buffer from a pool and giving it back, rounds times,
+//	and add the result. Returns false if there is nothing to time
+bool TimeBufferPool (const int rounds, std::vector<BenchResult>& results);
+
+//	Time writing and then reading ioSize bytes of target in blockSize
+//	requests through each block I/O engine, best of rounds runs, and add
+//	the results. The target should be on a RAM disk or be a null device,
+//	so the engine rather than the device is measured. Anything but a null
+//	device must not already be there, as it is written over. It is
+//	created and deleted afterwards. Returns false if the target could not
+//	be used
+bool TimeEngines (const char* target, const uint64_t ioSize, const uint32_t blockSize, const unsigned queueDepth, const int rounds, std::vector<BenchResult>& results);
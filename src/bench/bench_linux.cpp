@@ -0,0 +1,237 @@
+//	Buffer pool and block I/O engine benchmarks on Linux. The engines are
+//	run against a file on a RAM disk e.g. /dev/shm or against /dev/null
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "bench.h"
+#include "blockio.h"
+#include "buffer.h"
+#include "output.h"
+#include "timing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+
+//	Direct I/O buffers are aligned on the largest common sector size
+constexpr size_t	benchAlignment	= 4096;
+
+
+//	The Linux pool hands its buffers out by index, as each one is
+//	registered with the kernel, so there is no taking and giving back to
+//	time
+bool TimeBufferPool (const int rounds, std::vector<BenchResult>& results)
+{
+	(void) rounds;
+	(void) results;
+	printf("%-16s not timed, the Linux pool hands its buffers out by index\n", "BufferPool");
+	return false;
+}
+
+
+//	Start the next block in a slot
+static bool StartBlock (BlockEngine& engine, BlockRequest& slot, const BufferPool& bufferPool, const size_t slotIndex, const uint64_t block, const uint32_t blockSize, const bool reading)
+{
+	slot.buffer			= bufferPool.Buffer(slotIndex);
+	slot.bufferIndex	= (int) slotIndex;
+	slot.offset			= (int64_t) (block * blockSize);
+	slot.size			= blockSize;
+	slot.reading		= reading;
+	slot.tag			= block;
+	return engine.Start(slot);
+}
+
+
+//	Write or read totalBlocks blocks through an engine, keeping a request
+//	in flight in every slot. What a request transferred isn't checked, as
+//	a null device reads nothing back. Returns the seconds it took, or a
+//	negative value, with errno set, if a request failed
+static double RunEngine (BlockEngine& engine, const BufferPool& bufferPool, const unsigned numSlots, const bool reading, const uint64_t totalBlocks, const uint32_t blockSize)
+{
+	std::vector<BlockRequest> ioSlots(numSlots);
+
+	//	Start the timer
+	BatchTimer timer;
+
+	uint64_t	nextBlock	= 0;
+	unsigned	inFlight	= 0;
+	bool		failed		= false;
+	for (unsigned s = 0; s < numSlots && nextBlock < totalBlocks && !failed; s++)
+	{
+		if (StartBlock(engine, ioSlots [s], bufferPool, s, nextBlock ++, blockSize, reading))
+		{
+			inFlight ++;
+		}
+		else
+		{
+			failed = true;
+		}
+	}
+
+	int savedError = 0;
+	while (inFlight > 0)
+	{
+		const BlockCompletion completion = engine.Wait();
+		if (completion.request == nullptr)
+		{
+			//	The ring itself failed. Anything still in flight uses the
+			//	slots, so it is cancelled and reaped before they are freed
+			engine.Cancel();
+			errno = completion.error;
+			return -1;
+		}
+
+		inFlight --;
+		if (!completion.succeeded)
+		{
+			savedError	= completion.error;
+			failed		= true;
+			continue;
+		}
+
+		if (!failed && nextBlock < totalBlocks)
+		{
+			BlockRequest& slot = *completion.request;
+			if (StartBlock(engine, slot, bufferPool, &slot - ioSlots.data(), nextBlock ++, blockSize, reading))
+			{
+				inFlight ++;
+			}
+			else
+			{
+				savedError	= errno;
+				failed		= true;
+			}
+		}
+	}
+
+	if (failed)
+	{
+		errno = savedError != 0 ? savedError : errno;
+		return -1;
+	}
+
+	return timer.TotalSeconds();
+}
+
+
+bool TimeEngines (const char* target, const uint64_t ioSize, const uint32_t blockSize, const unsigned queueDepth, const int rounds, std::vector<BenchResult>& results)
+{
+	//	The engines write over the target, so it has to be a null device or
+	//	a file we make. They open an existing file, so it is made first
+	struct stat	targetStat;
+	bool		created	= false;
+	if (stat(target, &targetStat) == 0)
+	{
+		if (!S_ISCHR(targetStat.st_mode))
+		{
+			printf("%s is already there, it would be written over\n", target);
+			return false;
+		}
+	}
+	else
+	{
+		const int fd = open(target, O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0 || fstat(fd, &targetStat) != 0)
+		{
+			PrintError("Could not create %s", target);
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			return false;
+		}
+		close(fd);
+		created = true;
+	}
+
+	//	A null device can't be opened for direct I/O, and has no cache to
+	//	go through anyway
+	const bool		nullDevice	= S_ISCHR(targetStat.st_mode);
+	const uint64_t	totalBlocks	= ioSize / blockSize;
+
+	//	Without io_uring in the kernel the second run falls back to the
+	//	synchronous engine and times the same thing again
+	struct EngineRun
+	{
+		const char*	name;
+		unsigned	depth;
+	};
+	const EngineRun engineRuns [] = { { "Sync", 0 }, { "Uring", queueDepth } };
+
+	bool succeeded = true;
+	for (const EngineRun& run : engineRuns)
+	{
+		BlockOptions options	= {};
+		options.cached			= nullDevice;
+		options.queueDepth		= run.depth;
+		std::unique_ptr<BlockEngine> engine = OpenBlockEngine(target, options);
+		if (!engine)
+		{
+			PrintError("Could not open %s", target);
+			succeeded = false;
+			break;
+		}
+
+		const unsigned	numSlots	= std::max(run.depth, 1u);
+		BufferPool		bufferPool;
+		if (!bufferPool.Create(blockSize, numSlots, benchAlignment))
+		{
+			PrintError("Did not get I/O buffers for %s", target);
+			succeeded = false;
+			break;
+		}
+
+		if (!engine->RegisterBuffers(bufferPool.Iovecs()))
+		{
+			PrintError("Could not register the I/O buffers for %s", target);
+			succeeded = false;
+			break;
+		}
+
+		//	Every write round goes first, so the reads have data to read
+		for (const bool reading : { false, true })
+		{
+			const std::string name = std::string(run.name) + (reading ? "Read" : "Write");
+
+			double fastest = 0;
+			for (int r = 0; r < rounds && succeeded; r++)
+			{
+				const double seconds = RunEngine(*engine, bufferPool, numSlots, reading, totalBlocks, blockSize);
+				if (seconds < 0)
+				{
+					PrintError("%s of %s failed", name.c_str(), target);
+					succeeded = false;
+				}
+				else
+				if (r == 0 || seconds < fastest)
+				{
+					fastest = seconds;
+				}
+			}
+
+			if (!succeeded)
+			{
+				break;
+			}
+			results.push_back(MakeResult(name.c_str(), totalBlocks * blockSize, blockSize, fastest));
+		}
+
+		if (!succeeded)
+		{
+			break;
+		}
+	}
+
+	if (created && unlink(target) != 0)
+	{
+		PrintError("Could not delete %s", target);
+	}
+
+	return succeeded;
+}
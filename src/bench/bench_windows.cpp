@@ -0,0 +1,243 @@
+//	Buffer pool and block I/O engine benchmarks on Windows. The engines
+//	are run against a file on a RAM disk or against the NUL device
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "bench.h"
+#include "blockio.h"
+#include "buffer.h"
+#include "output.h"
+#include "timing.h"
+
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <memory>
+
+//	Unbuffered I/O buffers are aligned on the largest common sector size
+constexpr size_t	benchAlignment	= 4096;
+
+//	Buffers in the pool, and how many times one is taken and given back
+//	in each round
+constexpr size_t	poolBuffers		= 64;
+constexpr uint64_t	poolOperations	= 1024 * 1024;
+
+
+bool TimeBufferPool (const int rounds, std::vector<BenchResult>& results)
+{
+	BufferPool bufferPool;
+	if (!bufferPool.Create(benchAlignment, poolBuffers, benchAlignment, false))
+	{
+		PrintError(L"Did not get a buffer pool");
+		return false;
+	}
+
+	//	Take two, as a run with requests in flight does, so the free list
+	//	is never just the one buffer going back and forth
+	double fastest = 0;
+	for (int r = 0; r < rounds; r++)
+	{
+		BatchTimer timer;
+		for (uint64_t o = 0; o < poolOperations; o++)
+		{
+			uint8_t* first	= bufferPool.Acquire();
+			uint8_t* second	= bufferPool.Acquire();
+			bufferPool.Release(first);
+			bufferPool.Release(second);
+		}
+		const double seconds = timer.TotalSeconds();
+		if (r == 0 || seconds < fastest)
+		{
+			fastest = seconds;
+		}
+	}
+
+	//	Nothing is moved, so the time is per take and give back
+	BenchResult result	= {};
+	result.name			= "BufferPool";
+	result.nsPerBlock	= fastest * 1e9 / (poolOperations * 2);
+	results.push_back(result);
+	return true;
+}
+
+
+//	Start the next block in a slot
+static bool StartBlock (BlockEngine& engine, BlockRequest& slot, uint8_t* buffer, const uint64_t block, const DWORD blockSize, const bool reading)
+{
+	slot.buffer		= buffer;
+	slot.offset		= (int64_t) (block * blockSize);
+	slot.size		= blockSize;
+	slot.reading	= reading;
+	slot.tag		= block;
+	return engine.Start(slot);
+}
+
+
+//	Write or read totalBlocks blocks through an engine, keeping a request
+//	in flight in every slot. What a request transferred isn't checked, as
+//	the NUL device reads nothing back. Returns the seconds it took, or a
+//	negative value, with the Windows error set, if a request failed
+static double RunEngine (BlockEngine& engine, const std::vector<uint8_t*>& buffers, const bool reading, const uint64_t totalBlocks, const DWORD blockSize)
+{
+	const size_t				numSlots	= buffers.size();
+	std::vector<BlockRequest>	ioSlots(numSlots);
+
+	//	Start the timer
+	BatchTimer timer;
+
+	uint64_t	nextBlock	= 0;
+	size_t		inFlight	= 0;
+	bool		failed		= false;
+	for (size_t s = 0; s < numSlots && nextBlock < totalBlocks && !failed; s++)
+	{
+		if (StartBlock(engine, ioSlots [s], buffers [s], nextBlock ++, blockSize, reading))
+		{
+			inFlight ++;
+		}
+		else
+		{
+			failed = true;
+		}
+	}
+
+	DWORD savedError = ERROR_SUCCESS;
+	while (inFlight > 0)
+	{
+		const BlockCompletion completion = engine.Wait();
+		if (completion.request == nullptr)
+		{
+			//	The completion port itself failed, nothing more will complete
+			return -1;
+		}
+
+		inFlight --;
+		if (!completion.succeeded)
+		{
+			savedError	= GetLastError();
+			failed		= true;
+			continue;
+		}
+
+		if (!failed && nextBlock < totalBlocks)
+		{
+			BlockRequest& slot = *completion.request;
+			if (StartBlock(engine, slot, buffers [&slot - ioSlots.data()], nextBlock ++, blockSize, reading))
+			{
+				inFlight ++;
+			}
+			else
+			{
+				savedError	= GetLastError();
+				failed		= true;
+			}
+		}
+	}
+
+	if (failed)
+	{
+		SetLastError(savedError);
+		return -1;
+	}
+
+	return timer.TotalSeconds();
+}
+
+
+bool TimeEngines (const char* target, const uint64_t ioSize, const uint32_t blockSize, const unsigned queueDepth, const int rounds, std::vector<BenchResult>& results)
+{
+	wchar_t targetName [MAX_PATH];
+	swprintf_s(targetName, L"%S", target);
+
+	//	The NUL device has no cache to bypass, and isn't created. Anything
+	//	else is a new file the engines create and we delete afterwards
+	const bool		nullDevice	= _stricmp(target, "NUL") == 0 || _stricmp(target, "\\\\.\\NUL") == 0;
+	const uint64_t	totalBlocks	= ioSize / blockSize;
+	if (!nullDevice && GetFileAttributes(targetName) != INVALID_FILE_ATTRIBUTES)
+	{
+		OutputText(L"%s is already there, it would be written over\n", targetName);
+		return false;
+	}
+
+	struct EngineRun
+	{
+		const char*	name;
+		DWORD		depth;
+	};
+	const EngineRun engineRuns [] = { { "Sync", 0 }, { "Overlapped", queueDepth } };
+
+	bool succeeded = true;
+	for (const EngineRun& run : engineRuns)
+	{
+		BlockOptions options	= {};
+		options.cached			= nullDevice;
+		options.create			= !nullDevice;
+		options.queueDepth		= run.depth;
+		std::unique_ptr<BlockEngine> engine = OpenBlockEngine(targetName, options);
+		if (!engine)
+		{
+			PrintError(L"Could not open %s", targetName);
+			succeeded = false;
+			break;
+		}
+
+		const size_t	numSlots	= run.depth != 0 ? run.depth : 1;
+		BufferPool		bufferPool;
+		if (!bufferPool.Create(blockSize, numSlots, benchAlignment, false))
+		{
+			PrintError(L"Did not get I/O buffers for %s", targetName);
+			succeeded = false;
+			break;
+		}
+
+		std::vector<uint8_t*> buffers(numSlots);
+		for (uint8_t*& buffer : buffers)
+		{
+			buffer = bufferPool.Acquire();
+		}
+
+		//	Every write round goes first, so the reads have data to read
+		for (const bool reading : { false, true })
+		{
+			const std::string name = std::string(run.name) + (reading ? "Read" : "Write");
+
+			double fastest = 0;
+			for (int r = 0; r < rounds && succeeded; r++)
+			{
+				const double seconds = RunEngine(*engine, buffers, reading, totalBlocks, blockSize);
+				if (seconds < 0)
+				{
+					PrintError(L"%S of %s failed", name.c_str(), targetName);
+					succeeded = false;
+				}
+				else
+				if (r == 0 || seconds < fastest)
+				{
+					fastest = seconds;
+				}
+			}
+
+			if (!succeeded)
+			{
+				break;
+			}
+			results.push_back(MakeResult(name.c_str(), totalBlocks * blockSize, blockSize, fastest));
+		}
+
+		//	Close the file before the buffers it used are freed
+		engine.reset();
+		if (!succeeded)
+		{
+			break;
+		}
+	}
+
+	if (!nullDevice && !DeleteFile(targetName) && GetLastError() != ERROR_FILE_NOT_FOUND)
+	{
+		PrintError(L"Could not delete %s", targetName);
+	}
+
+	return succeeded;
+}
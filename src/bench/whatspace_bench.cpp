@@ -0,0 +1,343 @@
+//	Time the pattern and compare kernels the tools use, the buffer pool,
+//	and the block I/O engines against a RAM disk or a null device, on
+//	their own and away from the speed of any real device, so a change to
+//	them can be measured. The results can be saved as a baseline and a
+//	later run checked against it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "bench.h"
+#include "cpu.h"
+#include "marker.h"
+#include "pattern.h"
+#include "timing.h"
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+//	Bytes in a KiB and a MiB, and in the GB the throughput is reported in
+constexpr uint64_t	benchKiB			= 1024;
+constexpr uint64_t	benchMiB			= 1024 * 1024;
+constexpr double	benchGB				= 1e9;
+
+//	Defaults for the buffer size, the block size the time per block is
+//	given for, and the number of times each benchmark is run
+constexpr uint64_t	defaultMiB			= 64;
+constexpr uint64_t	defaultBlockKiB		= 1024;
+constexpr int		defaultRounds		= 20;
+
+//	Requests the queued I/O engine keeps in flight
+constexpr unsigned	defaultQueueDepth	= 32;
+
+//	How much slower than the baseline a benchmark can be, in percent,
+//	before it counts as a regression
+constexpr double	defaultTolerance	= 10;
+
+//	Sector size used when checking a pattern sector by sector
+constexpr size_t	benchSector			= 4096;
+
+//	Exit code when a benchmark is slower than its baseline
+constexpr int		regressionExit		= 2;
+
+
+BenchResult MakeResult (const char* name, const uint64_t bytes, const size_t blockSize, const double seconds)
+{
+	BenchResult result	= {};
+	result.name			= name;
+	if (seconds > 0)
+	{
+		result.gbPerSecond	= (double) bytes / seconds / benchGB;
+		result.nsPerBlock	= seconds * 1e9 / ((double) bytes / blockSize);
+	}
+	return result;
+}
+
+
+//	Time a kernel over rounds runs of a buffer and keep the fastest run,
+//	which is the one least disturbed by anything else
+template <typename Kernel>
+BenchResult TimeKernel (const char* name, const size_t bufferSize, const size_t blockSize, const int rounds, Kernel kernel)
+{
+	double fastest = 0;
+	for (int r = 0; r < rounds; r++)
+	{
+		BatchTimer timer;
+		kernel();
+		const double seconds = timer.TotalSeconds();
+		if (r == 0 || seconds < fastest)
+		{
+			fastest = seconds;
+		}
+	}
+
+	return MakeResult(name, bufferSize, blockSize, fastest);
+}
+
+
+//	Save the results as a baseline. Each line is a benchmark's name, its
+//	throughput and its time per block, after one giving the block size
+bool SaveBaseline (const char* fileName, const size_t blockSize, const std::vector<BenchResult>& results)
+{
+	FILE* baseline = fopen(fileName, "w");
+	if (baseline == nullptr)
+	{
+		printf("Could not create %s\n", fileName);
+		return false;
+	}
+
+	fprintf(baseline, "block %llu\n", (unsigned long long) blockSize);
+	for (const BenchResult& result : results)
+	{
+		fprintf(baseline, "%s %.4f %.4f\n", result.name.c_str(), result.gbPerSecond, result.nsPerBlock);
+	}
+
+	const bool written = ferror(baseline) == 0;
+	if (fclose(baseline) != 0 || !written)
+	{
+		printf("Could not write %s\n", fileName);
+		return false;
+	}
+
+	return true;
+}
+
+
+//	Load a baseline saved by an earlier run. It has to be for the same
+//	block size, or the times per block can't be compared
+bool LoadBaseline (const char* fileName, const size_t blockSize, std::vector<BenchResult>& baseline)
+{
+	FILE* baselineFile = fopen(fileName, "r");
+	if (baselineFile == nullptr)
+	{
+		printf("Could not open %s\n", fileName);
+		return false;
+	}
+
+	unsigned long long savedBlockSize = 0;
+	if (fscanf(baselineFile, "block %llu", &savedBlockSize) == 1)
+	{
+		char		name [64];
+		BenchResult	result;
+		while (fscanf(baselineFile, "%63s %lf %lf", name, &result.gbPerSecond, &result.nsPerBlock) == 3)
+		{
+			result.name = name;
+			baseline.push_back(result);
+		}
+	}
+	fclose(baselineFile);
+
+	if (baseline.empty())
+	{
+		printf("%s is not a baseline\n", fileName);
+		return false;
+	}
+
+	if (savedBlockSize != blockSize)
+	{
+		printf("%s is for %llu byte blocks, not %llu\n", fileName, savedBlockSize, (unsigned long long) blockSize);
+		return false;
+	}
+
+	return true;
+}
+
+
+//	Output the results, next to the baseline if there is one. Returns
+//	false if a benchmark took more than tolerance percent longer per
+//	block than it did in the baseline
+bool OutputResults (const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline, const double tolerance)
+{
+	bool withinTolerance = true;
+	for (const BenchResult& result : results)
+	{
+		if (result.gbPerSecond > 0)
+		{
+			printf("%-16s %8.2f GB/s %12.1f ns/block", result.name.c_str(), result.gbPerSecond, result.nsPerBlock);
+		}
+		else
+		{
+			printf("%-16s %13s %12.1f ns each ", result.name.c_str(), "", result.nsPerBlock);
+		}
+
+		const BenchResult* saved = nullptr;
+		for (const BenchResult& b : baseline)
+		{
+			if (b.name == result.name)
+			{
+				saved = &b;
+			}
+		}
+
+		if (saved != nullptr && saved->nsPerBlock > 0)
+		{
+			const double change = (result.nsPerBlock - saved->nsPerBlock) * 100 / saved->nsPerBlock;
+			const bool slower = change > tolerance;
+			printf(" %+7.1f%%%s", change, slower ? " slower than the baseline" : "");
+			withinTolerance = withinTolerance && !slower;
+		}
+		else
+		if (!baseline.empty())
+		{
+			printf("  not in the baseline");
+		}
+		printf("\n");
+	}
+
+	return withinTolerance;
+}
+
+
+//	Output a usage message
+void Usage (const char* progName)
+{
+	printf("\nUsage: %s [-size <MiB>] [-block <KiB>] [-rounds <count>] [-target <file or null device> [-qd <depth>]] [-save <file>] [-baseline <file> [-tolerance <percent>]]\n", progName);
+}
+
+
+int main (int argc, char** argv)
+{
+	uint64_t	sizeMiB		= defaultMiB;
+	uint64_t	blockKiB	= defaultBlockKiB;
+	int			rounds		= defaultRounds;
+	const char*	target		= nullptr;
+	unsigned	queueDepth	= defaultQueueDepth;
+	const char*	saveName	= nullptr;
+	const char*	baseName	= nullptr;
+	double		tolerance	= defaultTolerance;
+	for (int i = 1; i < argc; i ++)
+	{
+		if (strcmp(argv [i], "-size") == 0 && i + 1 < argc)
+		{
+			sizeMiB = strtoull(argv [++ i], nullptr, 10);
+		}
+		else
+		if (strcmp(argv [i], "-block") == 0 && i + 1 < argc)
+		{
+			blockKiB = strtoull(argv [++ i], nullptr, 10);
+		}
+		else
+		if (strcmp(argv [i], "-rounds") == 0 && i + 1 < argc)
+		{
+			rounds = atoi(argv [++ i]);
+		}
+		else
+		if (strcmp(argv [i], "-target") == 0 && i + 1 < argc)
+		{
+			target = argv [++ i];
+		}
+		else
+		if (strcmp(argv [i], "-qd") == 0 && i + 1 < argc)
+		{
+			queueDepth = (unsigned) strtoul(argv [++ i], nullptr, 10);
+		}
+		else
+		if (strcmp(argv [i], "-save") == 0 && i + 1 < argc)
+		{
+			saveName = argv [++ i];
+		}
+		else
+		if (strcmp(argv [i], "-baseline") == 0 && i + 1 < argc)
+		{
+			baseName = argv [++ i];
+		}
+		else
+		if (strcmp(argv [i], "-tolerance") == 0 && i + 1 < argc)
+		{
+			tolerance = atof(argv [++ i]);
+		}
+		else
+		{
+			Usage(argv [0]);
+			return 1;
+		}
+	}
+
+	//	A block has to fit in the buffer, and be whole sectors for direct I/O
+	const size_t bufferSize	= (size_t) (sizeMiB * benchMiB);
+	const size_t blockSize	= (size_t) (blockKiB * benchKiB);
+	if (sizeMiB == 0 || rounds <= 0 || blockSize == 0 || blockSize > bufferSize || blockSize % benchSector != 0 || blockSize > UINT32_MAX || queueDepth == 0 || tolerance < 0)
+	{
+		Usage(argv [0]);
+		return 1;
+	}
+
+	std::vector<BenchResult> baseline;
+	if (baseName != nullptr && !LoadBaseline(baseName, blockSize, baseline))
+	{
+		return 1;
+	}
+
+	printf("Kernels          : %s\n", CpuHasAvx512() ? "AVX-512" : CpuHasAvx2() ? "AVX2" : "SSE2");
+	printf("Buffer size      : %llu MiB in %llu KiB blocks, best of %d rounds\n", (unsigned long long) sizeMiB, (unsigned long long) blockKiB, rounds);
+	if (target != nullptr)
+	{
+		printf("I/O target       : %s, %u requests in flight\n", target, queueDepth);
+	}
+
+	const uint64_t			seed		= NewPatternSeed();
+	const uint64_t			runId		= NewRunId();
+	std::vector<uint8_t>	pattern(bufferSize);
+	std::vector<uint8_t>	copy(bufferSize);
+	std::vector<BenchResult> results;
+
+	//	The results feed a checksum, so the compiler can't drop the calls
+	uint64_t checksum = 0;
+
+	results.push_back(TimeKernel("FillPattern", bufferSize, blockSize, rounds, [&] {
+		FillPattern(pattern.data(), bufferSize, seed, 0);
+	}));
+
+	memcpy(copy.data(), pattern.data(), bufferSize);
+	results.push_back(TimeKernel("FindMismatch", bufferSize, blockSize, rounds, [&] {
+		checksum += FindMismatch(copy.data(), pattern.data(), bufferSize);
+	}));
+
+	results.push_back(TimeKernel("VerifyPattern", bufferSize, blockSize, rounds, [&] {
+		checksum += VerifyPattern(pattern.data(), bufferSize, seed, 0, benchSector).firstMismatch;
+	}));
+
+	//	A header is written and read back at the start of every block, as
+	//	the marker loops do. Only the header is touched, so there is a time
+	//	per block but no throughput
+	uint64_t headersRead = 0;
+	BenchResult headers = TimeKernel("MarkerHeader", bufferSize, blockSize, rounds, [&] {
+		for (size_t b = 0; b < bufferSize; b += blockSize)
+		{
+			MarkerHeader header;
+			SetMarkerHeader(copy.data() + b, runId, (int64_t) b, b / blockSize);
+			headersRead += ReadMarkerHeader(copy.data() + b, header) && header.offset == (int64_t) b ? 1 : 0;
+		}
+	});
+	headers.gbPerSecond = 0;
+	results.push_back(headers);
+
+	TimeBufferPool(rounds, results);
+
+	bool succeeded = true;
+	if (target != nullptr)
+	{
+		succeeded = TimeEngines(target, bufferSize, (uint32_t) blockSize, queueDepth, rounds, results);
+	}
+
+	const bool withinTolerance = OutputResults(results, baseline, tolerance);
+	if (saveName != nullptr && !SaveBaseline(saveName, blockSize, results))
+	{
+		succeeded = false;
+	}
+
+	//	Every byte matched, so each compare returned the buffer size, and
+	//	every header read back
+	const bool checked = checksum == (uint64_t) bufferSize * rounds * 2 && headersRead == (uint64_t) ((bufferSize + blockSize - 1) / blockSize) * rounds;
+	if (!checked || !succeeded)
+	{
+		return 1;
+	}
+
+	return withinTolerance ? 0 : regressionExit;
+}
@@ -0,0 +1,1159 @@
+//	Check how much disk space a device actually has, on Linux. This is
+//	done by creating a large file and then writing and reading
+//	specific patterns to verify data made it to the device
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "../whatspace_core/blockio.h"
+#include "../whatspace_core/buffer.h"
+#include "../whatspace_core/output.h"
+#include "../../windows/whatspace_core/fakedevice.h"
+#include "../../windows/whatspace_core/marker.h"
+#include "../../windows/whatspace_core/pattern.h"
+#include "../../windows/whatspace_core/timing.h"
+#include "../../windows/whatspace_core/verify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+//	File prefix
+constexpr const char*		verifyFilename	= "verifysp.bin";
+
+//	Default distance between markers
+constexpr uint64_t			verifySize		= 10 * MiB;
+
+//	Largest marker size and stride the user can ask for
+constexpr uint64_t			maxBlockSize	= 64 * MiB;
+constexpr uint64_t			maxStride		= 1024 * GiB;
+
+//	Batch size for some operations
+constexpr uint64_t			batchSize		= 5;
+
+//	Largest number of requests we will keep in flight
+constexpr unsigned			maxQueueDepth	= 256;
+
+//	First offset after 0 on the bisect ladder
+constexpr int64_t			minBoundary		= 64 * MiB;
+
+//	Smallest distance between the low rungs of a bisect's wrap check, and
+//	the most rungs it writes. The distance doubles until the rungs fit,
+//	and a wrap at any multiple of it is caught
+constexpr int64_t			ladderGranule	= MiB;
+constexpr size_t			maxWrapRungs	= 2048;
+
+//	Share of the file given back each time fallocate runs out of space,
+//	as the file system needs some of the free space for the file's extents
+constexpr int64_t			allocateBackoff	= 256;
+
+//	Program actions
+namespace progActions
+{
+	uint8_t justPath	= 1;
+	uint8_t noreads		= 2;
+	uint8_t outputStats	= 4;
+	uint8_t twoPass		= 8;
+	uint8_t pattern		= 16;
+	uint8_t bisect		= 32;
+};
+
+
+//	Make the name of the verification file in a directory
+void VerifyFileName (char (&fileName) [PATH_MAX], const char* pathName)
+{
+	const size_t	length		= strlen(pathName);
+	const bool		needSlash	= length == 0 || pathName [length - 1] != '/';
+	snprintf(fileName, sizeof(fileName), "%s%s%s", pathName, needSlash ? "/" : "", verifyFilename);
+}
+
+
+//	Quickly create the file. fallocate gives the file its extents without
+//	writing them, the same as SetFileValidData on Windows. The file size
+//	comes back as the space that could actually be had
+bool CreateVerifyFile (const char* pathName, const uint32_t bytesPerSector, int64_t& totalSpace)
+{
+	//	Create the filename
+	char writeName [PATH_MAX];
+	VerifyFileName(writeName, pathName);
+
+	//	Output some information
+	printf("Creating file %s", writeName);
+	OutputSize(", will be", totalSpace);
+
+	const int writeFile = open(writeName, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (writeFile < 0)
+	{
+		PrintError("Could not create %s", writeName);
+		return false;
+	}
+
+	//	The free space includes what the file system needs to keep track
+	//	of the file, so a little is given back until the file fits
+	int64_t fileSize = totalSpace - (totalSpace % bytesPerSector);
+	int		result;
+	while ((result = fallocate(writeFile, 0, 0, fileSize)) != 0 && errno == ENOSPC && fileSize > (int64_t) bytesPerSector)
+	{
+		fileSize -= std::max(fileSize / allocateBackoff, (int64_t) bytesPerSector);
+		fileSize -= fileSize % bytesPerSector;
+	}
+
+	//	Some file systems e.g. older FAT drivers can't allocate without
+	//	writing. The file is just extended, and the first write to a high
+	//	offset may then have to fill everything before it
+	if (result != 0 && errno == EOPNOTSUPP)
+	{
+		printf("%s can't be preallocated, the first writes may be slow\n", writeName);
+		result = ftruncate(writeFile, fileSize);
+	}
+
+	if (result != 0)
+	{
+		PrintError("Could not allocate %s", writeName);
+		close(writeFile);
+		return false;
+	}
+
+	if (fileSize != totalSpace)
+	{
+		OutputSize("The file system had room for", fileSize);
+		totalSpace = fileSize;
+	}
+
+	//	We can close the file
+	if (close(writeFile) != 0)
+	{
+		PrintError("Could not close file %s after creation", writeName);
+		return false;
+	}
+
+	return true;
+}
+
+
+//	Open what the markers are written to - the verification file, or the
+//	whole device for a raw run. A queue depth of zero gives synchronous
+//	I/O
+std::unique_ptr<BlockEngine> OpenVerifyTarget (const char* pathName, const bool raw, const unsigned queueDepth)
+{
+	char verifyName [PATH_MAX];
+	if (raw)
+	{
+		snprintf(verifyName, sizeof(verifyName), "%s", pathName);
+	}
+	else
+	{
+		VerifyFileName(verifyName, pathName);
+	}
+
+	BlockOptions options;
+	options.raw			= raw;
+	options.cached		= false;
+	options.queueDepth	= queueDepth;
+
+	std::unique_ptr<BlockEngine> verifyTarget = OpenBlockEngine(verifyName, options);
+	if (!verifyTarget)
+	{
+		PrintError("Could not open %s for verification", verifyName);
+		return nullptr;
+	}
+
+	return verifyTarget;
+}
+
+
+//	How markers are laid out in a sector. This is the same layout the
+//	Windows maxspace uses
+struct MarkerStyle
+{
+	//	Fill the whole sector with a pattern instead of four values
+	bool		fullPattern;
+	uint64_t	patternSeed;
+
+	//	Each marker has a header with its own offset and this run ID
+	uint64_t	runId;
+
+	//	Size of each marker write and read, and the distance from one
+	//	marker to the next
+	uint32_t	blockSize;
+	uint64_t	stride;
+};
+
+
+//	Set the marker for the block at an offset
+void SetMarker (uint8_t* buffer, const uint32_t bytesPerSector, const uint64_t value, const int64_t offset, const MarkerStyle& style)
+{
+	//	The header is at the start of the block, then either the pattern
+	//	fills the rest of it or there are three more headers spread
+	//	through it. The rest of the block is left alone, as a write
+	//	buffer starts out zeroed and only ever holds markers
+	SetMarkerHeader(buffer, style.runId, offset, value);
+	if (style.fullPattern)
+	{
+		FillPattern(buffer + markerHeaderSize, bytesPerSector - markerHeaderSize, style.patternSeed, offset + markerHeaderSize);
+		return;
+	}
+
+	const uint64_t dataOffsets = bytesPerSector / 4;
+	for (int o = 1; o < 4; o++)
+	{
+		SetMarkerHeader(buffer + (o * dataOffsets), style.runId, offset, value);
+	}
+}
+
+
+//	Spoil the parts of a read buffer that CheckMarker looks at first, so
+//	a read that doesn't fill the buffer can't pass with an old marker
+void PoisonMarker (uint8_t* buffer, const uint32_t bytesPerSector, const MarkerStyle& style)
+{
+	const int		numStamps	= style.fullPattern ? 1 : 4;
+	const uint64_t	dataOffsets	= bytesPerSector / 4;
+	for (int o = 0; o < numStamps; o++)
+	{
+		memset(buffer + (o * dataOffsets), 0xFF, markerHeaderSize);
+	}
+}
+
+
+//	Check the marker for the block at an offset. Returns the position of
+//	the first bad byte, or bytesPerSector if the marker is correct
+uint32_t CheckMarker (const uint8_t* buffer, const uint32_t bytesPerSector, const uint64_t value, const int64_t offset, const MarkerStyle& style)
+{
+	//	The header we expect to see
+	uint8_t expectedHeader [markerHeaderSize];
+	SetMarkerHeader(expectedHeader, style.runId, offset, value);
+
+	const int		numHeaders	= style.fullPattern ? 1 : 4;
+	const uint64_t	dataOffsets	= bytesPerSector / 4;
+	for (int o = 0; o < numHeaders; o++)
+	{
+		const size_t badByte = FindMismatch(buffer + (o * dataOffsets), expectedHeader, markerHeaderSize);
+		if (badByte != markerHeaderSize)
+		{
+			return (uint32_t) ((o * dataOffsets) + badByte);
+		}
+	}
+
+	if (style.fullPattern)
+	{
+		return (uint32_t) (markerHeaderSize + VerifyPattern(buffer + markerHeaderSize, bytesPerSector - markerHeaderSize, style.patternSeed, offset + markerHeaderSize, bytesPerSector).firstMismatch);
+	}
+
+	return bytesPerSector;
+}
+
+
+//	Give the user an idea of where a marker check failed. A controller
+//	that wraps addresses writes the marker for a high offset onto a low
+//	one. The last write to a sector is the one that stays, so the distance
+//	between them is some multiple of where the device wraps. Returns the
+//	distance, or zero if the marker wasn't overwritten that way
+int64_t ReportMarkerMismatch (const uint8_t* buffer, const uint32_t badByte, const int64_t offset, const MarkerStyle& style)
+{
+	printf("\n%s is incorrect at byte %u of the block @ offset %lld\n", style.fullPattern ? "Pattern" : "Verification marker", badByte, (long long) offset);
+
+	MarkerHeader header;
+	if (!ReadMarkerHeader(buffer, header) || header.runId != style.runId || header.offset == offset)
+	{
+		return 0;
+	}
+
+	printf("Offset %lld was overwritten by the marker for offset %lld\n", (long long) offset, (long long) header.offset);
+	return header.offset > offset ? header.offset - offset : 0;
+}
+
+
+//	Write the marker for offset 0 and then the one for an offset, and see
+//	whether the second landed on the first. Returns false if the I/O failed
+bool ProbeAlias (BlockEngine& verifyFile, uint8_t* writeBuffer, uint8_t* readBuffer, const uint32_t bytesPerSector, const int64_t offset, const uint64_t value, const MarkerStyle& style, bool& aliased)
+{
+	uint32_t transferred;
+	SetMarker(writeBuffer, bytesPerSector, value, 0, style);
+	if (!verifyFile.Write(0, writeBuffer, bytesPerSector, transferred) || transferred != bytesPerSector)
+	{
+		return false;
+	}
+
+	SetMarker(writeBuffer, bytesPerSector, value + 1, offset, style);
+	if (!verifyFile.Write(offset, writeBuffer, bytesPerSector, transferred) || transferred != bytesPerSector)
+	{
+		return false;
+	}
+
+	PoisonMarker(readBuffer, bytesPerSector, style);
+	if (!verifyFile.Read(0, readBuffer, bytesPerSector, transferred) || transferred != bytesPerSector)
+	{
+		return false;
+	}
+
+	MarkerHeader header;
+	aliased = ReadMarkerHeader(readBuffer, header) && header.runId == style.runId && header.offset == offset;
+	return true;
+}
+
+
+//	Narrow the distances from markers to the ones for other offsets that
+//	overwrote them down to where the device wraps, with a few probes
+//	through a pair of buffers. The marker at offset 0 is left overwritten,
+//	and nothing else can be in flight
+int64_t FindWrap (BlockEngine& verifyFile, uint8_t* writeBuffer, uint8_t* readBuffer, const uint32_t bytesPerSector, const int64_t aliasDistance, const MarkerStyle& style)
+{
+	uint64_t probeCount = 0;
+	return NarrowAliasModulus(aliasDistance, bytesPerSector, [&] (int64_t offset, bool& aliased)
+	{
+		probeCount += 2;
+		return ProbeAlias(verifyFile, writeBuffer, readBuffer, bytesPerSector, offset, probeCount, style, aliased);
+	});
+}
+
+
+//	Markers were overwritten by the ones for higher offsets, so the device
+//	wraps, and where it wraps is the capacity
+int64_t ReportWrap (BlockEngine& verifyFile, uint8_t* writeBuffer, uint8_t* readBuffer, const uint32_t bytesPerSector, const int64_t aliasDistance, const MarkerStyle& style)
+{
+	const int64_t wrapModulus = FindWrap(verifyFile, writeBuffer, readBuffer, bytesPerSector, aliasDistance, style);
+	OutputSize("\nThe device wraps every", wrapModulus);
+	OutputSize("Capacity is", wrapModulus);
+	return wrapModulus;
+}
+
+
+//	Start a write or read for a slot. The slot's tag is the block number,
+//	and the last marker can't go past the end of the target. Each slot
+//	has a write buffer and a read buffer, registered as 2s and 2s + 1
+bool StartSlotIo (BlockEngine& verifyFile, BlockRequest& slot, const BufferPool& bufferPool, const size_t slotIndex, const bool reading, const MarkerStyle& style)
+{
+	slot.size			= (uint32_t) std::min((uint64_t) style.blockSize, (uint64_t) (verifyFile.Size() - slot.offset));
+	slot.reading		= reading;
+	slot.bufferIndex	= (int) (slotIndex * 2 + (reading ? 1 : 0));
+	slot.buffer			= bufferPool.Buffer(slot.bufferIndex);
+
+	if (reading)
+	{
+		//	Make sure an old marker in the buffer can't pass
+		PoisonMarker(slot.buffer, slot.size, style);
+	}
+	else
+	{
+		//	Set verification data - the current count + 1
+		SetMarker(slot.buffer, slot.size, slot.tag + 1, slot.offset, style);
+	}
+
+	return verifyFile.Start(slot);
+}
+
+
+//	Verify the created file, keeping queueDepth marker writes and reads in
+//	flight at different offsets. A queue depth of zero does one at a time
+bool VerifyTheFile (const char* pathName, const bool raw, const uint32_t bytesPerSector, const bool noReads, const bool twoPass, const unsigned queueDepth, const MarkerStyle& style)
+{
+	//	A write and a read buffer for each request in flight. The pool is
+	//	declared before the target, so the target is closed before the
+	//	buffers are freed
+	BufferPool bufferPool;
+
+	//	Open the file, or the whole device for a raw run
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, queueDepth);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	const char*		verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+	const unsigned	numSlots	= std::max(queueDepth, 1u);
+
+	//	The buffers are registered with the kernel once, rather than
+	//	mapped on every request
+	if (!bufferPool.Create(style.blockSize, numSlots * 2, bytesPerSector))
+	{
+		PrintError("Did not get verify buffers for %s", verifyName);
+		return false;
+	}
+
+	if (!verifyFile->RegisterBuffers(bufferPool.Iovecs()))
+	{
+		PrintError("Could not register the verify buffers for %s", verifyName);
+		return false;
+	}
+
+	std::vector<BlockRequest> ioSlots(numSlots);
+	for (BlockRequest& slot : ioSlots)
+	{
+		slot.active = false;
+	}
+
+	//	Output some information
+	const uint64_t stride		= style.stride;
+	const uint64_t totalBlocks	= (fileSize + stride - 1) / stride;
+	printf("Verification of %s will use %llu blocks of", verifyName, (unsigned long long) totalBlocks);
+	OutputSize("", stride);
+	if (style.blockSize != bytesPerSector)
+	{
+		OutputSize("Each marker is", style.blockSize);
+	}
+	if (queueDepth != 0)
+	{
+		printf("Keeping %u requests in flight\n", queueDepth);
+	}
+
+	//	The lowest offset that failed. Requests complete out of order,
+	//	so we stop issuing new blocks on a failure and drain the ones
+	//	in flight before reporting
+	int64_t	firstFailure	= fileSize;
+	bool	engineFailed	= false;
+
+	//	Greatest common divisor of the distances from markers to the ones
+	//	for higher offsets that overwrote them
+	int64_t	aliasDistance	= 0;
+
+	//	A two pass run writes every marker first and then reads them all
+	//	back, otherwise each marker is read straight after it is written
+	const int numPasses = (twoPass && !noReads) ? 2 : 1;
+	for (int pass = 0; pass < numPasses && firstFailure == fileSize && !engineFailed; pass ++)
+	{
+		const bool readFirst		= numPasses > 1 && pass == 1;
+		const bool readAfterWrite	= numPasses == 1 && !noReads;
+
+		if (numPasses > 1)
+		{
+			printf("%s markers\n", readFirst ? "Reading" : "Writing");
+		}
+
+		//	Start the timer
+		BatchTimer timer;
+
+		uint64_t	nextBlock	= 0;
+		uint64_t	completed	= 0;
+		unsigned	inFlight	= 0;
+
+		//	Get the first set of requests going
+		for (unsigned s = 0; s < numSlots && nextBlock < totalBlocks; s++)
+		{
+			BlockRequest& slot	= ioSlots [s];
+			slot.tag			= nextBlock ++;
+			slot.offset			= (int64_t) (slot.tag * stride);
+			if (!StartSlotIo(*verifyFile, slot, bufferPool, s, readFirst, style))
+			{
+				PrintError("\nCould not start I/O on %s @ offset %lld", verifyName, (long long) slot.offset);
+				firstFailure = std::min(firstFailure, slot.offset);
+				break;
+			}
+			inFlight ++;
+		}
+
+		while (inFlight > 0)
+		{
+			const BlockCompletion completion = verifyFile->Wait();
+			if (completion.request == nullptr)
+			{
+				//	The ring itself failed, nothing more will complete
+				errno = completion.error;
+				PrintError("\nWaiting for I/O on %s failed", verifyName);
+				engineFailed = true;
+				break;
+			}
+
+			BlockRequest&	slot		= *completion.request;
+			const size_t	slotIndex	= &slot - ioSlots.data();
+			inFlight --;
+
+			if (!completion.succeeded)
+			{
+				errno = completion.error;
+				PrintError("\nUnable to %s %s @ offset %lld", slot.reading ? "read from" : "write to", verifyName, (long long) slot.offset);
+				firstFailure = std::min(firstFailure, slot.offset);
+				continue;
+			}
+
+			if (completion.transferred != slot.size)
+			{
+				//	Give a clear indication where the error was
+				printf("\n%s transferred %u bytes, expected %u bytes @ offset %lld\n", verifyName, completion.transferred, slot.size, (long long) slot.offset);
+				firstFailure = std::min(firstFailure, slot.offset);
+				continue;
+			}
+
+			if (!slot.reading && readAfterWrite)
+			{
+				//	Write is done, read the marker back
+				if (!StartSlotIo(*verifyFile, slot, bufferPool, slotIndex, true, style))
+				{
+					PrintError("\nUnable to read from %s @ offset %lld", verifyName, (long long) slot.offset);
+					firstFailure = std::min(firstFailure, slot.offset);
+					continue;
+				}
+				inFlight ++;
+				continue;
+			}
+
+			if (slot.reading)
+			{
+				const uint32_t badByte = CheckMarker(slot.buffer, slot.size, slot.tag + 1, slot.offset, style);
+				if (badByte != slot.size)
+				{
+					aliasDistance = FoldAliasDistance(aliasDistance, ReportMarkerMismatch(slot.buffer, badByte, slot.offset, style));
+					firstFailure = std::min(firstFailure, slot.offset);
+				}
+			}
+
+			//	Output some stats if it is time
+			if (++ completed % batchSize == 0)
+			{
+				const double elapsedSeconds	= timer.TotalSeconds();
+				const double blockSeconds	= timer.Lap();
+
+				//	Let the user know how long these blocks took
+				printf("\rProcess verification block %llu/%llu took %.2lf seconds (%.2lf total seconds)   ", (unsigned long long) completed, (unsigned long long) totalBlocks, blockSeconds, elapsedSeconds);
+				fflush(stdout);
+			}
+
+			//	Reuse the slot for the next block, unless something failed
+			if (firstFailure == fileSize && nextBlock < totalBlocks)
+			{
+				slot.tag	= nextBlock ++;
+				slot.offset	= (int64_t) (slot.tag * stride);
+				if (!StartSlotIo(*verifyFile, slot, bufferPool, slotIndex, readFirst, style))
+				{
+					PrintError("\nCould not start I/O on %s @ offset %lld", verifyName, (long long) slot.offset);
+					firstFailure = std::min(firstFailure, slot.offset);
+					continue;
+				}
+				inFlight ++;
+			}
+		}
+
+		if (numPasses > 1)
+		{
+			printf("\n");
+		}
+	}
+
+	//	Requests may still be in flight if the ring failed, and they use
+	//	the slots and their buffers, so they are cancelled and reaped
+	//	before those are freed
+	if (engineFailed)
+	{
+		verifyFile->Cancel();
+		return false;
+	}
+
+	if (firstFailure < fileSize)
+	{
+		if (aliasDistance != 0)
+		{
+			ReportWrap(*verifyFile, bufferPool.Buffer(0), bufferPool.Buffer(1), bytesPerSector, aliasDistance, style);
+		}
+		else
+		{
+			OutputSize("Reached", firstFailure);
+		}
+		return false;
+	}
+
+	//	Tell the user the good news
+	printf("\n%s ", pathName);
+	OutputSize("is", fileSize);
+	return true;
+}
+
+
+//	A marker we wrote during the bisect and its location
+struct ProbeMarker
+{
+	int64_t		offset;
+	uint64_t	value;
+};
+
+
+//	Write the marker for a probe to one sector
+bool WriteProbe (BlockEngine& verifyFile, uint8_t* writeBuffer, const uint32_t bytesPerSector, const ProbeMarker& probe, const MarkerStyle& style)
+{
+	SetMarker(writeBuffer, bytesPerSector, probe.value, probe.offset, style);
+
+	uint32_t written;
+	return verifyFile.Write(probe.offset, writeBuffer, bytesPerSector, written)
+		&& written == bytesPerSector;
+}
+
+
+//	Write the marker for a probe to one sector and optionally read it back
+bool ProbeOffset (BlockEngine& verifyFile, uint8_t* writeBuffer, uint8_t* readBuffer, const uint32_t bytesPerSector, const ProbeMarker& probe, const bool writeMarker, const MarkerStyle& style)
+{
+	if (writeMarker && !WriteProbe(verifyFile, writeBuffer, bytesPerSector, probe, style))
+	{
+		return false;
+	}
+
+	//	Make sure an old marker in the buffer can't pass
+	PoisonMarker(readBuffer, bytesPerSector, style);
+
+	uint32_t bytesRead;
+	if (!verifyFile.Read(probe.offset, readBuffer, bytesPerSector, bytesRead)
+	||	bytesRead != bytesPerSector)
+	{
+		return false;
+	}
+
+	return CheckMarker(readBuffer, bytesPerSector, probe.value, probe.offset, style) == bytesPerSector;
+}
+
+
+//	Make sure the marker for the highest good offset was not overwritten
+//	by a later write, as a good write and read at one offset of a device
+//	that wraps can destroy the data at another. If it was it is put back
+bool RecheckMarker (BlockEngine& verifyFile, uint8_t* writeBuffer, uint8_t* readBuffer, const uint32_t bytesPerSector, const ProbeMarker& marker, const MarkerStyle& style)
+{
+	if (ProbeOffset(verifyFile, writeBuffer, readBuffer, bytesPerSector, marker, false, style))
+	{
+		return true;
+	}
+
+	printf("\nMarker @ offset %lld was overwritten\n", (long long) marker.offset);
+	ProbeOffset(verifyFile, writeBuffer, readBuffer, bytesPerSector, marker, true, style);
+	return false;
+}
+
+
+//	Find the capacity using a binary search rather than walking every
+//	block, the same way the Windows maxspace does. Markers are written at
+//	a ladder of offsets that doubles from 64 MiB to find the first bad
+//	offset. A device that wraps keeps the marker for each of those, so a
+//	bounded wrap check follows, with rungs placed so a wrap at a multiple
+//	of its granule puts the marker for a higher rung on a lower one. We
+//	then bisect between the last good and first bad offset down to a
+//	single sector
+bool BisectTheFile (const char* pathName, const bool raw, const uint32_t bytesPerSector, const MarkerStyle& style)
+{
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, 0);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	const char*		verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	BufferPool bufferPool;
+	if (!bufferPool.Create(bytesPerSector, 2, bytesPerSector))
+	{
+		PrintError("Did not get probe buffers for %s", verifyName);
+		return false;
+	}
+
+	uint8_t* writeBuffer	= bufferPool.Buffer(0);
+	uint8_t* readBuffer		= bufferPool.Buffer(1);
+
+	//	The last sector we can probe
+	const int64_t lastOffset = ((fileSize / bytesPerSector) - 1) * bytesPerSector;
+	if (lastOffset < 0)
+	{
+		printf("%s is too small to bisect\n", verifyName);
+		return false;
+	}
+
+	printf("Bisecting %s", verifyName);
+	OutputSize(", file size is", fileSize);
+
+	BatchTimer timer;
+
+	std::vector<ProbeMarker> goodMarkers;
+	int64_t		lastGood	= -1;
+	int64_t		firstBad	= fileSize;
+	uint64_t	probeCount	= 0;
+
+	//	Walk the offset ladder - 0, then doubling from 64 MiB, with the
+	//	last sector of the file as the final rung
+	int64_t ladderOffset = 0;
+	for (;;)
+	{
+		const ProbeMarker probe = { ladderOffset, ++probeCount };
+		if (!ProbeOffset(*verifyFile, writeBuffer, readBuffer, bytesPerSector, probe, true, style))
+		{
+			printf("\nLadder probe @ offset %lld failed\n", (long long) probe.offset);
+			firstBad = probe.offset;
+			break;
+		}
+
+		goodMarkers.push_back(probe);
+		printf("\rLadder probe @ offset %lld is good   ", (long long) probe.offset);
+		fflush(stdout);
+
+		if (ladderOffset == lastOffset)
+		{
+			break;
+		}
+
+		ladderOffset = std::min(ladderOffset == 0 ? minBoundary : ladderOffset * 2, lastOffset);
+	}
+
+	//	Check for a wrap below the first bad offset. Rungs the ladder
+	//	already has are left as they are
+	int64_t wrapGranule = ladderGranule;
+	if (firstBad > 0)
+	{
+		const std::vector<int64_t> wrapOffsets = WrapLadder(std::min(lastOffset, firstBad - (int64_t) bytesPerSector), ladderGranule, maxWrapRungs, wrapGranule);
+		printf("\nChecking for a wrap with %zu probes", wrapOffsets.size());
+		OutputSize(", at every multiple of", wrapGranule);
+
+		const size_t ladderRungs = goodMarkers.size();
+		for (const int64_t wrapOffset : wrapOffsets)
+		{
+			const auto ladderEnd = goodMarkers.begin() + ladderRungs;
+			if (std::any_of(goodMarkers.begin(), ladderEnd, [&] (const ProbeMarker& marker) { return marker.offset == wrapOffset; }))
+			{
+				continue;
+			}
+
+			const ProbeMarker probe = { wrapOffset, ++probeCount };
+			if (!WriteProbe(*verifyFile, writeBuffer, bytesPerSector, probe, style))
+			{
+				printf("\nWrap probe @ offset %lld failed\n", (long long) probe.offset);
+				firstBad = std::min(firstBad, probe.offset);
+				break;
+			}
+			goodMarkers.push_back(probe);
+		}
+	}
+
+	//	Read every marker back. One holding the marker for another offset
+	//	shows the device wraps, and the distance between them is a
+	//	multiple of where. Anything else, e.g. a marker from an earlier
+	//	run, means the offset lost its data
+	int64_t aliasDistance = 0;
+	for (const ProbeMarker& marker : goodMarkers)
+	{
+		if (ProbeOffset(*verifyFile, writeBuffer, readBuffer, bytesPerSector, marker, false, style))
+		{
+			continue;
+		}
+
+		MarkerHeader header;
+		if (ReadMarkerHeader(readBuffer, header) && header.runId == style.runId && header.offset != marker.offset)
+		{
+			printf("\nOffset %lld was overwritten by the marker for offset %lld\n", (long long) marker.offset, (long long) header.offset);
+			aliasDistance = FoldAliasDistance(aliasDistance, header.offset > marker.offset ? header.offset - marker.offset : marker.offset - header.offset);
+		}
+		else
+		{
+			printf("\nProbe @ offset %lld lost its marker\n", (long long) marker.offset);
+			firstBad = std::min(firstBad, marker.offset);
+		}
+	}
+
+	//	Nothing past where the device wraps is kept
+	if (aliasDistance != 0)
+	{
+		const int64_t wrapModulus = FindWrap(*verifyFile, writeBuffer, readBuffer, bytesPerSector, aliasDistance, style);
+		OutputSize("The device wraps every", wrapModulus);
+		firstBad = std::min(firstBad, wrapModulus);
+	}
+
+	//	The highest marker below the first bad offset brackets the search.
+	//	It is written again, as a marker for a higher offset may have
+	//	landed on it, and it is the only one checked while bisecting
+	std::sort(goodMarkers.begin(), goodMarkers.end(), [] (const ProbeMarker& a, const ProbeMarker& b) { return a.offset > b.offset; });
+	ProbeMarker bracket = { -1, 0 };
+	for (const ProbeMarker& marker : goodMarkers)
+	{
+		if (marker.offset >= firstBad)
+		{
+			continue;
+		}
+
+		bracket = { marker.offset, ++probeCount };
+		if (WriteProbe(*verifyFile, writeBuffer, bytesPerSector, bracket, style))
+		{
+			lastGood = bracket.offset;
+			break;
+		}
+
+		printf("\nProbe @ offset %lld could not be written again\n", (long long) marker.offset);
+		firstBad = marker.offset;
+	}
+
+	//	Bisect between the last good and first bad offsets until they
+	//	are one sector apart
+	if (lastGood >= 0 && firstBad < fileSize)
+	{
+		while (firstBad - lastGood > (int64_t) bytesPerSector)
+		{
+			//	Middle offset, aligned to the sector size
+			int64_t midOffset = lastGood + ((firstBad - lastGood) / 2);
+			midOffset -= midOffset % bytesPerSector;
+			if (midOffset <= lastGood)
+			{
+				midOffset = lastGood + bytesPerSector;
+			}
+
+			const ProbeMarker probe = { midOffset, ++probeCount };
+			if (ProbeOffset(*verifyFile, writeBuffer, readBuffer, bytesPerSector, probe, true, style)
+			&&	RecheckMarker(*verifyFile, writeBuffer, readBuffer, bytesPerSector, bracket, style))
+			{
+				bracket		= probe;
+				lastGood	= probe.offset;
+			}
+			else
+			{
+				firstBad = probe.offset;
+			}
+
+			printf("\rBisecting between offset %lld and %lld   ", (long long) lastGood, (long long) firstBad);
+			fflush(stdout);
+		}
+	}
+
+	printf("\n%llu probes, %llu reads and writes, took %.2lf seconds\n", (unsigned long long) probeCount, (unsigned long long) verifyFile->Transfers(), timer.TotalSeconds());
+
+	if (firstBad == fileSize)
+	{
+		//	Tell the user the good news, and what the wrap check could see
+		OutputSize("No wrap was found at any multiple of", wrapGranule);
+		printf("%s ", pathName);
+		OutputSize("is", fileSize);
+		return true;
+	}
+
+	//	Give the user an idea of where the verification failed
+	printf("First bad offset is %lld", (long long) firstBad);
+	OutputSize("", firstBad);
+	return false;
+}
+
+
+//	A raw run writes over everything on the device, so the user has to
+//	say they mean it, and the device can't be mounted
+bool ConfirmRawRun (const char* pathName, const int64_t driveSize)
+{
+	if (DriveIsMounted(pathName))
+	{
+		printf("%s, or a partition on it, is mounted. Unmount it before a raw run\n", pathName);
+		return false;
+	}
+
+	printf("\nEverything on %s will be overwritten", pathName);
+	OutputSize(", the drive size is", driveSize);
+	printf("Type YES to carry on: ");
+	fflush(stdout);
+
+	char answer [16];
+	if (fgets(answer, sizeof(answer), stdin) == nullptr)
+	{
+		return false;
+	}
+
+	return strcmp(answer, "YES\n") == 0 || strcmp(answer, "YES") == 0;
+}
+
+
+//	Delete the file we created
+bool DeleteVerifyFile (const char* pathName)
+{
+	char deleteName [PATH_MAX];
+	VerifyFileName(deleteName, pathName);
+	if (unlink(deleteName) != 0)
+	{
+		PrintError("Could not delete %s", deleteName);
+		return false;
+	}
+
+	return true;
+}
+
+
+//	Output a usage message
+void Usage (const char* progName)
+{
+	printf("\nUsage: %s [-stats] [-noreads] [-twopass] [-pattern] [-bisect] [-block <KiB>] [-stride <KiB>] [-qd <depth>] <path> | -raw /dev/<device> | -fake <spec>\n", progName);
+	printf("\nExample:\n");
+	printf("\n%s -stats /media/usb\n\n", progName);
+}
+
+
+int main (int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		//	We need at least 2 options - output a usage message
+		Usage(argv [0]);
+		return 1;
+	}
+
+	//	See what the user asked for
+	const char*	pathName	= nullptr;
+	uint8_t		ourActions	= progActions::justPath;
+	unsigned	queueDepth	= 0;
+	uint64_t	blockSize	= 0;
+	uint64_t	stride		= 0;
+	bool		rawDrive	= false;
+	bool		fakeDevice	= false;
+	std::string	fakeName;
+	for (int i = 1; i < argc; i ++)
+	{
+		if (strcmp(argv[i], "-stats") == 0)
+		{
+			//	User wants stats
+			ourActions |= progActions::outputStats;
+		}
+		else
+		if (strcmp(argv[i], "-noreads") == 0)
+		{
+			//	User doesn't want reads
+			ourActions |= progActions::noreads;
+		}
+		else
+		if (strcmp(argv[i], "-twopass") == 0)
+		{
+			//	User wants every marker written before any are read back
+			ourActions |= progActions::twoPass;
+		}
+		else
+		if (strcmp(argv[i], "-pattern") == 0)
+		{
+			//	User wants the whole marker checked
+			ourActions |= progActions::pattern;
+		}
+		else
+		if (strcmp(argv[i], "-bisect") == 0)
+		{
+			//	User wants the capacity found with a binary search
+			ourActions |= progActions::bisect;
+		}
+		else
+		if (strcmp(argv[i], "-qd") == 0)
+		{
+			//	User wants a number of requests kept in flight
+			if (i + 1 >= argc
+			||	sscanf(argv [i + 1], "%u", &queueDepth) != 1
+			||	queueDepth < 1
+			||	queueDepth > maxQueueDepth)
+			{
+				printf("The -qd option needs a depth from 1 to %u\n", maxQueueDepth);
+				return 1;
+			}
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-block") == 0)
+		{
+			//	User wants each marker to be a number of KiB
+			unsigned long long sizeKiB = 0;
+			if (i + 1 >= argc
+			||	sscanf(argv [i + 1], "%llu", &sizeKiB) != 1
+			||	sizeKiB < 1
+			||	sizeKiB > maxBlockSize / KiB)
+			{
+				printf("The -block option needs a size from 1 to %lld KiB\n", (long long) (maxBlockSize / KiB));
+				return 1;
+			}
+			blockSize = sizeKiB * KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-stride") == 0)
+		{
+			//	User wants the markers a number of KiB apart
+			unsigned long long strideKiB = 0;
+			if (i + 1 >= argc
+			||	sscanf(argv [i + 1], "%llu", &strideKiB) != 1
+			||	strideKiB < 1
+			||	strideKiB > maxStride / KiB)
+			{
+				printf("The -stride option needs a size from 1 to %lld KiB\n", (long long) (maxStride / KiB));
+				return 1;
+			}
+			stride = strideKiB * KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-raw") == 0)
+		{
+			//	User wants the markers written to the device itself
+			rawDrive = true;
+		}
+		else
+		if (strcmp(argv[i], "-fake") == 0)
+		{
+			//	User wants the run against a fake device modelled in memory
+			if (pathName != nullptr)
+			{
+				printf("Only one path or fake device can be checked at a time\n");
+				return 1;
+			}
+
+			FakeDeviceSpec fakeSpec;
+			if (i + 1 >= argc
+			||	!ParseFakeDevice((fakeName = std::string(fakeDevicePrefix) + argv [i + 1]).c_str(), fakeSpec))
+			{
+				printf("The -fake option needs a device such as size=128T,capacity=16G with any of sector, capacity, wrap, cache, slc, fast, slow, dropout and seed\n");
+				return 1;
+			}
+			pathName	= fakeName.c_str();
+			fakeDevice	= true;
+			i ++;
+		}
+		else
+		if (argv[i][0] == '-')
+		{
+			printf("%s is an invalid option\n", argv[i]);
+			Usage(argv [0]);
+			return 1;
+		}
+		else
+		if (pathName != nullptr)
+		{
+			printf("Only one path or fake device can be checked at a time\n");
+			return 1;
+		}
+		else
+		{
+			//	This will be the path to check
+			pathName = argv[i];
+		}
+	}
+
+	if (pathName == nullptr)
+	{
+		Usage(argv [0]);
+		return 1;
+	}
+
+	//	Get the sector size and space for the device or the file system
+	uint32_t	bytesPerSector;
+	int64_t		freeSpace;
+	int64_t		totalSpace;
+	if (fakeDevice)
+	{
+		FakeDeviceSpec fakeSpec;
+		ParseFakeDevice(pathName, fakeSpec);
+		bytesPerSector	= fakeSpec.sectorSize;
+		totalSpace		= (int64_t) fakeSpec.size;
+		freeSpace		= totalSpace;
+	}
+	else
+	if (rawDrive)
+	{
+		if (!GetRawDriveInfo(pathName, bytesPerSector, totalSpace))
+		{
+			return 1;
+		}
+		freeSpace = totalSpace;
+	}
+	else
+	{
+		struct statvfs fsInfo;
+		if (statvfs(pathName, &fsInfo) != 0)
+		{
+			PrintError("Could not get the free space on %s", pathName);
+			return 1;
+		}
+
+		//	O_DIRECT I/O has to be aligned to the logical sector size,
+		//	which the file system block size is always a multiple of
+		bytesPerSector	= (uint32_t) fsInfo.f_bsize;
+		freeSpace		= (int64_t) fsInfo.f_bavail * (int64_t) fsInfo.f_frsize;
+		totalSpace		= (int64_t) fsInfo.f_blocks * (int64_t) fsInfo.f_frsize;
+	}
+
+	if (freeSpace	<= 0
+	||	totalSpace	<= 0)
+	{
+		printf("Incorrect total %lld or free space %lld\n", (long long) totalSpace, (long long) freeSpace);
+		return 1;
+	}
+
+	//	User wanted stats
+	if ((ourActions & progActions::outputStats) != 0)
+	{
+		printf("Bytes per sector : %u\n", bytesPerSector);
+		OutputSize("Total space      :", totalSpace);
+		OutputSize("Free space       :", freeSpace);
+	}
+
+	//	Every marker and every offset has to be a whole number of sectors
+	MarkerStyle markerStyle;
+	markerStyle.fullPattern	= (ourActions & progActions::pattern) != 0;
+	markerStyle.patternSeed	= markerStyle.fullPattern ? NewPatternSeed() : 0;
+	markerStyle.runId		= NewRunId();
+	markerStyle.blockSize	= (uint32_t) (blockSize != 0 ? blockSize : bytesPerSector);
+	markerStyle.stride		= stride != 0 ? stride : std::max(verifySize, (uint64_t) markerStyle.blockSize);
+	if (markerStyle.blockSize % bytesPerSector != 0 || markerStyle.stride % bytesPerSector != 0)
+	{
+		printf("The -block and -stride sizes must be multiples of the %u byte sector\n", bytesPerSector);
+		return 1;
+	}
+
+	if (markerStyle.stride < markerStyle.blockSize)
+	{
+		printf("The -stride can't be smaller than the -block size\n");
+		return 1;
+	}
+
+	//	A fake device is written like a raw drive, as there is no file
+	//	system on it, but there is nothing to confirm
+	if (fakeDevice)
+	{
+		rawDrive = true;
+	}
+	else
+	if (rawDrive)
+	{
+		if (!ConfirmRawRun(pathName, totalSpace))
+		{
+			printf("Raw run cancelled\n");
+			return 1;
+		}
+	}
+	else
+	if (!CreateVerifyFile(pathName, bytesPerSector, freeSpace))
+	{
+		printf("File creation failed\n");
+		return 1;
+	}
+
+	int returnStatus = 0;
+	if ((ourActions & progActions::bisect) != 0)
+	{
+		if (!BisectTheFile(pathName, rawDrive, bytesPerSector, markerStyle))
+		{
+			printf("File verification failed\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if (!VerifyTheFile(pathName, rawDrive, bytesPerSector, (ourActions & progActions::noreads) != 0, (ourActions & progActions::twoPass) != 0, queueDepth, markerStyle))
+	{
+		printf("File verification failed\n");
+		returnStatus = 1;
+	}
+
+	if (rawDrive)
+	{
+		//	A fake device only lives in memory, so nothing is lost
+		if (!fakeDevice)
+		{
+			printf("%s needs to be partitioned and formatted before it can be used again\n", pathName);
+		}
+	}
+	else
+	//	Delete the file
+	if (!DeleteVerifyFile(pathName))
+	{
+		printf("File deletion failed\n");
+		returnStatus = 1;
+	}
+
+	//	All done!
+	return returnStatus;
+}
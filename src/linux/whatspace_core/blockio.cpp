@@ -0,0 +1,644 @@
+//	Block I/O engine used by the Linux tools to write and read a file or a
+//	whole block device. The synchronous engine does one request at a
+//	time with pread and pwrite, and the io_uring engine keeps many in
+//	flight through one submission ring
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "blockio.h"
+#include "fakedevice.h"
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <deque>
+
+
+BlockEngine::BlockEngine (int fd, const char* name, int64_t size)
+{
+	targetFd		= fd;
+	targetSize		= size;
+	transferCount	= 0;
+	snprintf(targetName, sizeof(targetName), "%s", name);
+}
+
+
+BlockEngine::~BlockEngine ()
+{
+	//	A fake device has nothing open
+	if (targetFd >= 0)
+	{
+		close(targetFd);
+	}
+}
+
+
+//	Only the io_uring engine has anything to register
+bool BlockEngine::RegisterBuffers (const std::vector<iovec>&)
+{
+	return true;
+}
+
+
+//	Only the io_uring engine has anything left in flight
+void BlockEngine::Cancel ()
+{
+}
+
+
+//	Start one request and wait for it
+bool BlockEngine::Transfer (BlockRequest& request, uint32_t& transferred)
+{
+	transferred = 0;
+	transferCount ++;
+	if (!Start(request))
+	{
+		return false;
+	}
+
+	const BlockCompletion completion = Wait();
+	if (completion.request == nullptr || !completion.succeeded)
+	{
+		errno = completion.error;
+		return false;
+	}
+
+	transferred = completion.transferred;
+	return true;
+}
+
+
+//	Read one block and wait for it
+bool BlockEngine::Read (int64_t offset, uint8_t* buffer, uint32_t size, uint32_t& transferred)
+{
+	BlockRequest request = {};
+	request.buffer		= buffer;
+	request.offset		= offset;
+	request.size		= size;
+	request.reading		= true;
+	request.bufferIndex	= -1;
+	return Transfer(request, transferred);
+}
+
+
+//	Write one block and wait for it
+bool BlockEngine::Write (int64_t offset, const uint8_t* buffer, uint32_t size, uint32_t& transferred)
+{
+	BlockRequest request = {};
+	request.buffer		= (uint8_t*) buffer;
+	request.offset		= offset;
+	request.size		= size;
+	request.reading		= false;
+	request.bufferIndex	= -1;
+	return Transfer(request, transferred);
+}
+
+
+//	One request at a time. A request is done by the time Start returns,
+//	and Wait hands the completions back in order
+class SyncEngine : public BlockEngine
+{
+public:
+	SyncEngine (int fd, const char* name, int64_t size) : BlockEngine(fd, name, size) {}
+
+	bool Start (BlockRequest& request) override;
+	BlockCompletion Wait () override;
+
+private:
+	std::deque<BlockCompletion>	finished;
+};
+
+
+//	Do the read or write straight away
+bool SyncEngine::Start (BlockRequest& request)
+{
+	const ssize_t moved = request.reading
+		? pread(targetFd, request.buffer, request.size, request.offset)
+		: pwrite(targetFd, request.buffer, request.size, request.offset);
+
+	BlockCompletion completion;
+	completion.request		= &request;
+	completion.succeeded	= moved >= 0;
+	completion.transferred	= moved >= 0 ? (uint32_t) moved : 0;
+	completion.error		= moved >= 0 ? 0 : errno;
+	finished.push_back(completion);
+
+	request.active = true;
+	return true;
+}
+
+
+//	Hand back the oldest request that is done
+BlockCompletion SyncEngine::Wait ()
+{
+	if (finished.empty())
+	{
+		return { nullptr, false, 0, EINVAL };
+	}
+
+	BlockCompletion completion = finished.front();
+	finished.pop_front();
+	completion.request->active = false;
+	return completion;
+}
+
+
+//	A fake device in memory. Like the synchronous engine, a request is
+//	done by the time Start returns, whatever the queue depth
+class FakeEngine : public BlockEngine
+{
+public:
+	FakeEngine (const std::shared_ptr<FakeDevice>& fakeDevice, const char* name)
+		: BlockEngine(-1, name, (int64_t) fakeDevice->Spec().size), device(fakeDevice) {}
+
+	bool Start (BlockRequest& request) override;
+	BlockCompletion Wait () override;
+
+private:
+	std::shared_ptr<FakeDevice>	device;
+	std::deque<BlockCompletion>	finished;
+};
+
+
+//	Do the read or write on the model. A dropout looks like a device that
+//	has gone away, and a misaligned request fails as it would with
+//	O_DIRECT
+bool FakeEngine::Start (BlockRequest& request)
+{
+	BlockCompletion completion;
+	completion.request = &request;
+
+	const FakeStatus status = device->Transfer(request.reading, request.offset, request.buffer, request.size, completion.transferred);
+	completion.succeeded	= status == FakeStatus::done;
+	completion.error		= status == FakeStatus::done ? 0 : status == FakeStatus::dropout ? EIO : EINVAL;
+	finished.push_back(completion);
+
+	request.active = true;
+	return true;
+}
+
+
+BlockCompletion FakeEngine::Wait ()
+{
+	if (finished.empty())
+	{
+		return { nullptr, false, 0, EINVAL };
+	}
+
+	BlockCompletion completion = finished.front();
+	finished.pop_front();
+	completion.request->active = false;
+	return completion;
+}
+
+
+//	Many requests in flight through io_uring. The rings are driven with
+//	the raw system calls, so there is nothing to install, and requests
+//	are only submitted when the caller waits, so a batch of them goes to
+//	the kernel in one call
+class UringEngine : public BlockEngine
+{
+public:
+	UringEngine (int fd, const char* name, int64_t size);
+	~UringEngine () override;
+
+	//	Create the rings for queueDepth requests. Returns false, with
+	//	errno set, if the kernel doesn't support io_uring
+	bool Setup (unsigned queueDepth);
+
+	bool RegisterBuffers (const std::vector<iovec>& buffers) override;
+	bool Start (BlockRequest& request) override;
+	BlockCompletion Wait () override;
+	void Cancel () override;
+
+private:
+	//	Hand the queued requests to the kernel and wait for at least
+	//	waitFor of them to finish
+	bool Enter (unsigned waitFor);
+
+	int				ringFd;
+	bool			buffersRegistered;
+	unsigned		unsubmitted;
+	unsigned		inFlight;
+
+	//	Submission ring, and the entries its array indexes
+	void*			sqRing;
+	size_t			sqRingSize;
+	unsigned*		sqHead;
+	unsigned*		sqTail;
+	unsigned*		sqMask;
+	unsigned*		sqArray;
+	unsigned		sqEntries;
+	io_uring_sqe*	sqes;
+	size_t			sqesSize;
+
+	//	Completion ring, which may share the submission ring's mapping
+	void*			cqRing;
+	size_t			cqRingSize;
+	unsigned*		cqHead;
+	unsigned*		cqTail;
+	unsigned*		cqMask;
+	io_uring_cqe*	cqes;
+};
+
+
+UringEngine::UringEngine (int fd, const char* name, int64_t size) : BlockEngine(fd, name, size)
+{
+	ringFd				= -1;
+	buffersRegistered	= false;
+	unsubmitted			= 0;
+	inFlight			= 0;
+	sqRing				= MAP_FAILED;
+	cqRing				= MAP_FAILED;
+	sqes				= (io_uring_sqe*) MAP_FAILED;
+	sqRingSize			= 0;
+	cqRingSize			= 0;
+	sqesSize			= 0;
+}
+
+
+UringEngine::~UringEngine ()
+{
+	if (sqes != MAP_FAILED)
+	{
+		munmap(sqes, sqesSize);
+	}
+
+	if (cqRing != MAP_FAILED && cqRing != sqRing)
+	{
+		munmap(cqRing, cqRingSize);
+	}
+
+	if (sqRing != MAP_FAILED)
+	{
+		munmap(sqRing, sqRingSize);
+	}
+
+	if (ringFd >= 0)
+	{
+		close(ringFd);
+	}
+}
+
+
+//	Create and map the rings
+bool UringEngine::Setup (unsigned queueDepth)
+{
+	io_uring_params params = {};
+	ringFd = (int) syscall(__NR_io_uring_setup, queueDepth, &params);
+	if (ringFd < 0)
+	{
+		return false;
+	}
+
+	//	Newer kernels map both rings with one call
+	sqRingSize	= params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize	= params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap)
+	{
+		sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+	}
+
+	sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		return false;
+	}
+
+	cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+	if (cqRing == MAP_FAILED)
+	{
+		return false;
+	}
+
+	sqesSize	= params.sq_entries * sizeof(io_uring_sqe);
+	sqes		= (io_uring_sqe*) mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		return false;
+	}
+
+	uint8_t* sqBase	= (uint8_t*) sqRing;
+	sqHead			= (unsigned*) (sqBase + params.sq_off.head);
+	sqTail			= (unsigned*) (sqBase + params.sq_off.tail);
+	sqMask			= (unsigned*) (sqBase + params.sq_off.ring_mask);
+	sqArray			= (unsigned*) (sqBase + params.sq_off.array);
+	sqEntries		= params.sq_entries;
+
+	uint8_t* cqBase	= (uint8_t*) cqRing;
+	cqHead			= (unsigned*) (cqBase + params.cq_off.head);
+	cqTail			= (unsigned*) (cqBase + params.cq_off.tail);
+	cqMask			= (unsigned*) (cqBase + params.cq_off.ring_mask);
+	cqes			= (io_uring_cqe*) (cqBase + params.cq_off.cqes);
+	return true;
+}
+
+
+//	Register the buffers, so reads and writes can use the fixed versions
+bool UringEngine::RegisterBuffers (const std::vector<iovec>& buffers)
+{
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, buffers.data(), (unsigned) buffers.size()) < 0)
+	{
+		return false;
+	}
+
+	buffersRegistered = true;
+	return true;
+}
+
+
+//	Queue a request. It goes to the kernel on the next Wait, or now if
+//	the submission ring is full
+bool UringEngine::Start (BlockRequest& request)
+{
+	unsigned tail = *sqTail;
+	if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries && !Enter(0))
+	{
+		return false;
+	}
+
+	const unsigned	index	= tail & *sqMask;
+	io_uring_sqe&	sqe		= sqes [index];
+	const bool		fixed	= buffersRegistered && request.bufferIndex >= 0;
+	memset(&sqe, 0, sizeof(sqe));
+	if (request.reading)
+	{
+		sqe.opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	}
+	else
+	{
+		sqe.opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	}
+	sqe.fd			= targetFd;
+	sqe.addr		= (uint64_t) (uintptr_t) request.buffer;
+	sqe.len			= request.size;
+	sqe.off			= (uint64_t) request.offset;
+	sqe.buf_index	= fixed ? (uint16_t) request.bufferIndex : 0;
+	sqe.user_data	= (uint64_t) (uintptr_t) &request;
+
+	sqArray [index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	unsubmitted ++;
+	inFlight ++;
+
+	request.active = true;
+	return true;
+}
+
+
+//	Submit what is queued and wait for completions
+bool UringEngine::Enter (unsigned waitFor)
+{
+	for (;;)
+	{
+		const long submitted = syscall(__NR_io_uring_enter, ringFd, unsubmitted, waitFor, waitFor != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (submitted >= 0)
+		{
+			unsubmitted -= (unsigned) submitted < unsubmitted ? (unsigned) submitted : unsubmitted;
+			return true;
+		}
+
+		if (errno != EINTR)
+		{
+			return false;
+		}
+	}
+}
+
+
+//	Wait for the next request to finish
+BlockCompletion UringEngine::Wait ()
+{
+	for (;;)
+	{
+		const unsigned head = *cqHead;
+		if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			const io_uring_cqe&	cqe		= cqes [head & *cqMask];
+			BlockRequest*		request	= (BlockRequest*) (uintptr_t) cqe.user_data;
+			const int			result	= cqe.res;
+			__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+			inFlight --;
+			request->active = false;
+			return { request, result >= 0, result >= 0 ? (uint32_t) result : 0, result >= 0 ? 0 : -result };
+		}
+
+		if (!Enter(1))
+		{
+			return { nullptr, false, 0, errno };
+		}
+	}
+}
+
+
+//	Ask the kernel to cancel everything in flight, and then reap every
+//	completion. Closing the ring doesn't wait for its requests, and one
+//	the device already has can't be cancelled and still moves data into
+//	its buffer. If the ring can't be entered any more, nothing more can
+//	be reaped either
+void UringEngine::Cancel ()
+{
+	bool cancelPending = false;
+	const unsigned tail = *sqTail;
+	if (inFlight > 0 && tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) < sqEntries)
+	{
+		//	Kernels before 5.19 don't know the flag, and fail the cancel
+		//	rather than any of the requests
+		const unsigned	index	= tail & *sqMask;
+		io_uring_sqe&	sqe		= sqes [index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode			= IORING_OP_ASYNC_CANCEL;
+		sqe.fd				= -1;
+		sqe.cancel_flags	= IORING_ASYNC_CANCEL_ANY;
+		sqe.user_data		= 0;
+
+		sqArray [index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		unsubmitted ++;
+		cancelPending = true;
+	}
+
+	while (inFlight > 0 || cancelPending)
+	{
+		const unsigned head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			if (!Enter(1))
+			{
+				return;
+			}
+			continue;
+		}
+
+		//	The cancel itself is the only completion without a request
+		BlockRequest* request = (BlockRequest*) (uintptr_t) cqes [head & *cqMask].user_data;
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		if (request == nullptr)
+		{
+			cancelPending = false;
+			continue;
+		}
+
+		inFlight --;
+		request->active = false;
+	}
+}
+
+
+//	Open a file or block device for block I/O
+std::unique_ptr<BlockEngine> OpenBlockEngine (const char* targetName, const BlockOptions& options)
+{
+	//	A fake device is modelled in memory rather than opened
+	if (IsFakeDevice(targetName))
+	{
+		std::shared_ptr<FakeDevice> device = OpenFakeDevice(targetName);
+		if (!device)
+		{
+			errno = EINVAL;
+			return nullptr;
+		}
+		return std::make_unique<FakeEngine>(device, targetName);
+	}
+
+	//	O_DSYNC makes every write reach the device before it completes,
+	//	the same as write through on Windows
+	int flags = O_RDWR | O_DSYNC;
+	if (!options.cached)
+	{
+		flags |= O_DIRECT;
+	}
+
+	//	A raw run must be the only thing using the device
+	if (options.raw)
+	{
+		flags |= O_EXCL;
+	}
+
+	const int fd = open(targetName, flags);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+
+	int64_t size = 0;
+	struct stat fileInfo;
+	if (options.raw)
+	{
+		uint64_t deviceSize;
+		if (ioctl(fd, BLKGETSIZE64, &deviceSize) != 0)
+		{
+			const int savedError = errno;
+			close(fd);
+			errno = savedError;
+			return nullptr;
+		}
+		size = (int64_t) deviceSize;
+	}
+	else
+	if (fstat(fd, &fileInfo) == 0)
+	{
+		size = fileInfo.st_size;
+	}
+
+	if (options.queueDepth == 0)
+	{
+		return std::make_unique<SyncEngine>(fd, targetName, size);
+	}
+
+	//	io_uring can be missing from the kernel, or turned off with the
+	//	io_uring_disabled sysctl
+	std::unique_ptr<UringEngine> uringEngine = std::make_unique<UringEngine>(fd, targetName, size);
+	if (!uringEngine->Setup(options.queueDepth))
+	{
+		PrintError("io_uring is not available, using synchronous I/O for %s", targetName);
+
+		//	The io_uring engine closes its descriptor when it goes, so the
+		//	synchronous engine needs a copy of its own. Closing the original
+		//	must not lose the error from dup
+		const int syncFd = dup(fd);
+		if (syncFd < 0)
+		{
+			const int dupError = errno;
+			uringEngine.reset();
+			errno = dupError;
+			return nullptr;
+		}
+		return std::make_unique<SyncEngine>(syncFd, targetName, size);
+	}
+
+	return uringEngine;
+}
+
+
+//	Get the logical sector size and length of a block device
+bool GetRawDriveInfo (const char* pathName, uint32_t& bytesPerSector, int64_t& driveSize)
+{
+	const int fd = open(pathName, O_RDONLY);
+	if (fd < 0)
+	{
+		PrintError("Could not open %s", pathName);
+		return false;
+	}
+
+	int			sectorSize	= 0;
+	uint64_t	deviceSize	= 0;
+	const bool	gotInfo		= ioctl(fd, BLKSSZGET, &sectorSize) == 0 && ioctl(fd, BLKGETSIZE64, &deviceSize) == 0;
+	if (!gotInfo)
+	{
+		PrintError("Could not get the geometry of %s, it may not be a block device", pathName);
+	}
+	close(fd);
+
+	bytesPerSector	= (uint32_t) sectorSize;
+	driveSize		= (int64_t) deviceSize;
+	return gotInfo && sectorSize > 0;
+}
+
+
+//	True if the device, or a partition on it, is mounted
+bool DriveIsMounted (const char* pathName)
+{
+	//	Symbolic links like /dev/disk/by-id are followed, so they match
+	//	the names in /proc/mounts
+	char devicePath [PATH_MAX];
+	if (realpath(pathName, devicePath) == nullptr)
+	{
+		snprintf(devicePath, sizeof(devicePath), "%s", pathName);
+	}
+
+	FILE* mounts = fopen("/proc/mounts", "r");
+	if (mounts == nullptr)
+	{
+		//	If we can't tell, assume the worst
+		return true;
+	}
+
+	bool	mounted	= false;
+	char	line [PATH_MAX * 2];
+	while (!mounted && fgets(line, sizeof(line), mounts) != nullptr)
+	{
+		char* source = strtok(line, " ");
+		char mountedPath [PATH_MAX];
+		if (source != nullptr && realpath(source, mountedPath) != nullptr)
+		{
+			mounted = strncmp(mountedPath, devicePath, strlen(devicePath)) == 0;
+		}
+	}
+
+	fclose(mounts);
+	return mounted;
+}
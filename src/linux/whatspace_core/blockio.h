@@ -0,0 +1,126 @@
+//	Block I/O engine used by the Linux tools to write and read a file or a
+//	whole block device. The synchronous engine does one request at a
+//	time with pread and pwrite, and the io_uring engine keeps many in
+//	flight through one submission ring
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <vector>
+
+//	How a block target is opened
+struct BlockOptions
+{
+	//	The target is a whole block device e.g. /dev/sdb
+	bool		raw;
+
+	//	Go through the page cache rather than O_DIRECT
+	bool		cached;
+
+	//	Requests kept in flight, or zero for synchronous I/O
+	unsigned	queueDepth;
+};
+
+//	One read or write
+struct BlockRequest
+{
+	uint8_t*	buffer;
+	int64_t		offset;
+	uint32_t	size;
+	bool		reading;
+
+	//	The buffer's index in the registered set, or -1 if it isn't one
+	//	of them
+	int			bufferIndex;
+
+	//	Set while the request is in flight
+	bool		active;
+
+	//	Free for the caller to use, e.g. the block number
+	uint64_t	tag;
+};
+
+//	A request that has finished
+struct BlockCompletion
+{
+	//	The request, or nullptr if the engine failed and nothing more
+	//	will complete
+	BlockRequest*	request;
+
+	bool			succeeded;
+	uint32_t		transferred;
+
+	//	errno for a request that failed
+	int				error;
+};
+
+//	Writes and reads blocks of a file or device
+class BlockEngine
+{
+public:
+	virtual ~BlockEngine ();
+
+	//	Name the target was opened with
+	const char* Name () const		{ return targetName; }
+
+	//	Size of the file or device when it was opened
+	int64_t Size () const			{ return targetSize; }
+
+	//	Hand the buffers requests will use to the kernel up front, so it
+	//	doesn't map and pin them on every request. Returns false, with
+	//	errno set, if they could not be registered
+	virtual bool RegisterBuffers (const std::vector<iovec>& buffers);
+
+	//	Start a read or write. Returns false, with errno set, if the
+	//	request could not be started
+	virtual bool Start (BlockRequest& request) = 0;
+
+	//	Wait for the next request to finish
+	virtual BlockCompletion Wait () = 0;
+
+	//	Cancel everything in flight and wait for it to finish, so the
+	//	requests and their buffers can be freed
+	virtual void Cancel ();
+
+	//	Read or write one block and wait for it. These are for callers
+	//	that do one thing at a time, so nothing else can be in flight
+	bool Read (int64_t offset, uint8_t* buffer, uint32_t size, uint32_t& transferred);
+	bool Write (int64_t offset, const uint8_t* buffer, uint32_t size, uint32_t& transferred);
+
+	//	Number of blocks Read and Write have moved, or tried to
+	uint64_t Transfers () const		{ return transferCount; }
+
+protected:
+	BlockEngine (int fd, const char* name, int64_t size);
+
+	int				targetFd;
+	char			targetName [PATH_MAX];
+	int64_t			targetSize;
+
+private:
+	//	Start one request and wait for it
+	bool Transfer (BlockRequest& request, uint32_t& transferred);
+
+	uint64_t		transferCount;
+};
+
+//	Open a file or block device for block I/O. With a queue depth the
+//	io_uring engine is used, and if the kernel doesn't support io_uring
+//	this falls back to the synchronous engine. A name starting fake: is a
+//	fake device modelled in memory, see fakedevice.h. Returns nullptr,
+//	with errno set, if the target could not be opened
+std::unique_ptr<BlockEngine> OpenBlockEngine (const char* targetName, const BlockOptions& options);
+
+//	Get the logical sector size and length of a block device for a raw run
+bool GetRawDriveInfo (const char* pathName, uint32_t& bytesPerSector, int64_t& driveSize);
+
+//	True if the block device, or a partition on it, is in /proc/mounts.
+//	A raw run refuses to write over a mounted file system
+bool DriveIsMounted (const char* pathName);
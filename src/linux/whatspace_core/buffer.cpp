@@ -0,0 +1,81 @@
+//	Buffers for O_DIRECT I/O. Direct I/O needs the buffer aligned on a
+//	sector boundary
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//	Round a size up to a multiple of unit
+static size_t RoundUp (size_t size, size_t unit)
+{
+	return ((size + unit - 1) / unit) * unit;
+}
+
+
+BufferPool::BufferPool ()
+{
+	poolMemory		= nullptr;
+	bufferSize		= 0;
+	bufferStride	= 0;
+	bufferCount		= 0;
+}
+
+
+BufferPool::~BufferPool ()
+{
+	Destroy();
+}
+
+
+//	Get count aligned buffers of bufferSize bytes
+bool BufferPool::Create (size_t size, size_t count, size_t alignment)
+{
+	Destroy();
+
+	//	Each buffer starts on a page or alignment boundary
+	const size_t pageSize	= (size_t) sysconf(_SC_PAGESIZE);
+	const size_t boundary	= alignment > pageSize ? alignment : pageSize;
+	const size_t stride		= RoundUp(size, boundary);
+
+	void* memory = nullptr;
+	if (posix_memalign(&memory, boundary, stride * count) != 0)
+	{
+		return false;
+	}
+
+	poolMemory		= (uint8_t*) memory;
+	bufferSize		= size;
+	bufferStride	= stride;
+	bufferCount		= count;
+	memset(poolMemory, 0, stride * count);
+	return true;
+}
+
+
+//	Every buffer in the pool, for registering with io_uring
+std::vector<iovec> BufferPool::Iovecs () const
+{
+	std::vector<iovec> iovecs(bufferCount);
+	for (size_t b = 0; b < bufferCount; b++)
+	{
+		iovecs [b].iov_base	= Buffer(b);
+		iovecs [b].iov_len	= bufferSize;
+	}
+
+	return iovecs;
+}
+
+
+//	Free the pool memory
+void BufferPool::Destroy ()
+{
+	free(poolMemory);
+	poolMemory	= nullptr;
+	bufferCount	= 0;
+}
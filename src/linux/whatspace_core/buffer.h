@@ -0,0 +1,46 @@
+//	Buffers for O_DIRECT I/O. Direct I/O needs the buffer aligned on a
+//	sector boundary
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <vector>
+
+//	A set of equal sized aligned buffers carved out of one allocation, so
+//	each request in flight has its own buffer without allocating one per
+//	request. The buffers start out zeroed
+class BufferPool
+{
+public:
+	BufferPool ();
+	~BufferPool ();
+
+	BufferPool (const BufferPool&) = delete;
+	BufferPool& operator= (const BufferPool&) = delete;
+
+	//	Get count buffers of bufferSize bytes, each aligned to alignment.
+	//	Returns false if there isn't enough memory
+	bool Create (size_t bufferSize, size_t count, size_t alignment);
+
+	//	Buffer number index. Buffers are handed out by index rather than
+	//	taken and given back, as each one is registered with the kernel
+	uint8_t* Buffer (size_t index) const	{ return poolMemory + index * bufferStride; }
+
+	//	Every buffer in the pool, for registering with io_uring
+	std::vector<iovec> Iovecs () const;
+
+private:
+	//	Free the pool memory
+	void Destroy ();
+
+	uint8_t*	poolMemory;
+	size_t		bufferSize;
+	size_t		bufferStride;
+	size_t		bufferCount;
+};
@@ -0,0 +1,66 @@
+//	Console output for the Linux tools - errno messages and human
+//	readable sizes
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+//	Converts bytes to human readable sizes
+constexpr int64_t		sizeArray []	= { TiB, GiB, MiB, KiB};
+constexpr const char*	sizeNames []	= { "TiB", "GiB", "MiB", "KiB"};
+constexpr const char*	sizeIsBytes		= "bytes";
+constexpr int			numSizes		= sizeof(sizeArray) / sizeof(sizeArray[0]);
+
+
+//	Output an error message
+void PrintError (const char* format, ...)
+{
+	//	We start by saving the current error as we might make
+	//	calls that produce other errors
+	const int savedError = errno;
+
+	//	User message
+	char userMsg [BUFSIZ];
+
+	//	Get the start of the variable arguments
+	va_list ourArgs;
+	va_start(ourArgs, format);
+	vsnprintf(userMsg, sizeof(userMsg), format, ourArgs);
+	va_end(ourArgs);
+
+	//	Output the full message
+	printf("%s : %s\n", userMsg, strerror(savedError));
+}
+
+
+//	Output a human readable size
+const char* HumanReadable (int64_t sizeInBytes, int64_t& convertedSize)
+{
+	for (int i = 0; i < numSizes; i ++)
+	{
+		if (sizeInBytes >= sizeArray [i])
+		{
+			convertedSize = sizeInBytes / sizeArray [i];
+			return sizeNames [i];
+		}
+	}
+
+	//	Must be in bytes
+	convertedSize = sizeInBytes;
+	return sizeIsBytes;
+}
+
+
+//	Common output function for sizes
+void OutputSize (const char* msg, const uint64_t inSize)
+{
+	int64_t converted;
+	const char* textSize = HumanReadable(inSize, converted);
+	printf("%s %lld %s\n", msg, (long long) converted, textSize);
+}
@@ -0,0 +1,25 @@
+//	Console output for the Linux tools - errno messages and human
+//	readable sizes
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+//	Size metrics e.g. KiB, GiB etc.
+constexpr int64_t KiB = 1024;
+constexpr int64_t MiB = KiB * 1024;
+constexpr int64_t GiB = MiB * 1024;
+constexpr int64_t TiB = GiB * 1024;
+
+//	Output an error message, followed by the description of errno
+void PrintError (const char* format, ...);
+
+//	Convert a size in bytes to a human readable size. Returns the name of
+//	the units the converted size is in
+const char* HumanReadable (int64_t sizeInBytes, int64_t& convertedSize);
+
+//	Common output function for sizes
+void OutputSize (const char* msg, const uint64_t inSize);
@@ -5,34 +5,74 @@
 //	License: MIT. See the LICENSE file in the project root for more details.
 //
 
+#include "../../whatspace_core/blockio.h"
+#include "../../whatspace_core/buffer.h"
+#include "../../whatspace_core/budget.h"
+#include "../../whatspace_core/devices.h"
+#include "../../whatspace_core/fakedevice.h"
+#include "../../whatspace_core/geometry.h"
+#include "../../whatspace_core/journal.h"
+#include "../../whatspace_core/mapped.h"
+#include "../../whatspace_core/marker.h"
+#include "../../whatspace_core/output.h"
+#include "../../whatspace_core/pattern.h"
+#include "../../whatspace_core/privilege.h"
+#include "../../whatspace_core/results.h"
+#include "../../whatspace_core/telemetry.h"
+#include "../../whatspace_core/timing.h"
+#include "../../whatspace_core/verify.h"
+
 #include <Windows.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <wchar.h>
 
+#include <algorithm>
 #include <chrono>
-
-//	Size metrics e.g. KiB, GiB etc.
-constexpr int64_t KiB = 1024;
-constexpr int64_t MiB = KiB * 1024;
-constexpr int64_t GiB = MiB * 1024;
-constexpr int64_t TiB = GiB * 1024;
-
-//	Converts bytes to human readable sizes
-constexpr int64_t			sizeArray []	= { TiB, GiB, MiB, KiB};
-constexpr const wchar_t*	sizeNames []	= { L"TiB", L"GiB", L"MiB", L"KiB"};
-constexpr const wchar_t*	sizeIsBytes		= L"bytes";
-constexpr int				numSizes		= sizeof(sizeArray) / sizeof(sizeArray[0]);
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
 
 //	File prefix
 constexpr const char*		verifyFilename	= "verifysp.bin";
 
-//	Verification block size
+//	Default distance between markers
 constexpr uint64_t			verifySize		= 10 * MiB;
 
+//	Size of each transfer, and the transfers kept in flight, when a full
+//	surface run streams the pattern over the whole file
+constexpr uint64_t			fullBlockSize	= 4 * MiB;
+constexpr DWORD				fullQueueDepth	= 4;
+
+//	Largest marker size and stride the user can ask for
+constexpr uint64_t			maxBlockSize	= 64 * MiB;
+constexpr uint64_t			maxStride		= 1024 * GiB;
+
 //	Batch size for some operations
 constexpr uint64_t			batchSize		= 5;
 
+//	Largest number of overlapped requests we will keep in flight
+constexpr DWORD				maxQueueDepth	= 256;
+
+//	Largest number of stratified samples for a sampled run
+constexpr DWORD				maxSamples		= 1000000;
+
+//	Smallest power of two boundary a sampled run always checks, and the
+//	first offset after 0 on the bisect ladder
+constexpr int64_t			minBoundary		= 64 * MiB;
+
+//	Smallest distance between the low rungs of a bisect's wrap check, and
+//	the most rungs it writes. The distance doubles until the rungs fit,
+//	and a wrap at any multiple of it is caught
+constexpr int64_t			ladderGranule	= MiB;
+constexpr size_t			maxWrapRungs	= 2048;
+
+//	Reads kept in flight by a scan that isn't given a queue depth, and the
+//	number of bad blocks it reports one by one
+constexpr DWORD				scanQueueDepth	= 32;
+constexpr uint64_t			maxScanReports	= 10;
+
 //	Program actions
 namespace progActions
 {
@@ -40,112 +80,13 @@ namespace progActions
 	uint8_t cached		= 2;
 	uint8_t noreads		= 4;
 	uint8_t outputStats = 8;
+	uint8_t bisect		= 16;
+	uint8_t twoPass		= 32;
+	uint8_t pattern		= 64;
+	uint8_t resume		= 128;
 };
 
 
-//	Output an error message
-void PrintError (const wchar_t * format, ...)
-{
-	//	We start by saving the current error as we might make
-	//	API calls that produce other errors
-	auto savedError = GetLastError();
-
-	//	There are two parts to the error message. There's the Windows
-	//	description of the error and information passed by the user.
-	//	Start by getting the Windows error text
-	LPCTSTR windowsMsg = nullptr;
-
-	//	Format the error message
-	FormatMessage(	FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-					nullptr, savedError,
-					MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-					(LPTSTR) &windowsMsg, 0, nullptr);
-
-	//	User message
-	wchar_t userMsg [BUFSIZ];
-	
-	//	Get the start of the variable arguments
-	va_list ourArgs;
-	va_start(ourArgs, format);
-	vswprintf_s(userMsg, format, ourArgs);
-
-	//	Output the full message
-	wprintf(L"%s : %s\n", userMsg, windowsMsg);
-
-	//	Free off the Windows message buffer
-	LocalFree((LPVOID) windowsMsg);
-}
-
-
-//	Output a human readable size
-const wchar_t* HumanReadable (int64_t sizeInBytes, int64_t& convertedSize)
-{
-	for (int i = 0; i < numSizes; i ++)
-	{
-		if (sizeInBytes >= sizeArray [i])
-		{
-			convertedSize = sizeInBytes / sizeArray [i];
-			return sizeNames [i];
-		}
-	}
-
-	//	Must be in bytes
-	convertedSize = sizeInBytes;
-	return sizeIsBytes;
-}
-
-
-//	Common output function for sizes
-void OutputSize (const wchar_t* msg, const uint64_t inSize)
-{
-	int64_t converted;
-	const wchar_t* textSize = HumanReadable(inSize, converted);
-	wprintf(L"%s %lld %s\n", msg, converted, textSize);
-}
-
-
-//	We need to obtain a certain privelege to manipulate
-//	the verification file the way we want
-bool AddPrivelege (LPCTSTR privName)
-{
-	HANDLE tokenHandle = INVALID_HANDLE_VALUE;
-	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &tokenHandle)) 
-	{
-		PrintError(L"Could not get token handle for %s", privName);
-		return false;
-	}
-
-	//	Lookup the privelege
-	LUID lookupID;
-	LookupPrivilegeValue(NULL, privName, &lookupID);
-
-	//	Add the new privelege
-	TOKEN_PRIVILEGES newPriv;
-	ZeroMemory(&newPriv, sizeof(newPriv));
-	newPriv.PrivilegeCount				= 1;
-	newPriv.Privileges[0].Luid			= lookupID;
-	newPriv.Privileges[0].Attributes	= SE_PRIVILEGE_ENABLED;
-
-	DWORD				returnLen;
-	TOKEN_PRIVILEGES	oldPriv;
-	if (!AdjustTokenPrivileges(tokenHandle, FALSE, &newPriv, sizeof(TOKEN_PRIVILEGES), &oldPriv, &returnLen))
-	{
-		CloseHandle(tokenHandle);
-		PrintError(L"Unable to get privilege %s", privName);
-		return false;
-	}
-
-	if (!CloseHandle(tokenHandle))
-	{
-		//	Could not close the token handle
-		PrintError(L"Could not close the handle for %s", privName);
-		return false;
-	}
-
-	return true;
-}
-
-
 //	Quickly create the file
 bool CreateVerifyFile (const char* pathName, const DWORD bytesPerSector, const int64_t totalSpace)
 {
@@ -164,7 +105,7 @@ bool CreateVerifyFile (const char* pathName, const DWORD bytesPerSector, const i
 	swprintf_s(writeName, L"%hs%hs", pathName, verifyFilename);
 
 	//	Output some information
-	wprintf(L"Creating file %s", writeName);
+	OutputText(L"Creating file %s", writeName);
 	OutputSize(L", will be", totalSpace);
 
 	//	Create the file
@@ -219,372 +160,2813 @@ bool CreateVerifyFile (const char* pathName, const DWORD bytesPerSector, const i
 }
 
 
-//	Common clean up code
-inline void CommonVerifyCleanup (HANDLE verifyFile, uint8_t* verifyBuffer)
-{
-	if (verifyFile)
-	{
-		if (!CloseHandle(verifyFile))
-		{
-			PrintError(L"Could not close verification file");
-		}
-	}
-
-	if (verifyBuffer != nullptr)
-	{
-		_aligned_free(verifyBuffer);
-	}
-}
-
-
-//	Verify the created file is the correct size
-bool VerifyTheFile (const char* pathName, const DWORD bytesPerSector, const bool noReads, const bool cached)
+//	Open what the markers are written to - the verification file, or the
+//	whole drive for a raw run. A queue depth of zero gives synchronous I/O,
+//	and a shared target can be opened a second time alongside this one.
+//	Everything the target moves is counted in the run's results
+std::unique_ptr<BlockEngine> OpenVerifyTarget (const char* pathName, const bool raw, const bool cached, const bool shared, const DWORD queueDepth, RunResults& results)
 {
-	//	Create the verification filename
 	wchar_t verifyName [MAX_PATH];
-	swprintf_s(verifyName, L"%hs%hs", pathName, verifyFilename);
-
-	//	Set default values
-	HANDLE		verifyFile		= INVALID_HANDLE_VALUE;
-	uint8_t*	verifyBuffer	= nullptr;
-
-	//	See what type of caching we were asked to use
-	DWORD fileAttributes;
-	if (cached)
+	if (raw)
 	{
-		//	File system cache allowed
-		fileAttributes = FILE_ATTRIBUTE_NORMAL;
+		swprintf_s(verifyName, L"%hs", pathName);
 	}
 	else
 	{
-		//	File system cache is not allowed
-		fileAttributes = FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+		swprintf_s(verifyName, L"%hs%hs", pathName, verifyFilename);
 	}
 
-	//	Open the file
-	verifyFile = CreateFile(verifyName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, fileAttributes, nullptr);
-	if (verifyName == INVALID_HANDLE_VALUE)
+	BlockOptions options;
+	options.raw			= raw;
+	options.cached		= cached;
+	options.create		= false;
+	options.shared		= shared;
+	options.queueDepth	= queueDepth;
+	options.adaptive	= queueDepth != 0;
+	options.preallocate	= 0;
+
+	std::unique_ptr<BlockEngine> verifyTarget = OpenBlockEngine(verifyName, options);
+	if (!verifyTarget)
 	{
 		PrintError(L"Could not open %s for verification", verifyName);
-		return false;
+		results.IoFailed(-1, "open error");
+		return nullptr;
 	}
 
-	//	We need to know how big the file is
-	LARGE_INTEGER fileSize;
-	if (!GetFileSizeEx(verifyFile, &fileSize))
-	{
-		PrintError(L"Could not get the file size for %s", verifyName);
-		CommonVerifyCleanup(verifyFile, verifyBuffer);
-		return false;
-	}
+	verifyTarget->SetResults(&results);
+	return verifyTarget;
+}
 
-	//	Output some information
-	uint64_t totalBlocks = fileSize.QuadPart / verifySize;
-	wprintf(L"Verification of %s will use %lld blocks of", verifyName, totalBlocks);
-	OutputSize(L"", verifySize);
 
-	//	Create a buffer that we can use to verify markers
-	verifyBuffer = (uint8_t*) _aligned_malloc(bytesPerSector, bytesPerSector);
-	if (verifyBuffer == nullptr)
-	{
-		PrintError(L"Did not get verify buffer for %s", verifyName);
-		CommonVerifyCleanup(verifyFile, verifyBuffer);
-		return false;
-	}
+//	How markers are laid out in a sector
+struct MarkerStyle
+{
+	//	Fill the whole sector with a pattern instead of four values
+	bool		fullPattern;
+	uint64_t	patternSeed;
+
+	//	Each marker has a header with its own offset and this run ID.
+	//	Zero means a run from before headers were added
+	uint64_t	runId;
+
+	//	Size of each marker write and read, and the distance from one
+	//	marker to the next, in a run that walks the whole file
+	DWORD		blockSize;
+	uint64_t	stride;
+};
 
-	//	Start the timer
-	auto start		= std::chrono::high_resolution_clock::now();
-	auto elapsed	= std::chrono::high_resolution_clock::now();
 
-	//	Write and then read the verification markers at certain points in the file
-	uint64_t count = 0;
-	for (LONGLONG i = 0; i < fileSize.QuadPart; i += verifySize)
+//	Set the marker for the block at an offset
+void SetMarker (uint8_t* buffer, const DWORD bytesPerSector, const uint64_t value, const int64_t offset, const MarkerStyle& style)
+{
+	if (style.fullPattern)
 	{
-		//	Output some stats if it is time
-		if (count && count % batchSize == 0)
+		//	Every byte of the sector after the header comes from the
+		//	pattern for this offset
+		const size_t headerSize = style.runId != 0 ? markerHeaderSize : 0;
+		if (headerSize != 0)
 		{
-			//	Get the end time
-			auto end = std::chrono::high_resolution_clock::now();
-			std::chrono::duration<double> blockSeconds		= end - start;
-			std::chrono::duration<double> elapsedSeconds	= end - elapsed;
-
-			//	Let the user know how long these blocks took
-			wprintf(L"\rProcess verification block %lld/%lld took %.2lf seconds (%.2lf total seconds)   ", count, totalBlocks, blockSeconds.count(), elapsedSeconds.count());
-			start = std::chrono::high_resolution_clock::now();
+			SetMarkerHeader(buffer, style.runId, offset, value);
 		}
+		FillPattern(buffer + headerSize, bytesPerSector - headerSize, style.patternSeed, offset + headerSize);
+		return;
+	}
 
-		//	Move to that part of the file
-		LARGE_INTEGER fileOffset;
-		fileOffset.QuadPart = i;
-		if (!SetFilePointerEx(verifyFile, fileOffset, nullptr, FILE_BEGIN))
+	//	Put the marker at multiple offsets in the buffer. The rest of the
+	//	sector is left alone, as a write buffer starts out zeroed and only
+	//	ever holds markers
+	const uint64_t dataOffsets = bytesPerSector / 4;
+	for (int o = 0; o < 4; o++)
+	{
+		if (style.runId != 0)
 		{
-			PrintError(L"\nUnable to move verification file pointer for %s", verifyName);
-			OutputSize(L"Reached", i);
-			CommonVerifyCleanup(verifyFile, verifyBuffer);
-			return false;
+			SetMarkerHeader(buffer + (o * dataOffsets), style.runId, offset, value);
 		}
-
-		//	Clear the verification buffer
-		memset(verifyBuffer, 0, bytesPerSector);
-
-		//	Set verification data
-		//
-		//	This will be the current count + 1 at multiple offsets 
-		//	in the buffer
-		const uint64_t dataOffsets = bytesPerSector / 4;
-		for (int o = 0; o < 4; o++)
+		else
 		{
-			uint64_t* dataPtr = (uint64_t*) (verifyBuffer + (o * dataOffsets));
-			*dataPtr = count + 1;
+			uint64_t* dataPtr = (uint64_t*) (buffer + (o * dataOffsets));
+			*dataPtr = value;
 		}
+	}
+}
 
-		//	Write the data
-		DWORD written;
-		if (WriteFile(verifyFile, verifyBuffer, bytesPerSector, &written, nullptr) == 0)
-		{
-			PrintError(L"\nCould not write to %s", verifyName);
-			OutputSize(L"Reached", i);
-			CommonVerifyCleanup(verifyFile, verifyBuffer);
-			return false;
-		}
 
-		//	Sanity check
-		if (written != bytesPerSector)
-		{
-			//	Give a clear indication where the write error was
-			wprintf(L"\n%s wrote %d bytes, expected %d bytes @ offset %lld", 
-						verifyName, written, bytesPerSector, i);
-			OutputSize(L" ", i);
+//	Spoil the parts of a read buffer that CheckMarker looks at first, so
+//	a read that doesn't fill the buffer can't pass with an old marker.
+//	This is much cheaper than setting the whole sector before every read
+void PoisonMarker (uint8_t* buffer, const DWORD bytesPerSector, const MarkerStyle& style)
+{
+	const size_t	stampSize	= style.runId != 0 ? markerHeaderSize : sizeof(uint64_t);
+	const int		numStamps	= style.fullPattern ? 1 : 4;
+	const uint64_t	dataOffsets	= bytesPerSector / 4;
+	for (int o = 0; o < numStamps; o++)
+	{
+		memset(buffer + (o * dataOffsets), 0xFF, stampSize);
+	}
+}
 
-			//	Clean up and bail
-			CommonVerifyCleanup(verifyFile, verifyBuffer);
-			return false;
-		}
 
-		if (!noReads)
+//	Check the marker for the block at an offset. Returns the position of
+//	the first bad byte, or bytesPerSector if the marker is correct
+DWORD CheckMarker (const uint8_t* buffer, const DWORD bytesPerSector, const uint64_t value, const int64_t offset, const MarkerStyle& style)
+{
+	//	The header we expect to see
+	uint8_t expectedHeader [markerHeaderSize];
+	SetMarkerHeader(expectedHeader, style.runId, offset, value);
+
+	if (style.fullPattern)
+	{
+		size_t headerSize = 0;
+		if (style.runId != 0)
 		{
-			//	Need to set the file pointer back a block
-			if (!SetFilePointerEx(verifyFile, fileOffset, nullptr, FILE_BEGIN))
+			headerSize = FindMismatch(buffer, expectedHeader, markerHeaderSize);
+			if (headerSize != markerHeaderSize)
 			{
-				PrintError(L"\nMove read file pointer");
-				OutputSize(L"Reached", i);
-				CommonVerifyCleanup(verifyFile, verifyBuffer);
-				return false;
+				return (DWORD) headerSize;
 			}
+		}
 
-			//	Reset the buffer pattern to something very different than before
-			memset(verifyBuffer, 0xFF, bytesPerSector);
+		return (DWORD) (headerSize + VerifyPattern(buffer + headerSize, bytesPerSector - headerSize, style.patternSeed, offset + headerSize, bytesPerSector).firstMismatch);
+	}
 
-			//	Read the data
-			DWORD bytesRead;
-			if (ReadFile(verifyFile, verifyBuffer, bytesPerSector, &bytesRead, nullptr) == 0)
+	const uint64_t dataOffsets = bytesPerSector / 4;
+	for (int o = 0; o < 4; o++)
+	{
+		const uint8_t* dataPtr = buffer + (o * dataOffsets);
+		if (style.runId != 0)
+		{
+			size_t badByte = FindMismatch(dataPtr, expectedHeader, markerHeaderSize);
+			if (badByte != markerHeaderSize)
 			{
-				PrintError(L"\nUnable to read from %s", verifyFile);
-				OutputSize(L"Reached", i);
-				CommonVerifyCleanup(verifyFile, verifyBuffer);
-				return false;
+				return (DWORD) ((o * dataOffsets) + badByte);
 			}
+		}
+		else
+		if (*(const uint64_t*) dataPtr != value)
+		{
+			return (DWORD) (o * dataOffsets);
+		}
+	}
 
-			//	Sanity check
-			if (bytesRead != bytesPerSector)
-			{
-				//	Give a clear indication where the read error was
-				wprintf(L"\n%s read %d bytes, expected %d bytes @ offset %lld",
-					verifyName, bytesRead, bytesPerSector, i);
-				OutputSize(L"", i);
+	return bytesPerSector;
+}
 
-				//	Clean up and bail
-				CommonVerifyCleanup(verifyFile, verifyBuffer);
-				return false;
-			}
 
-			//	Read unique data from the buffer
-			for (int o = 0; o < 4; o++)
-			{
-				uint64_t* dataPtr = (uint64_t*)(verifyBuffer + (o * dataOffsets));
-				if (*dataPtr != count + 1)
-				{
-					//	Give the user an idea of where the verification failed
-					wprintf(L"\nVerification data %lld is incorrect should be %lld @ offset %lld", *dataPtr, count + 1, i);
-					OutputSize(L"", i);
+//	Find a header from this run in a marker that failed its check.
+//	Returns false if there isn't one
+bool FindRunHeader (const uint8_t* buffer, const DWORD bytesPerSector, const MarkerStyle& style, MarkerHeader& header)
+{
+	if (style.runId == 0)
+	{
+		return false;
+	}
 
-					//	Clean up and bail
-					CommonVerifyCleanup(verifyFile, verifyBuffer);
-					return false;
-				}
-			}
+	//	A pattern marker only has a header at the start
+	const int		numHeaders	= style.fullPattern ? 1 : 4;
+	const uint64_t	dataOffsets	= bytesPerSector / 4;
+	for (int o = 0; o < numHeaders; o++)
+	{
+		if (ReadMarkerHeader(buffer + (o * dataOffsets), header) && header.runId == style.runId)
+		{
+			return true;
 		}
-
-		//	Next block
-		count ++;
 	}
 
-	//	Tell the user the good news
-	wprintf(L"\n%hs ", pathName);
-	OutputSize(L"is", fileSize.QuadPart);
-
-	//	All done
-	CommonVerifyCleanup(verifyFile, verifyBuffer);
-	return true;
+	return false;
 }
 
 
-//	Delete the file we created
-bool DeleteVerifyFile (const char* pathName)
+//	Tell the user which offset overwrote the marker at an offset. A
+//	controller that wraps addresses writes the marker for a high offset
+//	onto a low one. The last write to a sector is the one that stays, so
+//	the distance between them is some multiple of where the device wraps.
+//	Returns the distance, or zero if the marker wasn't overwritten that way
+int64_t ReportOverwrite (const uint8_t* buffer, const DWORD bytesPerSector, const int64_t offset, const MarkerStyle& style)
 {
-	//	Create the search path
-	wchar_t deleteFile[MAX_PATH];
-	swprintf_s(deleteFile, L"%hs%hs", pathName, verifyFilename);
+	MarkerHeader header;
+	if (!FindRunHeader(buffer, bytesPerSector, style, header) || header.offset == offset)
+	{
+		return 0;
+	}
 
-	//	Output some information
-	wprintf(L"Removing file %s\n", deleteFile);
+	OutputText(L"Offset %lld was overwritten by the marker for offset %lld\n", offset, header.offset);
+	return header.offset > offset ? header.offset - offset : 0;
+}
 
-	if (!DeleteFile(deleteFile))
+
+//	Give the user an idea of where a marker check failed. Returns the
+//	distance to the higher offset that overwrote the marker, or zero
+int64_t ReportMarkerMismatch (const uint8_t* buffer, const DWORD bytesPerSector, const uint64_t value, const int64_t offset, const DWORD badByte, const MarkerStyle& style)
+{
+	if (style.fullPattern)
 	{
-		PrintError(L"Unable to delete file %s", deleteFile);
-		return false;
+		OutputText(L"\nPattern is incorrect at byte %d of the block @ offset %lld\n", badByte, offset);
+	}
+	else
+	if (style.runId != 0)
+	{
+		OutputText(L"\nVerification marker is incorrect at byte %d of the block @ offset %lld\n", badByte, offset);
+	}
+	else
+	{
+		OutputText(L"\nVerification data %lld is incorrect should be %lld @ offset %lld\n", *(const uint64_t*) (buffer + badByte), value, offset);
 	}
 
-	return true;
+	return ReportOverwrite(buffer, bytesPerSector, offset, style);
 }
 
 
-//	Output a usage message
-void Usage (const char* progName)
+//	Buffers for one marker. The marker is written from one and read back
+//	into the other, so the write buffer only ever holds markers and a read
+//	can't pass by finding the data that was just written
+struct MarkerBuffers
 {
-	wprintf(L"\nUsage: %hs [-stats] [-noreads] [-cached] <path>\n", progName);
-	wprintf(L"\nExample:\n");
-	wprintf(L"\n%hs -stats E:\\\n\n", progName);
-}
+	uint8_t*	write;
+	uint8_t*	read;
+};
 
 
-//	Main function
-int main (int argc, char** argv)
+//	Get count pairs of sector aligned marker buffers from a pool. The pool
+//	is allocated once for the whole run, rather than a buffer per request
+bool CreateMarkerBuffers (BufferPool& bufferPool, std::vector<MarkerBuffers>& markerBuffers, const DWORD blockSize, const DWORD bytesPerSector, const DWORD count, const bool largePages, const wchar_t* verifyName)
 {
-	if (argc < 2)
+	if (!bufferPool.Create(blockSize, (size_t) count * 2, bytesPerSector, largePages))
 	{
-		//	We need at least 2 options - output a usage message
-		Usage(argv[0]);
-		return 1;
+		PrintError(L"Did not get verify buffers for %s", verifyName);
+		return false;
 	}
 
-	//	See what the user asked for
-	const char* pathName = nullptr;
-	uint8_t		ourActions = progActions::justPath;
-	for (int i = 1; i < argc; i++)
+	if (largePages)
 	{
-		if (strcmp(argv [i], "-stats") == 0)
-		{
-			//	User wants stats
-			ourActions |= progActions::outputStats;
-		}
-		else
-		if (strcmp(argv [i], "-cached") == 0)
-		{
-			//	User wants to use file system cache
-			ourActions |= progActions::cached;
-		}
-		else
-		if (strcmp(argv[i], "-noreads") == 0)
-		{
-			//	User only wants to write to the device
-			ourActions |= progActions::noreads;
-		}
-		else
-		{
-			//	Check pathname
-			pathName = argv [i];
-
-			//	Convert to wide version
-			wchar_t widePath[16];
-			swprintf_s(widePath, L"%hs", pathName);
-
-			//	Get the type of drive
-			auto driveType = GetDriveType(widePath);
-
-			switch (driveType)
-			{
-				default:
-					printf("%s is an invalid option or drive path\n", pathName);
-					return 1;
-
-				case DRIVE_REMOVABLE:
-				case DRIVE_FIXED:
-				case DRIVE_REMOTE:
-				case DRIVE_RAMDISK:
-					//	All valid
-					break;
-			}
-		}
+		OutputPoolMemory(bufferPool);
 	}
 
-	//	We need to get stats for this device
-	DWORD bytesPerSector;
-	DWORD sectorsPerCluster;
-	DWORD freeClusters;
-	DWORD totalClusters;
-	if (GetDiskFreeSpaceA(pathName, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters) == 0)
+	markerBuffers.resize(count);
+	for (MarkerBuffers& buffers : markerBuffers)
 	{
-		PrintError(L"Could not get disk stats for %hs", pathName);
-		return 1;
+		buffers.write	= bufferPool.Acquire();
+		buffers.read	= bufferPool.Acquire();
 	}
 
-	//	Using DWORD, the free space could overflow
-	int64_t freeSpace	=	bytesPerSector;
-	freeSpace			*=	sectorsPerCluster;
-	freeSpace			*=	freeClusters;
+	return true;
+}
 
-	//	Same for total space
-	int64_t totalSpace	=	bytesPerSector;
-	totalSpace			*=	sectorsPerCluster;
-	totalSpace			*=	totalClusters;
 
-	//	Sanity check - we use file offsets later which are signed
-	if (freeSpace	<= 0
-	||	totalSpace	<= 0)
-	{
-		wprintf(L"Incorrect total %lld or free space %lld\n", totalSpace, freeSpace);
-		return 1;
-	}
+//	A marker written to a single sector and its location
+struct ProbeMarker
+{
+	int64_t		offset;
+	uint64_t	value;
+};
 
-	//	See what we need to do
-	if ((ourActions & progActions::outputStats) != 0)
-	{
-		//	Output some stats
-		wprintf(L"Bytes/sector     : %d\n", bytesPerSector);
-		wprintf(L"Sectors/cluster  : %d\n", sectorsPerCluster);
 
-		//	Get the human readable version of the total size
-		OutputSize(L"Total space      : %lld %s\n", totalSpace);
+//	Write a marker to one sector of the file
+bool WriteProbe (BlockEngine& verifyFile, const MarkerBuffers& probeBuffers, const DWORD bytesPerSector, const ProbeMarker& probe, const MarkerStyle& style)
+{
+	//	The marker is the same as the linear verification uses
+	SetMarker(probeBuffers.write, bytesPerSector, probe.value, probe.offset, style);
 
-		//	Get the human readable version of the free space
-		OutputSize(L"Free space       : %lld %s\n", freeSpace);
-	}
+	DWORD written;
+	return verifyFile.Write(probe.offset, probeBuffers.write, bytesPerSector, written)
+		&& written == bytesPerSector;
+}
 
 
-	//	Create the file and add markers
-	if (!CreateVerifyFile(pathName, bytesPerSector, freeSpace))
+//	Write the marker for offset 0 and then the one for an offset, and see
+//	whether the second landed on the first. Returns false if the I/O failed
+bool ProbeAlias (BlockEngine& verifyFile, const MarkerBuffers& probeBuffers, const DWORD bytesPerSector, const int64_t offset, const uint64_t value, const MarkerStyle& style, bool& aliased)
+{
+	if (!WriteProbe(verifyFile, probeBuffers, bytesPerSector, { 0, value }, style)
+	||	!WriteProbe(verifyFile, probeBuffers, bytesPerSector, { offset, value + 1 }, style))
 	{
-		wprintf(L"File creation failed\n");
-		return 1;
+		return false;
 	}
 
-	//	Verify the markers in the file
-	int returnStatus = 0;
-	if (!VerifyTheFile(pathName, bytesPerSector, (ourActions & progActions::noreads) != 0, (ourActions & progActions::cached) != 0))
+	PoisonMarker(probeBuffers.read, bytesPerSector, style);
+
+	DWORD bytesRead;
+	if (!verifyFile.Read(0, probeBuffers.read, bytesPerSector, bytesRead)
+	||	bytesRead != bytesPerSector)
 	{
-		wprintf(L"File verification failed\n");
-		returnStatus = 1;
+		return false;
 	}
 
-	//	Delete the file
-	if (!DeleteVerifyFile(pathName))
+	MarkerHeader header;
+	aliased = FindRunHeader(probeBuffers.read, bytesPerSector, style, header) && header.offset == offset;
+	return true;
+}
+
+
+//	Narrow the distances from markers to the ones for other offsets that
+//	overwrote them down to where the device wraps, with a few probes. The
+//	marker at offset 0 is left overwritten. Without the buffers to probe
+//	with, the distances are as close as we can get
+int64_t FindWrap (BlockEngine& verifyFile, const DWORD bytesPerSector, const bool largePages, const int64_t aliasDistance, const MarkerStyle& style)
+{
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	markerBuffers;
+	if (!CreateMarkerBuffers(bufferPool, markerBuffers, bytesPerSector, bytesPerSector, 1, largePages, verifyFile.Name()))
 	{
-		wprintf(L"File deletion failed\n");
-		returnStatus = 1;
+		return aliasDistance;
 	}
 
-	//	All done!
-	return returnStatus;
+	uint64_t probeCount = 0;
+	return NarrowAliasModulus(aliasDistance, bytesPerSector, [&] (int64_t offset, bool& aliased)
+	{
+		probeCount += 2;
+		return ProbeAlias(verifyFile, markerBuffers [0], bytesPerSector, offset, probeCount, style, aliased);
+	});
+}
+
+
+//	Markers were overwritten by the ones for higher offsets, so the device
+//	wraps. Where it wraps is taken as the capacity. Returns false if no
+//	marker was overwritten that way
+bool ReportWrap (BlockEngine& verifyFile, const DWORD bytesPerSector, const bool largePages, const int64_t resolution, const MarkerStyle& style, RunResults& results)
+{
+	const int64_t aliasDistance = results.AliasDistance();
+	if (aliasDistance == 0)
+	{
+		return false;
+	}
+
+	const int64_t wrapModulus = FindWrap(verifyFile, bytesPerSector, largePages, aliasDistance, style);
+	OutputSize(L"\nThe device wraps every", wrapModulus);
+	OutputSize(L"Capacity is", wrapModulus);
+	results.capacity	= wrapModulus;
+	results.resolution	= resolution;
+	return true;
+}
+
+
+//	Read a marker back through the file system cache and compare what it
+//	found with the unbuffered read of the same marker. A device that only
+//	fails one of the two is the most dangerous kind, as a cached run of the
+//	device looks fine. Returns false if the reads disagree or the cached
+//	read failed
+bool CheckCachedMarker (BlockEngine& cachedFile, uint8_t* buffer, const DWORD bytesPerSector, const uint64_t value, const int64_t offset, const bool uncachedGood, const MarkerStyle& style, RunResults& results)
+{
+	PoisonMarker(buffer, bytesPerSector, style);
+
+	DWORD bytesRead;
+	if (!cachedFile.Read(offset, buffer, bytesPerSector, bytesRead) || bytesRead != bytesPerSector)
+	{
+		PrintError(L"\nUnable to read from %s through the cache", cachedFile.Name());
+		results.IoFailed(offset, "cached read error");
+		return false;
+	}
+
+	const DWORD	badByte		= CheckMarker(buffer, bytesPerSector, value, offset, style);
+	const bool	cachedGood	= badByte == bytesPerSector;
+	if (cachedGood == uncachedGood)
+	{
+		//	If both are wrong, the caller reports the unbuffered read
+		return true;
+	}
+
+	if (cachedGood)
+	{
+		OutputText(L"\nThe cached read @ offset 0x%llX found the marker the unbuffered read did not, a -cached run would have passed", offset);
+	}
+	else
+	{
+		OutputText(L"\nThe unbuffered read @ offset 0x%llX found the marker but the cached read did not", offset);
+		results.AliasSeen(ReportMarkerMismatch(buffer, bytesPerSector, value, offset, badByte, style));
+	}
+
+	results.DataFailed(offset, "cached and unbuffered reads differ");
+	return false;
+}
+
+
+//	Write and read back the marker for one block. A differential run reads
+//	the marker back through the file system cache as well. Returns false
+//	if anything about the block failed
+bool CheckMarkerBlock (BlockEngine& verifyFile, BlockEngine* cachedFile, const MarkerBuffers& verifyBuffers, const LONGLONG i, const DWORD markerSize, const uint64_t count, const bool writePass, const bool readPass, const MarkerStyle& style, RunResults& results)
+{
+	const wchar_t* verifyName = verifyFile.Name();
+
+	if (writePass)
+	{
+		//	Set verification data - this will be the current count + 1
+		SetMarker(verifyBuffers.write, markerSize, count + 1, i, style);
+
+		//	Write the data
+		DWORD written;
+		if (!verifyFile.Write(i, verifyBuffers.write, markerSize, written))
+		{
+			PrintError(L"\nCould not write to %s", verifyName);
+			results.IoFailed(i, "write error");
+			OutputSize(L"Reached", i);
+			return false;
+		}
+
+		//	Sanity check
+		if (written != markerSize)
+		{
+			results.IoFailed(i, "short write");
+
+			//	Give a clear indication where the write error was
+			OutputText(L"\n%s wrote %d bytes, expected %d bytes @ offset %lld", 
+						verifyName, written, markerSize, i);
+			OutputSize(L" ", i);
+
+			//	Bail out
+			return false;
+		}
+
+		//	The cached read must come from the device, not from
+		//	anything still on its way there
+		if (cachedFile != nullptr && !verifyFile.Flush())
+		{
+			PrintError(L"\nCould not flush %s", verifyName);
+			results.IoFailed(i, "flush error");
+			OutputSize(L"Reached", i);
+			return false;
+		}
+	}
+
+	if (readPass)
+	{
+		//	Make sure an old marker in the buffer can't pass
+		PoisonMarker(verifyBuffers.read, markerSize, style);
+
+		//	Read the data
+		DWORD bytesRead;
+		if (!verifyFile.Read(i, verifyBuffers.read, markerSize, bytesRead))
+		{
+			PrintError(L"\nUnable to read from %s", verifyName);
+			results.IoFailed(i, "read error");
+			OutputSize(L"Reached", i);
+			return false;
+		}
+
+		//	Sanity check
+		if (bytesRead != markerSize)
+		{
+			results.IoFailed(i, "short read");
+
+			//	Give a clear indication where the read error was
+			OutputText(L"\n%s read %d bytes, expected %d bytes @ offset %lld",
+				verifyName, bytesRead, markerSize, i);
+			OutputSize(L"", i);
+
+			//	Bail out
+			return false;
+		}
+
+		//	Read unique data from the buffer
+		DWORD badByte = CheckMarker(verifyBuffers.read, markerSize, count + 1, i, style);
+		if (badByte != markerSize)
+		{
+			//	Give the user an idea of where the verification failed
+			results.AliasSeen(ReportMarkerMismatch(verifyBuffers.read, markerSize, count + 1, i, badByte, style));
+		}
+
+		if (cachedFile != nullptr && !CheckCachedMarker(*cachedFile, verifyBuffers.read, markerSize, count + 1, i, badByte == markerSize, style, results))
+		{
+			OutputSize(L"", i);
+			return false;
+		}
+
+		if (badByte != markerSize)
+		{
+			results.DataFailed(i, "marker mismatch");
+			OutputSize(L"", i);
+
+			//	Bail out
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//	Verify the created file is the correct size. A differential run reads
+//	every marker back through the file system cache as well, and fails as
+//	soon as the two reads disagree. Without an error budget the first
+//	failure ends the run. With one, budgetFailures failures within
+//	budgetWindow blocks of each other are taken as the end of the kept
+//	data and probed sparsely past, and anything fewer is counted as bad
+//	blocks and stepped over
+bool VerifyTheFile (const char* pathName, const bool raw, const DWORD bytesPerSector, const bool noReads, const bool cached, const bool largePages, const bool twoPass, const bool differential, const uint32_t budgetFailures, const uint64_t budgetWindow, const MarkerStyle& style, RunTelemetry* telemetry, RunResults& results, HANDLE journal, const JournalRecord& resumeFrom)
+{
+	//	Open the file, or the whole drive for a raw run
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, cached, differential, 0, results);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	//	The second handle goes through the cache. Only the device's own
+	//	latency is wanted in the telemetry, so it isn't timed
+	std::unique_ptr<BlockEngine> cachedFile;
+	if (differential)
+	{
+		cachedFile = OpenVerifyTarget(pathName, raw, true, true, 0, results);
+		if (!cachedFile)
+		{
+			return false;
+		}
+	}
+
+	//	Every write and read is timed if the user asked for telemetry
+	verifyFile->SetTelemetry(telemetry);
+
+	//	The verification filename, or the drive name for a raw run
+	const wchar_t*	verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	//	Output some information
+	const uint64_t stride = style.stride;
+	uint64_t totalBlocks = fileSize / stride;
+	OutputText(L"Verification of %s will use %lld blocks of", verifyName, totalBlocks);
+	OutputSize(L"", stride);
+	if (style.blockSize != bytesPerSector)
+	{
+		OutputSize(L"Each marker is", style.blockSize);
+	}
+
+	//	Create the buffers that we use to verify markers
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	markerBuffers;
+	if (!CreateMarkerBuffers(bufferPool, markerBuffers, style.blockSize, bytesPerSector, 1, largePages, verifyName))
+	{
+		return false;
+	}
+
+	const MarkerBuffers& verifyBuffers = markerBuffers [0];
+
+	//	Nothing is read back in the write pass of a two pass run, or in a
+	//	-noreads run, so a failure there always ends it
+	ErrorBudget budget(0, 0);
+
+	//	A two pass run writes every marker first and then reads them all
+	//	back, otherwise each marker is read straight after it is written.
+	//	A resumed run starts in the pass, and at the block, it got to
+	const int numPasses = (twoPass && !noReads) ? 2 : 1;
+	for (int pass = (int) resumeFrom.phase; pass < numPasses; pass ++)
+	{
+		const bool writePass	= numPasses == 1 || pass == 0;
+		const bool readPass		= !noReads && (numPasses == 1 || pass == 1);
+
+		if (numPasses > 1)
+		{
+			OutputText(L"%s markers\n", writePass ? L"Writing" : L"Reading");
+		}
+
+		if (readPass)
+		{
+			budget = ErrorBudget(budgetFailures, budgetWindow);
+		}
+
+		//	Start the timer
+		BatchTimer timer;
+
+		//	Write and then read the verification markers at certain points in the file
+		const uint64_t	startBlock	= pass == (int) resumeFrom.phase ? resumeFrom.next : 0;
+		uint64_t		count		= startBlock;
+		if (telemetry != nullptr)
+		{
+			telemetry->StartPass(pass + 1, startBlock * stride);
+		}
+		while (count != budgetStop && count * stride < (uint64_t) fileSize)
+		{
+			const LONGLONG i = (LONGLONG) (count * stride);
+
+			//	The last marker can't go past the end of the file
+			const DWORD markerSize = (DWORD) min((uint64_t) style.blockSize, (uint64_t) (fileSize - i));
+
+			//	Output some stats if it is time
+			if (count != startBlock && count % batchSize == 0)
+			{
+				const double elapsedSeconds	= timer.TotalSeconds();
+				const double blockSeconds	= timer.Lap();
+
+				//	Let the user know how long these blocks took
+				OutputText(L"\rProcess verification block %lld/%lld took %.2lf seconds (%.2lf total seconds)   ", count, totalBlocks, blockSeconds, elapsedSeconds);
+
+				//	Every block before this one is done
+				JournalBatch(journal, pass, count, batchSize, blockSeconds);
+			}
+
+			const bool blockGood = CheckMarkerBlock(*verifyFile, cachedFile.get(), verifyBuffers, i, markerSize, count, writePass, readPass, style, results);
+			if (!blockGood && !budget.Enabled())
+			{
+				ReportWrap(*verifyFile, bytesPerSector, largePages, stride, style, results);
+				return false;
+			}
+
+			//	Next block, which is further on when probing sparsely
+			const uint64_t nextBlock = budget.Next(count, !blockGood);
+			if (telemetry != nullptr)
+			{
+				const uint64_t covered = nextBlock == budgetStop ? stride : (nextBlock - count) * stride;
+				telemetry->AddProgress(min(covered, (uint64_t) (fileSize - i)), markerSize * ((writePass ? 1 : 0) + (readPass ? 1 : 0)));
+			}
+			count = nextBlock;
+		}
+
+		//	This pass is done, a resume starts at the next one
+		if (!budget.Confirmed())
+		{
+			JournalBatch(journal, pass + 1, 0, count % batchSize, timer.BatchSeconds());
+		}
+
+		if (numPasses > 1)
+		{
+			OutputText(L"\n");
+		}
+	}
+
+	//	Blocks stepped over by the budget fail the run, but they don't
+	//	bring the capacity down unless they were the end of the kept data
+	if (budget.Failures() != 0)
+	{
+		OutputText(L"\n%llu blocks failed", budget.Failures());
+		if (budget.Skipped() != 0)
+		{
+			OutputText(L", %llu were skipped by sparse probing", budget.Skipped());
+		}
+		OutputText(L"\n");
+
+		//	A device that wraps keeps nothing past where it wraps, which
+		//	is closer than the end of the kept data the budget found
+		if (ReportWrap(*verifyFile, bytesPerSector, largePages, stride, style, results))
+		{
+			return false;
+		}
+
+		results.capacity	= budget.Confirmed() ? (int64_t) (budget.Boundary() * stride) : fileSize;
+		results.resolution	= stride;
+		if (budget.Confirmed())
+		{
+			OutputSize(L"Data is kept up to", results.capacity);
+		}
+		return false;
+	}
+
+	//	Tell the user the good news. Nothing was read back in a -noreads
+	//	run, so it can't say what the capacity is
+	OutputText(L"\n%hs ", pathName);
+	OutputSize(L"is", fileSize);
+	if (!noReads)
+	{
+		results.capacity	= fileSize;
+		results.resolution	= stride;
+	}
+
+	//	All done
+	return true;
+}
+
+
+//	Verify the created file through a sliding view of it mapped into
+//	memory, so the markers are written and checked in the file system
+//	cache directly, with no read or write call for each one. This checks
+//	what the cache path sees, as the -cached option does, for far less
+//	work per marker. The journal only moves on once the markers written
+//	through a view have been flushed to the device, so a resumed run never
+//	trusts markers that were still in the cache
+bool VerifyTheFileMapped (const char* pathName, const DWORD bytesPerSector, const bool noReads, const bool twoPass, const MarkerStyle& style, RunTelemetry* telemetry, RunResults& results, HANDLE journal, const JournalRecord& resumeFrom)
+{
+	wchar_t verifyName [MAX_PATH];
+	swprintf_s(verifyName, L"%hs%hs", pathName, verifyFilename);
+
+	//	Open and map the file
+	MappedFile mappedFile;
+	if (!mappedFile.Open(verifyName, defaultMapWindow))
+	{
+		PrintError(L"Could not map %s for verification", verifyName);
+		results.IoFailed(-1, "open error");
+		return false;
+	}
+
+	const int64_t fileSize = mappedFile.Size();
+
+	//	Output some information
+	const uint64_t stride = style.stride;
+	uint64_t totalBlocks = fileSize / stride;
+	OutputText(L"Verification of %s will use %lld blocks of", verifyName, totalBlocks);
+	OutputSize(L"", stride);
+	if (style.blockSize != bytesPerSector)
+	{
+		OutputSize(L"Each marker is", style.blockSize);
+	}
+	OutputSize(L"The file is mapped a window at a time, each window is", defaultMapWindow);
+
+	//	A two pass run writes every marker first and then reads them all
+	//	back, otherwise each marker is read straight after it is written.
+	//	A resumed run starts in the pass, and at the block, it got to
+	const int numPasses = (twoPass && !noReads) ? 2 : 1;
+	for (int pass = (int) resumeFrom.phase; pass < numPasses; pass ++)
+	{
+		const bool writePass	= numPasses == 1 || pass == 0;
+		const bool readPass		= !noReads && (numPasses == 1 || pass == 1);
+
+		if (numPasses > 1)
+		{
+			OutputText(L"%s markers\n", writePass ? L"Writing" : L"Reading");
+		}
+
+		//	Start the timers. The journal is written each time the view
+		//	moves rather than every batch
+		BatchTimer timer;
+		BatchTimer journalTimer;
+
+		//	Write and then read the verification markers at certain points in the file
+		const uint64_t	startBlock	= pass == (int) resumeFrom.phase ? resumeFrom.next : 0;
+		uint64_t		count		= startBlock;
+		uint64_t		journaled	= startBlock;
+		if (telemetry != nullptr)
+		{
+			telemetry->StartPass(pass + 1, startBlock * stride);
+		}
+		while (count * stride < (uint64_t) fileSize)
+		{
+			const LONGLONG i = (LONGLONG) (count * stride);
+
+			//	The last marker can't go past the end of the file
+			const DWORD markerSize = (DWORD) min((uint64_t) style.blockSize, (uint64_t) (fileSize - i));
+
+			//	Output some stats if it is time
+			if (count != startBlock && count % batchSize == 0)
+			{
+				const double elapsedSeconds	= timer.TotalSeconds();
+				const double blockSeconds	= timer.Lap();
+
+				//	Let the user know how long these blocks took
+				OutputText(L"\rProcess verification block %lld/%lld took %.2lf seconds (%.2lf total seconds)   ", count, totalBlocks, blockSeconds, elapsedSeconds);
+			}
+
+			//	Moving the view flushes the markers written through the old
+			//	one to the device
+			const bool	moving	= !mappedFile.InView(i, markerSize);
+			uint8_t*	marker	= mappedFile.View(i, markerSize);
+			if (marker == nullptr)
+			{
+				PrintError(L"\nCould not map %s @ offset 0x%llX", verifyName, i);
+				results.IoFailed(i, "map error");
+				OutputSize(L"Reached", i);
+				return false;
+			}
+
+			//	Every block before this one is on the device
+			if (moving && count != journaled)
+			{
+				JournalBatch(journal, pass, count, count - journaled, journalTimer.Lap());
+				journaled = count;
+			}
+
+			if (writePass)
+			{
+				//	Set verification data - this will be the current count + 1
+				if (!TouchView([&] { SetMarker(marker, markerSize, count + 1, i, style); }))
+				{
+					OutputText(L"\nThe device failed writing to %s @ offset 0x%llX", verifyName, i);
+					results.IoFailed(i, "in-page error");
+					OutputSize(L"Reached", i);
+					return false;
+				}
+				results.bytesWritten += markerSize;
+			}
+
+			if (readPass)
+			{
+				//	Check the marker where it is, in the cache
+				DWORD badByte = markerSize;
+				if (!TouchView([&] { badByte = CheckMarker(marker, markerSize, count + 1, i, style); }))
+				{
+					OutputText(L"\nThe device failed reading from %s @ offset 0x%llX", verifyName, i);
+					results.IoFailed(i, "in-page error");
+					OutputSize(L"Reached", i);
+					return false;
+				}
+				results.bytesRead += markerSize;
+
+				if (badByte != markerSize)
+				{
+					//	Give the user an idea of where the verification failed
+					TouchView([&] { results.AliasSeen(ReportMarkerMismatch(marker, markerSize, count + 1, i, badByte, style)); });
+					results.DataFailed(i, "marker mismatch");
+					OutputSize(L"", i);
+
+					//	A device that wraps is probed through a handle of
+					//	its own, once the file is no longer mapped
+					if (results.AliasDistance() != 0)
+					{
+						mappedFile.Close();
+						std::unique_ptr<BlockEngine> probeFile = OpenVerifyTarget(pathName, false, false, false, 0, results);
+						if (probeFile)
+						{
+							ReportWrap(*probeFile, bytesPerSector, false, stride, style, results);
+						}
+					}
+
+					//	Bail out
+					return false;
+				}
+			}
+
+			if (telemetry != nullptr)
+			{
+				telemetry->AddProgress(min(stride, (uint64_t) (fileSize - i)), markerSize * ((writePass ? 1 : 0) + (readPass ? 1 : 0)));
+			}
+			count ++;
+		}
+
+		//	The last view has to reach the device before the pass is done
+		if (!mappedFile.Flush())
+		{
+			PrintError(L"\nCould not flush %s", verifyName);
+			results.IoFailed((int64_t) (count * stride), "flush error");
+			return false;
+		}
+
+		//	This pass is done, a resume starts at the next one
+		JournalBatch(journal, pass + 1, 0, count - journaled, journalTimer.BatchSeconds());
+
+		if (numPasses > 1)
+		{
+			OutputText(L"\n");
+		}
+	}
+
+	//	Tell the user the good news. Nothing was read back in a -noreads
+	//	run, so it can't say what the capacity is
+	OutputText(L"\n%hs ", pathName);
+	OutputSize(L"is", fileSize);
+	if (!noReads)
+	{
+		results.capacity	= fileSize;
+		results.resolution	= stride;
+	}
+
+	//	All done
+	return true;
+}
+
+
+//	Start an overlapped write or read for a slot. The slot's tag is the
+//	block number, and the last marker can't go past the end of the file
+bool StartSlotIo (BlockEngine& verifyFile, BlockRequest& slot, const MarkerBuffers& buffers, const bool reading, const MarkerStyle& style)
+{
+	slot.size		= (DWORD) min((uint64_t) style.blockSize, (uint64_t) (verifyFile.Size() - slot.offset));
+	slot.reading	= reading;
+
+	if (reading)
+	{
+		//	Make sure an old marker in the buffer can't pass
+		slot.buffer = buffers.read;
+		PoisonMarker(slot.buffer, slot.size, style);
+	}
+	else
+	{
+		//	Set verification data - the current count + 1
+		slot.buffer = buffers.write;
+		SetMarker(slot.buffer, slot.size, slot.tag + 1, slot.offset, style);
+	}
+
+	return verifyFile.Start(slot);
+}
+
+
+//	Requests complete out of order, so the blocks that are known to be
+//	done are the ones before the lowest block still in flight
+uint64_t FinishedBlocks (const std::vector<BlockRequest>& ioSlots, const uint64_t nextBlock)
+{
+	uint64_t finished = nextBlock;
+	for (const BlockRequest& slot : ioSlots)
+	{
+		if (slot.active)
+		{
+			finished = min(finished, slot.tag);
+		}
+	}
+
+	return finished;
+}
+
+
+//	Let the user know if latency spikes made the engine keep fewer
+//	requests in flight, or split them, at some point in the run
+void ReportBackoffs (const BlockEngine& verifyFile)
+{
+	const IoController* controller = verifyFile.Controller();
+	if (controller == nullptr || controller->Backoffs() == 0)
+	{
+		return;
+	}
+
+	OutputText(L"\nLatency spikes cut back the I/O %lld times, to as few as %d requests in flight", controller->Backoffs(), controller->LowestDepth());
+	if (controller->MostSplit() > 1)
+	{
+		OutputText(L" split into up to %d transfers each", controller->MostSplit());
+	}
+	OutputText(L"\n");
+}
+
+
+//	Verify the created file using overlapped I/O, keeping queueDepth
+//	marker writes and reads in flight at different offsets
+bool VerifyTheFileOverlapped (const char* pathName, const bool raw, const DWORD bytesPerSector, const bool noReads, const bool cached, const bool largePages, const bool twoPass, const DWORD queueDepth, const MarkerStyle& style, RunTelemetry* telemetry, RunResults& results, HANDLE journal, const JournalRecord& resumeFrom)
+{
+	//	Open the file, or the whole drive for a raw run. All completions
+	//	are delivered to one port
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, cached, false, queueDepth, results);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	//	Every write and read is timed if the user asked for telemetry.
+	//	Blocks finish out of order, but each one still moves the run on
+	verifyFile->SetTelemetry(telemetry);
+
+	//	The verification filename, or the drive name for a raw run
+	const wchar_t*	verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	//	Sector aligned write and read buffers for each outstanding request
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	slotBuffers;
+	if (!CreateMarkerBuffers(bufferPool, slotBuffers, style.blockSize, bytesPerSector, queueDepth, largePages, verifyName))
+	{
+		return false;
+	}
+
+	std::vector<BlockRequest> ioSlots(queueDepth);
+	for (DWORD s = 0; s < queueDepth; s++)
+	{
+		ioSlots [s].active = false;
+	}
+
+	//	Output some information
+	const uint64_t stride		= style.stride;
+	const uint64_t totalBlocks	= (fileSize + stride - 1) / stride;
+	OutputText(L"Verification of %s will use %lld blocks of", verifyName, totalBlocks);
+	OutputSize(L"", stride);
+	if (style.blockSize != bytesPerSector)
+	{
+		OutputSize(L"Each marker is", style.blockSize);
+	}
+	OutputText(L"Keeping %d requests in flight\n", queueDepth);
+
+	//	The lowest offset that failed. Requests complete out of order,
+	//	so we stop issuing new blocks on a failure and drain the ones
+	//	in flight before reporting
+	int64_t		firstFailure	= fileSize;
+	bool		portFailed		= false;
+
+	//	A two pass run writes every marker first and then reads them all
+	//	back, otherwise each marker is read straight after it is written
+	const int numPasses = (twoPass && !noReads) ? 2 : 1;
+	for (int pass = (int) resumeFrom.phase; pass < numPasses && firstFailure == fileSize && !portFailed; pass ++)
+	{
+		const bool readFirst		= numPasses > 1 && pass == 1;
+		const bool readAfterWrite	= numPasses == 1 && !noReads;
+
+		if (numPasses > 1)
+		{
+			OutputText(L"%s markers\n", readFirst ? L"Reading" : L"Writing");
+		}
+
+		//	Start the timer
+		BatchTimer timer;
+
+		//	A resumed run starts at the block it got to
+		uint64_t	nextBlock	= pass == (int) resumeFrom.phase ? resumeFrom.next : 0;
+		uint64_t	completed	= nextBlock;
+		DWORD		inFlight	= 0;
+		if (telemetry != nullptr)
+		{
+			telemetry->StartPass(pass + 1, nextBlock * stride);
+		}
+
+		//	Get the first set of requests going
+		for (DWORD s = 0; s < queueDepth && nextBlock < totalBlocks; s++)
+		{
+			BlockRequest& slot	= ioSlots [s];
+			slot.tag			= nextBlock ++;
+			slot.offset			= slot.tag * stride;
+			if (!StartSlotIo(*verifyFile, slot, slotBuffers [s], readFirst, style))
+			{
+				PrintError(L"\nCould not start I/O on %s @ offset %lld", verifyName, slot.offset);
+				results.IoFailed(slot.offset, "start error");
+				firstFailure = min(firstFailure, slot.offset);
+				break;
+			}
+			inFlight ++;
+		}
+
+		while (inFlight > 0)
+		{
+			BlockCompletion completion = verifyFile->Wait();
+			if (completion.request == nullptr)
+			{
+				//	The port itself failed, nothing more will complete
+				PrintError(L"\nCompletion port failed for %s", verifyName);
+				results.IoFailed(completed * stride, "completion port error");
+				portFailed = true;
+				break;
+			}
+
+			BlockRequest&			slot	= *completion.request;
+			const MarkerBuffers&	buffers	= slotBuffers [&slot - ioSlots.data()];
+			inFlight --;
+
+			if (!completion.succeeded)
+			{
+				PrintError(L"\nUnable to %s %s @ offset %lld", slot.reading ? L"read from" : L"write to", verifyName, slot.offset);
+				results.IoFailed(slot.offset, slot.reading ? "read error" : "write error");
+				firstFailure = min(firstFailure, slot.offset);
+				continue;
+			}
+
+			if (completion.transferred != slot.size)
+			{
+				//	Give a clear indication where the error was
+				OutputText(L"\n%s transferred %d bytes, expected %d bytes @ offset %lld\n", verifyName, completion.transferred, slot.size, slot.offset);
+				results.IoFailed(slot.offset, slot.reading ? "short read" : "short write");
+				firstFailure = min(firstFailure, slot.offset);
+				continue;
+			}
+
+			if (!slot.reading && readAfterWrite)
+			{
+				//	Write is done, read the marker back into the slot's read buffer
+				if (!StartSlotIo(*verifyFile, slot, buffers, true, style))
+				{
+					PrintError(L"\nUnable to read from %s @ offset %lld", verifyName, slot.offset);
+					results.IoFailed(slot.offset, "start error");
+					firstFailure = min(firstFailure, slot.offset);
+					continue;
+				}
+				inFlight ++;
+				continue;
+			}
+
+			if (slot.reading)
+			{
+				//	Read unique data from the buffer
+				DWORD badByte = CheckMarker(slot.buffer, slot.size, slot.tag + 1, slot.offset, style);
+				if (badByte != slot.size)
+				{
+					//	Give the user an idea of where the verification failed
+					results.AliasSeen(ReportMarkerMismatch(slot.buffer, slot.size, slot.tag + 1, slot.offset, badByte, style));
+					results.DataFailed(slot.offset, "marker mismatch");
+					firstFailure = min(firstFailure, slot.offset);
+				}
+			}
+
+			//	This block is finished
+			completed ++;
+			if (telemetry != nullptr)
+			{
+				telemetry->AddProgress(min(stride, (uint64_t) (fileSize - slot.offset)), slot.size * (readAfterWrite ? 2 : 1));
+			}
+
+			//	Output some stats if it is time
+			if (completed % batchSize == 0)
+			{
+				const double elapsedSeconds	= timer.TotalSeconds();
+				const double blockSeconds	= timer.Lap();
+
+				//	Let the user know how long these blocks took
+				OutputText(L"\rProcess verification block %lld/%lld took %.2lf seconds (%.2lf total seconds)   ", completed, totalBlocks, blockSeconds, elapsedSeconds);
+
+				//	Only record progress past blocks that are all done
+				if (firstFailure == fileSize)
+				{
+					JournalBatch(journal, pass, FinishedBlocks(ioSlots, nextBlock), batchSize, blockSeconds);
+				}
+			}
+
+			//	Reuse the slot for the next block, unless something failed
+			if (firstFailure == fileSize && nextBlock < totalBlocks)
+			{
+				slot.tag	= nextBlock ++;
+				slot.offset	= slot.tag * stride;
+				if (!StartSlotIo(*verifyFile, slot, buffers, readFirst, style))
+				{
+					PrintError(L"\nCould not start I/O on %s @ offset %lld", verifyName, slot.offset);
+					results.IoFailed(slot.offset, "start error");
+					firstFailure = min(firstFailure, slot.offset);
+					continue;
+				}
+				inFlight ++;
+			}
+		}
+
+		//	This pass is done, a resume starts at the next one
+		if (firstFailure == fileSize && !portFailed)
+		{
+			JournalBatch(journal, pass + 1, 0, completed % batchSize, timer.BatchSeconds());
+		}
+
+		if (numPasses > 1)
+		{
+			OutputText(L"\n");
+		}
+	}
+
+	ReportBackoffs(*verifyFile);
+
+	//	Requests may still be outstanding if the port failed, and they
+	//	use the slots and their buffers, so they are cancelled and waited
+	//	for before those are freed
+	if (portFailed)
+	{
+		verifyFile->Cancel();
+		return false;
+	}
+
+	if (firstFailure < fileSize)
+	{
+		if (!ReportWrap(*verifyFile, bytesPerSector, largePages, stride, style, results))
+		{
+			OutputSize(L"Reached", firstFailure);
+		}
+		return false;
+	}
+
+	//	Tell the user the good news. Nothing was read back in a -noreads
+	//	run, so it can't say what the capacity is
+	OutputText(L"\n%hs ", pathName);
+	OutputSize(L"is", fileSize);
+	if (!noReads)
+	{
+		results.capacity	= fileSize;
+		results.resolution	= stride;
+	}
+	return true;
+}
+
+
+//	What a scan found wrong with one block that failed its check
+enum class ScanFault
+{
+	unreadable,
+	lost,
+	damaged
+};
+
+
+//	Work out why a block read back without errors failed its check. A
+//	marker that still has this run's header for its own offset is there
+//	but has changed, anything else is gone, or was overwritten by the
+//	marker for another offset
+ScanFault ClassifyMismatch (const uint8_t* buffer, const DWORD size, const int64_t offset, const DWORD badByte, const MarkerStyle& style)
+{
+	if (style.runId == 0)
+	{
+		//	Without headers, a block whose first value is right is there
+		return badByte != 0 ? ScanFault::damaged : ScanFault::lost;
+	}
+
+	MarkerHeader header;
+	if (FindRunHeader(buffer, size, style, header) && header.offset == offset)
+	{
+		return ScanFault::damaged;
+	}
+
+	return ScanFault::lost;
+}
+
+
+//	Read back every marker an earlier run left, without writing anything,
+//	keeping queueDepth reads in flight. Unlike a verification run, the
+//	scan doesn't stop at the first bad block, it counts the blocks that
+//	could not be read, the ones whose marker has gone and the ones whose
+//	marker is there but has changed, so a device that passed can be
+//	checked later for data it has lost since
+bool ScanTheFile (const char* pathName, const bool raw, const DWORD bytesPerSector, const DWORD queueDepth, const bool largePages, const MarkerStyle& style, RunTelemetry* telemetry, RunResults& results)
+{
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, false, false, queueDepth, results);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	verifyFile->SetTelemetry(telemetry);
+
+	const wchar_t*	verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	slotBuffers;
+	if (!CreateMarkerBuffers(bufferPool, slotBuffers, style.blockSize, bytesPerSector, queueDepth, largePages, verifyName))
+	{
+		return false;
+	}
+
+	std::vector<BlockRequest> ioSlots(queueDepth);
+	for (DWORD s = 0; s < queueDepth; s++)
+	{
+		ioSlots [s].active = false;
+	}
+
+	//	Output some information
+	const uint64_t stride		= style.stride;
+	const uint64_t totalBlocks	= (fileSize + stride - 1) / stride;
+	OutputText(L"Scanning %s for the %lld markers of the earlier run, every", verifyName, totalBlocks);
+	OutputSize(L"", stride);
+	OutputText(L"Keeping %d reads in flight, nothing is written\n", queueDepth);
+
+	BatchTimer	timer;
+	uint64_t	nextBlock	= 0;
+	uint64_t	completed	= 0;
+	DWORD		inFlight	= 0;
+	bool		portFailed	= false;
+	uint64_t	faults [3]	= {};
+	uint64_t	reported	= 0;
+	if (telemetry != nullptr)
+	{
+		telemetry->StartPass(1, 0);
+	}
+
+	//	Count a block that failed, and tell the user about the first few
+	auto blockFailed = [&] (const BlockRequest& slot, const ScanFault fault, const char* reason)
+	{
+		faults [(int) fault] ++;
+		if (fault == ScanFault::unreadable)
+		{
+			results.IoFailed(slot.offset, reason);
+		}
+		else
+		{
+			results.DataFailed(slot.offset, reason);
+		}
+
+		if (reported ++ < maxScanReports)
+		{
+			OutputText(L"\nBlock %lld @ offset 0x%llX %hs", slot.tag, slot.offset, fault == ScanFault::unreadable ? "could not be read" : fault == ScanFault::lost ? "has lost its marker" : "has a damaged marker");
+			if (fault == ScanFault::lost)
+			{
+				ReportOverwrite(slot.buffer, slot.size, slot.offset, style);
+			}
+		}
+	};
+
+	//	Get the first set of reads going, and keep every slot busy until
+	//	the markers run out
+	for (DWORD s = 0; s < queueDepth && nextBlock < totalBlocks; s++)
+	{
+		BlockRequest& slot	= ioSlots [s];
+		slot.tag			= nextBlock ++;
+		slot.offset			= slot.tag * stride;
+		if (StartSlotIo(*verifyFile, slot, slotBuffers [s], true, style))
+		{
+			inFlight ++;
+		}
+		else
+		{
+			blockFailed(slot, ScanFault::unreadable, "start error");
+			completed ++;
+		}
+	}
+
+	while (inFlight > 0)
+	{
+		BlockCompletion completion = verifyFile->Wait();
+		if (completion.request == nullptr)
+		{
+			//	The port itself failed, nothing more will complete
+			PrintError(L"\nCompletion port failed for %s", verifyName);
+			results.IoFailed(completed * stride, "completion port error");
+			portFailed = true;
+			break;
+		}
+
+		BlockRequest&			slot	= *completion.request;
+		const MarkerBuffers&	buffers	= slotBuffers [&slot - ioSlots.data()];
+		inFlight --;
+
+		if (!completion.succeeded || completion.transferred != slot.size)
+		{
+			blockFailed(slot, ScanFault::unreadable, completion.succeeded ? "short read" : "read error");
+		}
+		else
+		{
+			const DWORD badByte = CheckMarker(slot.buffer, slot.size, slot.tag + 1, slot.offset, style);
+			if (badByte != slot.size)
+			{
+				const ScanFault fault = ClassifyMismatch(slot.buffer, slot.size, slot.offset, badByte, style);
+				blockFailed(slot, fault, fault == ScanFault::lost ? "marker lost" : "marker damaged");
+			}
+		}
+
+		completed ++;
+		if (telemetry != nullptr)
+		{
+			telemetry->AddProgress(min(stride, (uint64_t) (fileSize - slot.offset)), slot.size);
+		}
+
+		//	Output some stats if it is time
+		if (completed % batchSize == 0)
+		{
+			const double elapsedSeconds	= timer.TotalSeconds();
+			const double blockSeconds	= timer.Lap();
+			OutputText(L"\rScanned block %lld/%lld took %.2lf seconds (%.2lf total seconds)   ", completed, totalBlocks, blockSeconds, elapsedSeconds);
+		}
+
+		//	Reuse the slot for the next block
+		while (nextBlock < totalBlocks)
+		{
+			slot.tag	= nextBlock ++;
+			slot.offset	= slot.tag * stride;
+			if (StartSlotIo(*verifyFile, slot, buffers, true, style))
+			{
+				inFlight ++;
+				break;
+			}
+			blockFailed(slot, ScanFault::unreadable, "start error");
+			completed ++;
+		}
+	}
+
+	ReportBackoffs(*verifyFile);
+
+	//	Reads may still be outstanding if the port failed, and they fill
+	//	the slot buffers, so they are cancelled and waited for before the
+	//	slots and buffers are freed
+	if (portFailed)
+	{
+		verifyFile->Cancel();
+		return false;
+	}
+
+	//	Tell the user what the scan found
+	const uint64_t failed = faults [0] + faults [1] + faults [2];
+	OutputText(L"\nScanned %lld blocks in %.2lf seconds, %lld good", completed, timer.TotalSeconds(), completed - failed);
+	OutputText(L", %lld lost, %lld damaged, %lld unreadable\n", faults [(int) ScanFault::lost], faults [(int) ScanFault::damaged], faults [(int) ScanFault::unreadable]);
+	if (failed != 0)
+	{
+		return false;
+	}
+
+	OutputText(L"%hs still holds everything the earlier run wrote\n", pathName);
+	results.capacity	= fileSize;
+	results.resolution	= stride;
+	return true;
+}
+
+
+//	Write a marker to one sector of the file and optionally read it back
+bool ProbeOffset (BlockEngine& verifyFile, const MarkerBuffers& probeBuffers, const DWORD bytesPerSector, const ProbeMarker& probe, const bool writeMarker, const MarkerStyle& style)
+{
+	if (writeMarker && !WriteProbe(verifyFile, probeBuffers, bytesPerSector, probe, style))
+	{
+		return false;
+	}
+
+	//	Make sure an old marker in the buffer can't pass
+	PoisonMarker(probeBuffers.read, bytesPerSector, style);
+
+	DWORD bytesRead;
+	if (!verifyFile.Read(probe.offset, probeBuffers.read, bytesPerSector, bytesRead)
+	||	bytesRead != bytesPerSector)
+	{
+		return false;
+	}
+
+	return CheckMarker(probeBuffers.read, bytesPerSector, probe.value, probe.offset, style) == bytesPerSector;
+}
+
+
+//	Make sure the marker for the highest good offset was not overwritten
+//	by a later write. Fake controllers often wrap high offsets back onto
+//	low ones, so a good write and read at one offset can destroy the
+//	data at another offset
+bool RecheckMarker (BlockEngine& verifyFile, const MarkerBuffers& probeBuffers, const DWORD bytesPerSector, const ProbeMarker& marker, const MarkerStyle& style, RunResults& results)
+{
+	if (ProbeOffset(verifyFile, probeBuffers, bytesPerSector, marker, false, style))
+	{
+		return true;
+	}
+
+	OutputText(L"\nMarker @ offset %lld was overwritten\n", marker.offset);
+	results.AliasSeen(ReportOverwrite(probeBuffers.read, bytesPerSector, marker.offset, style));
+
+	//	Put the marker back so later checks are meaningful
+	ProbeOffset(verifyFile, probeBuffers, bytesPerSector, marker, true, style);
+	return false;
+}
+
+
+//	Find the capacity of the file using a binary search rather than
+//	walking every block. Markers are written at a ladder of offsets that
+//	doubles from 64 MiB to find the first bad offset. A device that wraps
+//	keeps the marker for each of those, so a bounded wrap check follows,
+//	with rungs placed so a wrap at a multiple of its granule puts the
+//	marker for a higher rung on a lower one. We then bisect between the
+//	last good and first bad offset down to a single sector
+bool BisectTheFile (const char* pathName, const bool raw, const DWORD bytesPerSector, const bool cached, const bool largePages, const MarkerStyle& style, RunResults& results)
+{
+	//	Open the file, or the whole drive for a raw run
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, cached, false, 0, results);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	//	The verification filename, or the drive name for a raw run
+	const wchar_t*	verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	//	Create the buffers that we use to write and read markers
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	markerBuffers;
+	if (!CreateMarkerBuffers(bufferPool, markerBuffers, bytesPerSector, bytesPerSector, 1, largePages, verifyName))
+	{
+		return false;
+	}
+
+	const MarkerBuffers& probeBuffers = markerBuffers [0];
+
+	//	The last sector we can probe
+	const int64_t lastOffset = ((fileSize / bytesPerSector) - 1) * bytesPerSector;
+	if (lastOffset < 0)
+	{
+		OutputText(L"%s is too small to bisect\n", verifyName);
+		results.DataFailed(-1, "too small");
+		return false;
+	}
+
+	OutputText(L"Bisecting %s", verifyName);
+	OutputSize(L", file size is", fileSize);
+
+	//	Start the timer
+	BatchTimer timer;
+
+	//	Markers we have written and read back. Each holds the run ID, so
+	//	markers from a previous run can't pass for them
+	std::vector<ProbeMarker> goodMarkers;
+
+	int64_t		lastGood	= -1;
+	int64_t		firstBad	= fileSize;
+	uint64_t	probeCount	= 0;
+
+	//	Walk the offset ladder - 0, then doubling from 64 MiB, with the
+	//	last sector of the file as the final rung
+	int64_t ladderOffset = 0;
+	for (;;)
+	{
+		const ProbeMarker probe = { ladderOffset, ++probeCount };
+		if (!ProbeOffset(*verifyFile, probeBuffers, bytesPerSector, probe, true, style))
+		{
+			OutputText(L"\nLadder probe @ offset %lld failed\n", probe.offset);
+			firstBad = probe.offset;
+			break;
+		}
+
+		goodMarkers.push_back(probe);
+		OutputText(L"\rLadder probe @ offset %lld is good   ", probe.offset);
+
+		if (ladderOffset == lastOffset)
+		{
+			break;
+		}
+
+		ladderOffset = min(ladderOffset == 0 ? minBoundary : ladderOffset * 2, lastOffset);
+	}
+
+	//	Check for a wrap below the first bad offset. Rungs the ladder
+	//	already has are left as they are
+	int64_t wrapGranule = ladderGranule;
+	if (firstBad > 0)
+	{
+		const std::vector<int64_t> wrapOffsets = WrapLadder(min(lastOffset, firstBad - (int64_t) bytesPerSector), ladderGranule, maxWrapRungs, wrapGranule);
+		OutputText(L"\nChecking for a wrap with %zu probes", wrapOffsets.size());
+		OutputSize(L", at every multiple of", wrapGranule);
+
+		const size_t ladderRungs = goodMarkers.size();
+		for (const int64_t wrapOffset : wrapOffsets)
+		{
+			const auto ladderEnd = goodMarkers.begin() + ladderRungs;
+			if (std::any_of(goodMarkers.begin(), ladderEnd, [&] (const ProbeMarker& marker) { return marker.offset == wrapOffset; }))
+			{
+				continue;
+			}
+
+			const ProbeMarker probe = { wrapOffset, ++probeCount };
+			if (!WriteProbe(*verifyFile, probeBuffers, bytesPerSector, probe, style))
+			{
+				OutputText(L"\nWrap probe @ offset %lld failed\n", probe.offset);
+				firstBad = min(firstBad, probe.offset);
+				break;
+			}
+			goodMarkers.push_back(probe);
+		}
+	}
+
+	//	Read every marker back. One holding the marker for another offset
+	//	shows the device wraps, and the distance between them is a
+	//	multiple of where. Anything else, e.g. a marker from an earlier
+	//	run, means the offset lost its data
+	for (const ProbeMarker& marker : goodMarkers)
+	{
+		if (ProbeOffset(*verifyFile, probeBuffers, bytesPerSector, marker, false, style))
+		{
+			continue;
+		}
+
+		MarkerHeader header;
+		if (FindRunHeader(probeBuffers.read, bytesPerSector, style, header) && header.offset != marker.offset)
+		{
+			OutputText(L"\nOffset %lld was overwritten by the marker for offset %lld\n", marker.offset, header.offset);
+			results.AliasSeen(header.offset > marker.offset ? header.offset - marker.offset : marker.offset - header.offset);
+		}
+		else
+		{
+			OutputText(L"\nProbe @ offset %lld lost its marker\n", marker.offset);
+			firstBad = min(firstBad, marker.offset);
+		}
+	}
+
+	//	Nothing past where the device wraps is kept
+	if (results.AliasDistance() != 0)
+	{
+		const int64_t wrapModulus = FindWrap(*verifyFile, bytesPerSector, largePages, results.AliasDistance(), style);
+		OutputSize(L"The device wraps every", wrapModulus);
+		firstBad = min(firstBad, wrapModulus);
+	}
+
+	//	The highest marker below the first bad offset brackets the search.
+	//	It is written again, as a marker for a higher offset may have
+	//	landed on it, and it is the only one checked while bisecting
+	std::sort(goodMarkers.begin(), goodMarkers.end(), [] (const ProbeMarker& a, const ProbeMarker& b) { return a.offset > b.offset; });
+	ProbeMarker bracket = { -1, 0 };
+	for (const ProbeMarker& marker : goodMarkers)
+	{
+		if (marker.offset >= firstBad)
+		{
+			continue;
+		}
+
+		bracket = { marker.offset, ++probeCount };
+		if (WriteProbe(*verifyFile, probeBuffers, bytesPerSector, bracket, style))
+		{
+			lastGood = bracket.offset;
+			break;
+		}
+
+		OutputText(L"\nProbe @ offset %lld could not be written again\n", marker.offset);
+		firstBad = marker.offset;
+	}
+
+	//	Bisect between the last good and first bad offsets until they
+	//	are one sector apart
+	if (lastGood >= 0 && firstBad < fileSize)
+	{
+		while (firstBad - lastGood > (int64_t) bytesPerSector)
+		{
+			//	Middle offset, aligned to the sector size
+			int64_t midOffset = lastGood + ((firstBad - lastGood) / 2);
+			midOffset -= midOffset % bytesPerSector;
+			if (midOffset <= lastGood)
+			{
+				midOffset = lastGood + bytesPerSector;
+			}
+
+			const ProbeMarker probe = { midOffset, ++probeCount };
+			if (ProbeOffset(*verifyFile, probeBuffers, bytesPerSector, probe, true, style)
+			&&	RecheckMarker(*verifyFile, probeBuffers, bytesPerSector, bracket, style, results))
+			{
+				bracket		= probe;
+				lastGood	= probe.offset;
+			}
+			else
+			{
+				firstBad = probe.offset;
+			}
+
+			OutputText(L"\rBisecting between offset %lld and %lld   ", lastGood, firstBad);
+		}
+	}
+
+	//	How long did this take, counting every read and write
+	OutputText(L"\n%lld probes, %lld reads and writes, took %.2lf seconds\n", probeCount, verifyFile->Transfers(), timer.TotalSeconds());
+
+	//	The search narrows the capacity down to a single sector
+	results.resolution = bytesPerSector;
+	if (firstBad == fileSize)
+	{
+		//	Tell the user the good news, and what the wrap check could see
+		OutputSize(L"No wrap was found at any multiple of", wrapGranule);
+		OutputText(L"%hs ", pathName);
+		OutputSize(L"is", fileSize);
+		results.capacity = fileSize;
+		return true;
+	}
+
+	//	Give the user an idea of where the verification failed
+	OutputText(L"First bad offset is %lld", firstBad);
+	OutputSize(L"", firstBad);
+	results.DataFailed(firstBad, "probe failed");
+	results.capacity = firstBad;
+	return false;
+}
+
+
+//	Pick the offsets for a sampled run. There is one random sector in each
+//	of sampleCount equal slices of the file, plus the sectors either side
+//	of every power of two boundary, as that is where fake controllers
+//	usually wrap. The offsets are returned in ascending order
+std::vector<int64_t> SampleOffsets (const int64_t lastOffset, const DWORD bytesPerSector, const DWORD sampleCount, const uint64_t randomSeed)
+{
+	std::vector<int64_t> sampleOffsets;
+
+	//	The ends of the file
+	sampleOffsets.push_back(0);
+	sampleOffsets.push_back(lastOffset);
+
+	//	Power of two boundaries
+	for (int64_t boundary = minBoundary; boundary <= lastOffset; boundary *= 2)
+	{
+		sampleOffsets.push_back(boundary - bytesPerSector);
+		sampleOffsets.push_back(boundary);
+	}
+
+	//	Stratified random samples
+	const int64_t	totalSectors	= (lastOffset / bytesPerSector) + 1;
+	std::mt19937_64	randomSource(randomSeed);
+	for (DWORD s = 0; s < sampleCount; s++)
+	{
+		int64_t firstSector	= (int64_t) ((double) totalSectors * s / sampleCount);
+		int64_t endSector	= (int64_t) ((double) totalSectors * (s + 1) / sampleCount);
+		if (endSector <= firstSector)
+		{
+			continue;
+		}
+
+		std::uniform_int_distribution<int64_t> pickSector(firstSector, endSector - 1);
+		sampleOffsets.push_back(pickSector(randomSource) * bytesPerSector);
+	}
+
+	std::sort(sampleOffsets.begin(), sampleOffsets.end());
+	sampleOffsets.erase(std::unique(sampleOffsets.begin(), sampleOffsets.end()), sampleOffsets.end());
+	return sampleOffsets;
+}
+
+
+//	Estimate the capacity of the file from a sample of offsets. Every
+//	sample is written first and then they are all read back, so a late
+//	write that wraps onto an earlier sample is caught
+bool SampleTheFile (const char* pathName, const bool raw, const DWORD bytesPerSector, const bool cached, const bool largePages, const DWORD sampleCount, const MarkerStyle& style, RunResults& results)
+{
+	//	Open the file, or the whole drive for a raw run
+	std::unique_ptr<BlockEngine> verifyFile = OpenVerifyTarget(pathName, raw, cached, false, 0, results);
+	if (!verifyFile)
+	{
+		return false;
+	}
+
+	//	The verification filename, or the drive name for a raw run
+	const wchar_t*	verifyName	= verifyFile->Name();
+	const int64_t	fileSize	= verifyFile->Size();
+
+	//	Create the buffers that we use to write and read markers
+	BufferPool					bufferPool;
+	std::vector<MarkerBuffers>	markerBuffers;
+	if (!CreateMarkerBuffers(bufferPool, markerBuffers, bytesPerSector, bytesPerSector, 1, largePages, verifyName))
+	{
+		return false;
+	}
+
+	const MarkerBuffers& probeBuffers = markerBuffers [0];
+
+	//	The last sector we can sample
+	const int64_t lastOffset = ((fileSize / bytesPerSector) - 1) * bytesPerSector;
+	if (lastOffset < 0)
+	{
+		OutputText(L"%s is too small to sample\n", verifyName);
+		results.DataFailed(-1, "too small");
+		return false;
+	}
+
+	//	Markers from a previous run could still be on the device, so
+	//	make the values unique to this run
+	const uint64_t runTag = (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count() << 32;
+
+	std::vector<ProbeMarker> samples;
+	for (int64_t offset : SampleOffsets(lastOffset, bytesPerSector, sampleCount, runTag ^ style.patternSeed))
+	{
+		samples.push_back({ offset, runTag | (samples.size() + 1) });
+	}
+
+	OutputText(L"Sampling %s at %lld offsets", verifyName, (int64_t) samples.size());
+	OutputSize(L", file size is", fileSize);
+
+	//	Start the timer
+	BatchTimer timer;
+
+	//	Write every sample. A failed write is only recorded here, as the
+	//	read back will fail for it too
+	std::vector<bool> goodSamples(samples.size(), false);
+	size_t count = 0;
+	for (size_t s = 0; s < samples.size(); s++)
+	{
+		goodSamples [s] = WriteProbe(*verifyFile, probeBuffers, bytesPerSector, samples [s], style);
+		if (!goodSamples [s])
+		{
+			OutputText(L"\nCould not write the sample @ offset %lld\n", samples [s].offset);
+		}
+
+		if (++ count % batchSize == 0)
+		{
+			OutputText(L"\rWritten %lld/%lld samples   ", (int64_t) count, (int64_t) samples.size());
+		}
+	}
+	OutputText(L"\rWritten %lld/%lld samples\n", (int64_t) count, (int64_t) samples.size());
+
+	//	Read them all back
+	uint64_t	badSamples		= 0;
+	uint64_t	aliasedSamples	= 0;
+	for (size_t s = 0; s < samples.size(); s++)
+	{
+		if (goodSamples [s])
+		{
+			goodSamples [s] = ProbeOffset(*verifyFile, probeBuffers, bytesPerSector, samples [s], false, style);
+
+			//	If a later sample was written on top of this one, the
+			//	distance between them is a multiple of where the device
+			//	wraps
+			MarkerHeader header;
+			if (!goodSamples [s]
+			&&	FindRunHeader(probeBuffers.read, bytesPerSector, style, header)
+			&&	header.offset > samples [s].offset)
+			{
+				results.AliasSeen(header.offset - samples [s].offset);
+				aliasedSamples ++;
+			}
+		}
+
+		if (!goodSamples [s])
+		{
+			badSamples ++;
+		}
+
+		if ((s + 1) % batchSize == 0)
+		{
+			OutputText(L"\rRead %lld/%lld samples, %lld bad   ", (int64_t) s + 1, (int64_t) samples.size(), badSamples);
+		}
+	}
+	OutputText(L"\rRead %lld/%lld samples, %lld bad\n", (int64_t) samples.size(), (int64_t) samples.size(), badSamples);
+
+	//	How long did this take
+	OutputText(L"%lld samples took %.2lf seconds\n", (int64_t) samples.size(), timer.TotalSeconds());
+
+	//	The capacity is somewhere between the last good sample before the
+	//	first bad one, and that bad one. The samples are in offset order
+	size_t firstBad = samples.size();
+	for (size_t s = 0; s < samples.size(); s++)
+	{
+		if (!goodSamples [s])
+		{
+			firstBad = s;
+			break;
+		}
+	}
+
+	if (firstBad == samples.size())
+	{
+		//	The largest gap between samples is how much could be bad
+		//	without us seeing it
+		int64_t resolution = samples.size() > 1 ? 0 : fileSize;
+		for (size_t s = 1; s < samples.size(); s++)
+		{
+			resolution = max(resolution, samples [s].offset - samples [s - 1].offset);
+		}
+
+		//	Tell the user the good news
+		OutputText(L"%hs ", pathName);
+		OutputSize(L"is", fileSize);
+		OutputSize(L"Largest gap between samples is", resolution);
+		results.capacity	= fileSize;
+		results.resolution	= resolution;
+		return true;
+	}
+
+	OutputText(L"First bad sample is @ offset %lld", samples [firstBad].offset);
+	OutputSize(L"", samples [firstBad].offset);
+	results.DataFailed(samples [firstBad].offset, "sample failed");
+
+	//	Where the device wraps is found to the sector, and the samples
+	//	below the first bad one don't bound it
+	if (aliasedSamples != 0)
+	{
+		OutputText(L"%lld samples were overwritten by the markers for higher offsets", aliasedSamples);
+		if (ReportWrap(*verifyFile, bytesPerSector, largePages, bytesPerSector, style, results))
+		{
+			return false;
+		}
+	}
+
+	const int64_t lastGood = firstBad == 0 ? 0 : samples [firstBad - 1].offset + bytesPerSector;
+	OutputSize(L"Capacity is at least", lastGood);
+	OutputSize(L"Estimate resolution is", samples [firstBad].offset + bytesPerSector - lastGood);
+	results.capacity	= lastGood;
+	results.resolution	= samples [firstBad].offset + bytesPerSector - lastGood;
+	return false;
+}
+
+
+//	Pick the marker size from a short benchmark at the start of the file,
+//	or the whole drive for a raw run. Returns zero if it could not be run
+DWORD TuneMarkerSize (const char* pathName, const bool raw, const DWORD bytesPerSector, const DeviceGeometry& geometry, const bool largePages)
+{
+	RunResults tuneResults;
+	std::unique_ptr<BlockEngine> tuneTarget = OpenVerifyTarget(pathName, raw, false, false, 0, tuneResults);
+	if (!tuneTarget)
+	{
+		return 0;
+	}
+
+	//	The benchmark's writes aren't counted in the run's results
+	tuneTarget->SetResults(nullptr);
+
+	const uint64_t tunedSize = AutoTuneBlockSize(*tuneTarget, min(tuneSpan, (uint64_t) tuneTarget->Size()), bytesPerSector, geometry, largePages);
+	if (tunedSize == 0)
+	{
+		OutputText(L"Could not tune the block size, using the default\n");
+	}
+
+	return (DWORD) tunedSize;
+}
+
+
+//	Everything on the drive is lost in a raw run, so the user has to say yes
+bool ConfirmRawRun (const char* pathName, const int64_t driveSize)
+{
+	OutputText(L"\nEverything on %hs will be overwritten", pathName);
+	OutputSize(L", the drive size is", driveSize);
+	OutputText(L"Type YES to carry on: ");
+
+	char answer [16];
+	if (fgets(answer, sizeof(answer), stdin) == nullptr)
+	{
+		return false;
+	}
+
+	return strcmp(answer, "YES\n") == 0 || strcmp(answer, "YES") == 0;
+}
+
+
+//	Delete the file we created
+bool DeleteVerifyFile (const char* pathName)
+{
+	//	Create the search path
+	wchar_t deleteFile[MAX_PATH];
+	swprintf_s(deleteFile, L"%hs%hs", pathName, verifyFilename);
+
+	//	Output some information
+	OutputText(L"Removing file %s\n", deleteFile);
+
+	if (!DeleteFile(deleteFile))
+	{
+		PrintError(L"Unable to delete file %s", deleteFile);
+		return false;
+	}
+
+	return true;
+}
+
+
+//	What the user asked for, shared by every device under test
+struct RunOptions
+{
+	uint8_t		actions						= progActions::justPath;
+	DWORD		queueDepth					= 0;
+	DWORD		sampleCount					= 0;
+	bool		rawDrive					= false;
+	bool		fakeDevice					= false;
+	bool		largePages					= false;
+	bool		differential				= false;
+	bool		mapped						= false;
+	bool		scanOnly					= false;
+	bool		keepFile					= false;
+	uint64_t	blockSize					= 0;
+	uint64_t	stride						= 0;
+	bool		autoTune					= false;
+	bool		fullSurface					= false;
+	uint32_t	budgetFailures				= 0;
+	uint64_t	budgetWindow				= 0;
+	DWORD		diskNumber					= 0;
+	wchar_t		journalPath [MAX_PATH]		= {};
+	wchar_t		telemetryPath [MAX_PATH]	= {};
+	wchar_t		resultsPath [MAX_PATH]		= {};
+
+	//	Set when more than one device is tested at once
+	bool		severalDevices				= false;
+};
+
+
+//	Test one device. Returns the exit code for the device
+int TestDevice (const char* pathName, const RunOptions& options, RunTelemetry& runTelemetry, RunResults& results)
+{
+	const uint8_t	ourActions		= options.actions;
+	const DWORD		queueDepth		= options.queueDepth;
+	const DWORD		sampleCount		= options.sampleCount;
+	const bool		fakeDevice		= options.fakeDevice;
+
+	//	A fake device is written like a raw drive, as there is no file
+	//	system on it, but there is nothing to confirm or lock
+	const bool		rawDrive		= options.rawDrive || fakeDevice;
+	const bool		largePages		= options.largePages;
+	const bool		differential	= options.differential;
+	const bool		scanOnly		= options.scanOnly;
+	const DWORD		diskNumber		= options.diskNumber;
+
+	//	With several devices each one gets its own journal, telemetry and
+	//	results files
+	wchar_t			journalPath [MAX_PATH]		= {};
+	wchar_t			telemetryPath [MAX_PATH]	= {};
+	wchar_t			resultsPath [MAX_PATH]		= {};
+	if (!options.severalDevices)
+	{
+		wcscpy_s(journalPath, options.journalPath);
+		wcscpy_s(telemetryPath, options.telemetryPath);
+		wcscpy_s(resultsPath, options.resultsPath);
+	}
+	else
+	{
+		if (options.telemetryPath [0] != 0)
+		{
+			DeviceFileName(telemetryPath, options.telemetryPath, pathName);
+		}
+
+		if (options.resultsPath [0] != 0)
+		{
+			DeviceFileName(resultsPath, options.resultsPath, pathName);
+		}
+	}
+
+	//	We need to get stats for this device
+	DWORD	bytesPerSector;
+	DWORD	sectorsPerCluster	= 1;
+	int64_t	freeSpace;
+	int64_t	totalSpace;
+	if (fakeDevice)
+	{
+		FakeDeviceSpec fakeSpec;
+		ParseFakeDevice(pathName, fakeSpec);
+		bytesPerSector	= fakeSpec.sectorSize;
+		totalSpace		= (int64_t) fakeSpec.size;
+		freeSpace		= totalSpace;
+	}
+	else
+	if (rawDrive)
+	{
+		//	A raw run uses the whole of the advertised capacity
+		if (!GetRawDriveInfo(pathName, bytesPerSector, totalSpace))
+		{
+			return 1;
+		}
+		freeSpace = totalSpace;
+	}
+	else
+	{
+		DWORD freeClusters;
+		DWORD totalClusters;
+		if (GetDiskFreeSpaceA(pathName, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters) == 0)
+		{
+			PrintError(L"Could not get disk stats for %hs", pathName);
+			return 1;
+		}
+
+		//	Using DWORD, the free space could overflow
+		freeSpace	=	bytesPerSector;
+		freeSpace	*=	sectorsPerCluster;
+		freeSpace	*=	freeClusters;
+
+		//	Same for total space
+		totalSpace	=	bytesPerSector;
+		totalSpace	*=	sectorsPerCluster;
+		totalSpace	*=	totalClusters;
+	}
+
+	//	Sanity check - we use file offsets later which are signed
+	if (freeSpace	<= 0
+	||	totalSpace	<= 0)
+	{
+		OutputText(L"Incorrect total %lld or free space %lld\n", totalSpace, freeSpace);
+		return 1;
+	}
+
+	//	See what we need to do
+	if ((ourActions & progActions::outputStats) != 0)
+	{
+		//	Output some stats
+		OutputText(L"Bytes/sector     : %d\n", bytesPerSector);
+		OutputText(L"Sectors/cluster  : %d\n", sectorsPerCluster);
+
+		//	Get the human readable version of the total size
+		OutputSize(L"Total space      : %lld %s\n", totalSpace);
+
+		//	Get the human readable version of the free space
+		OutputSize(L"Free space       : %lld %s\n", freeSpace);
+	}
+
+	//	The sector and transfer sizes the device reports decide which
+	//	marker sizes suit it
+	DeviceGeometry geometry = {};
+	if (!fakeDevice && QueryDeviceGeometry(pathName, geometry) && (ourActions & progActions::outputStats) != 0)
+	{
+		OutputGeometry(geometry);
+	}
+
+	//	Markers are written unbuffered, so they have to be whole sectors
+	//	at sector offsets
+	if (options.blockSize != 0 && !BlockSizeFits(options.blockSize, bytesPerSector, geometry))
+	{
+		OutputText(L"The -block size must be a multiple of the %lu byte sector\n", max(bytesPerSector, geometry.physicalSector));
+		return 1;
+	}
+
+	if (options.stride != 0 && options.stride % bytesPerSector != 0)
+	{
+		OutputText(L"The -stride must be a multiple of the %lu byte sector\n", bytesPerSector);
+		return 1;
+	}
+
+	//	A raw run destroys the file system on the drive, so make sure the
+	//	user means it and get the volumes on it out of the way. A scan only
+	//	reads what an earlier raw run left
+	std::vector<HANDLE> lockedVolumes;
+	if (options.rawDrive && !scanOnly)
+	{
+		if (!ConfirmRawRun(pathName, totalSpace))
+		{
+			OutputText(L"Nothing was written to %hs\n", pathName);
+			return 1;
+		}
+
+		if (!LockDriveVolumes(diskNumber, lockedVolumes))
+		{
+			for (HANDLE volume : lockedVolumes)
+			{
+				CloseHandle(volume);
+			}
+			return 1;
+		}
+	}
+
+	//	The journal lives on the host, as the device under test is the
+	//	thing that can't be trusted to keep it
+	if (journalPath [0] == 0)
+	{
+		DefaultJournalName(journalPath, "maxspace", pathName);
+	}
+
+	if (!fakeDevice && JournalOnDevice(journalPath, pathName))
+	{
+		OutputText(L"The journal %s must not be on the device under test, use -journal\n", journalPath);
+		return 1;
+	}
+
+	//	What the run finds is collected for -json, starting with the
+	//	geometry of the device. File creation counts towards the time
+	BatchTimer	runTimer;
+	results.bytesPerSector		= bytesPerSector;
+	results.sectorsPerCluster	= sectorsPerCluster;
+	results.totalSpace			= totalSpace;
+	results.freeSpace			= freeSpace;
+
+	//	How the markers are written
+	MarkerStyle markerStyle;
+	markerStyle.fullPattern	= (ourActions & progActions::pattern) != 0;
+	markerStyle.patternSeed	= NewPatternSeed();
+	markerStyle.runId		= NewRunId();
+	markerStyle.blockSize	= options.blockSize != 0 ? (DWORD) options.blockSize : options.fullSurface ? (DWORD) fullBlockSize : bytesPerSector;
+	markerStyle.stride		= options.fullSurface ? markerStyle.blockSize : options.stride != 0 ? options.stride : verifySize;
+	if (markerStyle.blockSize > markerStyle.stride)
+	{
+		OutputText(L"The -block size can't be more than the -stride\n");
+		return 1;
+	}
+
+	//	Work out where the run starts
+	const bool		twoPass		= (ourActions & progActions::twoPass) != 0 && (ourActions & progActions::noreads) == 0;
+	const bool		resume		= (ourActions & progActions::resume) != 0;
+	JournalRecord	runRecord	= {};
+	if (scanOnly)
+	{
+		//	The journal of the run that wrote the markers says where they
+		//	are and what they hold
+		if (!ReadJournal(journalPath, runRecord))
+		{
+			PrintError(L"Could not read the journal %s of the run to scan", journalPath);
+			return 1;
+		}
+
+		if (_stricmp(runRecord.target, pathName) != 0)
+		{
+			OutputText(L"The journal %s is for %hs, not %hs\n", journalPath, runRecord.target, pathName);
+			return 1;
+		}
+
+		if (!runRecord.finished)
+		{
+			OutputText(L"The run in %s did not finish, there is nothing to scan\n", journalPath);
+			return 1;
+		}
+
+		markerStyle.fullPattern	= runRecord.fullPattern;
+		markerStyle.patternSeed	= runRecord.patternSeed;
+		markerStyle.runId		= runRecord.runId;
+		markerStyle.blockSize	= runRecord.blockSize != 0 ? (DWORD) runRecord.blockSize : bytesPerSector;
+		markerStyle.stride		= runRecord.stride != 0 ? runRecord.stride : verifySize;
+	}
+	else
+	if (resume)
+	{
+		if (!ReadJournal(journalPath, runRecord))
+		{
+			PrintError(L"Could not read the journal %s to resume from", journalPath);
+			return 1;
+		}
+
+		if (_stricmp(runRecord.target, pathName) != 0)
+		{
+			OutputText(L"The journal %s is for %hs, not %hs\n", journalPath, runRecord.target, pathName);
+			return 1;
+		}
+
+		if (runRecord.finished)
+		{
+			OutputText(L"The run in %s has already finished\n", journalPath);
+			return 1;
+		}
+
+		if (runRecord.phases != (twoPass ? 2UL : 1UL))
+		{
+			OutputText(L"The -twopass and -noreads options must match the run being resumed\n");
+			return 1;
+		}
+
+		//	The markers already on the device use the earlier run's pattern
+		markerStyle.fullPattern	= runRecord.fullPattern;
+		markerStyle.patternSeed	= runRecord.patternSeed;
+		markerStyle.runId		= runRecord.runId;
+
+		//	The block numbers in the journal only mean something with the
+		//	earlier run's layout. A journal without one used the defaults
+		markerStyle.blockSize	= runRecord.blockSize != 0 ? (DWORD) runRecord.blockSize : bytesPerSector;
+		markerStyle.stride		= runRecord.stride != 0 ? runRecord.stride : verifySize;
+
+		OutputText(L"Resuming at block %lld", runRecord.next);
+		if (twoPass)
+		{
+			OutputText(L" of the %s pass", runRecord.phase == 0 ? L"write" : L"read");
+		}
+		OutputText(L"\n");
+	}
+	else
+	{
+		//	Create the file and add markers. A raw run writes to the
+		//	drive directly
+		if (!rawDrive && !CreateVerifyFile(pathName, bytesPerSector, freeSpace))
+		{
+			OutputText(L"File creation failed\n");
+			return 1;
+		}
+
+		//	The benchmark writes over the start of the file or drive,
+		//	which the markers are about to be written to anyway
+		if (options.autoTune)
+		{
+			const DWORD tunedSize = TuneMarkerSize(pathName, rawDrive, bytesPerSector, geometry, largePages);
+			if (tunedSize != 0)
+			{
+				markerStyle.blockSize	= tunedSize;
+				markerStyle.stride		= options.fullSurface ? tunedSize : max(markerStyle.stride, (uint64_t) tunedSize);
+			}
+		}
+
+		strcpy_s(runRecord.target, pathName);
+		runRecord.fullPattern	= markerStyle.fullPattern;
+		runRecord.patternSeed	= markerStyle.patternSeed;
+		runRecord.runId			= markerStyle.runId;
+		runRecord.phases		= twoPass ? 2 : 1;
+		runRecord.blockSize		= markerStyle.blockSize;
+		runRecord.stride		= markerStyle.stride;
+	}
+
+	//	A binary search or sampled run does not keep a journal, and a scan
+	//	leaves the journal of the run it scans as it is
+	HANDLE journal = INVALID_HANDLE_VALUE;
+	if ((ourActions & progActions::bisect) == 0 && sampleCount == 0 && !scanOnly)
+	{
+		journal = OpenJournal(journalPath, runRecord, resume);
+		if (journal == INVALID_HANDLE_VALUE)
+		{
+			PrintError(L"Could not open the journal %s", journalPath);
+			return 1;
+		}
+	}
+
+	//	Latency and throughput are only measured if they will be written
+	//	out, or if the status table for several devices needs them
+	RunTelemetry*	telemetry	= telemetryPath [0] != 0 || options.severalDevices ? &runTelemetry : nullptr;
+
+	//	Verify the markers in the file
+	int returnStatus = 0;
+	if (scanOnly)
+	{
+		if (!ScanTheFile(pathName, rawDrive, bytesPerSector, queueDepth != 0 ? queueDepth : scanQueueDepth, largePages, markerStyle, telemetry, results))
+		{
+			OutputText(L"The scan found blocks that have lost their data\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if ((ourActions & progActions::bisect) != 0)
+	{
+		if (!BisectTheFile(pathName, rawDrive, bytesPerSector, (ourActions & progActions::cached) != 0, largePages, markerStyle, results))
+		{
+			OutputText(L"File verification failed\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if (sampleCount != 0)
+	{
+		if (!SampleTheFile(pathName, rawDrive, bytesPerSector, (ourActions & progActions::cached) != 0, largePages, sampleCount, markerStyle, results))
+		{
+			OutputText(L"File verification failed\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if (queueDepth != 0)
+	{
+		if (!VerifyTheFileOverlapped(pathName, rawDrive, bytesPerSector, (ourActions & progActions::noreads) != 0, (ourActions & progActions::cached) != 0, largePages, (ourActions & progActions::twoPass) != 0, queueDepth, markerStyle, telemetry, results, journal, runRecord))
+		{
+			OutputText(L"File verification failed\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if (options.mapped)
+	{
+		if (!VerifyTheFileMapped(pathName, bytesPerSector, (ourActions & progActions::noreads) != 0, (ourActions & progActions::twoPass) != 0, markerStyle, telemetry, results, journal, runRecord))
+		{
+			OutputText(L"File verification failed\n");
+			returnStatus = 1;
+		}
+	}
+	else
+	if (!VerifyTheFile(pathName, rawDrive, bytesPerSector, (ourActions & progActions::noreads) != 0, (ourActions & progActions::cached) != 0, largePages, (ourActions & progActions::twoPass) != 0, differential, options.budgetFailures, options.budgetWindow, markerStyle, telemetry, results, journal, runRecord))
+	{
+		OutputText(L"File verification failed\n");
+		returnStatus = 1;
+	}
+
+	//	A run that walks the whole file stops at the first bad block, unless
+	//	its error budget has already placed the capacity. A scan carries on
+	//	past bad blocks and counts them, so they say nothing about it
+	if (returnStatus != 0 && !scanOnly && (ourActions & progActions::bisect) == 0 && sampleCount == 0)
+	{
+		results.CapacityFromFailure(markerStyle.stride);
+	}
+
+	//	A run that got to the end, or found data that was wrong, has
+	//	nothing left to resume. One that stopped on an I/O error, e.g. a
+	//	device that dropped off the bus or a request the watchdog timed
+	//	out, is left open so -resume can carry on from its last batch
+	const bool resumable = journal != INVALID_HANDLE_VALUE && returnStatus != 0 && results.IoFailedFirst();
+	CloseJournal(journal, !resumable);
+	if (resumable)
+	{
+		OutputText(L"The run stopped on an I/O error, use -resume to carry on from %s\n", journalPath);
+	}
+
+	//	A failed run's telemetry shows where the device slowed down or
+	//	stopped, so it is written whatever the result
+	const bool passed = returnStatus == 0;
+	if (telemetryPath [0] != 0)
+	{
+		OutputText(L"\n");
+		telemetry->OutputSummary();
+		if (!telemetry->WriteFiles(telemetryPath, "maxspace", pathName))
+		{
+			returnStatus = 1;
+		}
+	}
+
+	if (resultsPath [0] != 0 && !results.Write(resultsPath, "maxspace", pathName, passed, runTimer.TotalSeconds()))
+	{
+		returnStatus = 1;
+	}
+
+	if (options.rawDrive)
+	{
+		//	Let the volumes go. The drive no longer has a file system
+		for (HANDLE volume : lockedVolumes)
+		{
+			CloseHandle(volume);
+		}
+		OutputText(L"%hs needs to be partitioned and formatted before it can be used again\n", pathName);
+	}
+	else
+	if (resumable)
+	{
+		//	A resumed run carries on with the file that is there
+		if (!fakeDevice)
+		{
+			OutputText(L"Keeping the verification file for -resume\n");
+		}
+	}
+	else
+	if (scanOnly || options.keepFile)
+	{
+		//	The markers stay on the device for a later scan
+		if (!fakeDevice)
+		{
+			OutputText(L"Keeping the verification file, it can be checked again with -scanonly\n");
+		}
+	}
+	else
+	//	Delete the file. A fake device only has what it holds in memory
+	if (!fakeDevice && !DeleteVerifyFile(pathName))
+	{
+		OutputText(L"File deletion failed\n");
+		returnStatus = 1;
+	}
+
+	//	All done!
+	return returnStatus;
+
+}
+
+
+//	Output a usage message
+void Usage (const char* progName)
+{
+	OutputText(L"\nUsage: %hs [-stats] [-noreads] [-cached] [-bisect] [-sample <count>] [-twopass] [-pattern] [-full] [-differential] [-mapped] [-scanonly] [-keep] [-block <KiB>] [-stride <KiB>] [-autotune] [-budget <failures>[/<blocks>]] [-qd <depth>] [-largepages] [-resume] [-journal <file>] [-telemetry <name>] [-json <file>] [-hubrate <MiB/s>] [-iotimeout <seconds>] <path> [<path> ...] | -raw \\\\.\\PhysicalDrive<n> | -fake <spec>\n", progName);
+	OutputText(L"\nExample:\n");
+	OutputText(L"\n%hs -stats E:\\\n\n", progName);
+}
+
+
+//	Main function
+int main (int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		//	We need at least 2 options - output a usage message
+		Usage(argv[0]);
+		return 1;
+	}
+
+	//	See what the user asked for
+	std::vector<const char*>	pathNames;
+	std::string					fakeName;
+	RunOptions					options;
+	DWORD						hubRate = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv [i], "-stats") == 0)
+		{
+			//	User wants stats
+			options.actions |= progActions::outputStats;
+		}
+		else
+		if (strcmp(argv [i], "-cached") == 0)
+		{
+			//	User wants to use file system cache
+			options.actions |= progActions::cached;
+		}
+		else
+		if (strcmp(argv[i], "-noreads") == 0)
+		{
+			//	User only wants to write to the device
+			options.actions |= progActions::noreads;
+		}
+		else
+		if (strcmp(argv[i], "-bisect") == 0)
+		{
+			//	User wants a binary search for the capacity
+			options.actions |= progActions::bisect;
+		}
+		else
+		if (strcmp(argv[i], "-sample") == 0)
+		{
+			//	User wants a capacity estimate from a number of samples
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &options.sampleCount) != 1
+			||	options.sampleCount < 1
+			||	options.sampleCount > maxSamples)
+			{
+				OutputText(L"The -sample option needs a count from 1 to %d\n", maxSamples);
+				return 1;
+			}
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-twopass") == 0)
+		{
+			//	User wants every marker written before any are read
+			options.actions |= progActions::twoPass;
+		}
+		else
+		if (strcmp(argv[i], "-pattern") == 0)
+		{
+			//	User wants every byte of the markers checked
+			options.actions |= progActions::pattern;
+		}
+		else
+		if (strcmp(argv[i], "-largepages") == 0)
+		{
+			//	User wants the I/O buffers to stay resident in memory
+			options.largePages = true;
+		}
+		else
+		if (strcmp(argv[i], "-differential") == 0)
+		{
+			//	User wants every marker read back with and without the
+			//	file system cache
+			options.differential = true;
+		}
+		else
+		if (strcmp(argv[i], "-scanonly") == 0)
+		{
+			//	User wants the markers of an earlier run read back, with
+			//	nothing written
+			options.scanOnly = true;
+		}
+		else
+		if (strcmp(argv[i], "-keep") == 0)
+		{
+			//	User wants the verification file left for a later scan
+			options.keepFile = true;
+		}
+		else
+		if (strcmp(argv[i], "-mapped") == 0)
+		{
+			//	User wants the markers written and checked through a
+			//	mapped view of the file, in the file system cache
+			options.mapped = true;
+			options.actions |= progActions::cached;
+		}
+		else
+		if (strcmp(argv[i], "-full") == 0)
+		{
+			//	User wants every byte of the file written and checked
+			options.fullSurface = true;
+		}
+		else
+		if (strcmp(argv[i], "-block") == 0)
+		{
+			//	User wants each marker to be a number of KiB
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%llu", &options.blockSize) != 1
+			||	options.blockSize < 1
+			||	options.blockSize > maxBlockSize / KiB)
+			{
+				OutputText(L"The -block option needs a size from 1 to %lld KiB\n", maxBlockSize / KiB);
+				return 1;
+			}
+			options.blockSize *= KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-stride") == 0)
+		{
+			//	User wants the markers a number of KiB apart
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%llu", &options.stride) != 1
+			||	options.stride < 1
+			||	options.stride > maxStride / KiB)
+			{
+				OutputText(L"The -stride option needs a size from 1 to %lld KiB\n", maxStride / KiB);
+				return 1;
+			}
+			options.stride *= KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-autotune") == 0)
+		{
+			//	User wants the marker size picked by a short benchmark
+			options.autoTune = true;
+		}
+		else
+		if (strcmp(argv[i], "-budget") == 0)
+		{
+			//	User wants to carry on past isolated bad blocks, and only
+			//	stop once a number of them fail within a window of blocks
+			unsigned int		budgetFailures	= 0;
+			unsigned long long	budgetWindow	= defaultBudgetWindow;
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%u/%llu", &budgetFailures, &budgetWindow) < 1
+			||	budgetFailures < 1
+			||	budgetWindow < budgetFailures)
+			{
+				OutputText(L"The -budget option needs a number of failures and optionally a window of blocks at least that large, e.g. 8/64\n");
+				return 1;
+			}
+			options.budgetFailures	= budgetFailures;
+			options.budgetWindow	= budgetWindow;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-resume") == 0)
+		{
+			//	User wants to carry on from where an earlier run stopped
+			options.actions |= progActions::resume;
+		}
+		else
+		if (strcmp(argv[i], "-journal") == 0)
+		{
+			//	User wants the journal somewhere other than the default
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -journal option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(options.journalPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-telemetry") == 0)
+		{
+			//	User wants latency and throughput written to <name>.csv
+			//	and <name>.json
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -telemetry option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(options.telemetryPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-json") == 0)
+		{
+			//	User wants the results in a file a program can read
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -json option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(options.resultsPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-raw") == 0)
+		{
+			//	User wants the markers written straight to a physical drive
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "\\\\.\\PhysicalDrive%lu", &options.diskNumber) != 1)
+			{
+				OutputText(L"The -raw option needs a drive such as \\\\.\\PhysicalDrive1\n");
+				return 1;
+			}
+			pathNames.push_back(argv [i + 1]);
+			options.rawDrive	= true;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-fake") == 0)
+		{
+			//	User wants the run against a fake device modelled in memory
+			FakeDeviceSpec fakeSpec;
+			if (i + 1 >= argc || !fakeName.empty()
+			||	!ParseFakeDevice((fakeName = std::string(fakeDevicePrefix) + argv [i + 1]).c_str(), fakeSpec)
+			||	fakeName.size() >= MAX_PATH)
+			{
+				OutputText(L"The -fake option needs a device such as size=128T,capacity=16G with any of sector, capacity, wrap, cache, slc, fast, slow, dropout and seed\n");
+				return 1;
+			}
+			pathNames.push_back(fakeName.c_str());
+			options.fakeDevice	= true;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-qd") == 0)
+		{
+			//	User wants overlapped I/O with a number of requests in flight
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &options.queueDepth) != 1
+			||	options.queueDepth < 1
+			||	options.queueDepth > maxQueueDepth)
+			{
+				OutputText(L"The -qd option needs a queue depth from 1 to %d\n", maxQueueDepth);
+				return 1;
+			}
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-hubrate") == 0)
+		{
+			//	User wants the devices on each USB root hub held to a total
+			//	number of MiB a second
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &hubRate) != 1
+			||	hubRate < 1)
+			{
+				OutputText(L"The -hubrate option needs a number of MiB a second\n");
+				return 1;
+			}
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-iotimeout") == 0)
+		{
+			//	User wants a request cancelled after a different number of
+			//	seconds in flight, or never with zero
+			DWORD ioTimeout = 0;
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &ioTimeout) != 1)
+			{
+				OutputText(L"The -iotimeout option needs a number of seconds, or 0 for none\n");
+				return 1;
+			}
+			SetIoTimeout(ioTimeout);
+			i ++;
+		}
+		else
+		{
+			//	Check pathname
+			const char* pathName = argv [i];
+
+			//	Convert to wide version
+			wchar_t widePath[16];
+			swprintf_s(widePath, L"%hs", pathName);
+
+			//	Get the type of drive
+			auto driveType = GetDriveType(widePath);
+
+			switch (driveType)
+			{
+				default:
+					OutputText(L"%hs is an invalid option or drive path\n", pathName);
+					return 1;
+
+				case DRIVE_REMOVABLE:
+				case DRIVE_FIXED:
+				case DRIVE_REMOTE:
+				case DRIVE_RAMDISK:
+					//	All valid
+					pathNames.push_back(pathName);
+					break;
+			}
+		}
+	}
+
+	if (pathNames.empty())
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	//	A raw run asks before it overwrites a drive, a fake device has no
+	//	drive letter to tell it apart from others, and a journal is for one
+	//	device
+	if (pathNames.size() > 1
+	&&	(options.rawDrive || options.fakeDevice || options.journalPath [0] != 0))
+	{
+		OutputText(L"The -raw, -fake and -journal options cannot be used with more than one device\n");
+		return 1;
+	}
+
+	//	There is no file system on a fake device to share with a cached
+	//	handle
+	if (options.fakeDevice && options.differential)
+	{
+		OutputText(L"The -fake and -differential options cannot be combined\n");
+		return 1;
+	}
+
+	//	A scan reads the markers an earlier run left with that run's
+	//	layout, and writes nothing
+	if (options.scanOnly
+	&&	((options.actions & (progActions::bisect | progActions::noreads | progActions::resume | progActions::pattern | progActions::twoPass | progActions::cached)) != 0
+	||	options.sampleCount != 0 || options.differential || options.mapped || options.budgetFailures != 0 || options.fullSurface
+	||	options.blockSize != 0 || options.stride != 0 || options.autoTune || options.fakeDevice || options.keepFile))
+	{
+		OutputText(L"The -scanonly option can only be combined with -stats, -qd, -largepages, -journal, -telemetry, -json, -hubrate and -raw\n");
+		return 1;
+	}
+
+	//	A mapped run walks a verification file through the cache one marker
+	//	at a time, and the mapping always has the file's own cache
+	if (options.mapped
+	&&	((options.actions & progActions::bisect) != 0 || options.sampleCount != 0 || options.queueDepth != 0
+	||	options.differential || options.budgetFailures != 0 || options.fullSurface || options.autoTune
+	||	options.rawDrive || options.fakeDevice))
+	{
+		OutputText(L"The -mapped option cannot be combined with -bisect, -sample, -qd, -differential, -budget, -full, -autotune, -raw or -fake\n");
+		return 1;
+	}
+
+	//	A full surface run is a two pass pattern run whose markers are
+	//	large, back to back and kept in flight, so the whole file is
+	//	streamed out and back at the device's sequential speed
+	if (options.fullSurface)
+	{
+		if ((options.actions & progActions::bisect) != 0 || options.sampleCount != 0 || options.differential || options.stride != 0)
+		{
+			OutputText(L"The -full option cannot be combined with -bisect, -sample, -differential or -stride\n");
+			return 1;
+		}
+
+		options.actions		|= progActions::twoPass | progActions::pattern;
+		options.queueDepth	= options.queueDepth != 0 ? options.queueDepth : fullQueueDepth;
+	}
+
+	//	A binary search needs to read back every marker
+	if ((options.actions & progActions::bisect) != 0
+	&&	(options.actions & progActions::noreads) != 0)
+	{
+		OutputText(L"The -bisect and -noreads options cannot be combined\n");
+		return 1;
+	}
+
+	//	A binary search is quick enough to start again
+	if ((options.actions & progActions::bisect) != 0
+	&&	(options.actions & progActions::resume) != 0)
+	{
+		OutputText(L"The -bisect and -resume options cannot be combined\n");
+		return 1;
+	}
+
+	//	Sampling reads back every sample, and is quick enough to start again
+	if (options.sampleCount != 0
+	&&	(options.actions & (progActions::bisect | progActions::noreads | progActions::resume)) != 0)
+	{
+		OutputText(L"The -sample option cannot be combined with -bisect, -noreads or -resume\n");
+		return 1;
+	}
+
+	//	A differential run compares unbuffered and cached reads of markers
+	//	written unbuffered, one at a time, on a file system
+	if (options.differential
+	&&	((options.actions & (progActions::cached | progActions::noreads | progActions::bisect)) != 0
+	||	options.sampleCount != 0 || options.queueDepth != 0 || options.rawDrive))
+	{
+		OutputText(L"The -differential option cannot be combined with -cached, -noreads, -bisect, -sample, -qd or -raw\n");
+		return 1;
+	}
+
+	//	The benchmark picks the marker size, so it can't be given as well
+	if (options.blockSize != 0 && options.autoTune)
+	{
+		OutputText(L"The -block and -autotune options cannot be combined\n");
+		return 1;
+	}
+
+	//	A binary search and a sampled run probe single sectors
+	if ((options.blockSize != 0 || options.stride != 0 || options.autoTune)
+	&&	((options.actions & progActions::bisect) != 0 || options.sampleCount != 0))
+	{
+		OutputText(L"The -block, -stride and -autotune options cannot be combined with -bisect or -sample\n");
+		return 1;
+	}
+
+	//	The budget needs the markers checked one at a time and in order, and
+	//	it needs them read back
+	if (options.budgetFailures != 0
+	&&	((options.actions & (progActions::bisect | progActions::noreads)) != 0
+	||	options.sampleCount != 0 || options.queueDepth != 0))
+	{
+		OutputText(L"The -budget option cannot be combined with -bisect, -noreads, -sample, -qd or -full\n");
+		return 1;
+	}
+
+	//	Telemetry describes a pass over the whole device
+	if (options.telemetryPath [0] != 0
+	&&	((options.actions & progActions::bisect) != 0 || options.sampleCount != 0))
+	{
+		OutputText(L"The -telemetry option cannot be combined with -bisect or -sample\n");
+		return 1;
+	}
+
+	//	Several devices are tested at once, each on its own thread
+	options.severalDevices = pathNames.size() > 1;
+	if (!options.severalDevices)
+	{
+		RunTelemetry	runTelemetry;
+		RunResults		results;
+		return TestDevice(pathNames [0], options, runTelemetry, results);
+	}
+
+	std::vector<std::unique_ptr<DeviceRun>> devices;
+	for (const char* pathName : pathNames)
+	{
+		devices.push_back(std::make_unique<DeviceRun>());
+		devices.back()->pathName = pathName;
+	}
+
+	const int failed = RunDevices(devices, "maxspace", (uint64_t) hubRate * MiB, [&options] (DeviceRun& device)
+	{
+		return TestDevice(device.pathName, options, device.telemetry, device.results);
+	});
+
+	//	All done!
+	return failed != 0 ? 1 : 0;
 
 }
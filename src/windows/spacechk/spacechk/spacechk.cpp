@@ -6,35 +6,67 @@
 //	License: MIT. See the LICENSE file in the project root for more details.
 //
 
+#include "../../whatspace_core/blockio.h"
+#include "../../whatspace_core/buffer.h"
+#include "../../whatspace_core/budget.h"
+#include "../../whatspace_core/geometry.h"
+#include "../../whatspace_core/journal.h"
+#include "../../whatspace_core/marker.h"
+#include "../../whatspace_core/output.h"
+#include "../../whatspace_core/pattern.h"
+#include "../../whatspace_core/privilege.h"
+#include "../../whatspace_core/results.h"
+#include "../../whatspace_core/telemetry.h"
+#include "../../whatspace_core/timing.h"
+#include "../../whatspace_core/verify.h"
+
 #include <Windows.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <wchar.h>
 
-#include <chrono>
+#include <atomic>
 #include <filesystem>
-
-//	Size metrics e.g. KiB, GiB etc.
-constexpr uint64_t KiB = 1024;
-constexpr uint64_t MiB = KiB * 1024;
-constexpr uint64_t GiB = MiB * 1024;
-constexpr uint64_t TiB = GiB * 1024;
-
-//	Converts bytes to human readable sizes
-constexpr uint64_t			sizeArray []	= {TiB, GiB, MiB, KiB};
-constexpr const wchar_t*	sizeNames []	= {L"TiB", L"GiB", L"MiB", L"KiB"};
-constexpr const wchar_t*	byteName		= L"bytes";
-constexpr int				numSizes		= sizeof(sizeArray) / sizeof(sizeArray[0]);
+#include <memory>
+#include <thread>
+#include <vector>
 
 //	File prefix
 constexpr const wchar_t*	filePrefix		= L"sp";
 
-//	File I/O size
+//	Prefix of the extent files that hold several sequence files each
+constexpr const wchar_t*	extentPrefix	= L"sx";
+
+//	Files are spread over this many directories under one named after the
+//	prefix, sp\00 to sp\ff, so no directory grows past the exFAT limit or
+//	gets slow to create files in
+constexpr DWORD				shardCount		= 256;
+
+//	Manifest of the files we created, and the temporary file used to update it
+constexpr const wchar_t*	manifestName	= L"spchk.txt";
+constexpr const wchar_t*	manifestTemp	= L"spchk.tmp";
+constexpr int				manifestVersion	= 2;
+
+//	Default file I/O size
 constexpr uint64_t			fileIOSize		= 10 * MiB;
 
+//	Largest file size the user can ask for, and the scratch file the block
+//	size is tuned on
+constexpr uint64_t			maxFileSize		= 256 * MiB;
+constexpr const wchar_t*	tuneName		= L"sptune.bin";
+
+//	Largest extent file the user can ask for
+constexpr uint64_t			maxExtentSize	= 64 * GiB;
+
 //	Batch size for some operations
 constexpr uint64_t			batchSize		= 10;
 
+//	Largest number of worker threads
+constexpr DWORD				maxThreads		= 64;
+
+//	How often, in milliseconds, progress is checked while workers run
+constexpr DWORD				progressPoll	= 250;
+
 //	Program actions
 namespace checkActions
 {
@@ -44,426 +76,1421 @@ namespace checkActions
 	uint8_t verifyFiles		= 4;
 	uint8_t keepVerifying	= 8;
 	uint8_t deleteFiles		= 16;
+	uint8_t fullPattern		= 32;
+	uint8_t resume			= 64;
+	uint8_t largePages		= 128;
+};
+
+//	Phases recorded in the journal
+namespace journalPhases
+{
+	DWORD create	= 0;
+	DWORD verify	= 1;
+	DWORD count		= 2;
 };
 
 
-//	Output an error message
-void PrintError(const wchar_t* format, ...)
+//	What we know about the files created on the device. Files are named
+//	from their sequence number, so this is all verification and deletion
+//	need to find them
+struct Manifest
 {
-	//	We start by saving the current error as we might make
-	//	API calls that produce other errors
-	auto savedError = GetLastError();
+	//	Files sp000000.bin up to this sequence number may exist
+	uint64_t	fileCount;
+
+	//	Files up to this sequence number are known to be fully written
+	uint64_t	completeCount;
+
+	//	The files are filled with a pattern made from this seed, rather
+	//	than just having the sequence number at four offsets
+	bool		fullPattern;
+	uint64_t	patternSeed;
+
+	//	Each file has a header with its own offset in the sequence and
+	//	this run ID. Zero means the files were created before headers
+	uint64_t	runId;
+
+	//	Size of every file, written in one I/O, and the distance between
+	//	the markers in each file
+	uint64_t	fileSize;
+	uint64_t	markerStride;
+
+	//	Number of directories the files are spread over, or zero if they
+	//	are all next to the manifest, as older versions left them
+	DWORD		shards;
+
+	//	Sequence files are regions of extent files this size, a whole
+	//	number of files each, rather than files of their own. Zero if each
+	//	one is a file
+	uint64_t	extentSize;
+};
+
+
+//	Number of markers in each file
+inline uint64_t MarkerCount (const Manifest& manifest)
+{
+	return (manifest.fileSize + manifest.markerStride - 1) / manifest.markerStride;
+}
+
+
+//	Build the name of a file that lives next to the sequence files
+inline void ManifestName (wchar_t (&fileName) [MAX_PATH], const char* pathName, const wchar_t* name)
+{
+	swprintf_s(fileName, L"%hs%s", pathName, name);
+}
 
-	//	There are two parts to the error message. There's the Windows
-	//	description of the error and information passed by the user.
-	//	Start by getting the Windows error text
-	LPCTSTR windowsMsg = nullptr;
 
-	//	Format the error message
-	FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-		nullptr, savedError,
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-		(LPTSTR)&windowsMsg, 0, nullptr);
+//	Number of sequence files in each file on the device, one unless they
+//	are regions of extent files
+inline uint64_t ExtentFiles (const Manifest& manifest)
+{
+	return manifest.extentSize == 0 ? 1 : manifest.extentSize / manifest.fileSize;
+}
+
+
+//	Offset of a sequence file in the file on the device that holds it
+inline int64_t ExtentOffset (const uint64_t seqNum, const Manifest& manifest)
+{
+	return (int64_t) ((seqNum % ExtentFiles(manifest)) * manifest.fileSize);
+}
 
-	//	User message
-	wchar_t userMsg[BUFSIZ];
 
-	//	Get the start of the variable arguments
-	va_list ourArgs;
-	va_start(ourArgs, format);
-	vswprintf_s(userMsg, format, ourArgs);
+//	Build the name of the file on the device that holds a sequence file,
+//	the file itself or the extent file it is a region of. Its directory
+//	comes from the low bits of the file's number, so consecutive files go
+//	to different directories and they all fill up at the same rate
+inline void SequenceName (wchar_t (&fileName) [MAX_PATH], const char* pathName, const uint64_t seqNum, const Manifest& manifest)
+{
+	const uint64_t	fileNum	= seqNum / ExtentFiles(manifest);
+	const wchar_t*	prefix	= manifest.extentSize != 0 ? extentPrefix : filePrefix;
+	if (manifest.shards == 0)
+	{
+		swprintf_s(fileName, L"%hs%s%06llx.bin", pathName, prefix, fileNum);
+	}
+	else
+	{
+		swprintf_s(fileName, L"%hs%s\\%02llx\\%s%06llx.bin", pathName, filePrefix, fileNum % manifest.shards, prefix, fileNum);
+	}
+}
 
-	//	Output the full message
-	wprintf(L"%s : %s\n", userMsg, windowsMsg);
 
-	//	Free off the Windows message buffer
-	LocalFree((LPVOID)windowsMsg);
+//	Build the name of a sequence file to show the user, which for one in
+//	an extent file says where in it the file starts
+inline void DisplayName (wchar_t (&fileName) [MAX_PATH], const char* pathName, const uint64_t seqNum, const Manifest& manifest)
+{
+	SequenceName(fileName, pathName, seqNum, manifest);
+	if (manifest.extentSize != 0)
+	{
+		const size_t length = wcslen(fileName);
+		swprintf_s(fileName + length, MAX_PATH - length, L" at 0x%llX", ExtentOffset(seqNum, manifest));
+	}
 }
 
 
-//	Output a human readable size
-const wchar_t* HumanReadable (uint64_t sizeInBytes, uint64_t &convertedSize)
+//	Read the manifest left by a previous run
+bool ReadManifest (const char* pathName, Manifest& manifest)
 {
-	for (int i = 0; i < numSizes; i ++)
+	wchar_t manifestPath [MAX_PATH];
+	ManifestName(manifestPath, pathName, manifestName);
+
+	FILE* manifestFile = nullptr;
+	if (_wfopen_s(&manifestFile, manifestPath, L"r") != 0 || manifestFile == nullptr)
+	{
+		return false;
+	}
+
+	//	The manifest is a set of "name value" lines, anything we do
+	//	not recognize is skipped
+	manifest = {};
+	bool	haveCount = false;
+	char	line [128];
+	while (fgets(line, sizeof(line), manifestFile) != nullptr)
 	{
-		if (sizeInBytes >= sizeArray [i])
+		uint64_t value;
+		if (sscanf_s(line, "files %llu", &value) == 1)
+		{
+			manifest.fileCount = value;
+			haveCount = true;
+		}
+		else
+		if (sscanf_s(line, "complete %llu", &value) == 1)
+		{
+			manifest.completeCount = value;
+		}
+		else
+		if (sscanf_s(line, "pattern %llu", &value) == 1)
+		{
+			manifest.fullPattern = value != 0;
+		}
+		else
+		if (sscanf_s(line, "seed %llx", &value) == 1)
+		{
+			manifest.patternSeed = value;
+		}
+		else
+		if (sscanf_s(line, "run %llx", &value) == 1)
+		{
+			manifest.runId = value;
+		}
+		else
+		if (sscanf_s(line, "size %llu", &value) == 1)
+		{
+			manifest.fileSize = value;
+		}
+		else
+		if (sscanf_s(line, "stride %llu", &value) == 1)
+		{
+			manifest.markerStride = value;
+		}
+		else
+		if (sscanf_s(line, "shards %llu", &value) == 1 && value <= shardCount)
+		{
+			manifest.shards = (DWORD) value;
+		}
+		else
+		if (sscanf_s(line, "extent %llu", &value) == 1)
 		{
-			convertedSize = sizeInBytes / sizeArray [i];
-			return sizeNames [i];
+			manifest.extentSize = value;
 		}
 	}
 
-	//	Must be in bytes
-	convertedSize = sizeInBytes;
-	return byteName;
+	fclose(manifestFile);
+
+	//	Older manifests have four markers in each file
+	if (manifest.fileSize == 0)
+	{
+		manifest.fileSize = fileIOSize;
+	}
+
+	if (manifest.markerStride == 0)
+	{
+		manifest.markerStride = manifest.fileSize / 4;
+	}
+
+	//	An extent file holds at least one sequence file
+	return haveCount && (manifest.extentSize == 0 || manifest.extentSize >= manifest.fileSize);
 }
 
 
-//	Common output function for sizes
-void OutputSize (const wchar_t* msg, const uint64_t inSize)
+//	Save the manifest. It is written to a temporary file first and moved
+//	into place so a power cut can't leave a half written manifest
+bool WriteManifest (const char* pathName, const Manifest& manifest)
 {
-	uint64_t converted;
-	const wchar_t* textSize = HumanReadable(inSize, converted);
-	wprintf(L"%s %lld %s\n", msg, converted, textSize);
+	wchar_t manifestPath [MAX_PATH];
+	wchar_t tempPath [MAX_PATH];
+	ManifestName(manifestPath, pathName, manifestName);
+	ManifestName(tempPath, pathName, manifestTemp);
+
+	FILE* manifestFile = nullptr;
+	if (_wfopen_s(&manifestFile, tempPath, L"w") != 0 || manifestFile == nullptr)
+	{
+		PrintError(L"\nCould not create manifest %s", tempPath);
+		return false;
+	}
+
+	fprintf(manifestFile, "spacechk manifest %d\n", manifestVersion);
+	fprintf(manifestFile, "files %llu\n", manifest.fileCount);
+	fprintf(manifestFile, "complete %llu\n", manifest.completeCount);
+	fprintf(manifestFile, "size %llu\n", manifest.fileSize);
+	fprintf(manifestFile, "stride %llu\n", manifest.markerStride);
+	fprintf(manifestFile, "shards %lu\n", manifest.shards);
+	fprintf(manifestFile, "extent %llu\n", manifest.extentSize);
+	fprintf(manifestFile, "pattern %d\n", manifest.fullPattern ? 1 : 0);
+	fprintf(manifestFile, "seed %llx\n", manifest.patternSeed);
+	fprintf(manifestFile, "run %llx\n", manifest.runId);
+
+	if (fclose(manifestFile) != 0)
+	{
+		PrintError(L"\nCould not write manifest %s", tempPath);
+		return false;
+	}
+
+	if (!MoveFileEx(tempPath, manifestPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		PrintError(L"\nCould not replace manifest %s", manifestPath);
+		return false;
+	}
+
+	return true;
 }
 
 
-//	Find any previous files we created, so we can skip
-//	over them
-uint64_t FindPriorFiles (const char* pathName)
+//	Raise the file count in a manifest to cover the sequence files that
+//	match a search path
+void ScanPriorFiles (const wchar_t* searchPath, Manifest& manifest)
 {
-	//	Create the search path
-	wchar_t searchPath [MAX_PATH];
-	swprintf_s(searchPath, L"%hs%s*.bin", pathName, filePrefix);
-
 	WIN32_FIND_DATA findData;
 	HANDLE findHandle = FindFirstFile(searchPath, &findData);
 	if (findHandle == INVALID_HANDLE_VALUE)
 	{
-		//	This does not mean there's a real error - start at
-		//	the first file
-		return 0;
+		//	This does not mean there's a real error - there are just
+		//	no files here
+		return;
 	}
 
-	uint64_t maxSeq = 0;
+	const size_t prefixLength = wcslen(filePrefix);
 	do
 	{
 		if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
 		{
-			//	Get the sequence number from the filename
-			wchar_t* seqPtr = wcschr(findData.cFileName, '-');
-			if (seqPtr == nullptr)
-			{
-				//	Something is wrong - use the max sequence number we have
-				FindClose(findHandle);
-				return maxSeq;
-			}
-
 			//	Get the sequence number from the file name
 			uint64_t seqNum;
-			swscanf_s(seqPtr + 1, L"%llx", &seqNum);
-
-			//	Set the maximum sequence number found
-			maxSeq = max(seqNum, maxSeq);
+			if (swscanf_s(findData.cFileName + prefixLength, L"%llx", &seqNum) == 1)
+			{
+				//	Set the maximum sequence number found
+				manifest.fileCount = max(seqNum + 1, manifest.fileCount);
+			}
 		}
 
 	} while (FindNextFile(findHandle, &findData));
 
 	FindClose(findHandle);
+}
+
+
+//	Find any previous files we created, so we can skip over them. This is
+//	a manifest lookup - the directories are only scanned for files created
+//	by older versions that did not write a manifest, or by a run that
+//	lost its manifest
+bool FindPriorFiles (const char* pathName, Manifest& manifest)
+{
+	if (ReadManifest(pathName, manifest))
+	{
+		return true;
+	}
+
+	manifest = {};
+
+	//	Older versions left the files next to the manifest
+	wchar_t searchPath [MAX_PATH];
+	swprintf_s(searchPath, L"%hs%s*.bin", pathName, filePrefix);
+	ScanPriorFiles(searchPath, manifest);
+
+	//	Newer ones spread them over the shard directories
+	if (manifest.fileCount == 0)
+	{
+		for (DWORD shard = 0; shard < shardCount; shard++)
+		{
+			swprintf_s(searchPath, L"%hs%s\\%02lx\\%s*.bin", pathName, filePrefix, shard, filePrefix);
+			ScanPriorFiles(searchPath, manifest);
+		}
+
+		if (manifest.fileCount != 0)
+		{
+			manifest.shards = shardCount;
+		}
+	}
+
+	manifest.completeCount	= manifest.fileCount;
+	manifest.fileSize		= fileIOSize;
+	manifest.markerStride	= fileIOSize / 4;
+	return manifest.fileCount != 0;
+}
+
+
+//	Build the name of one of the directories the files are spread over,
+//	or of the directory holding them all for shard == shards
+inline void ShardName (wchar_t (&dirName) [MAX_PATH], const char* pathName, const DWORD shard, const DWORD shards)
+{
+	if (shard == shards)
+	{
+		swprintf_s(dirName, L"%hs%s", pathName, filePrefix);
+	}
+	else
+	{
+		swprintf_s(dirName, L"%hs%s\\%02lx", pathName, filePrefix, shard);
+	}
+}
+
+
+//	Make the directories the files are spread over. Any that are already
+//	there from an earlier run are used as they are
+bool CreateShards (const char* pathName, const DWORD shards)
+{
+	if (shards == 0)
+	{
+		return true;
+	}
+
+	//	The directory holding them all goes first
+	for (DWORD shard = shards + 1; shard-- > 0; )
+	{
+		wchar_t dirName [MAX_PATH];
+		ShardName(dirName, pathName, shard, shards);
+		if (!CreateDirectory(dirName, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+		{
+			PrintError(L"\nCannot create directory %s", dirName);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+//	Remove the directories the files were spread over. One that still
+//	holds something, e.g. a file that could not be deleted, is left
+void RemoveShards (const char* pathName, const DWORD shards)
+{
+	if (shards == 0)
+	{
+		return;
+	}
+
+	//	The directory holding them all goes last
+	for (DWORD shard = 0; shard <= shards; shard++)
+	{
+		wchar_t dirName [MAX_PATH];
+		ShardName(dirName, pathName, shard, shards);
+		if (!RemoveDirectory(dirName) && GetLastError() != ERROR_FILE_NOT_FOUND && GetLastError() != ERROR_PATH_NOT_FOUND)
+		{
+			PrintError(L"\nUnable to remove directory %s", dirName);
+		}
+	}
+}
+
+
+//	Open the file on the device that holds a sequence file, or create it.
+//	An extent file is created with the space for numFiles sequence files
+//	already given to it, so writing them doesn't change its size
+std::unique_ptr<BlockEngine> OpenSequenceFile (const char* pathName, const uint64_t seqNum, const Manifest& manifest, const bool create, const uint64_t numFiles, RunTelemetry* telemetry, RunResults& results)
+{
+	wchar_t fileName [MAX_PATH];
+	SequenceName(fileName, pathName, seqNum, manifest);
+	const int64_t fileOffset = seqNum * manifest.fileSize;
+
+	BlockOptions options;
+	options.raw			= false;
+	options.cached		= false;
+	options.create		= create;
+	options.shared		= false;
+	options.queueDepth	= 0;
+	options.adaptive	= false;
+	options.preallocate	= create && manifest.extentSize != 0 ? (int64_t) (numFiles * manifest.fileSize) : 0;
+
+	std::unique_ptr<BlockEngine> sequenceFile = OpenBlockEngine(fileName, options);
+	if (!sequenceFile)
+	{
+		PrintError(create ? L"\nCannot create file %s" : L"\nCannot open file %s", fileName);
+		results.IoFailed(fileOffset, create ? "create error" : "open error");
+		return nullptr;
+	}
+
+	sequenceFile->SetTelemetry(telemetry);
+	sequenceFile->SetResults(&results);
+	return sequenceFile;
+}
+
+
+//	Create one file on the device with its unique data, or write it into
+//	the extent file that holds it
+bool CreateSequenceFile (const char* pathName, uint8_t* writeBuffer, const uint64_t seqNum, const Manifest& manifest, BlockEngine* extentFile, RunTelemetry* telemetry, RunResults& results)
+{
+	const int64_t fileOffset = seqNum * manifest.fileSize;
+
+	//	Create the file, unless it goes in an extent file
+	std::unique_ptr<BlockEngine>	ownFile;
+	BlockEngine*					writeFile	= extentFile;
+	if (writeFile == nullptr)
+	{
+		ownFile = OpenSequenceFile(pathName, seqNum, manifest, true, 1, telemetry, results);
+		if (!ownFile)
+		{
+			return false;
+		}
+		writeFile = ownFile.get();
+	}
+
+	const wchar_t* writeName = writeFile->Name();
+
+	//	Write unique data into the file. The header says where in the
+	//	sequence the file belongs, and which run wrote it
+	if (manifest.fullPattern)
+	{
+		//	The pattern depends on where the file sits in the sequence,
+		//	so every block of every file is different
+		const size_t headerSize = manifest.runId != 0 ? markerHeaderSize : 0;
+		if (headerSize != 0)
+		{
+			SetMarkerHeader(writeBuffer, manifest.runId, fileOffset, seqNum + 1);
+		}
+		FillPattern(writeBuffer + headerSize, manifest.fileSize - headerSize, manifest.patternSeed, fileOffset + headerSize);
+	}
+	else
+	{
+		const uint64_t dataOffsets = manifest.markerStride;
+		for (uint64_t o = 0; o < MarkerCount(manifest); o++)
+		{
+			if (manifest.runId != 0)
+			{
+				SetMarkerHeader(writeBuffer + (o * dataOffsets), manifest.runId, fileOffset, seqNum + 1);
+			}
+			else
+			{
+				uint64_t* dataPtr = (uint64_t*)(writeBuffer + (o * dataOffsets));
+				*dataPtr = seqNum + 1;
+			}
+		}
+	}
+
+	//	Write the data
+	DWORD written;
+	if (!writeFile->Write(ExtentOffset(seqNum, manifest), writeBuffer, manifest.fileSize, written))
+	{
+		PrintError(L"\nCannot write to %s", writeName);
+		results.IoFailed(fileOffset, "write error");
+		return false;
+	}
+
+	//	Sanity check
+	if (written != manifest.fileSize)
+	{
+		OutputText(L"\nWrote %d bytes to %s, expected %lld bytes\n", written, writeName, manifest.fileSize);
+		results.IoFailed(fileOffset, "short write");
+		return false;
+	}
+
+	if (telemetry != nullptr)
+	{
+		telemetry->AddProgress(manifest.fileSize, manifest.fileSize);
+	}
+
+	//	The file is closed when the engine goes
+	return true;
+}
+
+
+//	Marks a worker that is not working on a file
+constexpr uint64_t idleWorker = UINT64_MAX;
+
+
+//	State shared by the file creation workers
+struct CreateState
+{
+	const char*				pathName;
+	DWORD					bytesPerSector;
+	uint64_t				endFile;
+	std::atomic<uint64_t>	nextFile;
+	std::atomic<uint64_t>	filesDone;
+	std::atomic<uint64_t>	firstFailure;
+	std::atomic<DWORD>		activeWorkers;
+
+	//	One write buffer for each worker
+	BufferPool*				bufferPool;
+
+	//	Where the latency and throughput go, or nullptr, and what the run
+	//	found
+	RunTelemetry*			telemetry;
+	RunResults*				results;
+
+	//	How the files are filled
+	bool					fullPattern;
+	uint64_t				patternSeed;
+	uint64_t				runId;
+	uint64_t				fileSize;
+	uint64_t				markerStride;
+	DWORD					shards;
+	uint64_t				extentSize;
+
+	//	The lowest sequence number each worker could still be writing
+	std::unique_ptr<std::atomic<uint64_t> []>	inProgress;
+};
+
+
+//	Record the lowest sequence number that failed
+void RecordFailure (std::atomic<uint64_t>& firstFailure, const uint64_t seqNum)
+{
+	uint64_t current = firstFailure.load();
+	while (seqNum < current && !firstFailure.compare_exchange_weak(current, seqNum))
+	{
+	}
+}
+
+
+//	Worker thread that creates files until the sequence numbers run out
+void CreateWorker (CreateState& state, const DWORD workerIndex)
+{
+	std::atomic<uint64_t>& inProgress = state.inProgress [workerIndex];
+
+	//	Each worker has its own buffer from the pool. The pool buffers are
+	//	already sector aligned and cleared
+	uint8_t* writeBuffer = state.bufferPool->Acquire();
+	if (writeBuffer == nullptr)
+	{
+		OutputText(L"\nCould not get a write buffer\n");
+		RecordFailure(state.firstFailure, state.nextFile.load());
+		inProgress = idleWorker;
+		state.activeWorkers --;
+		return;
+	}
+
+	//	Only the pattern settings and layout are used when creating a file
+	Manifest progress = {};
+	progress.fullPattern	= state.fullPattern;
+	progress.patternSeed	= state.patternSeed;
+	progress.runId			= state.runId;
+	progress.fileSize		= state.fileSize;
+	progress.markerStride	= state.markerStride;
+	progress.shards			= state.shards;
+	progress.extentSize		= state.extentSize;
+
+	//	Sequence numbers are handed out one at a time, so file creation
+	//	on one worker overlaps with data writes on the others. The files
+	//	in an extent file are handed out together, and written in order
+	const uint64_t extentFiles = ExtentFiles(progress);
+	bool stopped = false;
+	while (!stopped)
+	{
+		//	Claim the next files. The lower bound is published first so the
+		//	manifest never counts a file that is still being written
+		uint64_t seqNum = state.nextFile.load();
+		uint64_t lastFile;
+		inProgress = seqNum;
+		do
+		{
+			lastFile = min((seqNum / extentFiles + 1) * extentFiles, state.endFile);
+		} while (seqNum < state.endFile && !state.nextFile.compare_exchange_weak(seqNum, lastFile));
+		inProgress = seqNum;
+
+		if (seqNum >= state.endFile || state.firstFailure.load() < state.endFile)
+		{
+			inProgress = idleWorker;
+			break;
+		}
+
+		//	An extent file is created, with all its space, when its first
+		//	file is claimed. A run that stopped part way through one
+		//	carries on in the one that is there
+		std::unique_ptr<BlockEngine> extentFile;
+		if (progress.extentSize != 0)
+		{
+			extentFile = OpenSequenceFile(state.pathName, seqNum, progress, seqNum % extentFiles == 0, lastFile - seqNum, state.telemetry, *state.results);
+			if (!extentFile)
+			{
+				RecordFailure(state.firstFailure, seqNum);
+				break;
+			}
+		}
 
-	return maxSeq;
+		for (; seqNum < lastFile && !stopped; seqNum++)
+		{
+			//	Leave this worker's sequence number in place if the file
+			//	was not completely written
+			inProgress = seqNum;
+			if (state.firstFailure.load() < state.endFile)
+			{
+				stopped = true;
+			}
+			else
+			if (!CreateSequenceFile(state.pathName, writeBuffer, seqNum, progress, extentFile.get(), state.telemetry, *state.results))
+			{
+				RecordFailure(state.firstFailure, seqNum);
+				stopped = true;
+			}
+			else
+			{
+				state.filesDone ++;
+			}
+		}
+	}
+
+	state.bufferPool->Release(writeBuffer);
+	state.activeWorkers --;
+}
+
+
+//	Work out how far file creation has got for the manifest
+Manifest CreateProgress (CreateState& state, const DWORD numThreads)
+{
+	Manifest manifest;
+	manifest.fullPattern	= state.fullPattern;
+	manifest.patternSeed	= state.patternSeed;
+	manifest.runId			= state.runId;
+	manifest.fileSize		= state.fileSize;
+	manifest.markerStride	= state.markerStride;
+	manifest.shards			= state.shards;
+	manifest.extentSize		= state.extentSize;
+	manifest.completeCount	= state.endFile;
+	for (DWORD t = 0; t < numThreads; t++)
+	{
+		manifest.completeCount = min(manifest.completeCount, state.inProgress [t].load());
+	}
+
+	manifest.fileCount		= min(state.nextFile.load(), state.endFile);
+	manifest.completeCount	= min(manifest.completeCount, manifest.fileCount);
+	return manifest;
 }
 
 
-//	Create a number of files on the device
-bool CreateFiles (const char* pathName, const DWORD bytesPerSector, const uint64_t totalSpace)
+//	Create a number of files on the device. With an extent size, the
+//	files are regions of extent files that are given their space when
+//	they are created, so there are far fewer files to create
+bool CreateFiles (const char* pathName, const DWORD bytesPerSector, const uint64_t fileSize, const uint64_t markerStride, const uint64_t extentSize, const DWORD numThreads, const bool fullPattern, const bool largePages, RunTelemetry* telemetry, RunResults& results, HANDLE journal)
 {
+	//	Find previous files to skip. Anything that was not completely
+	//	written by an earlier run is created again
+	Manifest	priorFiles;
+	uint64_t	startFile	= 0;
+	bool		usePattern	= fullPattern;
+	uint64_t	patternSeed	= NewPatternSeed();
+	uint64_t	runId		= NewRunId();
+	uint64_t	useSize		= fileSize;
+	uint64_t	useStride	= markerStride;
+	DWORD		useShards	= shardCount;
+	uint64_t	useExtent	= extentSize;
+	if (FindPriorFiles(pathName, priorFiles))
+	{
+		startFile = priorFiles.completeCount;
+		OutputText(L"\nSkipping %lld files from a previous run", startFile);
+
+		//	Files we keep must be verified the same way as the new ones,
+		//	so carry on with the previous run's settings
+		if (startFile != 0)
+		{
+			if (usePattern != priorFiles.fullPattern)
+			{
+				OutputText(L"\nUsing the %s data of the previous run", priorFiles.fullPattern ? L"pattern" : L"marker");
+			}
+			if (useSize != priorFiles.fileSize || useStride != priorFiles.markerStride)
+			{
+				OutputSize(L"\nUsing the file size of the previous run,", priorFiles.fileSize);
+			}
+			usePattern	= priorFiles.fullPattern;
+			patternSeed	= priorFiles.patternSeed;
+			runId		= priorFiles.runId;
+			useSize		= priorFiles.fileSize;
+			useStride	= priorFiles.markerStride;
+		}
+
+		//	Files that are there, complete or not, stay where they are so
+		//	the new ones can replace them and deletion finds them all
+		if (priorFiles.fileCount != 0)
+		{
+			if (priorFiles.shards == 0)
+			{
+				OutputText(L"\nUsing the single directory of the previous run");
+			}
+			if (useExtent != priorFiles.extentSize && priorFiles.extentSize == 0)
+			{
+				OutputText(L"\nWriting each file on its own as the previous run did");
+			}
+			else
+			if (useExtent != priorFiles.extentSize)
+			{
+				OutputSize(L"\nUsing the extent file size of the previous run,", priorFiles.extentSize);
+			}
+			useShards = priorFiles.shards;
+			useExtent = priorFiles.extentSize;
+		}
+	}
+
+	//	An extent file holds a whole number of files, and setting the
+	//	valid data length of one needs a privilege
+	if (useExtent != 0)
+	{
+		useExtent = max(useExtent / useSize, (uint64_t) 1) * useSize;
+		if (!AddPrivelege(SE_MANAGE_VOLUME_NAME))
+		{
+			results.IoFailed(-1, "create error");
+			return false;
+		}
+	}
+
+	//	Make the directories the files are spread over
+	if (!CreateShards(pathName, useShards))
+	{
+		results.IoFailed(-1, "create error");
+		return false;
+	}
+
+	//	Write the manifest before the first file, so the files can always
+	//	be found and deleted, even those of a run that stops straight away
+	Manifest startManifest = {};
+	startManifest.fileCount		= max(priorFiles.fileCount, startFile);
+	startManifest.completeCount	= startFile;
+	startManifest.fullPattern	= usePattern;
+	startManifest.patternSeed	= patternSeed;
+	startManifest.runId			= runId;
+	startManifest.fileSize		= useSize;
+	startManifest.markerStride	= useStride;
+	startManifest.shards		= useShards;
+	startManifest.extentSize	= useExtent;
+	if (!WriteManifest(pathName, startManifest))
+	{
+		results.IoFailed(-1, "create error");
+		return false;
+	}
+
+	//	The directories and the manifest take space of their own, so the
+	//	run is sized from what is free once they are there
+	DWORD sectorsPerCluster;
+	DWORD sectorSize;
+	DWORD freeClusters;
+	DWORD totalClusters;
+	if (GetDiskFreeSpaceA(pathName, &sectorsPerCluster, &sectorSize, &freeClusters, &totalClusters) == 0)
+	{
+		PrintError(L"\nCould not get the free space on %hs", pathName);
+		results.IoFailed(-1, "create error");
+		return false;
+	}
+
+	//	Using DWORD, the free space could overflow
+	uint64_t freeSpace	=	sectorSize;
+	freeSpace			*=	sectorsPerCluster;
+	freeSpace			*=	freeClusters;
+
 	//	Work out how many files we will create
-	uint64_t totalFiles = totalSpace / fileIOSize;
+	uint64_t totalFiles = freeSpace / useSize;
+
+	//	A failed run is good up to the file that failed
+	results.resolution = useSize;
 
 	//	Output some information
-	wprintf(L"\nI will create %lld files ", totalFiles);
-	OutputSize(L" with size ", fileIOSize);
+	OutputText(L"\nI will create %lld files ", totalFiles);
+	OutputSize(L" with size ", useSize);
+	if (useExtent != 0)
+	{
+		OutputSize(L"The files are regions of extent files that are each", useExtent);
+	}
+	if (numThreads > 1)
+	{
+		OutputText(L"Using %d worker threads\n", numThreads);
+	}
 
-	//	We will be using I/O that bypasses the file system cache which means our
-	//	buffers need to be aligned on a sector boundary
-	uint8_t* writeBuffer = (uint8_t *) _aligned_malloc(fileIOSize, bytesPerSector);
-	if (writeBuffer == nullptr)
+	//	We will be using I/O that bypasses the file system cache which means
+	//	our buffers need to be aligned on a sector boundary
+	BufferPool bufferPool;
+	if (!bufferPool.Create(useSize, numThreads, bytesPerSector, largePages))
 	{
-		PrintError(L"Could not get write buffer");
+		PrintError(L"Could not get write buffers");
 		return false;
 	}
 
-	//	Clear out the buffer
-	memset(writeBuffer, 0, fileIOSize);
+	if (largePages)
+	{
+		OutputPoolMemory(bufferPool);
+	}
 
 	//	Get a start time
-	auto start		= std::chrono::high_resolution_clock::now();
-	auto elapsed	= start;
+	BatchTimer timer;
+	if (telemetry != nullptr)
+	{
+		telemetry->StartPass(1, startFile * useSize);
+	}
 
-	//	Find previous files to skip
-	uint64_t startFile = FindPriorFiles(pathName);
+	//	Set up the workers
+	CreateState state;
+	state.pathName			= pathName;
+	state.bytesPerSector	= bytesPerSector;
+	state.endFile			= startFile + totalFiles;
+	state.nextFile			= startFile;
+	state.filesDone			= 0;
+	state.firstFailure		= state.endFile;
+	state.activeWorkers		= numThreads;
+	state.bufferPool		= &bufferPool;
+	state.telemetry			= telemetry;
+	state.results			= &results;
+	state.fullPattern		= usePattern;
+	state.patternSeed		= patternSeed;
+	state.runId				= runId;
+	state.fileSize			= useSize;
+	state.markerStride		= useStride;
+	state.shards			= useShards;
+	state.extentSize		= useExtent;
+	state.inProgress.reset(new std::atomic<uint64_t> [numThreads]);
+	for (DWORD t = 0; t < numThreads; t++)
+	{
+		state.inProgress [t] = startFile;
+	}
+
+	std::vector<std::thread> workers;
+	for (DWORD t = 0; t < numThreads; t++)
+	{
+		workers.emplace_back(CreateWorker, std::ref(state), t);
+	}
 
-	//	Create all files
-	wchar_t writeName [MAX_PATH];
-	for (uint64_t i = 0; i < totalFiles; i++)
+	//	Report progress across all workers while they run
+	uint64_t lastBatch = 0;
+	while (state.activeWorkers.load() > 0)
 	{
+		Sleep(progressPoll);
+
 		//	Output some stats if it is time
-		if (i && i % batchSize == 0)
+		uint64_t filesDone = state.filesDone.load();
+		if (filesDone / batchSize != lastBatch)
+		{
+			lastBatch = filesDone / batchSize;
+
+			//	Get the current time
+			const double elapsedSeconds	= timer.TotalSeconds();
+			const double batchSeconds	= timer.Lap();
+
+			//	Inform the user
+			OutputText(L"\r%lld/%lld written took %.2lf seconds (%.2lf seconds total)   ", filesDone, totalFiles, batchSeconds, elapsedSeconds);
+
+			//	Keep the manifest up to date so a later run knows what exists,
+			//	and the journal on the host so we know how far we got
+			//	Files the manifest can't record could not be found again,
+			//	so a manifest that can't be written stops the run
+			Manifest progress = CreateProgress(state, numThreads);
+			if (!WriteManifest(pathName, progress))
+			{
+				results.IoFailed(-1, "create error");
+				RecordFailure(state.firstFailure, state.nextFile.load());
+			}
+			JournalBatch(journal, journalPhases::create, progress.completeCount, batchSize, batchSeconds);
+		}
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	//	Record what was created, even if something failed
+	bool manifestSaved = WriteManifest(pathName, CreateProgress(state, numThreads));
+
+	if (state.firstFailure.load() < state.endFile)
+	{
+		OutputSize(L"Reached", state.firstFailure.load() * useSize);
+		return false;
+	}
+
+	//	Creation is done, a resume starts with verification
+	JournalBatch(journal, journalPhases::verify, 0, 0, 0.0);
+
+	//	Output some information
+	OutputText(L"\nWrote %lld total files ", totalFiles);
+	OutputSize(L"taking", totalFiles * useSize);
+
+	//	All good
+	return manifestSaved;
+}
+
+
+//	What was wrong with a file that failed verification. A lost file has
+//	none of its data, or another file's, and a damaged one has some of it
+enum class FileFault
+{
+	none,
+	unreadable,
+	lost,
+	damaged
+};
+
+
+//	Read back one file and make sure its unique data is there. Returns
+//	what was wrong with it, if anything
+FileFault VerifySequenceFile (const char* pathName, uint8_t* verifyBuffer, const DWORD bytesPerSector, const uint64_t seqNum, const Manifest& manifest, BlockEngine* extentFile, RunTelemetry* telemetry, RunResults& results)
+{
+	//	Create the filename
+	wchar_t verifyName [MAX_PATH];
+	DisplayName(verifyName, pathName, seqNum, manifest);
+	const int64_t fileOffset = seqNum * manifest.fileSize;
+
+	//	Open the file, unless it is in an extent file that is already open
+	std::unique_ptr<BlockEngine>	ownFile;
+	BlockEngine*					verifyFile	= extentFile;
+	if (verifyFile == nullptr)
+	{
+		ownFile = OpenSequenceFile(pathName, seqNum, manifest, false, 1, telemetry, results);
+		if (!ownFile)
+		{
+			return FileFault::unreadable;
+		}
+		verifyFile = ownFile.get();
+	}
+
+	//	Read the data
+	DWORD bytesRead;
+	if (!verifyFile->Read(ExtentOffset(seqNum, manifest), verifyBuffer, manifest.fileSize, bytesRead))
+	{
+		PrintError(L"\nCannot read from %s", verifyName);
+		results.IoFailed(fileOffset, "read error");
+		return FileFault::unreadable;
+	}
+
+	//	Close the file
+	ownFile.reset();
+
+	//	Sanity check
+	if (bytesRead != manifest.fileSize)
+	{
+		OutputText(L"\nRead %d bytes from %s, expected %lld bytes\n", bytesRead, verifyName, manifest.fileSize);
+		results.IoFailed(fileOffset, "short read");
+		return FileFault::unreadable;
+	}
+
+	if (telemetry != nullptr)
+	{
+		telemetry->AddProgress(manifest.fileSize, manifest.fileSize);
+	}
+
+	//	Make sure our unique data is in the file, starting with the headers
+	const uint64_t	dataOffsets	= manifest.markerStride;
+	const uint64_t	numHeaders	= manifest.runId == 0 ? 0 : manifest.fullPattern ? 1 : MarkerCount(manifest);
+	for (uint64_t o = 0; o < numHeaders; o++)
+	{
+		MarkerHeader header;
+		const uint8_t* headerPtr = verifyBuffer + (o * dataOffsets);
+		if (!ReadMarkerHeader(headerPtr, header))
+		{
+			OutputText(L"\nMarker in %s is missing @ offset 0x%llX\n", verifyName, o * dataOffsets);
+			results.DataFailed(fileOffset + (o * dataOffsets), "marker missing");
+			return o == 0 ? FileFault::lost : FileFault::damaged;
+		}
+
+		if (header.runId != manifest.runId)
+		{
+			OutputText(L"\n%s holds a marker from an earlier run @ offset 0x%llX\n", verifyName, o * dataOffsets);
+			results.DataFailed(fileOffset + (o * dataOffsets), "marker from an earlier run");
+			return FileFault::lost;
+		}
+
+		if (header.offset != fileOffset || header.value != seqNum + 1)
+		{
+			//	The device put the data for another file here
+			wchar_t otherName [MAX_PATH];
+			DisplayName(otherName, pathName, header.value - 1, manifest);
+			OutputText(L"\n%s was overwritten by the data for %s @ offset 0x%llX\n", verifyName, otherName, o * dataOffsets);
+			results.DataFailed(fileOffset + (o * dataOffsets), "overwritten by another file");
+			return FileFault::lost;
+		}
+	}
+
+	if (manifest.fullPattern)
+	{
+		//	The whole file is checked, so we can say how much of it is bad
+		const size_t headerSize = numHeaders != 0 ? markerHeaderSize : 0;
+		VerifyResult result = VerifyPattern(verifyBuffer + headerSize, manifest.fileSize - headerSize, manifest.patternSeed, fileOffset + headerSize, bytesPerSector);
+		if (result.badSectors != 0)
+		{
+			OutputText(L"\nPattern in %s is incorrect @ offset 0x%llX, %lld of %lld sectors are bad\n", verifyName, (uint64_t) (headerSize + result.firstMismatch), result.badSectors, manifest.fileSize / bytesPerSector);
+			results.DataFailed(fileOffset + headerSize + result.firstMismatch, "pattern mismatch");
+			return result.badSectors < manifest.fileSize / bytesPerSector ? FileFault::damaged : FileFault::lost;
+		}
+
+		return FileFault::none;
+	}
+
+	if (numHeaders != 0)
+	{
+		return FileFault::none;
+	}
+
+	for (uint64_t o = 0; o < MarkerCount(manifest); o++)
+	{
+		uint64_t* dataPtr = (uint64_t*) (verifyBuffer + (o * dataOffsets));
+		if (*dataPtr != seqNum + 1)
+		{
+			OutputText(L"\nData buffer should be 0x%llX @ offset 0x%llX, but is 0x%llX\n", seqNum + 1, o * dataOffsets, *dataPtr);
+			results.DataFailed(fileOffset + (o * dataOffsets), "marker mismatch");
+			return o == 0 ? FileFault::lost : FileFault::damaged;
+		}
+	}
+
+	return FileFault::none;
+}
+
+
+//	Verify that data we wrote to the device made it. keepGoing checks
+//	every file whatever fails. Otherwise the first failure stops the run,
+//	unless there is an error budget: budgetFailures failed files within
+//	budgetWindow files of each other are taken as the end of the kept data
+//	and probed sparsely past, and anything fewer is counted and stepped
+//	over
+bool VerifyFiles (const char* pathName, const DWORD bytesPerSector, const bool keepGoing, const uint32_t budgetFailures, const uint64_t budgetWindow, const bool largePages, RunTelemetry* telemetry, RunResults& results, HANDLE journal, const uint64_t startFile)
+{
+	//	The files are opened by name in sequence number order, rather than
+	//	enumerating what could be a very large directory
+	Manifest manifest;
+	if (!FindPriorFiles(pathName, manifest))
+	{
+		OutputText(L"Unable to find %hs%s files to verify\n", pathName, filePrefix);
+		return false;
+	}
+
+	//	A failed run is good up to the file that failed
+	results.resolution = manifest.fileSize;
+
+	//	We will be using I/O that bypasses the file system cache which means our
+	//	buffers need to be aligned on a sector boundary
+	BufferPool bufferPool;
+	if (!bufferPool.Create(manifest.fileSize, 1, bytesPerSector, largePages))
+	{
+		PrintError(L"Could not get verify buffer");
+		return false;
+	}
+
+	if (largePages)
+	{
+		OutputPoolMemory(bufferPool);
+	}
+
+	uint8_t* verifyBuffer = bufferPool.Acquire();
+
+	//	The extent file being read, if the files are in extent files
+	std::unique_ptr<BlockEngine>	extentFile;
+	uint64_t						extentNum	= 0;
+
+	//	Output some information
+	OutputText(L"Starting verification stage for %lld files\n", manifest.fileCount);
+	if (startFile != 0)
+	{
+		OutputText(L"Resuming at file %lld, earlier files were verified by a previous run\n", startFile);
+	}
+
+	//	Get a start time
+	BatchTimer timer;
+	if (telemetry != nullptr)
+	{
+		telemetry->StartPass(2, startFile * manifest.fileSize);
+	}
+
+	//	Read and verify the files
+	ErrorBudget	budget(budgetFailures, budgetWindow);
+	uint64_t	count		= 0;
+	uint64_t	failures	= 0;
+	uint64_t	faults [4]	= {};
+	uint64_t	seqNum		= startFile;
+	while (seqNum < manifest.fileCount)
+	{
+		if (count && count % batchSize == 0)
 		{
 			//	Get the current time
-			auto end = std::chrono::high_resolution_clock::now();
-			std::chrono::duration<double> batchSeconds		= end - start;
-			std::chrono::duration<double> elapsedSeconds	= end - elapsed;
+			const double elapsedSeconds	= timer.TotalSeconds();
+			const double batchSeconds	= timer.Lap();
+
+			//	Inform the user
+			OutputText(L"\rTotal verifications %lld, last %lld verifications took %.2lf seconds (%.2lf total seconds)   ", count, batchSize, batchSeconds, elapsedSeconds);
+
+			//	Every file before this one has been checked
+			JournalBatch(journal, journalPhases::verify, seqNum, batchSize, batchSeconds);
+		}
+
+		//	Files in an extent file are read through one handle, opened
+		//	when the first of them is reached
+		if (manifest.extentSize != 0 && (!extentFile || seqNum / ExtentFiles(manifest) != extentNum))
+		{
+			extentNum	= seqNum / ExtentFiles(manifest);
+			extentFile	= OpenSequenceFile(pathName, seqNum, manifest, false, 0, telemetry, results);
+		}
+
+		const FileFault	fault		= manifest.extentSize != 0 && !extentFile ? FileFault::unreadable : VerifySequenceFile(pathName, verifyBuffer, bytesPerSector, seqNum, manifest, extentFile.get(), telemetry, results);
+		const bool		fileGood	= fault == FileFault::none;
+		if (!fileGood)
+		{
+			OutputSize(L"Reached", (seqNum + 1) * manifest.fileSize);
+			failures ++;
+			faults [(int) fault] ++;
+
+			if (!keepGoing && !budget.Enabled())
+			{
+				//	We can stop
+				return false;
+			}
+		}
+
+		//	Number of files we verified
+		count ++;
+
+		//	Next file, which is further on when probing sparsely
+		const uint64_t nextFile = keepGoing ? seqNum + 1 : budget.Next(seqNum, !fileGood);
+		if (telemetry != nullptr && nextFile != budgetStop && nextFile > seqNum + 1)
+		{
+			telemetry->AddProgress((min(nextFile, manifest.fileCount) - seqNum - 1) * manifest.fileSize, 0);
+		}
+		seqNum = nextFile;
+	}
+
+	//	We can free off the buffer
+	bufferPool.Release(verifyBuffer);
+
+	//	Verification is done, unless the budget found where the kept data
+	//	ends, which a resume shouldn't step past
+	if (!budget.Confirmed())
+	{
+		JournalBatch(journal, journalPhases::count, 0, count % batchSize, timer.BatchSeconds());
+	}
+
+	//	Output some information
+	OutputText(L"\nVerified %lld total files", count);
+	OutputSize(L"taking", count * manifest.fileSize);
+	if (failures != 0)
+	{
+		OutputText(L"%lld files failed verification, %lld lost, %lld damaged and %lld unreadable\n", failures, faults [(int) FileFault::lost], faults [(int) FileFault::damaged], faults [(int) FileFault::unreadable]);
+		if (budget.Skipped() != 0)
+		{
+			OutputText(L"%lld files were skipped by sparse probing\n", budget.Skipped());
+		}
+
+		//	Files stepped over by the budget don't bring the capacity down
+		//	unless they were the end of the kept data
+		if (budget.Enabled())
+		{
+			results.capacity	= (budget.Confirmed() ? budget.Boundary() : manifest.fileCount) * manifest.fileSize;
+			results.resolution	= manifest.fileSize;
+			if (budget.Confirmed())
+			{
+				OutputSize(L"Data is kept up to", results.capacity);
+			}
+		}
+	}
+	else
+	{
+		//	Every file that was created holds what we wrote
+		results.capacity	= manifest.fileCount * manifest.fileSize;
+		results.resolution	= manifest.fileSize;
+	}
+
+	return failures == 0;
+}
+
+
+//	Delete one file. The name is removed from the directory straight
+//	away, as it would be on a POSIX system, rather than once the last
+//	handle to it closes, so the directory is empty as soon as its files
+//	have gone. File systems that can't do that, e.g. exFAT, get an
+//	ordinary delete. Returns false, with the Windows error set, if the
+//	file could not be deleted
+bool DeleteSequenceFile (const wchar_t* deleteName)
+{
+	HANDLE deleteHandle = CreateFile(deleteName, DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (deleteHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
 
-			//	Inform the user
-			printf("\r%lld/%lld written took %.2lf seconds (%.2lf seconds total)   ", i, totalFiles, batchSeconds.count(), elapsedSeconds.count());
+	FILE_DISPOSITION_INFO_EX posixInfo = {};
+	posixInfo.Flags = FILE_DISPOSITION_FLAG_DELETE | FILE_DISPOSITION_FLAG_POSIX_SEMANTICS;
+	bool deleted = SetFileInformationByHandle(deleteHandle, FileDispositionInfoEx, &posixInfo, sizeof(posixInfo)) != 0;
+	if (!deleted)
+	{
+		FILE_DISPOSITION_INFO dispositionInfo = {};
+		dispositionInfo.DeleteFile = TRUE;
+		deleted = SetFileInformationByHandle(deleteHandle, FileDispositionInfo, &dispositionInfo, sizeof(dispositionInfo)) != 0;
+	}
 
-			//	Reset the batch timer
-			start = std::chrono::high_resolution_clock::now();
-		}
+	auto savedError = GetLastError();
+	CloseHandle(deleteHandle);
+	SetLastError(savedError);
+	return deleted;
+}
 
-		//	Create the filename
-		swprintf_s(writeName, L"%hs%s%06llx.bin", pathName, filePrefix, i);
 
-		//	Create the file
-		HANDLE writeFile = CreateFile(writeName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
-		if (writeFile == INVALID_HANDLE_VALUE)
-		{
-			PrintError(L"Cannot create file %s\n", writeName);
-			_aligned_free(writeBuffer);
-			return false;
-		}
+//	State shared by the file deletion workers
+struct DeleteState
+{
+	const char*				pathName;
+	const Manifest*			manifest;
+	std::atomic<uint64_t>	nextFile;
+	std::atomic<uint64_t>	filesDone;
+	std::atomic<uint64_t>	filesFailed;
+	std::atomic<uint64_t>	bytesDeleted;
+	std::atomic<DWORD>		activeWorkers;
+};
 
-		//	Write unique data into the file
-		uint64_t dataOffsets = fileIOSize / 4;
-		for (int o = 0; o < 4; o++)
-		{
-			uint64_t* dataPtr = (uint64_t*)(writeBuffer + (o * dataOffsets));
-			*dataPtr = i + 1;
-		}
 
-		//	Write the data
-		DWORD written;
-		if (WriteFile(writeFile, writeBuffer, fileIOSize, &written, nullptr) == 0)
+//	Worker thread that deletes files until the sequence numbers run out.
+//	Consecutive files are in different directories, so the workers are
+//	rarely held up by each other's directory updates
+void DeleteWorker (DeleteState& state)
+{
+	const Manifest&	manifest	= *state.manifest;
+	const uint64_t	extentFiles	= ExtentFiles(manifest);
+	for (;;)
+	{
+		//	An extent file holds several sequence files, and goes in one go
+		const uint64_t seqNum = state.nextFile.fetch_add(extentFiles);
+		if (seqNum >= manifest.fileCount)
 		{
-			PrintError(L"\nCannot write to %s\n", writeName);
-			OutputSize(L"Reached", i * fileIOSize);
-			_aligned_free(writeBuffer);
-			return false;
+			break;
 		}
 
-		//	Sanity check
-		if (written != fileIOSize)
+		wchar_t deleteName [MAX_PATH];
+		SequenceName(deleteName, state.pathName, seqNum, manifest);
+		if (!DeleteSequenceFile(deleteName))
 		{
-			PrintError(L"Wrote %d bytes, expected %lld bytes\n", written, fileIOSize);
-			_aligned_free(writeBuffer);
-			return false;
+			//	A file that was never created is not a problem
+			if (GetLastError() != ERROR_FILE_NOT_FOUND && GetLastError() != ERROR_PATH_NOT_FOUND)
+			{
+				PrintError(L"\nUnable to delete file %s", deleteName);
+				state.filesFailed ++;
+			}
+			continue;
 		}
 
-		//	Close this file
-		CloseHandle(writeFile);
+		state.filesDone ++;
+		state.bytesDeleted += min(extentFiles, manifest.fileCount - seqNum) * manifest.fileSize;
 	}
 
-	//	We can free off the buffer
-	_aligned_free(writeBuffer);
-
-	//	Output some information
-	wprintf(L"\nWrote %lld total files ", totalFiles);
-	OutputSize(L"taking", totalFiles * fileIOSize);
-
-	//	All good
-	return true;
+	state.activeWorkers --;
 }
 
 
-//	Verify that data we wrote to the device made it
-bool VerifyFiles (const char* pathName, const DWORD bytesPerSector, const bool keepGoing)
+//	Delete files we created, numThreads at a time
+bool DeleteFiles (const char* pathName, const DWORD numThreads)
 {
-	//	Create the search path
-	wchar_t searchPath [MAX_PATH];
-	swprintf_s(searchPath, L"%hs%s*.bin", pathName, filePrefix);
-
-	WIN32_FIND_DATA findData;
-	HANDLE findHandle = FindFirstFile(searchPath, &findData);
-	if (findHandle == INVALID_HANDLE_VALUE)
+	Manifest manifest;
+	if (!FindPriorFiles(pathName, manifest))
 	{
-		PrintError(L"Unable to find %s files", searchPath);
+		OutputText(L"Could not locate %hs%s files to delete\n", pathName, filePrefix);
 		return false;
 	}
 
-	//	We will be using I/O that bypasses the file system cache which means our
-	//	buffers need to be aligned on a sector boundary
-	uint8_t* verifyBuffer = (uint8_t*) _aligned_malloc(fileIOSize, bytesPerSector);
-	if (verifyBuffer == nullptr)
+	//	Output some information
+	OutputText(L"\nDeletion phase starting\n");
+	if (numThreads > 1)
 	{
-		PrintError(L"Could not get verify buffer");
-		return false;
+		OutputText(L"Using %d worker threads\n", numThreads);
 	}
 
-	//	Output some information
-	wprintf(L"Starting verification stage\n");
-
 	//	Get a start time
-	auto start		= std::chrono::high_resolution_clock::now();
-	auto elapsed	= start;
+	BatchTimer timer;
+
+	//	The files are named from the manifest and handed out in sequence
+	//	number order
+	DeleteState state;
+	state.pathName		= pathName;
+	state.manifest		= &manifest;
+	state.nextFile		= 0;
+	state.filesDone		= 0;
+	state.filesFailed	= 0;
+	state.bytesDeleted	= 0;
+	state.activeWorkers	= numThreads;
+
+	std::vector<std::thread> workers;
+	for (DWORD t = 0; t < numThreads; t++)
+	{
+		workers.emplace_back(DeleteWorker, std::ref(state));
+	}
 
-	//	Read and verify the files
-	uint64_t count = 0;
-	do
+	//	Report progress across all workers while they run
+	uint64_t lastBatch = 0;
+	while (state.activeWorkers.load() > 0)
 	{
-		if (count && count % batchSize == 0)
+		Sleep(progressPoll);
+
+		//	Output some stats if it is time
+		const uint64_t filesDone = state.filesDone.load();
+		if (filesDone / batchSize != lastBatch)
 		{
+			lastBatch = filesDone / batchSize;
+
 			//	Get the current time
-			auto end = std::chrono::high_resolution_clock::now();
-			std::chrono::duration<double> batchSeconds		= end - start;
-			std::chrono::duration<double> elapsedSeconds	= end - elapsed;
+			const double elapsedSeconds	= timer.TotalSeconds();
+			const double batchSeconds	= timer.Lap();
 
 			//	Inform the user
-			wprintf(L"\rTotal verifications %lld, last %lld verifications took %.2lf seconds (%.2lf total seconds)   ", count, batchSize, batchSeconds.count(), elapsedSeconds.count());
-
-			//	Reset the batch timer
-			start = std::chrono::high_resolution_clock::now();
+			OutputText(L"\rTotal deletions %lld, last batch took %.2lf seconds (%.2lf total seconds)   ", filesDone, batchSeconds, elapsedSeconds);
 		}
+	}
 
-		if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-		{
-			//	The file will be missing the path name
-			wchar_t verifyName [MAX_PATH];
-			swprintf_s(verifyName, L"%hs%s", pathName, findData.cFileName);
-
-			//	Open the file
-			HANDLE verifyFile = CreateFile(verifyName, GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
-			if (verifyFile == INVALID_HANDLE_VALUE)
-			{
-				PrintError(L"\nCannot open file %s", verifyName);
-				_aligned_free(verifyBuffer);
-				return false;
-			}
-
-			//	Read the data
-			DWORD bytesRead;
-			if (ReadFile(verifyFile, verifyBuffer, fileIOSize, &bytesRead, nullptr) == 0)
-			{
-				PrintError(L"\nCannot read from %s", verifyName);
-				_aligned_free(verifyBuffer);
-				CloseHandle(verifyFile);
-				return false;
-			}
-
-			//	Close the file
-			CloseHandle(verifyFile);
-			verifyFile = INVALID_HANDLE_VALUE;
-
-			//	Sanity check
-			if (bytesRead != fileIOSize)
-			{
-				PrintError(L"\nRead %d bytes, expected %lld bytes, error 0x%X", bytesRead, fileIOSize);
-				_aligned_free(verifyBuffer);
-				return false;
-			}
-
-			//	Get the sequence number from the filename
-			wchar_t* seqPtr = wcschr(verifyName, '-');
-			if (seqPtr == nullptr)
-			{
-				wprintf(L"\nCould not find sequence number from %s", verifyName);
-				_aligned_free(verifyBuffer);
-				return false;
-			}
-
-			uint64_t seqNum;
-			swscanf_s(seqPtr + 1, L"%llx", &seqNum);
-
-			//	Make sure our unique data is in the file
-			uint64_t dataOffsets = fileIOSize / 4;
-			for (int o = 0; o < 4; o++)
-			{
-				uint64_t* dataPtr = (uint64_t*) (verifyBuffer + (o * dataOffsets));
-				if (*dataPtr != seqNum + 1)
-				{
-					printf("\nData buffer should be 0x%llX @ offset 0x%llX, but is 0x%llX\n", seqNum + 1, o * dataOffsets, *dataPtr);
-					OutputSize(L"Reached", (seqNum + 1) * fileIOSize);
-
-					if (!keepGoing)
-					{
-						//	We can stop
-						_aligned_free(verifyBuffer);
-						return false;
-					}
-				}
-			}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
 
-			//	Number of files we verified
-			count ++;
-		}
-	} while (FindNextFile(findHandle, &findData));
+	//	Output some information
+	OutputText(L"\nDeleted %lld total files in %.2lf seconds ", state.filesDone.load(), timer.TotalSeconds());
+	OutputSize(L"taking", state.bytesDeleted.load());
 
-	FindClose(findHandle);
+	//	Files that are still there need the manifest and the directories
+	//	they are in, so another -delete can find them
+	if (state.filesFailed.load() != 0)
+	{
+		OutputText(L"%lld files could not be deleted, the manifest was kept\n", state.filesFailed.load());
+		return false;
+	}
 
-	//	We can free off the buffer
-	_aligned_free(verifyBuffer);
+	//	The directories they were spread over are empty now
+	RemoveShards(pathName, manifest.shards);
 
-	//	Output some information
-	wprintf(L"\nVerified %lld total files", count);
-	OutputSize(L"taking", count * fileIOSize);
+	//	The files are gone, so is the manifest
+	wchar_t manifestPath [MAX_PATH];
+	ManifestName(manifestPath, pathName, manifestName);
+	if (!DeleteFile(manifestPath) && GetLastError() != ERROR_FILE_NOT_FOUND)
+	{
+		PrintError(L"\nUnable to delete manifest %s", manifestPath);
+	}
 
-	//	All good
 	return true;
 }
 
 
-//	Delete files we created
-bool DeleteFiles (const char* pathName)
+//	Write out the telemetry and results, if the user asked for them. A
+//	failed run's telemetry shows where the device slowed down or stopped,
+//	so they are written whatever the result. keepGoing is set for a run
+//	that carried on past bad files, e.g. -scanonly or -keepverifying
+bool FinishRun (RunTelemetry* telemetry, const wchar_t* telemetryPath, RunResults& results, const wchar_t* resultsPath, const char* pathName, const bool passed, const bool keepGoing, const double seconds)
 {
-	//	Create the search path
-	wchar_t searchPath [MAX_PATH];
-	swprintf_s(searchPath, L"%hs%s*.bin", pathName, filePrefix);
-
-	WIN32_FIND_DATA findData;
-	HANDLE findHandle = FindFirstFile(searchPath, &findData);
-	if (findHandle == INVALID_HANDLE_VALUE)
+	bool written = true;
+	if (telemetry != nullptr)
 	{
-		PrintError(L"Could not locate %s files to delete", searchPath);
-		return false;
+		OutputText(L"\n");
+		telemetry->OutputSummary();
+		written = telemetry->WriteFiles(telemetryPath, "spacechk", pathName);
 	}
 
-	//	Output some information
-	wprintf(L"\nDeletion phase starting\n");
-
-	//	Get a start time
-	auto start		= std::chrono::high_resolution_clock::now();
-	auto elapsed	= start;
+	//	A failed run got as far as the first bad file, unless it carried on
+	//	past bad files, which then say nothing about the capacity
+	if (!passed && !keepGoing)
+	{
+		results.CapacityFromFailure(results.resolution);
+	}
 
-	uint64_t count = 0;
-	do
+	if (resultsPath [0] != 0)
 	{
-		if (count && count % batchSize == 0)
-		{
-			//	Get the current time
-			auto end = std::chrono::high_resolution_clock::now();
-			std::chrono::duration<double> batchSeconds		= end - start;
-			std::chrono::duration<double> elapsedSeconds	= end - elapsed;
+		written = results.Write(resultsPath, "spacechk", pathName, passed, seconds) && written;
+	}
 
-			//	Inform the user
-			printf("\rTotal deletions %lld, last %lld deletions took %.2lf seconds (%.2lf total seconds)   ", count, batchSize, batchSeconds.count(), elapsedSeconds.count());
+	return written;
+}
 
-			//	Reset the batch timer
-			start = std::chrono::high_resolution_clock::now();
-		}
 
-		if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+//	Pick the file size from a short benchmark on a scratch file, which is
+//	deleted afterwards. Returns zero if it could not be run
+uint64_t TuneFileSize (const char* pathName, const DWORD bytesPerSector, const DeviceGeometry& geometry, const bool largePages)
+{
+	wchar_t tunePath [MAX_PATH];
+	ManifestName(tunePath, pathName, tuneName);
+
+	BlockOptions options;
+	options.raw			= false;
+	options.cached		= false;
+	options.create		= true;
+	options.shared		= false;
+	options.queueDepth	= 0;
+	options.adaptive	= false;
+	options.preallocate	= 0;
+
+	uint64_t tunedSize = 0;
+	{
+		std::unique_ptr<BlockEngine> tuneFile = OpenBlockEngine(tunePath, options);
+		if (!tuneFile)
 		{
-			//	The file will be missing the path name
-			wchar_t deleteName [MAX_PATH];
-			swprintf_s(deleteName, L"%hs%s", pathName, findData.cFileName);
-
-			if (!DeleteFile(deleteName))
-			{
-				PrintError(L"\nUnable to delete file %d", deleteName);
-			}
-
-			//	Number of files we deleted
-			count ++;
+			PrintError(L"\nCannot create file %s", tunePath);
+			return 0;
 		}
-	} while (FindNextFile(findHandle, &findData));
 
-	FindClose(findHandle);
+		tunedSize = AutoTuneBlockSize(*tuneFile, tuneSpan, bytesPerSector, geometry, largePages);
+	}
 
-	//	Output some information
-	wprintf(L"\nDeleted %lld total files ", count);
-	OutputSize(L"taking", count * fileIOSize);
+	if (!DeleteFile(tunePath))
+	{
+		PrintError(L"\nUnable to delete file %s", tunePath);
+	}
 
-	return true;
+	return tunedSize;
 }
 
 
 //	Output a usage message
 void Usage (const char* progName)
 {
-	wprintf(L"\nUsage: %hs [-stats] [-create] [-verify] [-keepverifying] [-delete] <path>\n", progName);
-	wprintf(L"\nExample:\n");
-	wprintf(L"\n%hs -stats E:\\\n\n", progName);
+	OutputText(L"\nUsage: %hs [-stats] [-create] [-verify] [-keepverifying] [-scanonly] [-budget <failures>[/<files>]] [-delete] [-threads <count>] [-pattern] [-largepages] [-block <KiB>] [-stride <KiB>] [-extent <GiB>] [-autotune] [-resume] [-journal <file>] [-telemetry <name>] [-json <file>] [-iotimeout <seconds>] <path>\n", progName);
+	OutputText(L"\nExample:\n");
+	OutputText(L"\n%hs -stats E:\\\n\n", progName);
 }
 
 
@@ -480,6 +1507,17 @@ int main (int argc, char** argv)
 	//	See what the user asked for
 	const char* pathName	= nullptr;
 	uint8_t		progActions	= checkActions::noActions;
+	DWORD		numThreads	= 1;
+	uint64_t	blockSize	= 0;
+	uint64_t	stride		= 0;
+	uint64_t	extentSize	= 0;
+	bool		autoTune	= false;
+	bool		scanOnly	= false;
+	uint32_t	budgetFailures	= 0;
+	uint64_t	budgetWindow	= 0;
+	wchar_t		journalPath [MAX_PATH] = {};
+	wchar_t		telemetryPath [MAX_PATH] = {};
+	wchar_t		resultsPath [MAX_PATH] = {};
 	for (int i = 1; i < argc; i ++)
 	{
 		if (strcmp(argv [i], "-stats") == 0)
@@ -506,13 +1544,185 @@ int main (int argc, char** argv)
 			progActions |= checkActions::keepVerifying;
 		}
 		else
+		if (strcmp(argv[i], "-scanonly") == 0)
+		{
+			//	User wants to read back files an earlier run left, e.g. after
+			//	the device sat unpowered, checking every one and writing
+			//	nothing
+			scanOnly	= true;
+			progActions	|= checkActions::verifyFiles | checkActions::keepVerifying;
+		}
+		else
+		if (strcmp(argv[i], "-budget") == 0)
+		{
+			//	User wants to carry on past isolated bad files, and only
+			//	stop once a number of them fail within a window of files
+			unsigned int		failures	= 0;
+			unsigned long long	window		= defaultBudgetWindow;
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%u/%llu", &failures, &window) < 1
+			||	failures < 1
+			||	window < failures)
+			{
+				OutputText(L"The -budget option needs a number of failures and optionally a window of files at least that large, e.g. 8/64\n");
+				return 1;
+			}
+			budgetFailures	= failures;
+			budgetWindow	= window;
+			i ++;
+		}
+		else
 		if (strcmp(argv[i], "-delete") == 0)
 		{
 			//	User wants to delete files
 			progActions |= checkActions::deleteFiles;
 		}
 		else
+		if (strcmp(argv[i], "-largepages") == 0)
+		{
+			//	User wants the I/O buffers to stay resident in memory
+			progActions |= checkActions::largePages;
+		}
+		else
+		if (strcmp(argv[i], "-pattern") == 0)
+		{
+			//	User wants every byte of the files checked
+			progActions |= checkActions::fullPattern;
+		}
+		else
+		if (strcmp(argv[i], "-block") == 0)
+		{
+			//	User wants files of a number of KiB
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%llu", &blockSize) != 1
+			||	blockSize < 1
+			||	blockSize > maxFileSize / KiB)
+			{
+				OutputText(L"The -block option needs a size from 1 to %lld KiB\n", maxFileSize / KiB);
+				return 1;
+			}
+			blockSize *= KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-stride") == 0)
+		{
+			//	User wants the markers in each file a number of KiB apart
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%llu", &stride) != 1
+			||	stride < 1
+			||	stride > maxFileSize / KiB)
+			{
+				OutputText(L"The -stride option needs a size from 1 to %lld KiB\n", maxFileSize / KiB);
+				return 1;
+			}
+			stride *= KiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-extent") == 0)
+		{
+			//	User wants the files written as regions of a few large
+			//	files of a number of GiB
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%llu", &extentSize) != 1
+			||	extentSize < 1
+			||	extentSize > maxExtentSize / GiB)
+			{
+				OutputText(L"The -extent option needs a size from 1 to %lld GiB\n", maxExtentSize / GiB);
+				return 1;
+			}
+			extentSize *= GiB;
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-autotune") == 0)
+		{
+			//	User wants the file size picked by a short benchmark
+			autoTune = true;
+		}
+		else
+		if (strcmp(argv[i], "-resume") == 0)
+		{
+			//	User wants to carry on from where an earlier run stopped
+			progActions |= checkActions::resume;
+		}
+		else
+		if (strcmp(argv[i], "-journal") == 0)
+		{
+			//	User wants the journal somewhere other than the default
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -journal option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(journalPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-telemetry") == 0)
+		{
+			//	User wants latency and throughput written to <name>.csv
+			//	and <name>.json
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -telemetry option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(telemetryPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-json") == 0)
+		{
+			//	User wants the results in a file a program can read
+			if (i + 1 >= argc)
+			{
+				OutputText(L"The -json option needs a file name\n");
+				return 1;
+			}
+			swprintf_s(resultsPath, L"%hs", argv [i + 1]);
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-threads") == 0)
+		{
+			//	User wants a number of worker threads
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &numThreads) != 1
+			||	numThreads < 1
+			||	numThreads > maxThreads)
+			{
+				OutputText(L"The -threads option needs a count from 1 to %d\n", maxThreads);
+				return 1;
+			}
+			i ++;
+		}
+		else
+		if (strcmp(argv[i], "-iotimeout") == 0)
+		{
+			//	User wants a write or read cancelled after a different number
+			//	of seconds, or never with zero
+			DWORD ioTimeout = 0;
+			if (i + 1 >= argc
+			||	sscanf_s(argv [i + 1], "%lu", &ioTimeout) != 1)
+			{
+				OutputText(L"The -iotimeout option needs a number of seconds, or 0 for none\n");
+				return 1;
+			}
+			SetIoTimeout(ioTimeout);
+			i ++;
+		}
+		else
 		{
+			//	Only maxspace tests several drives at once, and a second
+			//	path here would otherwise replace the first
+			if (pathName != nullptr)
+			{
+				OutputText(L"spacechk tests one drive at a time, use maxspace to test %hs and %hs at once\n", pathName, argv [i]);
+				return 1;
+			}
+
 			//	Check pathname
 			pathName = argv [i];
 
@@ -526,7 +1736,7 @@ int main (int argc, char** argv)
 			switch (driveType)
 			{
 				default:
-					printf("%s is an invalid option or drive path\n", pathName);
+					OutputText(L"%hs is an invalid option or drive path\n", pathName);
 					return 1;
 
 				case DRIVE_REMOVABLE:
@@ -553,7 +1763,7 @@ int main (int argc, char** argv)
 	DWORD totalClusters;
 	if (GetDiskFreeSpaceA(pathName, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters) == 0)
 	{
-		printf("Error: Could not get disk stats 0x%X\n", GetLastError());
+		OutputText(L"Error: Could not get disk stats 0x%X\n", GetLastError());
 		return 1;
 	}
 
@@ -571,8 +1781,8 @@ int main (int argc, char** argv)
 	if ((progActions & checkActions::outputStats) != 0)
 	{
 		//	Output some stats
-		printf("Bytes/sector     : %d\n", bytesPerSector);
-		printf("Sectors/cluster  : %d\n", sectorsPerCluster);
+		OutputText(L"Bytes/sector     : %d\n", bytesPerSector);
+		OutputText(L"Sectors/cluster  : %d\n", sectorsPerCluster);
 
 		//	Get the human readable version of the total size
 		OutputSize(L"Total space      : ", totalSpace);
@@ -581,33 +1791,186 @@ int main (int argc, char** argv)
 		OutputSize(L"Free space       : ", freeSpace);
 	}
 
+	//	The sector and transfer sizes the device reports decide which file
+	//	sizes suit it
+	DeviceGeometry geometry;
+	if (QueryDeviceGeometry(pathName, geometry) && (progActions & checkActions::outputStats) != 0)
+	{
+		OutputGeometry(geometry);
+	}
 
-	//	Create files
-	if ((progActions & checkActions::createFiles) != 0)
+	//	-keepverifying already checks every file, whatever fails
+	if (budgetFailures != 0 && (progActions & checkActions::keepVerifying) != 0)
+	{
+		OutputText(L"The -budget and -keepverifying options cannot be combined\n");
+		return 1;
+	}
+
+	//	A scan only reads what the manifest describes, so it neither writes
+	//	nor deletes files, and has no journal to resume from
+	if (scanOnly && ((progActions & (checkActions::createFiles | checkActions::deleteFiles | checkActions::resume)) != 0 || budgetFailures != 0))
+	{
+		OutputText(L"The -scanonly option cannot be combined with -create, -delete, -resume or -budget\n");
+		return 1;
+	}
+
+	//	Each file is written in one unbuffered I/O, so it has to be a
+	//	whole number of sectors
+	if (blockSize != 0 && autoTune)
+	{
+		OutputText(L"The -block and -autotune options cannot be combined\n");
+		return 1;
+	}
+
+	if (blockSize != 0 && !BlockSizeFits(blockSize, bytesPerSector, geometry))
+	{
+		OutputText(L"The -block size must be a multiple of the %lu byte sector\n", max(bytesPerSector, geometry.physicalSector));
+		return 1;
+	}
+
+	uint64_t fileSize		= blockSize != 0 ? blockSize : fileIOSize;
+	uint64_t markerStride	= stride != 0 ? stride : fileSize / 4;
+	if (markerStride > fileSize)
+	{
+		OutputText(L"The -stride can't be more than the file size\n");
+		return 1;
+	}
+
+
+	//	Creation and verification keep a journal on the host, so a run
+	//	that is interrupted can carry on. A scan is just started again
+	HANDLE			journal		= INVALID_HANDLE_VALUE;
+	JournalRecord	runRecord	= {};
+	if ((progActions & (checkActions::createFiles | checkActions::verifyFiles)) != 0 && !scanOnly)
 	{
-		if (!CreateFiles(pathName, bytesPerSector, freeSpace))
+		if (journalPath [0] == 0)
+		{
+			DefaultJournalName(journalPath, "spacechk", pathName);
+		}
+
+		if (JournalOnDevice(journalPath, pathName))
+		{
+			OutputText(L"The journal %s must not be on the device under test, use -journal\n", journalPath);
+			return 1;
+		}
+
+		const bool resume = (progActions & checkActions::resume) != 0;
+		if (resume)
+		{
+			if (!ReadJournal(journalPath, runRecord))
+			{
+				PrintError(L"Could not read the journal %s to resume from", journalPath);
+				return 1;
+			}
+
+			if (_stricmp(runRecord.target, pathName) != 0)
+			{
+				OutputText(L"The journal %s is for %hs, not %hs\n", journalPath, runRecord.target, pathName);
+				return 1;
+			}
+
+			if (runRecord.finished)
+			{
+				OutputText(L"The run in %s has already finished\n", journalPath);
+				return 1;
+			}
+		}
+		else
+		{
+			strcpy_s(runRecord.target, pathName);
+			runRecord.phases = journalPhases::count;
+		}
+
+		journal = OpenJournal(journalPath, runRecord, resume);
+		if (journal == INVALID_HANDLE_VALUE)
 		{
-			wprintf(L"File creation failed\n");
+			PrintError(L"Could not open the journal %s", journalPath);
 			return 1;
 		}
 	}
 
+	//	Latency and throughput are only measured if they will be written out
+	RunTelemetry	runTelemetry;
+	RunTelemetry*	telemetry	= telemetryPath [0] != 0 ? &runTelemetry : nullptr;
+
+	//	What the run finds is collected for -json, starting with the
+	//	geometry of the device
+	BatchTimer	runTimer;
+	RunResults	results;
+	results.bytesPerSector		= bytesPerSector;
+	results.sectorsPerCluster	= sectorsPerCluster;
+	results.totalSpace			= totalSpace;
+	results.freeSpace			= freeSpace;
+
+	//	Create files. The manifest on the device already lets creation
+	//	pick up where it stopped, so a resume only needs to skip it once
+	//	verification has started
+	if ((progActions & checkActions::createFiles) != 0)
+	{
+		if (runRecord.phase >= journalPhases::verify)
+		{
+			OutputText(L"\nFile creation finished in the run being resumed\n");
+		}
+		else
+		{
+			//	The benchmark picks the file size, and the markers are
+			//	spread over it unless the user asked for a stride
+			if (autoTune)
+			{
+				const uint64_t tunedSize = TuneFileSize(pathName, bytesPerSector, geometry, (progActions & checkActions::largePages) != 0);
+				if (tunedSize != 0)
+				{
+					fileSize		= tunedSize;
+					markerStride	= stride != 0 ? min(stride, fileSize) : fileSize / 4;
+				}
+				else
+				{
+					OutputText(L"\nCould not tune the file size, using the default\n");
+				}
+			}
+
+			if (!CreateFiles(pathName, bytesPerSector, fileSize, markerStride, extentSize, numThreads, (progActions & checkActions::fullPattern) != 0, (progActions & checkActions::largePages) != 0, telemetry, results, journal))
+			{
+				OutputText(L"File creation failed\n");
+				CloseJournal(journal, false);
+				FinishRun(telemetry, telemetryPath, results, resultsPath, pathName, false, false, runTimer.TotalSeconds());
+				return 1;
+			}
+		}
+	}
+
 	//	Verify files
 	if ((progActions & checkActions::verifyFiles) != 0)
 	{
-		if (!VerifyFiles(pathName, bytesPerSector, (progActions & checkActions::keepVerifying) != 0))
+		const uint64_t startFile = runRecord.phase == journalPhases::verify ? runRecord.next : 0;
+		if (!VerifyFiles(pathName, bytesPerSector, (progActions & checkActions::keepVerifying) != 0, budgetFailures, budgetWindow, (progActions & checkActions::largePages) != 0, telemetry, results, journal, startFile))
 		{
-			wprintf(L"File verification failed\n");
+			//	Only a run that stopped on an I/O error, e.g. a device that
+			//	dropped off the bus, has anything left to resume
+			const bool resumable = journal != INVALID_HANDLE_VALUE && results.IoFailedFirst();
+			OutputText(L"File verification failed\n");
+			CloseJournal(journal, !resumable);
+			if (resumable)
+			{
+				OutputText(L"The run stopped on an I/O error, use -resume to carry on from %s\n", journalPath);
+			}
+			FinishRun(telemetry, telemetryPath, results, resultsPath, pathName, false, (progActions & checkActions::keepVerifying) != 0, runTimer.TotalSeconds());
 			return 1;
 		}
 	}
 
+	CloseJournal(journal, true);
+	if (!FinishRun(telemetry, telemetryPath, results, resultsPath, pathName, true, false, runTimer.TotalSeconds()))
+	{
+		return 1;
+	}
+
 	//	Delete files we created
 	if ((progActions & checkActions::deleteFiles) != 0)
 	{
-		if (!DeleteFiles(pathName))
+		if (!DeleteFiles(pathName, numThreads))
 		{
-			wprintf(L"File deletion failed\n");
+			OutputText(L"File deletion failed\n");
 			return 1;
 		}
 	}
@@ -0,0 +1,114 @@
+//	Queue depth and transfer size that follow a device's latency
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "adaptive.h"
+
+//	Transfers measured before the depth or transfer size is changed
+constexpr uint32_t	controllerWindow	= 32;
+
+//	A window this many times slower per byte than the long run average is
+//	a spike, and one within calmFactor of it shows the device has recovered
+constexpr double	spikeFactor			= 4.0;
+constexpr double	calmFactor			= 1.5;
+
+//	Weight of each window in the long run average. Spikes count too, so a
+//	device that stays slow, e.g. once its SLC cache is full, becomes the new
+//	normal after a few windows and the depth comes back up
+constexpr double	averageWeight		= 0.125;
+
+//	A request is split at most 16 ways, into transfers of no less than this
+constexpr uint32_t	maxSplitShift		= 4;
+constexpr DWORD		minTransferSize		= 64 * 1024;
+
+
+IoController::IoController (DWORD depthLimit)
+{
+	maxDepth		= depthLimit != 0 ? depthLimit : 1;
+	depth			= maxDepth;
+	lowestDepth		= depth;
+	splitShift		= 0;
+	mostShift		= 0;
+	backoffs		= 0;
+	windowCount		= 0;
+	windowBytes		= 0;
+	windowLatency	= 0;
+	averageLatency	= 0;
+}
+
+
+DWORD IoController::TransferSize (DWORD size) const
+{
+	if (splitShift == 0 || size <= minTransferSize)
+	{
+		return size;
+	}
+
+	const DWORD transferSize = (((size >> splitShift) + minTransferSize - 1) / minTransferSize) * minTransferSize;
+	return min(transferSize, size);
+}
+
+
+//	Multiplicative decrease on a spike and additive increase once calm, as
+//	TCP does with its window. The depth goes first, as a queue on a
+//	struggling device only adds to the latency, and splitting only starts
+//	once a single request is in flight
+void IoController::Finished (DWORD bytes, uint64_t latency)
+{
+	if (bytes == 0)
+	{
+		return;
+	}
+
+	windowBytes		+= bytes;
+	windowLatency	+= latency;
+	if (++ windowCount < controllerWindow)
+	{
+		return;
+	}
+
+	const double windowAverage = (double) windowLatency / (double) windowBytes;
+	windowCount		= 0;
+	windowBytes		= 0;
+	windowLatency	= 0;
+
+	//	The first window only sets the average
+	if (averageLatency == 0)
+	{
+		averageLatency = windowAverage;
+		return;
+	}
+
+	if (windowAverage > spikeFactor * averageLatency)
+	{
+		if (depth > 1)
+		{
+			depth = depth / 2;
+		}
+		else
+		if (splitShift < maxSplitShift)
+		{
+			splitShift ++;
+		}
+
+		backoffs ++;
+		lowestDepth	= min(lowestDepth, depth);
+		mostShift	= max(mostShift, splitShift);
+	}
+	else
+	if (windowAverage < calmFactor * averageLatency)
+	{
+		if (splitShift > 0)
+		{
+			splitShift --;
+		}
+		else
+		if (depth < maxDepth)
+		{
+			depth ++;
+		}
+	}
+
+	averageLatency += averageWeight * (windowAverage - averageLatency);
+}
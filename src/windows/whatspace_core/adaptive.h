@@ -0,0 +1,53 @@
+//	Queue depth and transfer size that follow a device's latency. When a
+//	window of requests takes much longer per byte than the device has been
+//	managing, fewer requests are kept in flight and then each one is split
+//	into smaller transfers, and once the device is back to its usual speed
+//	they are raised again one step at a time
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+class IoController
+{
+public:
+	//	Start with depthLimit requests in flight, each in one transfer
+	explicit IoController (DWORD depthLimit);
+
+	//	Requests that should be in flight now
+	DWORD Depth () const		{ return depth; }
+
+	//	Largest transfer a request of size bytes should be split into. A
+	//	split transfer is a whole number of 64 KiB, so it stays a whole
+	//	number of sectors for unbuffered I/O
+	DWORD TransferSize (DWORD size) const;
+
+	//	Count a transfer of bytes that took latency nanoseconds, and adjust
+	//	the depth and transfer size at the end of each window
+	void Finished (DWORD bytes, uint64_t latency);
+
+	//	How many times latency spikes cut the depth or transfer size, and
+	//	the fewest requests in flight and the most ways a request was split
+	uint64_t Backoffs () const	{ return backoffs; }
+	DWORD LowestDepth () const	{ return lowestDepth; }
+	DWORD MostSplit () const	{ return 1 << mostShift; }
+
+private:
+	DWORD		maxDepth;
+	DWORD		depth;
+	DWORD		lowestDepth;
+	uint32_t	splitShift;
+	uint32_t	mostShift;
+	uint64_t	backoffs;
+
+	//	The window being measured, and the long run nanoseconds per byte
+	//	the windows are compared with
+	uint32_t	windowCount;
+	uint64_t	windowBytes;
+	uint64_t	windowLatency;
+	double		averageLatency;
+};
@@ -0,0 +1,694 @@
+//	Block I/O engine used by the tools to write and read a file or a whole
+//	drive. The synchronous engine does one request at a time, the
+//	overlapped engine keeps many in flight through a completion port, and
+//	either can run on a raw physical drive. Every request is watched, and
+//	cancelled if the device takes too long with it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "blockio.h"
+#include "fakedevice.h"
+#include "output.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <deque>
+
+
+//	Put the offset of a transfer in its request's OVERLAPPED structure, so
+//	the shared file pointer is never used
+static void SetRequestOffset (BlockRequest& request, int64_t offset)
+{
+	ZeroMemory(&request.overlapped, sizeof(request.overlapped));
+	request.overlapped.Offset		= (DWORD) (offset & 0xFFFFFFFF);
+	request.overlapped.OffsetHigh	= (DWORD) (offset >> 32);
+}
+
+
+BlockEngine::BlockEngine (HANDLE handle, const wchar_t* name, int64_t size)
+{
+	targetHandle	= handle;
+	targetSize		= size;
+	telemetry		= nullptr;
+	results			= nullptr;
+	throttle		= ThreadThrottle();
+	watchEach		= false;
+	transferCount	= 0;
+	swprintf_s(targetName, L"%s", name);
+}
+
+
+BlockEngine::~BlockEngine ()
+{
+	//	A fake device has nothing open
+	if (targetHandle != INVALID_HANDLE_VALUE && !CloseHandle(targetHandle))
+	{
+		PrintError(L"Could not close %s", targetName);
+	}
+}
+
+
+//	Note when a transfer starts, and start watching it. A fake device has
+//	no handle for the watchdog to cancel
+void BlockEngine::MarkStarted (BlockRequest& request)
+{
+	if (throttle != nullptr)
+	{
+		throttle->Take(request.transferSize);
+	}
+
+	request.started	= NowNanoseconds();
+	request.watch	= targetHandle != INVALID_HANDLE_VALUE ? WatchRequest(targetHandle, watchEach ? &request.overlapped : nullptr) : 0;
+}
+
+
+//	Count the latency of a transfer that has finished, and what it moved
+bool BlockEngine::MarkFinished (const BlockRequest& request, DWORD transferred)
+{
+	const bool timedOut = UnwatchRequest(request.watch);
+	if (telemetry != nullptr)
+	{
+		telemetry->AddLatency(request.reading, NowNanoseconds() - request.started);
+	}
+
+	if (results != nullptr)
+	{
+		(request.reading ? results->bytesRead : results->bytesWritten) += transferred;
+	}
+
+	return timedOut;
+}
+
+
+//	Start one request and wait for it
+bool BlockEngine::Transfer (BlockRequest& request, DWORD& transferred)
+{
+	transferred = 0;
+	transferCount ++;
+	if (!Start(request))
+	{
+		return false;
+	}
+
+	BlockCompletion completion = Wait();
+	transferred = completion.transferred;
+	return completion.request != nullptr && completion.succeeded;
+}
+
+
+//	Read one block and wait for it
+bool BlockEngine::Read (int64_t offset, uint8_t* buffer, DWORD size, DWORD& transferred)
+{
+	BlockRequest request = {};
+	request.buffer	= buffer;
+	request.offset	= offset;
+	request.size	= size;
+	request.reading	= true;
+	return Transfer(request, transferred);
+}
+
+
+//	Write one block and wait for it
+bool BlockEngine::Write (int64_t offset, const uint8_t* buffer, DWORD size, DWORD& transferred)
+{
+	BlockRequest request = {};
+	request.buffer	= (uint8_t*) buffer;
+	request.offset	= offset;
+	request.size	= size;
+	request.reading	= false;
+	return Transfer(request, transferred);
+}
+
+
+//	Wait for everything written to reach the device
+bool BlockEngine::Flush ()
+{
+	return FlushFileBuffers(targetHandle) != 0;
+}
+
+
+//	One request at a time. Each request is done when it is started, and
+//	waiting hands back the results in the same order
+class SyncEngine : public BlockEngine
+{
+public:
+	SyncEngine (HANDLE handle, const wchar_t* name, int64_t size)
+		: BlockEngine(handle, name, size)
+	{
+	}
+
+	bool Start (BlockRequest& request) override
+	{
+		//	The offset in the OVERLAPPED structure is used even though the
+		//	handle is synchronous, so there is no separate seek
+		SetRequestOffset(request, request.offset);
+		request.active			= true;
+		request.done			= 0;
+		request.transferSize	= request.size;
+		MarkStarted(request);
+
+		FinishedRequest finished;
+		finished.completion.request = &request;
+		if (request.reading)
+		{
+			finished.completion.succeeded = ReadFile(targetHandle, request.buffer, request.size, &finished.completion.transferred, &request.overlapped) != 0;
+		}
+		else
+		{
+			finished.completion.succeeded = WriteFile(targetHandle, request.buffer, request.size, &finished.completion.transferred, &request.overlapped) != 0;
+		}
+		finished.error = finished.completion.succeeded ? ERROR_SUCCESS : GetLastError();
+
+		//	A call the watchdog cancelled fails as aborted, but it was the
+		//	device that let it down
+		if (MarkFinished(request, finished.completion.transferred) && !finished.completion.succeeded)
+		{
+			finished.error = ERROR_TIMEOUT;
+		}
+
+		finishedRequests.push_back(finished);
+		return true;
+	}
+
+	BlockCompletion Wait () override
+	{
+		if (finishedRequests.empty())
+		{
+			SetLastError(ERROR_INVALID_FUNCTION);
+			return { nullptr, false, 0 };
+		}
+
+		FinishedRequest finished = finishedRequests.front();
+		finishedRequests.pop_front();
+		finished.completion.request->active = false;
+		SetLastError(finished.error);
+		return finished.completion;
+	}
+
+	void Cancel () override
+	{
+		//	Nothing is ever in flight
+		finishedRequests.clear();
+	}
+
+private:
+	//	A request and the error it finished with
+	struct FinishedRequest
+	{
+		BlockCompletion	completion;
+		DWORD			error;
+	};
+
+	std::deque<FinishedRequest>	finishedRequests;
+};
+
+
+//	Many requests in flight. All completions for the target are delivered
+//	to one port, in whatever order the device finishes them. An adaptive
+//	engine holds back requests past the depth its controller allows, and
+//	starts them as others finish, and moves each request in as many
+//	transfers as the controller asks for, so the callers never see either
+class OverlappedEngine : public BlockEngine
+{
+public:
+	OverlappedEngine (HANDLE handle, const wchar_t* name, int64_t size, HANDLE port, DWORD queueDepth, bool adaptive)
+		: BlockEngine(handle, name, size)
+	{
+		completionPort	= port;
+		inFlight		= 0;
+		watchEach		= true;
+		if (adaptive)
+		{
+			controller = std::make_unique<IoController>(queueDepth);
+		}
+	}
+
+	~OverlappedEngine () override
+	{
+		CloseHandle(completionPort);
+	}
+
+	bool Start (BlockRequest& request) override
+	{
+		request.active	= true;
+		request.done	= 0;
+		if (controller && inFlight >= controller->Depth())
+		{
+			heldRequests.push_back(&request);
+			return true;
+		}
+
+		if (!StartTransfer(request))
+		{
+			request.active = false;
+			return false;
+		}
+
+		return true;
+	}
+
+	BlockCompletion Wait () override
+	{
+		for (;;)
+		{
+			//	A held request that could not be started is handed back
+			//	first, as a failure
+			if (!failedRequests.empty())
+			{
+				FailedRequest failed = failedRequests.front();
+				failedRequests.pop_front();
+				failed.request->active = false;
+				SetLastError(failed.error);
+				return { failed.request, false, failed.request->done };
+			}
+
+			DWORD			bytesDone	= 0;
+			ULONG_PTR		portKey		= 0;
+			LPOVERLAPPED	overlapped	= nullptr;
+			BOOL ioResult = GetQueuedCompletionStatus(completionPort, &bytesDone, &portKey, &overlapped, INFINITE);
+			if (overlapped == nullptr)
+			{
+				//	The port itself failed, nothing more will complete
+				return { nullptr, false, 0 };
+			}
+
+			//	The latency includes any time the completion sat in the port.
+			//	A transfer the watchdog cancelled fails as aborted, but it
+			//	was the device that let it down
+			BlockRequest* request = (BlockRequest*) overlapped;
+			DWORD error = ioResult ? ERROR_SUCCESS : GetLastError();
+			transfers.erase(std::find(transfers.begin(), transfers.end(), request));
+			inFlight --;
+			if (MarkFinished(*request, bytesDone) && !ioResult)
+			{
+				error = ERROR_TIMEOUT;
+			}
+
+			if (controller && ioResult)
+			{
+				controller->Finished(bytesDone, NowNanoseconds() - request->started);
+			}
+
+			//	The rest of a split request goes straight back out
+			request->done += bytesDone;
+			if (ioResult && bytesDone == request->transferSize && request->done < request->size)
+			{
+				if (StartTransfer(*request))
+				{
+					continue;
+				}
+				error		= GetLastError();
+				ioResult	= FALSE;
+			}
+
+			StartHeldRequests();
+			request->active = false;
+			SetLastError(error);
+			return { request, ioResult != 0, request->done };
+		}
+	}
+
+	//	Held and failed requests never reach the device, so they are just
+	//	dropped, and are no longer active for a caller that reuses them.
+	//	A cancelled transfer still writes its status into its OVERLAPPED
+	//	structure, and a read may still be filling its buffer, so each one
+	//	is waited for. The port may be what failed, so each request is
+	//	checked rather than waiting for its completion packet
+	void Cancel () override
+	{
+		for (BlockRequest* request : heldRequests)
+		{
+			request->active = false;
+		}
+		for (const FailedRequest& failed : failedRequests)
+		{
+			failed.request->active = false;
+		}
+		heldRequests.clear();
+		failedRequests.clear();
+		CancelIoEx(targetHandle, nullptr);
+
+		for (BlockRequest* request : transfers)
+		{
+			while (!HasOverlappedIoCompleted(&request->overlapped))
+			{
+				Sleep(1);
+			}
+			UnwatchRequest(request->watch);
+			request->active = false;
+		}
+		transfers.clear();
+		inFlight = 0;
+	}
+
+	const IoController* Controller () const override
+	{
+		return controller.get();
+	}
+
+private:
+	//	A held request that could not be started, and why
+	struct FailedRequest
+	{
+		BlockRequest*	request;
+		DWORD			error;
+	};
+
+	//	Start the next transfer of a request, from what it has moved so far
+	bool StartTransfer (BlockRequest& request)
+	{
+		const DWORD remaining = request.size - request.done;
+		SetRequestOffset(request, request.offset + request.done);
+		request.transferSize = controller ? controller->TransferSize(remaining) : remaining;
+		MarkStarted(request);
+
+		BOOL started;
+		if (request.reading)
+		{
+			started = ReadFile(targetHandle, request.buffer + request.done, request.transferSize, nullptr, &request.overlapped);
+		}
+		else
+		{
+			started = WriteFile(targetHandle, request.buffer + request.done, request.transferSize, nullptr, &request.overlapped);
+		}
+
+		//	A request that completes straight away still posts a completion
+		//	packet, so only a real failure needs to be handled here
+		if (!started && GetLastError() != ERROR_IO_PENDING)
+		{
+			auto savedError = GetLastError();
+			UnwatchRequest(request.watch);
+			SetLastError(savedError);
+			return false;
+		}
+
+		transfers.push_back(&request);
+		inFlight ++;
+		return true;
+	}
+
+	//	Start held requests while there is room for them
+	void StartHeldRequests ()
+	{
+		while (!heldRequests.empty() && inFlight < controller->Depth())
+		{
+			BlockRequest* request = heldRequests.front();
+			heldRequests.pop_front();
+			if (!StartTransfer(*request))
+			{
+				failedRequests.push_back({ request, GetLastError() });
+			}
+		}
+	}
+
+	HANDLE							completionPort;
+	DWORD							inFlight;
+	std::vector<BlockRequest*>		transfers;
+	std::unique_ptr<IoController>	controller;
+	std::deque<BlockRequest*>		heldRequests;
+	std::deque<FailedRequest>		failedRequests;
+};
+
+
+//	A fake device in memory. Like the synchronous engine, each request is
+//	done when it is started, whatever the queue depth
+class FakeEngine : public BlockEngine
+{
+public:
+	FakeEngine (const std::shared_ptr<FakeDevice>& fakeDevice, const wchar_t* name)
+		: BlockEngine(INVALID_HANDLE_VALUE, name, (int64_t) fakeDevice->Spec().size)
+	{
+		device = fakeDevice;
+	}
+
+	bool Start (BlockRequest& request) override
+	{
+		request.active			= true;
+		request.done			= 0;
+		request.transferSize	= request.size;
+		MarkStarted(request);
+
+		//	A dropout looks like a device that has gone away, and a
+		//	misaligned request fails as it would unbuffered
+		FinishedRequest	finished;
+		uint32_t		transferred;
+		const FakeStatus status = device->Transfer(request.reading, request.offset, request.buffer, request.size, transferred);
+		finished.completion.request		= &request;
+		finished.completion.succeeded	= status == FakeStatus::done;
+		finished.completion.transferred	= transferred;
+		finished.error = status == FakeStatus::done ? ERROR_SUCCESS : status == FakeStatus::dropout ? ERROR_DEVICE_NOT_CONNECTED : ERROR_INVALID_PARAMETER;
+		MarkFinished(request, transferred);
+
+		finishedRequests.push_back(finished);
+		return true;
+	}
+
+	BlockCompletion Wait () override
+	{
+		if (finishedRequests.empty())
+		{
+			SetLastError(ERROR_INVALID_FUNCTION);
+			return { nullptr, false, 0 };
+		}
+
+		FinishedRequest finished = finishedRequests.front();
+		finishedRequests.pop_front();
+		finished.completion.request->active = false;
+		SetLastError(finished.error);
+		return finished.completion;
+	}
+
+	void Cancel () override
+	{
+		finishedRequests.clear();
+	}
+
+	//	The write-back cache claims everything is on the media. That is
+	//	the lie it tells
+	bool Flush () override
+	{
+		return true;
+	}
+
+private:
+	//	A request and the error it finished with
+	struct FinishedRequest
+	{
+		BlockCompletion	completion;
+		DWORD			error;
+	};
+
+	std::shared_ptr<FakeDevice>	device;
+	std::deque<FinishedRequest>	finishedRequests;
+};
+
+
+//	Open a file or drive for block I/O
+std::unique_ptr<BlockEngine> OpenBlockEngine (const wchar_t* targetName, const BlockOptions& options)
+{
+	//	A fake device is modelled in memory rather than opened
+	char narrowName [MAX_PATH];
+	sprintf_s(narrowName, "%ls", targetName);
+	if (IsFakeDevice(narrowName))
+	{
+		std::shared_ptr<FakeDevice> device = OpenFakeDevice(narrowName);
+		if (!device)
+		{
+			SetLastError(ERROR_INVALID_PARAMETER);
+			return nullptr;
+		}
+		return std::make_unique<FakeEngine>(device, targetName);
+	}
+
+	//	See what type of caching we were asked to use
+	DWORD fileAttributes;
+	if (options.cached)
+	{
+		//	File system cache allowed
+		fileAttributes = FILE_ATTRIBUTE_NORMAL;
+	}
+	else
+	{
+		//	File system cache is not allowed
+		fileAttributes = FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+	}
+
+	if (options.queueDepth != 0)
+	{
+		fileAttributes |= FILE_FLAG_OVERLAPPED;
+	}
+
+	//	A drive is shared with the locked volume handles
+	const DWORD shareMode	= options.raw || options.shared ? FILE_SHARE_READ | FILE_SHARE_WRITE : 0;
+	const DWORD disposition	= options.create && !options.raw ? CREATE_ALWAYS : OPEN_EXISTING;
+	HANDLE targetHandle = CreateFile(targetName, GENERIC_READ | GENERIC_WRITE, shareMode, nullptr, disposition, fileAttributes, nullptr);
+	if (targetHandle == INVALID_HANDLE_VALUE)
+	{
+		return nullptr;
+	}
+
+	//	Move the end of a new file out and mark everything up to it as
+	//	valid, so the file takes its space in one go without being written
+	if (options.create && !options.raw && options.preallocate != 0)
+	{
+		LARGE_INTEGER endOffset;
+		endOffset.QuadPart = options.preallocate;
+		if (!SetFilePointerEx(targetHandle, endOffset, nullptr, FILE_BEGIN)
+		||	!SetEndOfFile(targetHandle)
+		||	!SetFileValidData(targetHandle, endOffset.QuadPart))
+		{
+			auto savedError = GetLastError();
+			CloseHandle(targetHandle);
+			SetLastError(savedError);
+			return nullptr;
+		}
+	}
+
+	//	We need to know how big the file or drive is
+	LARGE_INTEGER	targetSize;
+	BOOL			haveSize;
+	if (options.raw)
+	{
+		GET_LENGTH_INFORMATION lengthInfo;
+		DWORD returned;
+		haveSize = DeviceIoControl(targetHandle, IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &lengthInfo, sizeof(lengthInfo), &returned, nullptr);
+		targetSize = lengthInfo.Length;
+	}
+	else
+	{
+		haveSize = GetFileSizeEx(targetHandle, &targetSize);
+	}
+
+	HANDLE completionPort = nullptr;
+	if (haveSize && options.queueDepth != 0)
+	{
+		completionPort = CreateIoCompletionPort(targetHandle, nullptr, 0, 1);
+	}
+
+	if (!haveSize || (options.queueDepth != 0 && completionPort == nullptr))
+	{
+		//	Keep the error that stopped us for the caller
+		auto savedError = GetLastError();
+		CloseHandle(targetHandle);
+		SetLastError(savedError);
+		return nullptr;
+	}
+
+	if (options.queueDepth != 0)
+	{
+		return std::make_unique<OverlappedEngine>(targetHandle, targetName, targetSize.QuadPart, completionPort, options.queueDepth, options.adaptive);
+	}
+
+	return std::make_unique<SyncEngine>(targetHandle, targetName, targetSize.QuadPart);
+}
+
+
+//	Get the sector size and length of a physical drive for a raw run
+bool GetRawDriveInfo (const char* pathName, DWORD& bytesPerSector, int64_t& driveSize)
+{
+	wchar_t driveName [MAX_PATH];
+	swprintf_s(driveName, L"%hs", pathName);
+
+	HANDLE driveHandle = CreateFile(driveName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (driveHandle == INVALID_HANDLE_VALUE)
+	{
+		PrintError(L"Could not open %s", driveName);
+		return false;
+	}
+
+	DISK_GEOMETRY_EX		geometry;
+	GET_LENGTH_INFORMATION	lengthInfo;
+	DWORD					returned;
+	if (!DeviceIoControl(driveHandle, IOCTL_DISK_GET_DRIVE_GEOMETRY_EX, nullptr, 0, &geometry, sizeof(geometry), &returned, nullptr))
+	{
+		PrintError(L"Could not get the geometry of %s", driveName);
+		CloseHandle(driveHandle);
+		return false;
+	}
+
+	//	The length from the disk itself is the advertised capacity, the
+	//	geometry can round it down to a whole number of cylinders
+	if (!DeviceIoControl(driveHandle, IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &lengthInfo, sizeof(lengthInfo), &returned, nullptr))
+	{
+		PrintError(L"Could not get the length of %s", driveName);
+		CloseHandle(driveHandle);
+		return false;
+	}
+
+	CloseHandle(driveHandle);
+
+	bytesPerSector	= geometry.Geometry.BytesPerSector;
+	driveSize		= lengthInfo.Length.QuadPart;
+	return true;
+}
+
+
+//	Windows won't let us write to sectors that belong to a mounted
+//	volume, so every volume on the drive is locked and dismounted. The
+//	locks are held until the handles are closed
+bool LockDriveVolumes (const DWORD diskNumber, std::vector<HANDLE>& lockedVolumes)
+{
+	wchar_t volumeName [MAX_PATH];
+	HANDLE findHandle = FindFirstVolume(volumeName, MAX_PATH);
+	if (findHandle == INVALID_HANDLE_VALUE)
+	{
+		PrintError(L"Could not list the volumes");
+		return false;
+	}
+
+	bool allLocked = true;
+	do
+	{
+		//	The volume is opened without the trailing backslash
+		size_t nameLength = wcslen(volumeName);
+		if (nameLength > 0 && volumeName [nameLength - 1] == L'\\')
+		{
+			volumeName [nameLength - 1] = 0;
+		}
+
+		HANDLE volume = CreateFile(volumeName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (volume == INVALID_HANDLE_VALUE)
+		{
+			continue;
+		}
+
+		//	See if any part of the volume is on our drive
+		uint8_t	extentBuffer [sizeof(VOLUME_DISK_EXTENTS) + (16 * sizeof(DISK_EXTENT))];
+		DWORD	returned;
+		bool	onDrive = false;
+		if (DeviceIoControl(volume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, nullptr, 0, extentBuffer, sizeof(extentBuffer), &returned, nullptr))
+		{
+			const VOLUME_DISK_EXTENTS* diskExtents = (const VOLUME_DISK_EXTENTS*) extentBuffer;
+			for (DWORD e = 0; e < diskExtents->NumberOfDiskExtents; e++)
+			{
+				onDrive = onDrive || diskExtents->Extents [e].DiskNumber == diskNumber;
+			}
+		}
+
+		if (!onDrive)
+		{
+			CloseHandle(volume);
+			continue;
+		}
+
+		OutputText(L"Locking and dismounting %s\n", volumeName);
+		if (!DeviceIoControl(volume, FSCTL_LOCK_VOLUME, nullptr, 0, nullptr, 0, &returned, nullptr)
+		||	!DeviceIoControl(volume, FSCTL_DISMOUNT_VOLUME, nullptr, 0, nullptr, 0, &returned, nullptr))
+		{
+			PrintError(L"Could not lock and dismount %s", volumeName);
+			CloseHandle(volume);
+			allLocked = false;
+			break;
+		}
+
+		lockedVolumes.push_back(volume);
+
+	} while (FindNextVolume(findHandle, volumeName, MAX_PATH));
+
+	FindVolumeClose(findHandle);
+	return allLocked;
+}
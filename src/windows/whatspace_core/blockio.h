@@ -0,0 +1,183 @@
+//	Block I/O engine used by the tools to write and read a file or a whole
+//	drive. The synchronous engine does one request at a time, the
+//	overlapped engine keeps many in flight through a completion port, and
+//	either can run on a raw physical drive. Every request is watched, and
+//	cancelled if the device takes too long with it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include "adaptive.h"
+#include "results.h"
+#include "telemetry.h"
+#include "throttle.h"
+#include "watchdog.h"
+
+#include <Windows.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+//	How a block target is opened
+struct BlockOptions
+{
+	//	The target is a whole physical drive e.g. \\.\PhysicalDrive1
+	bool	raw;
+
+	//	Go through the file system cache
+	bool	cached;
+
+	//	Create the file, replacing one that is already there
+	bool	create;
+
+	//	Let another handle open the file at the same time, e.g. a cached
+	//	handle alongside an unbuffered one
+	bool	shared;
+
+	//	Requests kept in flight, or zero for synchronous I/O
+	DWORD	queueDepth;
+
+	//	Let the overlapped engine keep fewer requests in flight, and split
+	//	them into smaller transfers, while the device's latency spikes. See
+	//	adaptive.h
+	bool	adaptive;
+
+	//	Give a file that is created this many bytes straight away, with
+	//	its valid data length set to match so Windows doesn't write zeroes
+	//	over it, or zero to leave it empty. The process needs the
+	//	SE_MANAGE_VOLUME_NAME privilege
+	int64_t	preallocate;
+};
+
+//	One read or write. The OVERLAPPED structure must be first so a
+//	completion can be cast back to the request
+struct BlockRequest
+{
+	OVERLAPPED	overlapped;
+	uint8_t*	buffer;
+	int64_t		offset;
+	DWORD		size;
+	bool		reading;
+
+	//	Set while the request is in flight
+	bool		active;
+
+	//	Free for the caller to use, e.g. the block number
+	uint64_t	tag;
+
+	//	When the transfer in flight was started, for its latency, and its
+	//	watchdog ticket
+	uint64_t	started;
+	uint64_t	watch;
+
+	//	Bytes moved so far and the size of the transfer in flight, when
+	//	the engine splits the request into smaller transfers
+	DWORD		done;
+	DWORD		transferSize;
+};
+
+//	A request that has finished
+struct BlockCompletion
+{
+	//	The request, or nullptr if the engine failed and nothing more
+	//	will complete
+	BlockRequest*	request;
+
+	bool			succeeded;
+	DWORD			transferred;
+};
+
+//	Writes and reads blocks of a file or drive
+class BlockEngine
+{
+public:
+	virtual ~BlockEngine ();
+
+	//	Name the target was opened with
+	const wchar_t* Name () const	{ return targetName; }
+
+	//	Size of the file or drive when it was opened
+	int64_t Size () const			{ return targetSize; }
+
+	//	Count the latency of every request in a run's telemetry, or stop
+	//	counting with nullptr
+	void SetTelemetry (RunTelemetry* runTelemetry)	{ telemetry = runTelemetry; }
+
+	//	Add the bytes every request moves to a run's results, or stop
+	//	adding them with nullptr
+	void SetResults (RunResults* runResults)		{ results = runResults; }
+
+	//	Start a read or write. Returns false, with the Windows error set,
+	//	if the request could not be started
+	virtual bool Start (BlockRequest& request) = 0;
+
+	//	Wait for the next request to finish. A failed request has the
+	//	Windows error set when this returns
+	virtual BlockCompletion Wait () = 0;
+
+	//	Cancel everything in flight and wait for it to finish, so the
+	//	requests and their buffers can be freed
+	virtual void Cancel () = 0;
+
+	//	Read or write one block and wait for it. These are for callers
+	//	that do one thing at a time, so nothing else can be in flight
+	bool Read (int64_t offset, uint8_t* buffer, DWORD size, DWORD& transferred);
+	bool Write (int64_t offset, const uint8_t* buffer, DWORD size, DWORD& transferred);
+
+	//	Number of blocks Read and Write have moved, or tried to
+	uint64_t Transfers () const	{ return transferCount; }
+
+	//	Wait for everything written to reach the device. Returns false,
+	//	with the Windows error set, if it could not be flushed
+	virtual bool Flush ();
+
+	//	What the engine did with the queue depth and transfer size, or
+	//	nullptr if it doesn't adapt them
+	virtual const IoController* Controller () const	{ return nullptr; }
+
+protected:
+	BlockEngine (HANDLE handle, const wchar_t* name, int64_t size);
+
+	//	Note when a transfer starts, waiting first if the target's hub is
+	//	over its cap, and have the watchdog look after it. Count its latency
+	//	and the bytes it moved when it finishes, and return true if the
+	//	watchdog cancelled it
+	void MarkStarted (BlockRequest& request);
+	bool MarkFinished (const BlockRequest& request, DWORD transferred);
+
+	HANDLE			targetHandle;
+	wchar_t			targetName [MAX_PATH];
+	int64_t			targetSize;
+	RunTelemetry*	telemetry;
+	RunResults*		results;
+
+	//	Bandwidth cap picked up from the thread that opened the target
+	RateLimiter*	throttle;
+
+	//	The watchdog cancels each request on its own through its OVERLAPPED,
+	//	as it can for an overlapped handle, rather than through the thread
+	//	that made it, as a synchronous handle needs
+	bool			watchEach;
+
+private:
+	//	Start one request and wait for it
+	bool Transfer (BlockRequest& request, DWORD& transferred);
+
+	uint64_t		transferCount;
+};
+
+//	Open a file or drive for block I/O. A name starting fake: is a fake
+//	device modelled in memory, see fakedevice.h. Returns nullptr, with
+//	the Windows error set, if it could not be opened
+std::unique_ptr<BlockEngine> OpenBlockEngine (const wchar_t* targetName, const BlockOptions& options);
+
+//	Get the sector size and length of a physical drive for a raw run
+bool GetRawDriveInfo (const char* pathName, DWORD& bytesPerSector, int64_t& driveSize);
+
+//	Windows won't let us write to sectors that belong to a mounted
+//	volume, so every volume on the drive is locked and dismounted. The
+//	locks are held until the handles are closed
+bool LockDriveVolumes (const DWORD diskNumber, std::vector<HANDLE>& lockedVolumes);
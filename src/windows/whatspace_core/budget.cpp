@@ -0,0 +1,91 @@
+//	Error budget for a run that checks blocks in order. Isolated bad
+//	blocks are counted and the run carries on, a cluster of them switches
+//	to sparse probing, and the run stops once the probes agree that
+//	nothing past the cluster is kept
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "budget.h"
+
+
+ErrorBudget::ErrorBudget (uint32_t failureLimit, uint64_t failureWindow)
+{
+	limit			= failureLimit;
+	window			= failureWindow != 0 ? failureWindow : defaultBudgetWindow;
+	sparse			= false;
+	probesFailed	= 0;
+	confirmed		= false;
+	boundary		= 0;
+	failures		= 0;
+	skipped			= 0;
+}
+
+
+//	Record how a block went and get the next block to check
+uint64_t ErrorBudget::Next (uint64_t block, bool failed)
+{
+	if (failed)
+	{
+		failures ++;
+	}
+
+	//	Without a budget the first failure is the capacity
+	if (limit == 0)
+	{
+		if (failed)
+		{
+			confirmed	= true;
+			boundary	= block;
+			return budgetStop;
+		}
+		return block + 1;
+	}
+
+	if (sparse)
+	{
+		if (!failed)
+		{
+			//	Something past the cluster was kept, so it was a bad patch
+			//	rather than the end. Carry on checking every block
+			sparse = false;
+			recentFailures.clear();
+			return block + 1;
+		}
+
+		if (++ probesFailed >= confirmProbes)
+		{
+			confirmed = true;
+			return budgetStop;
+		}
+
+		const uint64_t gap = (uint64_t) 1 << probesFailed;
+		skipped += gap - 1;
+		return block + gap;
+	}
+
+	//	Only the failures within the window of this block count
+	while (!recentFailures.empty() && recentFailures.front() + window <= block)
+	{
+		recentFailures.pop_front();
+	}
+
+	if (!failed)
+	{
+		return block + 1;
+	}
+
+	recentFailures.push_back(block);
+	if (recentFailures.size() < limit)
+	{
+		return block + 1;
+	}
+
+	//	A cluster - the capacity probably ends at its first block. Probe
+	//	further and further past it to make sure
+	sparse			= true;
+	probesFailed	= 0;
+	boundary		= recentFailures.front();
+	skipped			+= 1;
+	return block + 2;
+}
@@ -0,0 +1,65 @@
+//	Error budget for a run that checks blocks in order. Isolated bad
+//	blocks are counted and the run carries on, a cluster of them switches
+//	to sparse probing, and the run stops once the probes agree that
+//	nothing past the cluster is kept
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+
+//	Next returns this when the run should stop
+constexpr uint64_t	budgetStop			= UINT64_MAX;
+
+//	Window used when the user only gives the number of failures
+constexpr uint64_t	defaultBudgetWindow	= 64;
+
+//	Sparse probes past a cluster that have to fail before the capacity is
+//	taken as confirmed
+constexpr uint32_t	confirmProbes		= 8;
+
+class ErrorBudget
+{
+public:
+	//	failureLimit failures within window blocks is a cluster. A limit
+	//	of zero turns the budget off, so the first failure stops the run
+	ErrorBudget (uint32_t failureLimit, uint64_t window);
+
+	//	True if failures are allowed at all
+	bool Enabled () const			{ return limit != 0; }
+
+	//	Record how a block went and get the next block to check, or
+	//	budgetStop. In sparse probing the gap to the next probe doubles
+	//	each time one fails
+	uint64_t Next (uint64_t block, bool failed);
+
+	//	True once the probes past a cluster have all failed, and the
+	//	first block of that cluster, which is where the capacity ends
+	bool Confirmed () const			{ return confirmed; }
+	uint64_t Boundary () const		{ return boundary; }
+
+	//	True while probing sparsely past a cluster
+	bool Sparse () const			{ return sparse; }
+
+	//	Blocks that failed, and blocks jumped over by sparse probing
+	uint64_t Failures () const		{ return failures; }
+	uint64_t Skipped () const		{ return skipped; }
+
+private:
+	uint32_t				limit;
+	uint64_t				window;
+
+	//	Failed blocks within the window of the latest block
+	std::deque<uint64_t>	recentFailures;
+
+	bool					sparse;
+	uint32_t				probesFailed;
+	bool					confirmed;
+	uint64_t				boundary;
+	uint64_t				failures;
+	uint64_t				skipped;
+};
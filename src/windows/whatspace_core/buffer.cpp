@@ -0,0 +1,170 @@
+//	Buffers for I/O that bypasses the file system cache. Unbuffered I/O
+//	needs the buffer aligned on a sector boundary
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "buffer.h"
+#include "output.h"
+#include "privilege.h"
+
+#include <Windows.h>
+#include <stdio.h>
+
+
+//	Round a size up to a multiple of unit
+static size_t RoundUp (size_t size, size_t unit)
+{
+	return ((size + unit - 1) / unit) * unit;
+}
+
+
+//	Lock memory so it can't be paged out while I/O uses it. The working
+//	set has to be big enough to hold the locked pages
+static bool LockPoolMemory (uint8_t* memory, size_t memorySize)
+{
+	if (VirtualLock(memory, memorySize))
+	{
+		return true;
+	}
+
+	SIZE_T minimumSize;
+	SIZE_T maximumSize;
+	HANDLE process = GetCurrentProcess();
+	return GetProcessWorkingSetSize(process, &minimumSize, &maximumSize)
+		&& SetProcessWorkingSetSize(process, minimumSize + memorySize, max(maximumSize, minimumSize + memorySize))
+		&& VirtualLock(memory, memorySize);
+}
+
+
+BufferPool::BufferPool ()
+{
+	poolMemory		= nullptr;
+	poolSize		= 0;
+	usingLargePages	= false;
+	lockedInMemory	= false;
+}
+
+
+BufferPool::~BufferPool ()
+{
+	Destroy();
+}
+
+
+//	Get count aligned buffers of bufferSize bytes
+bool BufferPool::Create (size_t bufferSize, size_t count, size_t alignment, bool largePages)
+{
+	Destroy();
+
+	//	Pool memory comes straight from VirtualAlloc, so it is page aligned
+	//	and zeroed. Each buffer starts on a page or alignment boundary
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	const size_t bufferStride = RoundUp(bufferSize, max((size_t) systemInfo.dwPageSize, alignment));
+	poolSize = bufferStride * count;
+
+	//	Large pages are never paged out, but they need the lock memory
+	//	privilege and a size that is a multiple of the large page size
+	const size_t largePageSize = largePages ? GetLargePageMinimum() : 0;
+	if (largePageSize != 0 && AddPrivelege(SE_LOCK_MEMORY_NAME))
+	{
+		const size_t largePoolSize = RoundUp(poolSize, largePageSize);
+		poolMemory = (uint8_t*) VirtualAlloc(nullptr, largePoolSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (poolMemory != nullptr)
+		{
+			poolSize		= largePoolSize;
+			usingLargePages	= true;
+			lockedInMemory	= true;
+		}
+	}
+
+	if (poolMemory == nullptr)
+	{
+		poolMemory = (uint8_t*) VirtualAlloc(nullptr, poolSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (poolMemory == nullptr)
+		{
+			poolSize = 0;
+			return false;
+		}
+
+		//	Without large pages, ordinary pages are locked instead
+		lockedInMemory = largePages && LockPoolMemory(poolMemory, poolSize);
+	}
+
+	freeBuffers.reserve(count);
+	for (size_t b = count; b > 0; b--)
+	{
+		freeBuffers.push_back(poolMemory + ((b - 1) * bufferStride));
+	}
+
+	return true;
+}
+
+
+//	Take a buffer from the pool
+uint8_t* BufferPool::Acquire ()
+{
+	std::lock_guard<std::mutex> guard(poolLock);
+	if (freeBuffers.empty())
+	{
+		return nullptr;
+	}
+
+	uint8_t* buffer = freeBuffers.back();
+	freeBuffers.pop_back();
+	return buffer;
+}
+
+
+//	Give a buffer back to the pool
+void BufferPool::Release (uint8_t* buffer)
+{
+	if (buffer == nullptr)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(poolLock);
+	freeBuffers.push_back(buffer);
+}
+
+
+//	Free the pool memory
+void BufferPool::Destroy ()
+{
+	if (poolMemory != nullptr)
+	{
+		if (lockedInMemory && !usingLargePages)
+		{
+			VirtualUnlock(poolMemory, poolSize);
+		}
+		VirtualFree(poolMemory, 0, MEM_RELEASE);
+	}
+
+	poolMemory		= nullptr;
+	poolSize		= 0;
+	usingLargePages	= false;
+	lockedInMemory	= false;
+	freeBuffers.clear();
+}
+
+
+//	Tell the user how the memory for a pool that asked for large pages
+//	was obtained
+void OutputPoolMemory (const BufferPool& bufferPool)
+{
+	if (bufferPool.LargePages())
+	{
+		OutputText(L"Using large pages for the I/O buffers\n");
+	}
+	else
+	if (bufferPool.Locked())
+	{
+		OutputText(L"Large pages are not available, the I/O buffers are locked in memory instead\n");
+	}
+	else
+	{
+		OutputText(L"Large pages are not available and the I/O buffers could not be locked in memory\n");
+	}
+}
@@ -0,0 +1,59 @@
+//	Buffers for I/O that bypasses the file system cache. Unbuffered I/O
+//	needs the buffer aligned on a sector boundary
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+//	A set of equal sized aligned buffers carved out of one allocation, so
+//	each request in flight has its own buffer without allocating one per
+//	request. The buffers start out zeroed
+class BufferPool
+{
+public:
+	BufferPool ();
+	~BufferPool ();
+
+	BufferPool (const BufferPool&) = delete;
+	BufferPool& operator= (const BufferPool&) = delete;
+
+	//	Get count buffers of bufferSize bytes, each aligned to alignment.
+	//	With largePages the pool tries to use large pages, and if they
+	//	can't be had it locks ordinary pages in memory instead. Returns
+	//	false if there isn't enough memory
+	bool Create (size_t bufferSize, size_t count, size_t alignment, bool largePages);
+
+	//	Take a buffer from the pool, or nullptr if they are all in use.
+	//	This is safe to call from more than one thread
+	uint8_t* Acquire ();
+
+	//	Give a buffer back to the pool
+	void Release (uint8_t* buffer);
+
+	//	How the pool memory was obtained
+	bool LargePages () const	{ return usingLargePages; }
+	bool Locked () const		{ return lockedInMemory; }
+
+private:
+	//	Free the pool memory
+	void Destroy ();
+
+	uint8_t*				poolMemory;
+	size_t					poolSize;
+	bool					usingLargePages;
+	bool					lockedInMemory;
+
+	std::mutex				poolLock;
+	std::vector<uint8_t*>	freeBuffers;
+};
+
+//	Tell the user how the memory for a pool that asked for large pages
+//	was obtained
+void OutputPoolMemory (const BufferPool& bufferPool);
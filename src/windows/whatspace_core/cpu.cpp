@@ -0,0 +1,124 @@
+//	Processor feature checks used to pick SIMD code paths at run time
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "cpu.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+//	CPUID leaf 1 ECX bits
+constexpr int cpuidOsXsave	= 1 << 27;
+constexpr int cpuidAvx		= 1 << 28;
+
+//	CPUID leaf 7 EBX bits
+constexpr int cpuidAvx2		= 1 << 5;
+constexpr int cpuidAvx512F	= 1 << 16;
+constexpr int cpuidAvx512BW	= 1 << 30;
+
+//	XCR0 bits for the SSE and AVX register state, and for the AVX-512
+//	mask and upper register state on top of that
+constexpr unsigned long long xcr0SseAvx		= 0x6;
+constexpr unsigned long long xcr0Avx512		= 0xE6;
+
+
+//	Read a CPUID leaf and sub-leaf
+static void ReadCpuid (int (&cpuInfo) [4], int leaf, int subLeaf)
+{
+#if defined(_MSC_VER)
+	__cpuidex(cpuInfo, leaf, subLeaf);
+#else
+	unsigned int eax, ebx, ecx, edx;
+	__cpuid_count(leaf, subLeaf, eax, ebx, ecx, edx);
+	cpuInfo [0] = (int) eax;
+	cpuInfo [1] = (int) ebx;
+	cpuInfo [2] = (int) ecx;
+	cpuInfo [3] = (int) edx;
+#endif
+}
+
+
+//	Read the XCR0 register, which says what register state the OS saves
+static unsigned long long ReadXcr0 ()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	//	_xgetbv needs the whole file built for XSAVE with GCC
+	unsigned int low, high;
+	__asm__ volatile ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+	return ((unsigned long long) high << 32) | low;
+#endif
+}
+
+
+//	Read CPUID leaf 7 if the processor and OS support AVX. The XCR0
+//	register state is returned so the caller can check for more
+static bool ReadAvxLeaf (int (&cpuInfo) [4], unsigned long long& xcr0)
+{
+	ReadCpuid(cpuInfo, 0, 0);
+	if (cpuInfo [0] < 7)
+	{
+		return false;
+	}
+
+	//	The processor has to support AVX, and the OS has to save the
+	//	AVX registers on a context switch
+	ReadCpuid(cpuInfo, 1, 0);
+	if ((cpuInfo [2] & cpuidOsXsave) == 0
+	||	(cpuInfo [2] & cpuidAvx) == 0)
+	{
+		return false;
+	}
+
+	xcr0 = ReadXcr0();
+	if ((xcr0 & xcr0SseAvx) != xcr0SseAvx)
+	{
+		return false;
+	}
+
+	ReadCpuid(cpuInfo, 7, 0);
+	return true;
+}
+
+
+//	Work out if AVX2 can be used
+static bool CheckAvx2 ()
+{
+	int					cpuInfo [4];
+	unsigned long long	xcr0;
+	return ReadAvxLeaf(cpuInfo, xcr0) && (cpuInfo [1] & cpuidAvx2) != 0;
+}
+
+
+//	Work out if the AVX-512 foundation and byte/word instructions can be used
+static bool CheckAvx512 ()
+{
+	int					cpuInfo [4];
+	unsigned long long	xcr0;
+	return ReadAvxLeaf(cpuInfo, xcr0)
+		&& (cpuInfo [1] & cpuidAvx512F) != 0
+		&& (cpuInfo [1] & cpuidAvx512BW) != 0
+		&& (xcr0 & xcr0Avx512) == xcr0Avx512;
+}
+
+
+//	True if the processor and the OS both support AVX2
+bool CpuHasAvx2 ()
+{
+	//	Only ask the processor once
+	static const bool haveAvx2 = CheckAvx2();
+	return haveAvx2;
+}
+
+
+//	True if the processor and the OS both support AVX-512F and AVX-512BW
+bool CpuHasAvx512 ()
+{
+	static const bool haveAvx512 = CheckAvx512();
+	return haveAvx512;
+}
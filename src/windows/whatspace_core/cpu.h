@@ -0,0 +1,23 @@
+//	Processor feature checks used to pick SIMD code paths at run time
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+//	MSVC lets any function use any instruction set. GCC and Clang only
+//	emit AVX instructions in functions marked for them, which are then
+//	only called once the checks below have passed
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2		__attribute__((target("avx2")))
+#define TARGET_AVX512	__attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+//	True if the processor and the OS both support AVX2
+bool CpuHasAvx2 ();
+
+//	True if the processor and the OS both support AVX-512F and AVX-512BW
+bool CpuHasAvx512 ();
@@ -0,0 +1,312 @@
+//	Testing several devices from one process. Each device is tested on its
+//	own thread with its output going to a log, the devices on one USB root
+//	hub share a bandwidth cap, and the console shows one status table for
+//	all of them
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "devices.h"
+#include "output.h"
+#include "throttle.h"
+
+#include <SetupAPI.h>
+#include <cfgmgr32.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include <string>
+#include <thread>
+
+#pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "cfgmgr32.lib")
+
+//	How often the status table is redrawn, in milliseconds
+constexpr DWORD		statusInterval	= 2000;
+
+//	GUID_DEVINTERFACE_DISK, spelled out so winioctl.h doesn't have to be
+//	included with initguid.h to define it
+static const GUID	diskInterface	= { 0x53f56307, 0xb6bf, 0x11d0, { 0x94, 0xf2, 0x00, 0xa0, 0xc9, 0x1e, 0xfb, 0x8b } };
+
+//	Instance IDs of USB root hubs start with this
+constexpr const wchar_t*	rootHubPrefix	= L"USB\\ROOT_HUB";
+
+
+//	Get the disk number a volume or disk is on
+static bool GetDeviceNumber (const wchar_t* deviceName, STORAGE_DEVICE_NUMBER& deviceNumber)
+{
+	HANDLE device = CreateFile(deviceName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (device == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD returned;
+	BOOL haveNumber = DeviceIoControl(device, IOCTL_STORAGE_GET_DEVICE_NUMBER, nullptr, 0, &deviceNumber, sizeof(deviceNumber), &returned, nullptr);
+	CloseHandle(device);
+	return haveNumber != 0;
+}
+
+
+//	Find the USB root hub a drive is on. The volume gives us the disk
+//	number, the disk with that number gives us a device node, and the
+//	root hub is somewhere up the chain of parents from there
+bool FindRootHub (const char* pathName, wchar_t (&hubId) [MAX_PATH])
+{
+	hubId [0] = 0;
+
+	wchar_t volumeName [MAX_PATH];
+	swprintf_s(volumeName, L"\\\\.\\%hc:", pathName [0]);
+
+	STORAGE_DEVICE_NUMBER volumeNumber;
+	if (!GetDeviceNumber(volumeName, volumeNumber))
+	{
+		return false;
+	}
+
+	HDEVINFO disks = SetupDiGetClassDevs(&diskInterface, nullptr, nullptr, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+	if (disks == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	SP_DEVICE_INTERFACE_DATA diskData;
+	diskData.cbSize = sizeof(diskData);
+	for (DWORD d = 0; hubId [0] == 0 && SetupDiEnumDeviceInterfaces(disks, nullptr, &diskInterface, d, &diskData); d++)
+	{
+		//	The detail holds the path of the disk, which can be long
+		uint8_t detailBuffer [1024];
+		PSP_DEVICE_INTERFACE_DETAIL_DATA diskDetail = (PSP_DEVICE_INTERFACE_DETAIL_DATA) detailBuffer;
+		diskDetail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+		SP_DEVINFO_DATA diskNode;
+		diskNode.cbSize = sizeof(diskNode);
+		if (!SetupDiGetDeviceInterfaceDetail(disks, &diskData, diskDetail, sizeof(detailBuffer), nullptr, &diskNode))
+		{
+			continue;
+		}
+
+		STORAGE_DEVICE_NUMBER diskNumber;
+		if (!GetDeviceNumber(diskDetail->DevicePath, diskNumber)
+		||	diskNumber.DeviceType != volumeNumber.DeviceType
+		||	diskNumber.DeviceNumber != volumeNumber.DeviceNumber)
+		{
+			continue;
+		}
+
+		//	Walk up to the root hub
+		DEVINST node = diskNode.DevInst;
+		DEVINST parent;
+		while (CM_Get_Parent(&parent, node, 0) == CR_SUCCESS)
+		{
+			wchar_t instanceId [MAX_DEVICE_ID_LEN];
+			if (CM_Get_Device_ID(parent, instanceId, MAX_DEVICE_ID_LEN, 0) == CR_SUCCESS
+			&&	_wcsnicmp(instanceId, rootHubPrefix, wcslen(rootHubPrefix)) == 0)
+			{
+				swprintf_s(hubId, L"%s", instanceId);
+				break;
+			}
+			node = parent;
+		}
+
+		//	Only one disk can have the volume's number
+		break;
+	}
+
+	SetupDiDestroyDeviceInfoList(disks);
+	return hubId [0] != 0;
+}
+
+
+//	Build a file name for one of several devices. The drive letter goes
+//	in front of the extension, if the name has one
+void DeviceFileName (wchar_t (&fileName) [MAX_PATH], const wchar_t* baseName, const char* pathName)
+{
+	const wchar_t* extension	= wcsrchr(baseName, L'.');
+	const wchar_t* directory	= wcsrchr(baseName, L'\\');
+	if (extension == nullptr || (directory != nullptr && directory > extension))
+	{
+		swprintf_s(fileName, L"%s-%hc", baseName, pathName [0]);
+		return;
+	}
+
+	swprintf_s(fileName, L"%.*s-%hc%s", (int) (extension - baseName), baseName, pathName [0], extension);
+}
+
+
+//	Test one device with its output going to its own log and its I/O
+//	under its hub's cap
+static void DeviceWorker (DeviceRun& device, RateLimiter* throttle, const DeviceTest& testDevice)
+{
+	FILE* logFile = nullptr;
+	if (_wfopen_s(&logFile, device.logPath, L"w") != 0)
+	{
+		logFile = nullptr;
+	}
+
+	//	If the log can't be created the output goes to the console, mixed
+	//	in with the table
+	SetThreadOutput(logFile);
+	SetThreadThrottle(throttle);
+	device.exitCode = testDevice(device);
+	SetThreadThrottle(nullptr);
+	SetThreadOutput(nullptr);
+
+	if (logFile != nullptr)
+	{
+		fclose(logFile);
+	}
+
+	device.finished = true;
+}
+
+
+//	Draw the status table. MiB/s is from the bytes moved since the table
+//	was last drawn
+static void DrawStatus (std::vector<std::unique_ptr<DeviceRun>>& devices, std::vector<uint64_t>& lastBytes, const double seconds)
+{
+	OutputText(L"%-10s %-4s %-5s %-22s %-9s %s\n", L"Drive", L"Hub", L"Pass", L"Done", L"MiB/s", L"Status");
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		DeviceRun& device = *devices [d];
+
+		uint32_t		pass;
+		const uint64_t	position	= device.telemetry.Position(pass);
+		const uint64_t	bytes		= device.results.bytesWritten.load() + device.results.bytesRead.load();
+		const double	throughput	= seconds > 0 ? ((double) (bytes - lastBytes [d]) / (double) MiB) / seconds : 0;
+		lastBytes [d] = bytes;
+
+		wchar_t hubText [16];
+		if (device.hubNumber != 0)
+		{
+			swprintf_s(hubText, L"%d", device.hubNumber);
+		}
+		else
+		{
+			swprintf_s(hubText, L"-");
+		}
+
+		wchar_t doneText [32];
+		swprintf_s(doneText, L"%.1f/%.1f GiB", (double) position / (double) GiB, (double) device.results.freeSpace / (double) GiB);
+
+		wchar_t statusText [64];
+		if (!device.finished.load())
+		{
+			swprintf_s(statusText, L"running");
+		}
+		else
+		if (device.exitCode == 0)
+		{
+			swprintf_s(statusText, L"passed");
+		}
+		else
+		if (device.results.capacity >= 0)
+		{
+			swprintf_s(statusText, L"failed, %.2f GiB good", (double) device.results.capacity / (double) GiB);
+		}
+		else
+		{
+			swprintf_s(statusText, L"failed");
+		}
+
+		OutputText(L"%-10hs %-4s %-5u %-22s %-9.1f %-30s\n", device.pathName, hubText, pass, doneText, device.finished.load() ? 0.0 : throughput, statusText);
+	}
+}
+
+
+//	Test every device at once, each on its own thread
+int RunDevices (std::vector<std::unique_ptr<DeviceRun>>& devices, const char* toolName, uint64_t hubRate, const DeviceTest& testDevice)
+{
+	//	Group the devices by root hub, with one cap for each hub
+	std::vector<std::wstring>					hubIds;
+	std::vector<std::unique_ptr<RateLimiter>>	hubLimits;
+	std::vector<RateLimiter*>					deviceLimits;
+	for (auto& device : devices)
+	{
+		device->hubNumber	= 0;
+		device->finished	= false;
+		device->exitCode	= 1;
+		swprintf_s(device->logPath, L"%hs-%hc.log", toolName, device->pathName [0]);
+
+		RateLimiter* limiter = nullptr;
+		if (FindRootHub(device->pathName, device->hubId))
+		{
+			size_t h = 0;
+			while (h < hubIds.size() && hubIds [h] != device->hubId)
+			{
+				h ++;
+			}
+
+			if (h == hubIds.size())
+			{
+				hubIds.push_back(device->hubId);
+				hubLimits.push_back(hubRate != 0 ? std::make_unique<RateLimiter>(hubRate) : nullptr);
+			}
+
+			device->hubNumber	= (int) h + 1;
+			limiter				= hubLimits [h].get();
+		}
+		deviceLimits.push_back(limiter);
+
+		OutputText(L"%hs is on %s, output goes to %s\n", device->pathName, device->hubNumber != 0 ? hubIds [device->hubNumber - 1].c_str() : L"no USB root hub", device->logPath);
+	}
+
+	if (hubRate != 0)
+	{
+		OutputSize(L"Each root hub is capped at a total per second of", hubRate);
+	}
+	OutputText(L"\n");
+
+	//	The table is redrawn in place if the console understands VT
+	//	sequences, otherwise a new one is printed each time
+	HANDLE	console		= GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD	consoleMode	= 0;
+	bool	redraw		= GetConsoleMode(console, &consoleMode) && SetConsoleMode(console, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+	std::vector<std::thread> workers;
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		workers.emplace_back(DeviceWorker, std::ref(*devices [d]), deviceLimits [d], std::cref(testDevice));
+	}
+
+	std::vector<uint64_t>	lastBytes(devices.size(), 0);
+	bool					allFinished	= false;
+	bool					drawn		= false;
+	while (!allFinished)
+	{
+		Sleep(statusInterval);
+
+		allFinished = true;
+		for (auto& device : devices)
+		{
+			allFinished = allFinished && device->finished.load();
+		}
+
+		if (redraw && drawn)
+		{
+			OutputText(L"\x1b[%dA", (int) devices.size() + 1);
+		}
+		else
+		if (drawn)
+		{
+			OutputText(L"\n");
+		}
+
+		DrawStatus(devices, lastBytes, statusInterval / 1000.0);
+		drawn = true;
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	int failed = 0;
+	for (auto& device : devices)
+	{
+		failed += device->exitCode != 0 ? 1 : 0;
+	}
+
+	OutputText(L"\n%d of %d devices passed\n", (int) devices.size() - failed, (int) devices.size());
+	return failed;
+}
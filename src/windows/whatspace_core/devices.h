@@ -0,0 +1,60 @@
+//	Testing several devices from one process. Each device is tested on its
+//	own thread with its output going to a log, the devices on one USB root
+//	hub share a bandwidth cap, and the console shows one status table for
+//	all of them
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include "results.h"
+#include "telemetry.h"
+
+#include <Windows.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//	One device in a run over several
+struct DeviceRun
+{
+	//	Drive path the device is tested through
+	const char*			pathName;
+
+	//	USB root hub the device is on, and its number in the status
+	//	table. Zero means it isn't on USB, or the hub couldn't be found
+	wchar_t				hubId [MAX_PATH];
+	int					hubNumber;
+
+	//	Where the output for the device goes
+	wchar_t				logPath [MAX_PATH];
+
+	//	Progress and results the status table is drawn from
+	RunTelemetry		telemetry;
+	RunResults			results;
+
+	//	Set when the test is done, with the tool's exit code
+	std::atomic<bool>	finished;
+	int					exitCode;
+};
+
+//	What a tool does to test one device. Returns the exit code the tool
+//	would have for just that device
+typedef std::function<int (DeviceRun& device)> DeviceTest;
+
+//	Find the USB root hub a drive is on. Returns false if the drive isn't
+//	on USB or the hub can't be found
+bool FindRootHub (const char* pathName, wchar_t (&hubId) [MAX_PATH]);
+
+//	Build a file name for one of several devices from the one the user
+//	gave, e.g. results.json becomes results-E.json for drive E:
+void DeviceFileName (wchar_t (&fileName) [MAX_PATH], const wchar_t* baseName, const char* pathName);
+
+//	Test every device at once, each on its own thread. hubRate caps the
+//	bytes a second across the devices on one root hub, or zero for no cap.
+//	Returns the number of devices that failed
+int RunDevices (std::vector<std::unique_ptr<DeviceRun>>& devices, const char* toolName, uint64_t hubRate, const DeviceTest& testDevice);
@@ -0,0 +1,339 @@
+//	Fake device modelled in memory, for trying the search strategies and
+//	engines against the ways counterfeit drives cheat without needing one
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "fakedevice.h"
+#include "timing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+//	Sector size of a fake device that doesn't give one, and the largest
+//	it can have
+constexpr uint32_t	defaultFakeSector	= 512;
+constexpr uint32_t	maxFakeSector		= 64 * 1024;
+
+
+FakeDevice::FakeDevice (const FakeDeviceSpec& deviceSpec)
+	: random(deviceSpec.seed)
+{
+	spec			= deviceSpec;
+	generation		= 0;
+	bytesWritten	= 0;
+	busyUntil		= 0;
+}
+
+
+FakeStatus FakeDevice::Transfer (const bool reading, const int64_t offset, uint8_t* buffer, const uint32_t size, uint32_t& transferred)
+{
+	transferred = 0;
+	const uint32_t sectorSize = spec.sectorSize;
+	if (offset < 0 || offset % sectorSize != 0 || size % sectorSize != 0)
+	{
+		return FakeStatus::misaligned;
+	}
+
+	std::lock_guard<std::mutex> guard(deviceLock);
+	if (spec.dropout > 0 && std::uniform_real_distribution<double>(0, 1)(random) < spec.dropout)
+	{
+		return FakeStatus::dropout;
+	}
+
+	//	Nothing past the advertised size is moved
+	const uint64_t start	= (uint64_t) offset;
+	const uint64_t length	= start < spec.size ? std::min((uint64_t) size, spec.size - start) : 0;
+	const uint64_t first	= start / sectorSize;
+	for (uint64_t s = 0; s < length / sectorSize; s++)
+	{
+		const uint64_t	sector	= first + s;
+		uint8_t*		data	= buffer + s * sectorSize;
+		if (reading)
+		{
+			//	The cache answers for anything it holds, kept or not
+			const auto cached = cache.find(sector);
+			if (cached != cache.end())
+			{
+				memcpy(data, cached->second.data.data(), sectorSize);
+				continue;
+			}
+
+			uint64_t	mediaSector;
+			auto		stored = media.end();
+			if (MediaSector(sector, mediaSector))
+			{
+				stored = media.find(mediaSector);
+			}
+
+			if (stored != media.end())
+			{
+				memcpy(data, stored->second.data(), sectorSize);
+			}
+			else
+			{
+				//	Never written, or written and thrown away
+				memset(data, 0, sectorSize);
+			}
+		}
+		else
+		if (spec.cacheSize == 0)
+		{
+			StoreSector(sector, data);
+		}
+		else
+		{
+			CachedSector& cached = cache [sector];
+			cached.data.assign(data, data + sectorSize);
+			cached.generation = ++ generation;
+			cacheOrder.emplace_back(sector, cached.generation);
+		}
+	}
+
+	if (!reading)
+	{
+		//	The oldest writes leave the cache for the media once it is full
+		while (!cacheOrder.empty() && cache.size() * sectorSize > spec.cacheSize)
+		{
+			const auto oldest = cacheOrder.front();
+			cacheOrder.pop_front();
+
+			const auto cached = cache.find(oldest.first);
+			if (cached != cache.end() && cached->second.generation == oldest.second)
+			{
+				StoreSector(oldest.first, cached->second.data.data());
+				cache.erase(cached);
+			}
+		}
+
+		PaceWrite((uint32_t) length);
+	}
+
+	transferred = (uint32_t) length;
+	return FakeStatus::done;
+}
+
+
+bool FakeDevice::MediaSector (const uint64_t sector, uint64_t& mediaSector) const
+{
+	uint64_t byteOffset = sector * spec.sectorSize;
+	if (spec.wrap != 0)
+	{
+		byteOffset %= spec.wrap;
+	}
+
+	if (byteOffset >= spec.capacity)
+	{
+		return false;
+	}
+
+	mediaSector = byteOffset / spec.sectorSize;
+	return true;
+}
+
+
+void FakeDevice::StoreSector (const uint64_t sector, const uint8_t* data)
+{
+	uint64_t mediaSector;
+	if (MediaSector(sector, mediaSector))
+	{
+		media [mediaSector].assign(data, data + spec.sectorSize);
+	}
+}
+
+
+void FakeDevice::PaceWrite (const uint32_t size)
+{
+	//	The device lock is held, so writes queue behind each other as they
+	//	would on one device
+	const uint64_t rate = spec.slcSize == 0 || bytesWritten < spec.slcSize ? spec.fastRate : spec.slowRate;
+	bytesWritten += size;
+	if (rate == 0)
+	{
+		return;
+	}
+
+	const uint64_t now = NowNanoseconds();
+	busyUntil = std::max(busyUntil, now) + (uint64_t) ((double) size * 1e9 / rate);
+	if (busyUntil > now)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds(busyUntil - now));
+	}
+}
+
+
+bool IsFakeDevice (const char* targetName)
+{
+	return strncmp(targetName, fakeDevicePrefix, strlen(fakeDevicePrefix)) == 0;
+}
+
+
+//	Read a size with an optional binary suffix
+static bool ParseFakeSize (const char* text, uint64_t& size)
+{
+	char*		end;
+	uint64_t	value	= strtoull(text, &end, 10);
+	if (end == text)
+	{
+		return false;
+	}
+
+	const char*	suffixes	= "KMGTP";
+	const char*	suffix		= *end != 0 ? strchr(suffixes, *end) : nullptr;
+	if (suffix != nullptr)
+	{
+		for (const char* s = suffixes; s <= suffix; s++)
+		{
+			if (value > UINT64_MAX / 1024)
+			{
+				return false;
+			}
+			value *= 1024;
+		}
+		end ++;
+	}
+
+	size = value;
+	return *end == 0;
+}
+
+
+bool ParseFakeDevice (const char* targetName, FakeDeviceSpec& spec)
+{
+	if (!IsFakeDevice(targetName))
+	{
+		return false;
+	}
+
+	spec			= {};
+	spec.sectorSize	= defaultFakeSector;
+
+	const std::string	settings		= targetName + strlen(fakeDevicePrefix);
+	bool				haveCapacity	= false;
+	size_t				start			= 0;
+	while (start < settings.size())
+	{
+		size_t comma = settings.find(',', start);
+		if (comma == std::string::npos)
+		{
+			comma = settings.size();
+		}
+
+		const std::string	setting	= settings.substr(start, comma - start);
+		const size_t		equals	= setting.find('=');
+		if (equals == std::string::npos)
+		{
+			return false;
+		}
+
+		const std::string	key		= setting.substr(0, equals);
+		const char*			value	= setting.c_str() + equals + 1;
+		uint64_t			number	= 0;
+		char*				end		= nullptr;
+		bool				valid;
+		if (key == "dropout")
+		{
+			spec.dropout = strtod(value, &end);
+			valid = end != value && *end == 0 && spec.dropout >= 0 && spec.dropout <= 1;
+		}
+		else
+		{
+			valid = ParseFakeSize(value, number);
+			if (key == "size")
+			{
+				spec.size = number;
+			}
+			else
+			if (key == "sector")
+			{
+				spec.sectorSize = (uint32_t) std::min(number, (uint64_t) UINT32_MAX);
+			}
+			else
+			if (key == "capacity")
+			{
+				spec.capacity	= number;
+				haveCapacity	= true;
+			}
+			else
+			if (key == "wrap")
+			{
+				spec.wrap = number;
+			}
+			else
+			if (key == "cache")
+			{
+				spec.cacheSize = number;
+			}
+			else
+			if (key == "slc")
+			{
+				spec.slcSize = number;
+			}
+			else
+			if (key == "fast")
+			{
+				spec.fastRate = number;
+			}
+			else
+			if (key == "slow")
+			{
+				spec.slowRate = number;
+			}
+			else
+			if (key == "seed")
+			{
+				spec.seed = number;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+
+		if (!valid)
+		{
+			return false;
+		}
+		start = comma + 1;
+	}
+
+	//	A device that doesn't say otherwise keeps everything it advertises
+	if (!haveCapacity)
+	{
+		spec.capacity = spec.size;
+	}
+
+	//	Sectors are a power of two, and the device is whole sectors
+	const uint32_t sectorSize = spec.sectorSize;
+	return spec.size != 0
+		&& sectorSize >= defaultFakeSector && sectorSize <= maxFakeSector && (sectorSize & (sectorSize - 1)) == 0
+		&& spec.size % sectorSize == 0
+		&& spec.wrap % sectorSize == 0
+		&& spec.capacity <= spec.size;
+}
+
+
+std::shared_ptr<FakeDevice> OpenFakeDevice (const char* targetName)
+{
+	FakeDeviceSpec spec;
+	if (!ParseFakeDevice(targetName, spec))
+	{
+		return nullptr;
+	}
+
+	static std::mutex													devicesLock;
+	static std::unordered_map<std::string, std::shared_ptr<FakeDevice>>	devices;
+
+	std::lock_guard<std::mutex> guard(devicesLock);
+	std::shared_ptr<FakeDevice>& device = devices [targetName];
+	if (!device)
+	{
+		device = std::make_shared<FakeDevice>(spec);
+	}
+	return device;
+}
@@ -0,0 +1,124 @@
+//	Fake device modelled in memory, for trying the search strategies and
+//	engines against the ways counterfeit drives cheat without needing one.
+//	It can have less real capacity than it advertises, wrap its block
+//	addresses round, hold writes in a cache that never reaches the media,
+//	slow down once its SLC cache is full, and drop requests at random.
+//	Only the sectors written are stored, so it can advertise any size
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+//	Names of fake devices start with this, e.g. fake:size=128T,capacity=16G
+constexpr const char*	fakeDevicePrefix	= "fake:";
+
+//	How a fake device behaves. Sizes are in bytes and rates in bytes a
+//	second, with zero meaning there is no limit
+struct FakeDeviceSpec
+{
+	//	Size the device advertises, and its sector size
+	uint64_t	size;
+	uint32_t	sectorSize;
+
+	//	Bytes the media really keeps. Writes past it are thrown away
+	uint64_t	capacity;
+
+	//	Block addresses wrap round at this many bytes, so a write past it
+	//	lands on the start of the media. Zero if they don't wrap
+	uint64_t	wrap;
+
+	//	Write-back cache that holds the most recent writes and reads them
+	//	back from itself, whether or not the media kept them, and claims a
+	//	flush has put them on the media
+	uint64_t	cacheSize;
+
+	//	Writes run at fastRate until slcSize bytes have been written, then
+	//	drop to slowRate
+	uint64_t	slcSize;
+	uint64_t	fastRate;
+	uint64_t	slowRate;
+
+	//	Chance of any one request failing as if the device had dropped
+	//	off the bus, and the seed for it, so a run can be repeated
+	double		dropout;
+	uint64_t	seed;
+};
+
+//	How a request to a fake device went
+enum class FakeStatus
+{
+	done,
+	dropout,
+	misaligned
+};
+
+class FakeDevice
+{
+public:
+	explicit FakeDevice (const FakeDeviceSpec& deviceSpec);
+
+	FakeDevice (const FakeDevice&) = delete;
+	FakeDevice& operator= (const FakeDevice&) = delete;
+
+	const FakeDeviceSpec& Spec () const	{ return spec; }
+
+	//	Read or write size bytes at offset. A request that runs past the
+	//	advertised size is cut short, and one that isn't whole sectors at
+	//	a sector offset fails, as unbuffered I/O does. This is safe to
+	//	call from more than one thread
+	FakeStatus Transfer (const bool reading, const int64_t offset, uint8_t* buffer, const uint32_t size, uint32_t& transferred);
+
+private:
+	//	A sector held in the write-back cache. Each write of a sector gets
+	//	a new generation, so an older entry in the eviction order is
+	//	ignored
+	struct CachedSector
+	{
+		std::vector<uint8_t>	data;
+		uint64_t				generation;
+	};
+
+	//	Where a sector lands on the media, or false if it is thrown away
+	bool MediaSector (const uint64_t sector, uint64_t& mediaSector) const;
+
+	//	Write a sector to the media, or throw it away if it doesn't fit
+	void StoreSector (const uint64_t sector, const uint8_t* data);
+
+	//	Hold a write until writes at the current rate would have got there
+	void PaceWrite (const uint32_t size);
+
+	FakeDeviceSpec												spec;
+	std::mutex													deviceLock;
+	std::unordered_map<uint64_t, std::vector<uint8_t>>			media;
+	std::unordered_map<uint64_t, CachedSector>					cache;
+	std::deque<std::pair<uint64_t, uint64_t>>					cacheOrder;
+	uint64_t													generation;
+	uint64_t													bytesWritten;
+	uint64_t													busyUntil;
+	std::mt19937_64												random;
+};
+
+//	True if a target name is a fake device
+bool IsFakeDevice (const char* targetName);
+
+//	Read a fake device's spec from its name, e.g.
+//	fake:size=128T,capacity=16G,wrap=16G,cache=64M,slc=4G,fast=400M,slow=20M,dropout=0.0001,seed=1
+//	Sizes take a K, M, G, T or P suffix. Returns false if the spec is not
+//	valid
+bool ParseFakeDevice (const char* targetName, FakeDeviceSpec& spec);
+
+//	Get the device for a fake name. Each name has one device for the life
+//	of the program, so everything written to it through one engine can be
+//	read back through another. Returns nullptr if the spec is not valid
+std::shared_ptr<FakeDevice> OpenFakeDevice (const char* targetName);
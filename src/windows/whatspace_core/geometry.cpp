@@ -0,0 +1,195 @@
+//	What the storage stack says about a device's sectors and transfers,
+//	and a short benchmark that picks the I/O size the device is happiest
+//	with
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "buffer.h"
+#include "geometry.h"
+#include "pattern.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+//	The knee is the smallest size that gets this close to the best
+constexpr double	kneeFraction	= 0.9;
+
+
+//	Run one storage property query
+static bool QueryStorageProperty (HANDLE device, STORAGE_PROPERTY_ID propertyId, void* descriptor, DWORD descriptorSize)
+{
+	STORAGE_PROPERTY_QUERY query = {};
+	query.PropertyId	= propertyId;
+	query.QueryType		= PropertyStandardQuery;
+
+	DWORD returned;
+	return DeviceIoControl(device, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), descriptor, descriptorSize, &returned, nullptr) != 0
+		&& returned >= sizeof(DWORD) * 2;
+}
+
+
+//	Ask the storage stack about the device a drive path is on
+bool QueryDeviceGeometry (const char* pathName, DeviceGeometry& geometry)
+{
+	geometry = {};
+
+	//	A volume is queried through \\.\E: and the query is passed down to
+	//	the disk it is on
+	wchar_t deviceName [MAX_PATH];
+	if (strncmp(pathName, "\\\\.\\", 4) == 0)
+	{
+		swprintf_s(deviceName, L"%hs", pathName);
+	}
+	else
+	{
+		swprintf_s(deviceName, L"\\\\.\\%hc:", pathName [0]);
+	}
+
+	//	No access rights are needed for a property query
+	HANDLE device = CreateFile(deviceName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (device == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	STORAGE_ACCESS_ALIGNMENT_DESCRIPTOR	alignment	= {};
+	STORAGE_ADAPTER_DESCRIPTOR			adapter		= {};
+	const bool haveAlignment	= QueryStorageProperty(device, StorageAccessAlignmentProperty, &alignment, sizeof(alignment));
+	const bool haveAdapter		= QueryStorageProperty(device, StorageAdapterProperty, &adapter, sizeof(adapter));
+	CloseHandle(device);
+
+	if (haveAlignment)
+	{
+		geometry.logicalSector		= alignment.BytesPerLogicalSector;
+		geometry.physicalSector		= alignment.BytesPerPhysicalSector;
+		geometry.alignmentOffset	= alignment.BytesOffsetForSectorAlignment;
+	}
+
+	if (haveAdapter)
+	{
+		geometry.maxTransfer		= adapter.MaximumTransferLength;
+	}
+
+	return haveAlignment || haveAdapter;
+}
+
+
+//	Tell the user what the device reported
+void OutputGeometry (const DeviceGeometry& geometry)
+{
+	if (geometry.logicalSector != 0)
+	{
+		OutputText(L"Logical sector   : %lu\n", geometry.logicalSector);
+		OutputText(L"Physical sector  : %lu\n", geometry.physicalSector);
+	}
+
+	if (geometry.alignmentOffset != 0)
+	{
+		OutputText(L"The device is misaligned by %lu bytes, every I/O straddles two physical sectors\n", geometry.alignmentOffset);
+	}
+
+	if (geometry.maxTransfer != 0)
+	{
+		OutputSize(L"Max transfer     :", geometry.maxTransfer);
+	}
+}
+
+
+//	True if an I/O size suits the device
+bool BlockSizeFits (const uint64_t blockSize, const DWORD bytesPerSector, const DeviceGeometry& geometry)
+{
+	if (blockSize == 0 || blockSize % bytesPerSector != 0)
+	{
+		return false;
+	}
+
+	return geometry.physicalSector == 0 || blockSize % geometry.physicalSector == 0;
+}
+
+
+//	Write span bytes at each power of two I/O size and pick the knee
+uint64_t AutoTuneBlockSize (BlockEngine& target, const uint64_t span, const DWORD bytesPerSector, const DeviceGeometry& geometry, const bool largePages)
+{
+	//	The pattern stops a controller that compresses or dedupes from
+	//	making some sizes look faster than they are
+	BufferPool bufferPool;
+	if (span < maxTuneSize || !bufferPool.Create(maxTuneSize, 1, bytesPerSector, largePages))
+	{
+		return 0;
+	}
+
+	uint8_t* tuneBuffer = bufferPool.Acquire();
+	FillPattern(tuneBuffer, maxTuneSize, NewPatternSeed(), 0);
+
+	//	Every size that suits the device, largest first
+	std::vector<uint64_t> sizes;
+	for (uint64_t size = maxTuneSize; size >= minTuneSize; size /= 2)
+	{
+		if (BlockSizeFits(size, bytesPerSector, geometry))
+		{
+			sizes.push_back(size);
+		}
+	}
+
+	//	The first pass over the span can be slowed down by the file being
+	//	extended, or by the device waking up, so it is written once at the
+	//	largest size before anything is timed
+	OutputText(L"Tuning the block size on %s\n", target.Name());
+	std::vector<double>	throughputs;
+	bool				tuned	= !sizes.empty();
+	for (int s = -1; s < (int) sizes.size() && tuned; s++)
+	{
+		const DWORD	size	= (DWORD) sizes [s < 0 ? 0 : s];
+		BatchTimer	timer;
+		for (uint64_t offset = 0; offset + size <= span; offset += size)
+		{
+			DWORD written;
+			if (!target.Write((int64_t) offset, tuneBuffer, size, written) || written != size)
+			{
+				PrintError(L"Could not write to %s while tuning", target.Name());
+				tuned = false;
+				break;
+			}
+		}
+
+		const double seconds = timer.TotalSeconds();
+		if (s >= 0)
+		{
+			throughputs.push_back(seconds > 0 ? ((double) span / (double) MiB) / seconds : 0);
+		}
+	}
+
+	bufferPool.Release(tuneBuffer);
+	if (!tuned)
+	{
+		return 0;
+	}
+
+	double best = 0;
+	for (double throughput : throughputs)
+	{
+		best = max(best, throughput);
+	}
+
+	//	Sizes go from largest to smallest, so the last one close enough to
+	//	the best is the knee. Sizes past the adapter's largest transfer
+	//	are split up anyway, so they are only picked if nothing else is
+	//	close
+	uint64_t knee = 0;
+	for (size_t s = 0; s < throughputs.size(); s++)
+	{
+		const bool fitsAdapter = geometry.maxTransfer == 0 || sizes [s] <= geometry.maxTransfer;
+		OutputText(L"  %8llu KiB  %9.1f MiB/s\n", sizes [s] / KiB, throughputs [s]);
+		if (throughputs [s] >= best * kneeFraction && (fitsAdapter || knee == 0))
+		{
+			knee = sizes [s];
+		}
+	}
+
+	OutputSize(L"Picked a block size of", knee);
+	return knee;
+}
@@ -0,0 +1,55 @@
+//	What the storage stack says about a device's sectors and transfers,
+//	and a short benchmark that picks the I/O size the device is happiest
+//	with
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include "blockio.h"
+#include "output.h"
+
+#include <Windows.h>
+#include <stdint.h>
+
+//	Smallest and largest I/O sizes the benchmark tries, and how much it
+//	writes at each size
+constexpr uint64_t	minTuneSize		= 64 * KiB;
+constexpr uint64_t	maxTuneSize		= 16 * MiB;
+constexpr uint64_t	tuneSpan		= 32 * MiB;
+
+//	Sector and transfer sizes reported for a device. A size of zero means
+//	the device didn't say
+struct DeviceGeometry
+{
+	DWORD	logicalSector;
+	DWORD	physicalSector;
+
+	//	Bytes from the start of the device to the first physical sector
+	//	boundary. Anything other than zero means every I/O straddles two
+	//	physical sectors
+	DWORD	alignmentOffset;
+
+	//	Largest transfer the adapter takes in one go
+	DWORD	maxTransfer;
+};
+
+//	Ask the storage stack about the device a drive path is on, either a
+//	volume e.g. E:\ or a physical drive e.g. \\.\PhysicalDrive1. Returns
+//	false if neither the alignment nor the adapter could be queried
+bool QueryDeviceGeometry (const char* pathName, DeviceGeometry& geometry);
+
+//	Tell the user what the device reported
+void OutputGeometry (const DeviceGeometry& geometry);
+
+//	True if an I/O size suits the device: a multiple of the sector size
+//	and of the physical sector size, if there is one
+bool BlockSizeFits (const uint64_t blockSize, const DWORD bytesPerSector, const DeviceGeometry& geometry);
+
+//	Write span bytes from the start of target at each power of two I/O
+//	size from minTuneSize to maxTuneSize, and pick the knee - the smallest
+//	size that gets close to the best throughput. target must be opened
+//	unbuffered, and whatever is in the first span bytes is overwritten.
+//	Returns zero if the benchmark could not be run
+uint64_t AutoTuneBlockSize (BlockEngine& target, const uint64_t span, const DWORD bytesPerSector, const DeviceGeometry& geometry, const bool largePages);
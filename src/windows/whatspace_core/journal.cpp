@@ -0,0 +1,232 @@
+//	Journal kept on the host while a test runs, so a run that is cut
+//	short by a power cut or a reboot can carry on where it stopped
+//
+//	The journal is a text file of "name value" lines. The settings come
+//	first, followed by one batch line each time progress is saved:
+//
+//		batch <phase> <next> <blocks> <seconds>
+//
+//	Lines are only ever appended, and each batch is flushed before the
+//	run carries on, so the last complete batch line is always safe to
+//	resume from
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "journal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//	Journal format version
+constexpr int	journalVersion	= 1;
+
+//	Longest line we write to the journal
+constexpr int	journalLine		= MAX_PATH + 64;
+
+
+//	Write a line to the journal
+static bool WriteJournalLine (HANDLE journal, const char* line)
+{
+	DWORD length = (DWORD) strlen(line);
+	DWORD written;
+	return WriteFile(journal, line, length, &written, nullptr) != 0 && written == length;
+}
+
+
+//	Build the default journal name for a tool and drive. The journal goes
+//	in the current directory, which should not be on the device under test
+void DefaultJournalName (wchar_t (&journalPath) [MAX_PATH], const char* toolName, const char* pathName)
+{
+	//	One journal per drive so runs on different devices don't share a
+	//	journal. A raw run names the drive e.g. \\.\PhysicalDrive1
+	if (strncmp(pathName, "\\\\.\\", 4) == 0)
+	{
+		swprintf_s(journalPath, L"%hs-%hs.jnl", toolName, pathName + 4);
+	}
+	else
+	{
+		swprintf_s(journalPath, L"%hs-%hc.jnl", toolName, pathName [0]);
+	}
+}
+
+
+//	True if the journal would be written to the device being tested
+bool JournalOnDevice (const wchar_t* journalPath, const char* pathName)
+{
+	wchar_t fullPath [MAX_PATH];
+	if (GetFullPathName(journalPath, MAX_PATH, fullPath, nullptr) == 0)
+	{
+		return false;
+	}
+
+	wchar_t journalVolume [MAX_PATH];
+	wchar_t targetVolume [MAX_PATH];
+	wchar_t widePath [MAX_PATH];
+	swprintf_s(widePath, L"%hs", pathName);
+	if (!GetVolumePathName(fullPath, journalVolume, MAX_PATH)
+	||	!GetVolumePathName(widePath, targetVolume, MAX_PATH))
+	{
+		return false;
+	}
+
+	return _wcsicmp(journalVolume, targetVolume) == 0;
+}
+
+
+//	Read the journal left by an earlier run
+bool ReadJournal (const wchar_t* journalPath, JournalRecord& record)
+{
+	FILE* journalFile = nullptr;
+	if (_wfopen_s(&journalFile, journalPath, L"r") != 0 || journalFile == nullptr)
+	{
+		return false;
+	}
+
+	//	Anything we do not recognize is skipped, as is a batch line that
+	//	was only partly written when the run stopped
+	record = {};
+	bool	haveTarget = false;
+	char	line [journalLine];
+	while (fgets(line, sizeof(line), journalFile) != nullptr)
+	{
+		uint64_t	value;
+		DWORD		phase;
+		uint64_t	next;
+		uint64_t	blocks;
+		double		seconds;
+		if (sscanf_s(line, "target %259[^\n]", record.target, (unsigned) sizeof(record.target)) == 1)
+		{
+			haveTarget = true;
+		}
+		else
+		if (sscanf_s(line, "pattern %llu", &value) == 1)
+		{
+			record.fullPattern = value != 0;
+		}
+		else
+		if (sscanf_s(line, "seed %llx", &value) == 1)
+		{
+			record.patternSeed = value;
+		}
+		else
+		if (sscanf_s(line, "run %llx", &value) == 1)
+		{
+			record.runId = value;
+		}
+		else
+		if (sscanf_s(line, "block %llu", &value) == 1)
+		{
+			record.blockSize = value;
+		}
+		else
+		if (sscanf_s(line, "stride %llu", &value) == 1)
+		{
+			record.stride = value;
+		}
+		else
+		if (sscanf_s(line, "phases %lu", &phase) == 1)
+		{
+			record.phases = phase;
+		}
+		else
+		if (sscanf_s(line, "batch %lu %llu %llu %lf", &phase, &next, &blocks, &seconds) == 4)
+		{
+			record.phase	= phase;
+			record.next		= next;
+		}
+		else
+		if (strncmp(line, "finished", 8) == 0)
+		{
+			record.finished = true;
+		}
+	}
+
+	fclose(journalFile);
+
+	//	A run that got past its last phase is finished too
+	if (record.phases != 0 && record.phase >= record.phases)
+	{
+		record.finished = true;
+	}
+
+	return haveTarget;
+}
+
+
+//	Start a new journal for a run, or add to the existing one when the run
+//	is resumed. Returns INVALID_HANDLE_VALUE if the journal can't be opened
+HANDLE OpenJournal (const wchar_t* journalPath, const JournalRecord& record, bool resume)
+{
+	HANDLE journal = CreateFile(journalPath, FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, resume ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (journal == INVALID_HANDLE_VALUE || resume)
+	{
+		return journal;
+	}
+
+	//	A new journal starts with the settings of the run
+	char line [journalLine];
+	bool written = true;
+	sprintf_s(line, "whatspace journal %d\n", journalVersion);
+	written = written && WriteJournalLine(journal, line);
+	sprintf_s(line, "target %s\n", record.target);
+	written = written && WriteJournalLine(journal, line);
+	if (record.fullPattern)
+	{
+		sprintf_s(line, "pattern 1\nseed %llx\n", record.patternSeed);
+		written = written && WriteJournalLine(journal, line);
+	}
+	if (record.runId != 0)
+	{
+		sprintf_s(line, "run %llx\n", record.runId);
+		written = written && WriteJournalLine(journal, line);
+	}
+	if (record.blockSize != 0)
+	{
+		sprintf_s(line, "block %llu\nstride %llu\n", record.blockSize, record.stride);
+		written = written && WriteJournalLine(journal, line);
+	}
+	sprintf_s(line, "phases %lu\n", record.phases);
+	written = written && WriteJournalLine(journal, line);
+
+	if (!written || !FlushFileBuffers(journal))
+	{
+		CloseHandle(journal);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return journal;
+}
+
+
+//	Record how far a run has got and how long the last batch took, and
+//	flush it to disk. Does nothing if there is no journal
+bool JournalBatch (HANDLE journal, DWORD phase, uint64_t next, uint64_t blocks, double batchSeconds)
+{
+	if (journal == INVALID_HANDLE_VALUE)
+	{
+		return true;
+	}
+
+	char line [journalLine];
+	sprintf_s(line, "batch %lu %llu %llu %.3lf\n", phase, next, blocks, batchSeconds);
+	return WriteJournalLine(journal, line) && FlushFileBuffers(journal);
+}
+
+
+//	Close the journal, marking it finished if the run got to the end
+void CloseJournal (HANDLE journal, bool finished)
+{
+	if (journal == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	if (finished)
+	{
+		WriteJournalLine(journal, "finished\n");
+		FlushFileBuffers(journal);
+	}
+
+	CloseHandle(journal);
+}
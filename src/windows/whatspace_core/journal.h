@@ -0,0 +1,59 @@
+//	Journal kept on the host while a test runs, so a run that is cut
+//	short by a power cut or a reboot can carry on where it stopped
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+//	Where a run had got to, and the settings it needs to carry on
+struct JournalRecord
+{
+	//	Drive path the run was testing
+	char		target [MAX_PATH];
+
+	//	Pattern used for the markers, and the run ID in their headers
+	bool		fullPattern;
+	uint64_t	patternSeed;
+	uint64_t	runId;
+
+	//	Size of each I/O and the distance between markers. Zero means the
+	//	run was started before these could be changed
+	uint64_t	blockSize;
+	uint64_t	stride;
+
+	//	Number of phases the run has, e.g. a write pass and a read pass
+	DWORD		phases;
+
+	//	Everything before block or sequence number next, in this phase,
+	//	has been done
+	DWORD		phase;
+	uint64_t	next;
+
+	//	The run got to the end, so there is nothing to resume
+	bool		finished;
+};
+
+//	Build the default journal name for a tool and drive. The journal goes
+//	in the current directory, which should not be on the device under test
+void DefaultJournalName (wchar_t (&journalPath) [MAX_PATH], const char* toolName, const char* pathName);
+
+//	True if the journal would be written to the device being tested
+bool JournalOnDevice (const wchar_t* journalPath, const char* pathName);
+
+//	Read the journal left by an earlier run
+bool ReadJournal (const wchar_t* journalPath, JournalRecord& record);
+
+//	Start a new journal for a run, or add to the existing one when the run
+//	is resumed. Returns INVALID_HANDLE_VALUE if the journal can't be opened
+HANDLE OpenJournal (const wchar_t* journalPath, const JournalRecord& record, bool resume);
+
+//	Record how far a run has got and how long the last batch took, and
+//	flush it to disk. Does nothing if there is no journal
+bool JournalBatch (HANDLE journal, DWORD phase, uint64_t next, uint64_t blocks, double batchSeconds);
+
+//	Close the journal, marking it finished if the run got to the end
+void CloseJournal (HANDLE journal, bool finished);
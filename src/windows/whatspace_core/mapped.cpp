@@ -0,0 +1,149 @@
+//	File mapped into memory a window at a time, so markers can be written
+//	and checked in the file system cache directly, without a read or write
+//	call for each one
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "mapped.h"
+
+
+MappedFile::MappedFile ()
+{
+	fileHandle		= INVALID_HANDLE_VALUE;
+	mappingHandle	= nullptr;
+	fileSize		= 0;
+	windowSize		= 0;
+	granularity		= 0;
+	viewBase		= nullptr;
+	viewOffset		= 0;
+	viewSize		= 0;
+}
+
+
+MappedFile::~MappedFile ()
+{
+	Close();
+}
+
+
+bool MappedFile::Open (const wchar_t* fileName, uint64_t mapWindow)
+{
+	Close();
+
+	//	Views have to start on the allocation granularity, usually 64 KiB
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	granularity	= systemInfo.dwAllocationGranularity;
+	windowSize	= ((mapWindow + granularity - 1) / granularity) * granularity;
+
+	fileHandle = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fileHandle, &size))
+	{
+		auto savedError = GetLastError();
+		Close();
+		SetLastError(savedError);
+		return false;
+	}
+	fileSize = size.QuadPart;
+
+	//	The mapping covers the whole file, only the view slides
+	mappingHandle = CreateFileMapping(fileHandle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	if (mappingHandle == nullptr)
+	{
+		auto savedError = GetLastError();
+		Close();
+		SetLastError(savedError);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool MappedFile::InView (int64_t offset, uint64_t size) const
+{
+	return viewBase != nullptr && offset >= viewOffset && (uint64_t) (offset - viewOffset) + size <= viewSize;
+}
+
+
+uint8_t* MappedFile::View (int64_t offset, uint64_t size)
+{
+	if (InView(offset, size))
+	{
+		return viewBase + (offset - viewOffset);
+	}
+
+	if (!Unmap())
+	{
+		return nullptr;
+	}
+
+	//	The new view starts on the granularity at or before the offset, and
+	//	is a whole window unless the file ends first
+	const int64_t	start	= offset - (int64_t) (offset % granularity);
+	const uint64_t	span	= max(windowSize, (uint64_t) (offset - start) + size);
+	const uint64_t	length	= min(span, (uint64_t) (fileSize - start));
+	viewBase = (uint8_t*) MapViewOfFile(mappingHandle, FILE_MAP_READ | FILE_MAP_WRITE, (DWORD) (start >> 32), (DWORD) (start & 0xFFFFFFFF), (SIZE_T) length);
+	if (viewBase == nullptr)
+	{
+		return nullptr;
+	}
+
+	viewOffset	= start;
+	viewSize	= length;
+	return viewBase + (offset - viewOffset);
+}
+
+
+bool MappedFile::Flush ()
+{
+	if (viewBase != nullptr && !FlushViewOfFile(viewBase, 0))
+	{
+		return false;
+	}
+
+	return FlushFileBuffers(fileHandle) != 0;
+}
+
+
+bool MappedFile::Unmap ()
+{
+	if (viewBase == nullptr)
+	{
+		return true;
+	}
+
+	//	Everything written through the view reaches the device before it goes
+	const bool flushed = Flush();
+	auto savedError = GetLastError();
+	UnmapViewOfFile(viewBase);
+	viewBase	= nullptr;
+	viewSize	= 0;
+	SetLastError(savedError);
+	return flushed;
+}
+
+
+void MappedFile::Close ()
+{
+	Unmap();
+
+	if (mappingHandle != nullptr)
+	{
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+	}
+
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+}
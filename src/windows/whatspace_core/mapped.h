@@ -0,0 +1,81 @@
+//	File mapped into memory a window at a time, so markers can be written
+//	and checked in the file system cache directly, without a read or write
+//	call for each one
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+//	Default size of the window of the file that is mapped at any one time
+constexpr uint64_t	defaultMapWindow	= 1024 * 1024 * 1024;
+
+//	A file mapped through a sliding view. Moving the view flushes what was
+//	written through the old one to the device
+class MappedFile
+{
+public:
+	MappedFile ();
+	~MappedFile ();
+
+	MappedFile (const MappedFile&) = delete;
+	MappedFile& operator= (const MappedFile&) = delete;
+
+	//	Open and map a file that already exists. Returns false, with the
+	//	Windows error set, if it could not be opened or mapped
+	bool Open (const wchar_t* fileName, uint64_t windowSize);
+
+	//	Size of the file when it was opened
+	int64_t Size () const	{ return fileSize; }
+
+	//	True if size bytes of the file at offset are all in the view
+	bool InView (int64_t offset, uint64_t size) const;
+
+	//	Get size bytes of the file at offset, moving the view if they are
+	//	not all in it. Returns nullptr, with the Windows error set, if the
+	//	view could not be moved
+	uint8_t* View (int64_t offset, uint64_t size);
+
+	//	Write what has changed in the view to the file, and wait for it
+	//	to reach the device. Returns false, with the Windows error set, if
+	//	it could not be flushed
+	bool Flush ();
+
+	//	Unmap the view and close the file, so it can be opened another
+	//	way. This is safe to call more than once
+	void Close ();
+
+private:
+	//	Unmap the view, flushing it to the device first
+	bool Unmap ();
+
+	HANDLE		fileHandle;
+	HANDLE		mappingHandle;
+	int64_t		fileSize;
+	uint64_t	windowSize;
+	uint64_t	granularity;
+	uint8_t*	viewBase;
+	int64_t		viewOffset;
+	uint64_t	viewSize;
+};
+
+//	Run access against a mapped view. A read or write the device fails
+//	shows up as an in-page error exception rather than an error code, so
+//	it is caught here. Returns false if the device failed. The access
+//	can't leave anything needing to be destroyed if it fails
+template <typename Access>
+bool TouchView (Access access)
+{
+	__try
+	{
+		access();
+		return true;
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+}
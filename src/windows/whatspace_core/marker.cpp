@@ -0,0 +1,170 @@
+//	Marker header written into each block. It holds the offset the block
+//	was written to and the run that wrote it, so when a fake controller
+//	maps one offset onto another we can tell which offset the data at a
+//	block really came from
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "marker.h"
+#include "pattern.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+
+//	Mixed into the check value
+constexpr uint64_t	markerMagic		= 0x5753504D4B523031ULL;
+
+
+//	Check value for a header
+static uint64_t HeaderCheck (uint64_t runId, int64_t offset, uint64_t value)
+{
+	uint64_t check = markerMagic ^ runId;
+	check = (check << 21 | check >> 43) ^ (uint64_t) offset;
+	check = (check << 21 | check >> 43) ^ value;
+	return check;
+}
+
+
+//	Pick a new ID for a run. This is never zero, which is used for
+//	markers written before headers existed
+uint64_t NewRunId ()
+{
+	uint64_t runId = NewPatternSeed();
+	return runId != 0 ? runId : 1;
+}
+
+
+//	Write a marker header at a position in a buffer
+void SetMarkerHeader (uint8_t* where, uint64_t runId, int64_t offset, uint64_t value)
+{
+	MarkerHeader header;
+	header.runId	= runId;
+	header.offset	= offset;
+	header.value	= value;
+	header.check	= HeaderCheck(runId, offset, value);
+
+	//	The position may not be aligned for a 64 bit store
+	memcpy(where, &header, sizeof(header));
+}
+
+
+//	Read a marker header from a position in a buffer. Returns false if
+//	the data there is not a header
+bool ReadMarkerHeader (const uint8_t* where, MarkerHeader& header)
+{
+	memcpy(&header, where, sizeof(header));
+	return header.check == HeaderCheck(header.runId, header.offset, header.value);
+}
+
+
+//	Fold an alias distance into where the device wraps
+int64_t FoldAliasDistance (int64_t modulus, int64_t distance)
+{
+	return distance > 0 ? std::gcd(modulus, distance) : modulus;
+}
+
+
+//	Narrow a multiple of where a device wraps down to where it wraps. Each
+//	prime factor is tried once for every time it divides the distance, so
+//	this takes a probe for each of them
+int64_t NarrowAliasModulus (int64_t distance, uint32_t sectorSize, const std::function<bool (int64_t offset, bool& aliased)>& aliasesZero)
+{
+	if (distance <= 0 || sectorSize == 0 || distance % sectorSize != 0)
+	{
+		return distance;
+	}
+
+	int64_t modulus	= distance;
+	int64_t sectors	= distance / sectorSize;
+	int64_t factor	= 2;
+	while (sectors > 1)
+	{
+		//	What is left once no factor up to its square root divides it
+		//	is prime
+		if (factor * factor > sectors)
+		{
+			factor = sectors;
+		}
+
+		if (sectors % factor != 0)
+		{
+			factor ++;
+			continue;
+		}
+
+		sectors /= factor;
+
+		bool aliased = false;
+		if (!aliasesZero(modulus / factor, aliased))
+		{
+			break;
+		}
+
+		if (aliased)
+		{
+			modulus /= factor;
+		}
+	}
+
+	return modulus;
+}
+
+
+//	Smallest number of baby steps whose square covers the granules
+static int64_t BabySteps (int64_t granules)
+{
+	int64_t babySteps = 1;
+	while (babySteps * babySteps < granules)
+	{
+		babySteps ++;
+	}
+
+	return babySteps;
+}
+
+
+//	Offsets for the wrap check. The low rungs are the baby steps and the
+//	ones down from the top the giant steps, so every whole number of
+//	granules up to the last is the distance from a giant step to a baby
+//	step
+std::vector<int64_t> WrapLadder (int64_t lastOffset, int64_t minGranule, size_t maxRungs, int64_t& granule)
+{
+	std::vector<int64_t> ladderOffsets;
+	granule = minGranule;
+	if (lastOffset < 0 || minGranule <= 0)
+	{
+		return ladderOffsets;
+	}
+
+	//	There are about as many giant steps as baby steps, plus offset 0
+	//	and the last offset
+	while ((size_t) (BabySteps(lastOffset / granule) * 2 + 2) > maxRungs && granule <= lastOffset)
+	{
+		granule *= 2;
+	}
+
+	const int64_t granules	= lastOffset / granule;
+	const int64_t babySteps	= BabySteps(granules);
+
+	const int64_t topOffset	= granules * granule;
+	const int64_t giantStep	= babySteps * granule;
+
+	for (int64_t step = 0; step < babySteps && step * granule <= topOffset; step++)
+	{
+		ladderOffsets.push_back(step * granule);
+	}
+
+	for (int64_t offset = topOffset; offset >= giantStep; offset -= giantStep)
+	{
+		ladderOffsets.push_back(offset);
+	}
+
+	ladderOffsets.push_back(lastOffset);
+
+	std::sort(ladderOffsets.begin(), ladderOffsets.end());
+	ladderOffsets.erase(std::unique(ladderOffsets.begin(), ladderOffsets.end()), ladderOffsets.end());
+	return ladderOffsets;
+}
@@ -0,0 +1,74 @@
+//	Marker header written into each block. It holds the offset the block
+//	was written to and the run that wrote it, so when a fake controller
+//	maps one offset onto another we can tell which offset the data at a
+//	block really came from
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+//	What a marker header holds
+struct MarkerHeader
+{
+	//	Unique to the run that wrote it, so markers left by an earlier
+	//	run are not mistaken for ours
+	uint64_t	runId;
+
+	//	Offset the marker was written to
+	int64_t		offset;
+
+	//	Value the utility uses for the block e.g. a sequence number
+	uint64_t	value;
+
+	//	Check value, so random data is not taken for a header
+	uint64_t	check;
+};
+
+//	Bytes a header takes up in a block
+constexpr size_t markerHeaderSize = sizeof(MarkerHeader);
+
+//	Pick a new ID for a run. This is never zero, which is used for
+//	markers written before headers existed
+uint64_t NewRunId ();
+
+//	Write a marker header at a position in a buffer
+void SetMarkerHeader (uint8_t* where, uint64_t runId, int64_t offset, uint64_t value);
+
+//	Read a marker header from a position in a buffer. Returns false if
+//	the data there is not a header
+bool ReadMarkerHeader (const uint8_t* where, MarkerHeader& header);
+
+//	Fold the distance from a marker to the marker for a higher offset that
+//	overwrote it into where the device wraps, starting from zero. The last
+//	write to a sector is what stays there, so the distance can be any
+//	multiple of where it wraps, and only the greatest common divisor of
+//	the distances is kept
+int64_t FoldAliasDistance (int64_t modulus, int64_t distance);
+
+//	Narrow a multiple of where a device wraps down to where it wraps. That
+//	is a whole number of sectors, so each prime factor of the distance in
+//	sectors is divided out for as long as a marker at the smaller distance
+//	still lands on offset 0. aliasesZero writes the markers for offset 0
+//	and then an offset, and says whether the second overwrote the first.
+//	It returns false if the I/O failed, which ends the search there
+int64_t NarrowAliasModulus (int64_t distance, uint32_t sectorSize, const std::function<bool (int64_t offset, bool& aliased)>& aliasesZero);
+
+//	Offsets for the wrap check of a bisect, from offset 0 up to lastOffset.
+//	A device that wraps puts the marker for a rung at or past where it
+//	wraps onto another rung only if the two are a multiple of the wrap
+//	apart. There is a rung at every granule up to about the square root of
+//	the granules in the file, and then rungs that far apart down from the
+//	last granule, so a wrap at any whole number of granules lands a rung
+//	on one of the low ones. That takes about twice the square root of the
+//	granules in rungs, so the granule starts at minGranule and doubles
+//	until there are no more than maxRungs. The granule used is returned in
+//	granule, and a wrap that isn't a multiple of it may not be seen. The
+//	last offset is always a rung. The offsets are in ascending order
+std::vector<int64_t> WrapLadder (int64_t lastOffset, int64_t minGranule, size_t maxRungs, int64_t& granule);
@@ -0,0 +1,100 @@
+//	Console output shared by the tools - Windows error messages and
+//	human readable sizes
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "output.h"
+
+#include <Windows.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <wchar.h>
+
+//	Converts bytes to human readable sizes
+constexpr int64_t			sizeArray []	= { TiB, GiB, MiB, KiB};
+constexpr const wchar_t*	sizeNames []	= { L"TiB", L"GiB", L"MiB", L"KiB"};
+constexpr const wchar_t*	sizeIsBytes		= L"bytes";
+constexpr int				numSizes		= sizeof(sizeArray) / sizeof(sizeArray[0]);
+
+//	Where the current thread's output goes, nullptr for the console
+static thread_local FILE*	threadOutput	= nullptr;
+
+
+//	Output text for the device the current thread is testing
+void OutputText (const wchar_t* format, ...)
+{
+	va_list ourArgs;
+	va_start(ourArgs, format);
+	vfwprintf(threadOutput != nullptr ? threadOutput : stdout, format, ourArgs);
+	va_end(ourArgs);
+}
+
+
+//	Send the current thread's output to a file
+void SetThreadOutput (FILE* outputFile)
+{
+	threadOutput = outputFile;
+}
+
+
+//	Output an error message
+void PrintError (const wchar_t* format, ...)
+{
+	//	We start by saving the current error as we might make
+	//	API calls that produce other errors
+	auto savedError = GetLastError();
+
+	//	There are two parts to the error message. There's the Windows
+	//	description of the error and information passed by the user.
+	//	Start by getting the Windows error text
+	LPCTSTR windowsMsg = nullptr;
+
+	//	Format the error message
+	FormatMessage(	FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+					nullptr, savedError,
+					MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+					(LPTSTR) &windowsMsg, 0, nullptr);
+
+	//	User message
+	wchar_t userMsg [BUFSIZ];
+
+	//	Get the start of the variable arguments
+	va_list ourArgs;
+	va_start(ourArgs, format);
+	vswprintf_s(userMsg, format, ourArgs);
+	va_end(ourArgs);
+
+	//	Output the full message
+	OutputText(L"%s : %s\n", userMsg, windowsMsg);
+
+	//	Free off the Windows message buffer
+	LocalFree((LPVOID) windowsMsg);
+}
+
+
+//	Output a human readable size
+const wchar_t* HumanReadable (int64_t sizeInBytes, int64_t& convertedSize)
+{
+	for (int i = 0; i < numSizes; i ++)
+	{
+		if (sizeInBytes >= sizeArray [i])
+		{
+			convertedSize = sizeInBytes / sizeArray [i];
+			return sizeNames [i];
+		}
+	}
+
+	//	Must be in bytes
+	convertedSize = sizeInBytes;
+	return sizeIsBytes;
+}
+
+
+//	Common output function for sizes
+void OutputSize (const wchar_t* msg, const uint64_t inSize)
+{
+	int64_t converted;
+	const wchar_t* textSize = HumanReadable(inSize, converted);
+	OutputText(L"%s %lld %s\n", msg, converted, textSize);
+}
@@ -0,0 +1,36 @@
+//	Console output shared by the tools - Windows error messages and
+//	human readable sizes
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+//	Size metrics e.g. KiB, GiB etc.
+constexpr int64_t KiB = 1024;
+constexpr int64_t MiB = KiB * 1024;
+constexpr int64_t GiB = MiB * 1024;
+constexpr int64_t TiB = GiB * 1024;
+
+//	Output text for the device the current thread is testing. This goes to
+//	the console unless the thread has been given its own output
+void OutputText (const wchar_t* format, ...);
+
+//	Send the current thread's output to a file, e.g. the log for one of
+//	several devices being tested at once, or back to the console with
+//	nullptr
+void SetThreadOutput (FILE* outputFile);
+
+//	Output an error message, followed by the Windows description of the
+//	last error
+void PrintError (const wchar_t* format, ...);
+
+//	Convert a size in bytes to a human readable size. Returns the name of
+//	the units the converted size is in
+const wchar_t* HumanReadable (int64_t sizeInBytes, int64_t& convertedSize);
+
+//	Common output function for sizes
+void OutputSize (const wchar_t* msg, const uint64_t inSize);
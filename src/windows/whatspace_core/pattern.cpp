@@ -0,0 +1,194 @@
+//	Full block pattern generation shared by the utilities. Every 32 bit
+//	word of a block is a hash of its position on the device and a seed,
+//	so the pattern can be regenerated on verification without storing it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "pattern.h"
+#include "cpu.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+#include <chrono>
+#include <random>
+
+//	Words that share a key. The key changes every 2^32 words (16 GiB)
+constexpr uint64_t	wordsPerKey		= 0x100000000ULL;
+
+//	Multipliers for the 32 bit mix
+constexpr uint32_t	mixMultiply1	= 0x85EBCA6B;
+constexpr uint32_t	mixMultiply2	= 0xC2B2AE35;
+
+//	Fills a run of words that share a key
+typedef void (*FillRunFunction) (uint32_t* words, size_t count, uint32_t start);
+
+
+//	Mix a 64 bit value - the splitmix64 finalizer
+static inline uint64_t Mix64 (uint64_t value)
+{
+	value += 0x9E3779B97F4A7C15ULL;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+	return value ^ (value >> 31);
+}
+
+
+//	Mix a 32 bit value - the murmur3 finalizer. This is a one to one
+//	mapping, so no two words with the same key have the same value
+static inline uint32_t Mix32 (uint32_t value)
+{
+	value ^= value >> 16;
+	value *= mixMultiply1;
+	value ^= value >> 13;
+	value *= mixMultiply2;
+	return value ^ (value >> 16);
+}
+
+
+//	The key for a run of words, from the top half of the word index
+static inline uint32_t RunKey (uint64_t seed, uint64_t wordIndex)
+{
+	return (uint32_t) Mix64(seed ^ (wordIndex >> 32));
+}
+
+
+//	Word j of the run is Mix32(start + j)
+static void FillRunScalar (uint32_t* words, size_t count, uint32_t start)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		words [i] = Mix32(start + (uint32_t) i);
+	}
+}
+
+
+//	SSE2 has no 32 bit multiply that keeps the low half, so build one
+//	from the even and odd 32 x 32 -> 64 bit multiplies
+static inline __m128i MultiplyLow32Sse2 (__m128i a, __m128i b)
+{
+	__m128i even	= _mm_mul_epu32(a, b);
+	__m128i odd		= _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+//	SSE2 version, 4 words at a time
+static void FillRunSse2 (uint32_t* words, size_t count, uint32_t start)
+{
+	const __m128i step		= _mm_set1_epi32(4);
+	const __m128i multiply1	= _mm_set1_epi32((int) mixMultiply1);
+	const __m128i multiply2	= _mm_set1_epi32((int) mixMultiply2);
+
+	__m128i index = _mm_add_epi32(_mm_set1_epi32((int) start), _mm_setr_epi32(0, 1, 2, 3));
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i value = index;
+		value = _mm_xor_si128(value, _mm_srli_epi32(value, 16));
+		value = MultiplyLow32Sse2(value, multiply1);
+		value = _mm_xor_si128(value, _mm_srli_epi32(value, 13));
+		value = MultiplyLow32Sse2(value, multiply2);
+		value = _mm_xor_si128(value, _mm_srli_epi32(value, 16));
+		_mm_storeu_si128((__m128i*) (words + i), value);
+
+		index = _mm_add_epi32(index, step);
+	}
+
+	FillRunScalar(words + i, count - i, start + (uint32_t) i);
+}
+
+
+//	AVX2 version, 16 words at a time in two independent chains so the
+//	multiply latency is hidden
+TARGET_AVX2 static void FillRunAvx2 (uint32_t* words, size_t count, uint32_t start)
+{
+	const __m256i step		= _mm256_set1_epi32(16);
+	const __m256i multiply1	= _mm256_set1_epi32((int) mixMultiply1);
+	const __m256i multiply2	= _mm256_set1_epi32((int) mixMultiply2);
+
+	__m256i indexLow	= _mm256_add_epi32(_mm256_set1_epi32((int) start), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i indexHigh	= _mm256_add_epi32(indexLow, _mm256_set1_epi32(8));
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i low		= indexLow;
+		__m256i high	= indexHigh;
+
+		low		= _mm256_xor_si256(low, _mm256_srli_epi32(low, 16));
+		high	= _mm256_xor_si256(high, _mm256_srli_epi32(high, 16));
+		low		= _mm256_mullo_epi32(low, multiply1);
+		high	= _mm256_mullo_epi32(high, multiply1);
+		low		= _mm256_xor_si256(low, _mm256_srli_epi32(low, 13));
+		high	= _mm256_xor_si256(high, _mm256_srli_epi32(high, 13));
+		low		= _mm256_mullo_epi32(low, multiply2);
+		high	= _mm256_mullo_epi32(high, multiply2);
+		low		= _mm256_xor_si256(low, _mm256_srli_epi32(low, 16));
+		high	= _mm256_xor_si256(high, _mm256_srli_epi32(high, 16));
+
+		_mm256_storeu_si256((__m256i*) (words + i), low);
+		_mm256_storeu_si256((__m256i*) (words + i + 8), high);
+
+		indexLow	= _mm256_add_epi32(indexLow, step);
+		indexHigh	= _mm256_add_epi32(indexHigh, step);
+	}
+
+	FillRunSse2(words + i, count - i, start + (uint32_t) i);
+}
+
+
+//	Pick the fastest fill the processor supports
+static FillRunFunction PickFillRun ()
+{
+	if (CpuHasAvx2())
+	{
+		return FillRunAvx2;
+	}
+
+	return FillRunSse2;
+}
+
+
+//	Fill words starting at a word index, splitting where the key changes
+static void FillWords (uint32_t* words, size_t wordCount, uint64_t seed, uint64_t wordIndex)
+{
+	static const FillRunFunction fillRun = PickFillRun();
+
+	while (wordCount > 0)
+	{
+		uint64_t	keyLeft		= wordsPerKey - (wordIndex & (wordsPerKey - 1));
+		size_t		runCount	= (size_t) (wordCount < keyLeft ? wordCount : keyLeft);
+
+		fillRun(words, runCount, (uint32_t) wordIndex + RunKey(seed, wordIndex));
+
+		words		+= runCount;
+		wordCount	-= runCount;
+		wordIndex	+= runCount;
+	}
+}
+
+
+//	Pick a new seed for a run, so data left behind by an earlier run
+//	never matches
+uint64_t NewPatternSeed ()
+{
+	std::random_device randomSource;
+	uint64_t seed = ((uint64_t) randomSource() << 32) | randomSource();
+
+	//	Mix in the time in case the random device is deterministic
+	return Mix64(seed ^ (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count());
+}
+
+
+//	Fill a buffer with the pattern for the data at the given device or
+//	file offset. The offset and size must be multiples of 4 bytes
+void FillPattern (uint8_t* buffer, size_t bufferSize, uint64_t seed, uint64_t offset)
+{
+	FillWords((uint32_t*) buffer, bufferSize / sizeof(uint32_t), seed, offset / sizeof(uint32_t));
+}
@@ -0,0 +1,19 @@
+//	Full block pattern generation shared by the utilities. Every 32 bit
+//	word of a block is a hash of its position on the device and a seed,
+//	so the pattern can be regenerated on verification without storing it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//	Pick a new seed for a run, so data left behind by an earlier run
+//	never matches
+uint64_t NewPatternSeed ();
+
+//	Fill a buffer with the pattern for the data at the given device or
+//	file offset. The offset and size must be multiples of 4 bytes
+void FillPattern (uint8_t* buffer, size_t bufferSize, uint64_t seed, uint64_t offset);
@@ -0,0 +1,49 @@
+//	Process privileges some of the I/O needs, e.g. to set the valid data
+//	length of a file or to use large pages
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "privilege.h"
+#include "output.h"
+
+
+//	Add a privilege to the process token
+bool AddPrivelege (LPCTSTR privName)
+{
+	HANDLE tokenHandle = INVALID_HANDLE_VALUE;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &tokenHandle)) 
+	{
+		PrintError(L"Could not get token handle for %s", privName);
+		return false;
+	}
+
+	//	Lookup the privelege
+	LUID lookupID;
+	LookupPrivilegeValue(NULL, privName, &lookupID);
+
+	//	Add the new privelege
+	TOKEN_PRIVILEGES newPriv;
+	ZeroMemory(&newPriv, sizeof(newPriv));
+	newPriv.PrivilegeCount				= 1;
+	newPriv.Privileges[0].Luid			= lookupID;
+	newPriv.Privileges[0].Attributes	= SE_PRIVILEGE_ENABLED;
+
+	DWORD				returnLen;
+	TOKEN_PRIVILEGES	oldPriv;
+	if (!AdjustTokenPrivileges(tokenHandle, FALSE, &newPriv, sizeof(TOKEN_PRIVILEGES), &oldPriv, &returnLen))
+	{
+		CloseHandle(tokenHandle);
+		PrintError(L"Unable to get privilege %s", privName);
+		return false;
+	}
+
+	if (!CloseHandle(tokenHandle))
+	{
+		//	Could not close the token handle
+		PrintError(L"Could not close the handle for %s", privName);
+		return false;
+	}
+
+	return true;
+}
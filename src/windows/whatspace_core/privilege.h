@@ -0,0 +1,12 @@
+//	Process privileges some of the I/O needs, e.g. to set the valid data
+//	length of a file or to use large pages
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+
+//	Add a privilege to the process token
+bool AddPrivelege (LPCTSTR privName);
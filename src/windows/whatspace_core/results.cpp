@@ -0,0 +1,174 @@
+//	Results of a run written to a JSON file, for rigs that screen many
+//	devices at once and would rather not scrape the console output
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "marker.h"
+#include "output.h"
+#include "results.h"
+
+#include <string.h>
+#include <wchar.h>
+
+
+RunResults::RunResults ()
+{
+	bytesPerSector		= 0;
+	sectorsPerCluster	= 0;
+	totalSpace			= 0;
+	freeSpace			= 0;
+	capacity			= -1;
+	resolution			= 0;
+	bytesWritten		= 0;
+	bytesRead			= 0;
+	failureCount		= 0;
+	haveFailure			= false;
+	failureIo			= false;
+	failureOffset		= -1;
+	failureReason [0]	= 0;
+	failureError		= ERROR_SUCCESS;
+	aliasDistance		= 0;
+}
+
+
+//	Record a failure, keeping the lowest offset
+void RunResults::Failed (int64_t offset, const char* reason, bool io, DWORD error)
+{
+	std::lock_guard<std::mutex> lock(failureLock);
+	failureCount ++;
+	if (!haveFailure || offset < failureOffset)
+	{
+		haveFailure		= true;
+		failureIo		= io;
+		failureOffset	= offset;
+		failureError	= error;
+		strcpy_s(failureReason, reason);
+	}
+}
+
+
+//	Record an I/O that failed, along with the Windows error
+void RunResults::IoFailed (int64_t offset, const char* reason)
+{
+	Failed(offset, reason, true, GetLastError());
+}
+
+
+//	Record data that was wrong
+void RunResults::DataFailed (int64_t offset, const char* reason)
+{
+	Failed(offset, reason, false, ERROR_SUCCESS);
+}
+
+
+//	The capacity is up to the first offset that failed
+void RunResults::CapacityFromFailure (int64_t failureResolution)
+{
+	std::lock_guard<std::mutex> lock(failureLock);
+	if (haveFailure && failureOffset >= 0 && capacity < 0)
+	{
+		capacity	= failureOffset;
+		resolution	= failureResolution;
+	}
+}
+
+
+//	Fold an alias distance into the ones already seen
+void RunResults::AliasSeen (int64_t distance)
+{
+	std::lock_guard<std::mutex> lock(failureLock);
+	aliasDistance = FoldAliasDistance(aliasDistance, distance);
+}
+
+
+//	Greatest common divisor of the alias distances seen
+int64_t RunResults::AliasDistance ()
+{
+	std::lock_guard<std::mutex> lock(failureLock);
+	return aliasDistance;
+}
+
+
+//	Whether the lowest failure was an I/O that failed
+bool RunResults::IoFailedFirst ()
+{
+	std::lock_guard<std::mutex> lock(failureLock);
+	return haveFailure && failureIo;
+}
+
+
+//	Write the results to resultsPath
+bool RunResults::Write (const wchar_t* resultsPath, const char* toolName, const char* target, bool passed, double seconds)
+{
+	FILE* jsonFile = nullptr;
+	if (_wfopen_s(&jsonFile, resultsPath, L"w") != 0 || jsonFile == nullptr)
+	{
+		PrintError(L"Could not create the results file %s", resultsPath);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(failureLock);
+	const uint64_t	written		= bytesWritten.load();
+	const uint64_t	read		= bytesRead.load();
+	const double	throughput	= seconds > 0 ? ((double) (written + read) / (double) MiB) / seconds : 0;
+
+	fprintf(jsonFile, "{\n  \"tool\": ");
+	WriteJsonString(jsonFile, toolName);
+	fprintf(jsonFile, ",\n  \"target\": ");
+	WriteJsonString(jsonFile, target);
+	fprintf(jsonFile, ",\n  \"geometry\": {\"bytes_per_sector\": %lu, \"sectors_per_cluster\": %lu, \"total_bytes\": %lld, \"free_bytes\": %lld},\n",
+			bytesPerSector, sectorsPerCluster, totalSpace, freeSpace);
+	fprintf(jsonFile, "  \"passed\": %s,\n", passed ? "true" : "false");
+
+	if (capacity >= 0)
+	{
+		fprintf(jsonFile, "  \"capacity_bytes\": %lld,\n  \"capacity_resolution_bytes\": %lld,\n", capacity, resolution);
+	}
+	else
+	{
+		fprintf(jsonFile, "  \"capacity_bytes\": null,\n  \"capacity_resolution_bytes\": null,\n");
+	}
+
+	fprintf(jsonFile, "  \"failures\": %llu,\n", failureCount);
+	if (haveFailure)
+	{
+		if (failureOffset >= 0)
+		{
+			fprintf(jsonFile, "  \"first_failure\": {\"offset\": %lld, \"reason\": ", failureOffset);
+		}
+		else
+		{
+			fprintf(jsonFile, "  \"first_failure\": {\"offset\": null, \"reason\": ");
+		}
+		WriteJsonString(jsonFile, failureReason);
+		fprintf(jsonFile, ", \"windows_error\": %lu},\n", failureError);
+	}
+	else
+	{
+		fprintf(jsonFile, "  \"first_failure\": null,\n");
+	}
+
+	fprintf(jsonFile, "  \"bytes_written\": %llu,\n  \"bytes_read\": %llu,\n", written, read);
+	fprintf(jsonFile, "  \"seconds\": %.3f,\n  \"mib_per_second\": %.1f\n}\n", seconds, throughput);
+
+	const bool resultsWritten = ferror(jsonFile) == 0;
+	fclose(jsonFile);
+	return resultsWritten;
+}
+
+
+//	Write a string for JSON, escaping the backslashes in Windows paths
+void WriteJsonString (FILE* jsonFile, const char* text)
+{
+	fputc('"', jsonFile);
+	for (const char* c = text; *c != 0; c++)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			fputc('\\', jsonFile);
+		}
+		fputc(*c, jsonFile);
+	}
+	fputc('"', jsonFile);
+}
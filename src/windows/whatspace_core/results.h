@@ -0,0 +1,83 @@
+//	Results of a run written to a JSON file, for rigs that screen many
+//	devices at once and would rather not scrape the console output
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+
+//	What a run found out about a device. The byte counts and failures are
+//	safe to update from more than one thread
+class RunResults
+{
+public:
+	RunResults ();
+
+	//	Record an I/O that failed at offset bytes into the device, along
+	//	with the Windows error. Only the lowest offset is kept, and -1 is
+	//	for a failure before any I/O, e.g. opening the device
+	void IoFailed (int64_t offset, const char* reason);
+
+	//	Record data that was wrong at offset bytes into the device
+	void DataFailed (int64_t offset, const char* reason);
+
+	//	For a run that walks the whole device, the capacity is up to the
+	//	first offset that failed. A run that has already worked out the
+	//	capacity, e.g. through its error budget, keeps it
+	void CapacityFromFailure (int64_t failureResolution);
+
+	//	Record the distance from a marker to the marker for a higher offset
+	//	that overwrote it. Every distance is a multiple of where the device
+	//	wraps, so only their greatest common divisor is kept
+	void AliasSeen (int64_t distance);
+
+	//	Greatest common divisor of the alias distances seen, or zero if no
+	//	marker was overwritten by a higher one
+	int64_t AliasDistance ();
+
+	//	True if the lowest offset that failed was an I/O that failed rather
+	//	than data that was wrong, e.g. a device that dropped off the bus
+	bool IoFailedFirst ();
+
+	//	Write the results to resultsPath. passed is the tool's verdict on
+	//	the run, and seconds how long it took
+	bool Write (const wchar_t* resultsPath, const char* toolName, const char* target, bool passed, double seconds);
+
+	//	Geometry of the device, from GetDiskFreeSpace or the drive itself
+	DWORD					bytesPerSector;
+	DWORD					sectorsPerCluster;
+	int64_t					totalSpace;
+	int64_t					freeSpace;
+
+	//	The capacity the run found, or -1 if it didn't get that far, and
+	//	how far out it could be
+	int64_t					capacity;
+	int64_t					resolution;
+
+	//	Everything written to and read from the device
+	std::atomic<uint64_t>	bytesWritten;
+	std::atomic<uint64_t>	bytesRead;
+
+private:
+	//	Record a failure, keeping the lowest offset
+	void Failed (int64_t offset, const char* reason, bool io, DWORD error);
+
+	std::mutex				failureLock;
+	uint64_t				failureCount;
+	bool					haveFailure;
+	bool					failureIo;
+	int64_t					failureOffset;
+	char					failureReason [64];
+	DWORD					failureError;
+	int64_t					aliasDistance;
+};
+
+//	Write a string for JSON, escaping the backslashes in Windows paths
+void WriteJsonString (FILE* jsonFile, const char* text);
@@ -0,0 +1,347 @@
+//	Latency and throughput telemetry for a run. Every request's latency
+//	goes into a log bucket histogram, and the progress through the device
+//	is cut into one GiB slices, so a drive that slows down once its fast
+//	cache is full, or that stalls as it wears out, shows up in the results
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "output.h"
+#include "results.h"
+#include "telemetry.h"
+#include "timing.h"
+
+#include <Windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+//	Values under this are counted exactly, one bucket each
+constexpr uint64_t		exactValues			= LatencyHistogram::subBuckets;
+
+//	Percentiles that are reported
+constexpr double		percentiles []		= { 50.0, 99.0, 99.9};
+constexpr const char*	percentileNames []	= { "p50", "p99", "p99_9"};
+constexpr int			numPercentiles		= sizeof(percentiles) / sizeof(percentiles [0]);
+
+
+//	Position of the highest set bit, for a value that isn't zero
+static inline int HighestBit (uint64_t value)
+{
+	int bit = 0;
+	for (int shift = 32; shift > 0; shift /= 2)
+	{
+		if (value >> shift)
+		{
+			value >>= shift;
+			bit += shift;
+		}
+	}
+
+	return bit;
+}
+
+
+LatencyHistogram::LatencyHistogram ()
+	: counts(numBuckets, 0)
+{
+	totalCount	= 0;
+	maxValue	= 0;
+}
+
+
+//	Bucket a value is counted in. Values under sixteen have a bucket
+//	each, after that the top four bits under the highest set bit pick one
+//	of the sixteen buckets for that power of two
+size_t LatencyHistogram::BucketIndex (uint64_t value)
+{
+	if (value < exactValues)
+	{
+		return (size_t) value;
+	}
+
+	const int highBit	= HighestBit(value);
+	const size_t sub	= (size_t) ((value >> (highBit - 4)) & (subBuckets - 1));
+	return ((size_t) (highBit - 3) * subBuckets) + sub;
+}
+
+
+//	Smallest value counted in a bucket
+uint64_t LatencyHistogram::BucketLowest (size_t index)
+{
+	if (index < exactValues)
+	{
+		return index;
+	}
+
+	const int highBit	= (int) (index / subBuckets) + 3;
+	const uint64_t sub	= index % subBuckets;
+	return (subBuckets + sub) << (highBit - 4);
+}
+
+
+//	Largest value counted in a bucket
+uint64_t LatencyHistogram::BucketHighest (size_t index)
+{
+	if (index + 1 >= numBuckets)
+	{
+		return UINT64_MAX;
+	}
+
+	return BucketLowest(index + 1) - 1;
+}
+
+
+//	Count one latency in nanoseconds
+void LatencyHistogram::Add (uint64_t nanoseconds)
+{
+	counts [BucketIndex(nanoseconds)] ++;
+	totalCount ++;
+	maxValue = max(maxValue, nanoseconds);
+}
+
+
+//	The latency percent of the counts are at or under
+uint64_t LatencyHistogram::Percentile (double percent) const
+{
+	if (totalCount == 0)
+	{
+		return 0;
+	}
+
+	//	The count that has to be reached, rounded up so p100 is the max
+	uint64_t wanted = (uint64_t) ((percent / 100.0) * (double) totalCount + 0.999999);
+	wanted = max(wanted, (uint64_t) 1);
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < numBuckets; i++)
+	{
+		seen += counts [i];
+		if (seen >= wanted)
+		{
+			return min(BucketHighest(i), maxValue);
+		}
+	}
+
+	return maxValue;
+}
+
+
+RunTelemetry::RunTelemetry ()
+{
+	current		= {};
+	current.pass	= 1;
+	sliceFrom	= 0;
+	sliceStart	= NowNanoseconds();
+}
+
+
+//	Close the slice in progress, unless nothing happened in it
+void RunTelemetry::EndSlice ()
+{
+	const uint64_t now = NowNanoseconds();
+	if (current.requests != 0 || current.transferred != 0)
+	{
+		current.seconds = (double) (now - sliceStart) / 1e9;
+		slices.push_back(current);
+	}
+
+	current.seconds			= 0;
+	current.transferred		= 0;
+	current.requests		= 0;
+	current.latencyTotal	= 0;
+	current.latencyMax		= 0;
+	sliceFrom	= current.endPosition;
+	sliceStart	= now;
+}
+
+
+//	Start a pass over the device
+void RunTelemetry::StartPass (uint32_t pass, uint64_t startPosition)
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	EndSlice();
+	current.pass		= pass;
+	current.endPosition	= startPosition;
+	sliceFrom			= startPosition;
+}
+
+
+//	Count how long one request took
+void RunTelemetry::AddLatency (bool reading, uint64_t nanoseconds)
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	if (reading)
+	{
+		readLatency.Add(nanoseconds);
+	}
+	else
+	{
+		writeLatency.Add(nanoseconds);
+	}
+
+	current.requests ++;
+	current.latencyTotal	+= nanoseconds;
+	current.latencyMax		= max(current.latencyMax, nanoseconds);
+}
+
+
+//	Move further through the device. A slice ends each time the position
+//	crosses a GiB boundary
+void RunTelemetry::AddProgress (uint64_t coveredBytes, uint64_t transferredBytes)
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	current.endPosition	+= coveredBytes;
+	current.transferred	+= transferredBytes;
+
+	const uint64_t boundary = ((sliceFrom / GiB) + 1) * GiB;
+	if (current.endPosition >= boundary)
+	{
+		EndSlice();
+	}
+}
+
+
+//	How far through the device the current pass has got
+uint64_t RunTelemetry::Position (uint32_t& pass)
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	pass = current.pass;
+	return current.endPosition;
+}
+
+
+//	MiB a second moved in a slice
+static double SliceThroughput (const ThroughputSlice& slice)
+{
+	if (slice.seconds <= 0)
+	{
+		return 0;
+	}
+
+	return ((double) slice.transferred / (double) MiB) / slice.seconds;
+}
+
+
+//	Latencies are reported in microseconds
+static double Microseconds (uint64_t nanoseconds)
+{
+	return (double) nanoseconds / 1000.0;
+}
+
+
+//	Print the percentiles of one histogram
+static void OutputHistogram (const wchar_t* name, const LatencyHistogram& histogram)
+{
+	if (histogram.Count() == 0)
+	{
+		return;
+	}
+
+	OutputText(L"%s latency over %llu requests:", name, histogram.Count());
+	for (int i = 0; i < numPercentiles; i++)
+	{
+		OutputText(L" %hs %.1f us,", percentileNames [i], Microseconds(histogram.Percentile(percentiles [i])));
+	}
+	OutputText(L" max %.1f us\n", Microseconds(histogram.Max()));
+}
+
+
+//	Print the latency percentiles, and the slowest and fastest GiB so a
+//	throughput cliff is easy to spot
+void RunTelemetry::OutputSummary ()
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	OutputHistogram(L"Write", writeLatency);
+	OutputHistogram(L"Read", readLatency);
+
+	const ThroughputSlice* slowest = nullptr;
+	const ThroughputSlice* fastest = nullptr;
+	for (const auto& slice : slices)
+	{
+		if (slowest == nullptr || SliceThroughput(slice) < SliceThroughput(*slowest))
+		{
+			slowest = &slice;
+		}
+
+		if (fastest == nullptr || SliceThroughput(slice) > SliceThroughput(*fastest))
+		{
+			fastest = &slice;
+		}
+	}
+
+	if (slowest != nullptr)
+	{
+		OutputText(L"Fastest GiB %.1f MiB/s ending at %.3f GiB, slowest %.1f MiB/s ending at %.3f GiB\n",
+				SliceThroughput(*fastest), (double) fastest->endPosition / (double) GiB,
+				SliceThroughput(*slowest), (double) slowest->endPosition / (double) GiB);
+	}
+}
+
+
+//	Write the percentiles of one histogram as a JSON object
+static void WriteJsonHistogram (FILE* jsonFile, const char* name, const LatencyHistogram& histogram)
+{
+	fprintf(jsonFile, "  \"%s\": {\"count\": %llu", name, histogram.Count());
+	for (int i = 0; i < numPercentiles; i++)
+	{
+		fprintf(jsonFile, ", \"%s\": %.1f", percentileNames [i], Microseconds(histogram.Percentile(percentiles [i])));
+	}
+	fprintf(jsonFile, ", \"max\": %.1f},\n", Microseconds(histogram.Max()));
+}
+
+
+//	Write the per GiB slices to baseName.csv and everything to
+//	baseName.json
+bool RunTelemetry::WriteFiles (const wchar_t* baseName, const char* toolName, const char* target)
+{
+	std::lock_guard<std::mutex> lock(telemetryLock);
+	EndSlice();
+
+	wchar_t	fileName [MAX_PATH];
+	FILE*	csvFile = nullptr;
+	swprintf_s(fileName, L"%s.csv", baseName);
+	if (_wfopen_s(&csvFile, fileName, L"w") != 0 || csvFile == nullptr)
+	{
+		PrintError(L"Could not create the telemetry file %s", fileName);
+		return false;
+	}
+
+	fprintf(csvFile, "pass,end_gib,seconds,mib_per_second,requests,mean_latency_us,max_latency_us\n");
+	for (const auto& slice : slices)
+	{
+		const uint64_t meanLatency = slice.requests != 0 ? slice.latencyTotal / slice.requests : 0;
+		fprintf(csvFile, "%u,%.3f,%.3f,%.1f,%llu,%.1f,%.1f\n",
+				slice.pass, (double) slice.endPosition / (double) GiB, slice.seconds, SliceThroughput(slice),
+				slice.requests, Microseconds(meanLatency), Microseconds(slice.latencyMax));
+	}
+	fclose(csvFile);
+
+	FILE* jsonFile = nullptr;
+	swprintf_s(fileName, L"%s.json", baseName);
+	if (_wfopen_s(&jsonFile, fileName, L"w") != 0 || jsonFile == nullptr)
+	{
+		PrintError(L"Could not create the telemetry file %s", fileName);
+		return false;
+	}
+
+	fprintf(jsonFile, "{\n  \"tool\": ");
+	WriteJsonString(jsonFile, toolName);
+	fprintf(jsonFile, ",\n  \"target\": ");
+	WriteJsonString(jsonFile, target);
+	fprintf(jsonFile, ",\n");
+	WriteJsonHistogram(jsonFile, "write_latency_us", writeLatency);
+	WriteJsonHistogram(jsonFile, "read_latency_us", readLatency);
+	fprintf(jsonFile, "  \"slices\": [");
+	for (size_t i = 0; i < slices.size(); i++)
+	{
+		const auto& slice = slices [i];
+		fprintf(jsonFile, "%s\n    {\"pass\": %u, \"end_gib\": %.3f, \"seconds\": %.3f, \"mib_per_second\": %.1f, \"max_latency_us\": %.1f}",
+				i == 0 ? "" : ",", slice.pass, (double) slice.endPosition / (double) GiB, slice.seconds,
+				SliceThroughput(slice), Microseconds(slice.latencyMax));
+	}
+	fprintf(jsonFile, "\n  ]\n}\n");
+
+	const bool written = ferror(jsonFile) == 0;
+	fclose(jsonFile);
+	return written;
+}
@@ -0,0 +1,113 @@
+//	Latency and throughput telemetry for a run. Every request's latency
+//	goes into a log bucket histogram, and the progress through the device
+//	is cut into one GiB slices, so a drive that slows down once its fast
+//	cache is full, or that stalls as it wears out, shows up in the results
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+//	Counts of latencies in log buckets. Each power of two is split into
+//	sixteen linear buckets, so a bucket is never more than about 6% wide
+//	and the whole range of a 64 bit value fits in under a thousand counts
+class LatencyHistogram
+{
+public:
+	LatencyHistogram ();
+
+	//	Count one latency in nanoseconds
+	void Add (uint64_t nanoseconds);
+
+	//	How many latencies were counted
+	uint64_t Count () const		{ return totalCount; }
+
+	//	The longest latency counted
+	uint64_t Max () const		{ return maxValue; }
+
+	//	The latency percent of the counts are at or under. The answer is
+	//	the top of the bucket it falls in, so it is never understated
+	uint64_t Percentile (double percent) const;
+
+	//	Number of buckets and the range of values each one covers
+	static constexpr size_t	subBuckets	= 16;
+	static constexpr size_t	numBuckets	= (64 - 3) * subBuckets;
+	static size_t BucketIndex (uint64_t value);
+	static uint64_t BucketLowest (size_t index);
+	static uint64_t BucketHighest (size_t index);
+
+private:
+	std::vector<uint64_t>	counts;
+	uint64_t				totalCount;
+	uint64_t				maxValue;
+};
+
+//	One GiB of progress through the device, or less for the last slice of
+//	a pass
+struct ThroughputSlice
+{
+	//	Which pass over the device this is, starting at one
+	uint32_t	pass;
+
+	//	How far through the device the slice ends, in bytes
+	uint64_t	endPosition;
+
+	//	How long the slice took and how much was written and read in it
+	double		seconds;
+	uint64_t	transferred;
+
+	//	Latency of the requests in the slice, in nanoseconds
+	uint64_t	requests;
+	uint64_t	latencyTotal;
+	uint64_t	latencyMax;
+};
+
+//	Everything measured about a run. All the members are safe to call
+//	from more than one thread
+class RunTelemetry
+{
+public:
+	RunTelemetry ();
+
+	//	Start a pass over the device, at startPosition bytes into it for
+	//	a run that is resuming. Passes are numbered from one
+	void StartPass (uint32_t pass, uint64_t startPosition);
+
+	//	Count how long one request took
+	void AddLatency (bool reading, uint64_t nanoseconds);
+
+	//	Move coveredBytes further through the device, having written and
+	//	read transferredBytes to do it
+	void AddProgress (uint64_t coveredBytes, uint64_t transferredBytes);
+
+	//	How far through the device the current pass has got, in bytes
+	uint64_t Position (uint32_t& pass);
+
+	//	Print the latency percentiles
+	void OutputSummary ();
+
+	//	Write the per GiB slices to baseName.csv and the latency
+	//	percentiles and slices to baseName.json. Returns false if either
+	//	file couldn't be written
+	bool WriteFiles (const wchar_t* baseName, const char* toolName, const char* target);
+
+private:
+	//	Close the slice in progress
+	void EndSlice ();
+
+	std::mutex						telemetryLock;
+	LatencyHistogram				writeLatency;
+	LatencyHistogram				readLatency;
+	std::vector<ThroughputSlice>	slices;
+
+	//	The slice in progress, where it started and when
+	ThroughputSlice					current;
+	uint64_t						sliceFrom;
+	uint64_t						sliceStart;
+};
@@ -0,0 +1,62 @@
+//	Bandwidth cap shared by the devices on one USB root hub, so testing
+//	several at once doesn't oversubscribe the host controller
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "throttle.h"
+#include "timing.h"
+
+#include <Windows.h>
+
+//	The cap for block targets opened from the current thread
+static thread_local RateLimiter*	threadThrottle	= nullptr;
+
+
+RateLimiter::RateLimiter (uint64_t bytesPerSecond)
+{
+	rate		= bytesPerSecond;
+	available	= (double) bytesPerSecond;
+	lastRefill	= NowNanoseconds();
+}
+
+
+//	Wait until bytes can be moved without going over the cap. The bytes
+//	are taken straight away, so the bucket can go into debt and the
+//	caller waits for the debt to be paid off. Waiting outside the lock
+//	lets the other devices on the hub queue up behind this one
+void RateLimiter::Take (uint64_t bytes)
+{
+	double waitSeconds = 0;
+	{
+		std::lock_guard<std::mutex> lock(limiterLock);
+		const uint64_t now = NowNanoseconds();
+		available	= min(available + ((double) (now - lastRefill) / 1e9) * (double) rate, (double) rate);
+		lastRefill	= now;
+
+		available -= (double) bytes;
+		if (available < 0)
+		{
+			waitSeconds = -available / (double) rate;
+		}
+	}
+
+	if (waitSeconds > 0)
+	{
+		Sleep((DWORD) (waitSeconds * 1000.0) + 1);
+	}
+}
+
+
+//	Cap the I/O of block targets opened from the current thread
+void SetThreadThrottle (RateLimiter* limiter)
+{
+	threadThrottle = limiter;
+}
+
+
+//	The cap for the current thread
+RateLimiter* ThreadThrottle ()
+{
+	return threadThrottle;
+}
@@ -0,0 +1,36 @@
+//	Bandwidth cap shared by the devices on one USB root hub, so testing
+//	several at once doesn't oversubscribe the host controller
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+
+//	Token bucket holding up to one second of bandwidth. Requests that
+//	don't fit wait until enough has built up again
+class RateLimiter
+{
+public:
+	explicit RateLimiter (uint64_t bytesPerSecond);
+
+	//	Wait until bytes can be moved without going over the cap. This is
+	//	safe to call from more than one thread
+	void Take (uint64_t bytes);
+
+private:
+	std::mutex	limiterLock;
+	uint64_t	rate;
+	double		available;
+	uint64_t	lastRefill;
+};
+
+//	Cap the I/O of block targets opened from the current thread, or lift
+//	the cap with nullptr
+void SetThreadThrottle (RateLimiter* limiter);
+
+//	The cap for the current thread, nullptr if there isn't one
+RateLimiter* ThreadThrottle ();
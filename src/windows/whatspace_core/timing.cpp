@@ -0,0 +1,51 @@
+//	Timer for the progress the tools report every batch of blocks or files
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "timing.h"
+
+//	All times are reported in seconds
+typedef std::chrono::duration<double> Seconds;
+
+
+//	Both the run and the first batch start now
+BatchTimer::BatchTimer ()
+{
+	runStart	= std::chrono::high_resolution_clock::now();
+	batchStart	= runStart;
+}
+
+
+//	Seconds the current batch has taken, then start the next batch
+double BatchTimer::Lap ()
+{
+	auto end = std::chrono::high_resolution_clock::now();
+	Seconds batchSeconds = end - batchStart;
+	batchStart = end;
+	return batchSeconds.count();
+}
+
+
+//	Seconds the current batch has taken so far
+double BatchTimer::BatchSeconds () const
+{
+	Seconds batchSeconds = std::chrono::high_resolution_clock::now() - batchStart;
+	return batchSeconds.count();
+}
+
+
+//	Seconds since the timer was created
+double BatchTimer::TotalSeconds () const
+{
+	Seconds totalSeconds = std::chrono::high_resolution_clock::now() - runStart;
+	return totalSeconds.count();
+}
+
+
+//	A time in nanoseconds for measuring how long one request takes
+uint64_t NowNanoseconds ()
+{
+	auto sinceEpoch = std::chrono::high_resolution_clock::now().time_since_epoch();
+	return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count();
+}
@@ -0,0 +1,35 @@
+//	Timer for the progress the tools report every batch of blocks or files
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+
+//	Times each batch and the run as a whole
+class BatchTimer
+{
+public:
+	//	Both the run and the first batch start now
+	BatchTimer ();
+
+	//	Seconds the current batch has taken, then start the next batch
+	double Lap ();
+
+	//	Seconds the current batch has taken so far
+	double BatchSeconds () const;
+
+	//	Seconds since the timer was created
+	double TotalSeconds () const;
+
+private:
+	std::chrono::high_resolution_clock::time_point	runStart;
+	std::chrono::high_resolution_clock::time_point	batchStart;
+};
+
+//	A time in nanoseconds for measuring how long one request takes. Only
+//	the difference between two of these means anything
+uint64_t NowNanoseconds ();
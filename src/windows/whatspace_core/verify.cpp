@@ -0,0 +1,184 @@
+//	Buffer comparison used to check data read back from a device. The
+//	compare runs with AVX-512 or AVX2 when the processor has them, so a
+//	full content check keeps up with memory bandwidth
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "verify.h"
+#include "cpu.h"
+#include "pattern.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+//	Bytes of expected pattern generated at a time. This is small enough
+//	to stay in the L1 cache while it is compared
+constexpr size_t	expectedBytes	= 4096;
+
+//	Compares two buffers, returning the first difference
+typedef size_t (*CompareFunction) (const uint8_t* actual, const uint8_t* expected, size_t size);
+
+
+//	Position of the lowest set bit in a non zero mask. This is done in
+//	two halves so it also builds for 32 bit targets
+static inline size_t LowestBit (uint64_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long bit;
+	if (_BitScanForward(&bit, (unsigned long) mask))
+	{
+		return bit;
+	}
+
+	_BitScanForward(&bit, (unsigned long) (mask >> 32));
+	return bit + 32;
+#else
+	return (size_t) __builtin_ctzll(mask);
+#endif
+}
+
+
+//	Byte at a time, for the end of a buffer
+static size_t CompareScalar (const uint8_t* actual, const uint8_t* expected, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		if (actual [i] != expected [i])
+		{
+			return i;
+		}
+	}
+
+	return size;
+}
+
+
+//	SSE2 version, 16 bytes at a time
+static size_t CompareSse2 (const uint8_t* actual, const uint8_t* expected, size_t size)
+{
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*) (actual + i));
+		__m128i e = _mm_loadu_si128((const __m128i*) (expected + i));
+
+		//	Each matching byte sets a bit in the mask
+		unsigned int same = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, e));
+		if (same != 0xFFFF)
+		{
+			return i + LowestBit(~same & 0xFFFF);
+		}
+	}
+
+	return i + CompareScalar(actual + i, expected + i, size - i);
+}
+
+
+//	AVX2 version, 64 bytes at a time. The two halves are combined before
+//	the mask is checked, so there is one branch per cache line
+TARGET_AVX2 static size_t CompareAvx2 (const uint8_t* actual, const uint8_t* expected, size_t size)
+{
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64)
+	{
+		__m256i low		= _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (actual + i)), _mm256_loadu_si256((const __m256i*) (expected + i)));
+		__m256i high	= _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (actual + i + 32)), _mm256_loadu_si256((const __m256i*) (expected + i + 32)));
+
+		if ((unsigned int) _mm256_movemask_epi8(_mm256_and_si256(low, high)) != 0xFFFFFFFF)
+		{
+			uint64_t same = ((uint64_t) (unsigned int) _mm256_movemask_epi8(high) << 32) | (unsigned int) _mm256_movemask_epi8(low);
+			return i + LowestBit(~same);
+		}
+	}
+
+	return i + CompareSse2(actual + i, expected + i, size - i);
+}
+
+
+//	AVX-512 version, 128 bytes at a time. The compare produces a mask of
+//	the bytes that differ directly
+TARGET_AVX512 static size_t CompareAvx512 (const uint8_t* actual, const uint8_t* expected, size_t size)
+{
+	size_t i = 0;
+	for (; i + 128 <= size; i += 128)
+	{
+		__mmask64 low	= _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(actual + i), _mm512_loadu_si512(expected + i));
+		__mmask64 high	= _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(actual + i + 64), _mm512_loadu_si512(expected + i + 64));
+
+		if ((low | high) != 0)
+		{
+			return low != 0 ? i + LowestBit(low) : i + 64 + LowestBit(high);
+		}
+	}
+
+	return i + CompareAvx2(actual + i, expected + i, size - i);
+}
+
+
+//	Pick the fastest compare the processor supports
+static CompareFunction PickCompare ()
+{
+	if (CpuHasAvx512())
+	{
+		return CompareAvx512;
+	}
+
+	if (CpuHasAvx2())
+	{
+		return CompareAvx2;
+	}
+
+	return CompareSse2;
+}
+
+
+//	Compare two buffers. Returns the byte position of the first
+//	difference, or size if they are the same
+size_t FindMismatch (const uint8_t* actual, const uint8_t* expected, size_t size)
+{
+	static const CompareFunction compare = PickCompare();
+	return compare(actual, expected, size);
+}
+
+
+//	Check a whole buffer against the pattern for its offset, sector by
+//	sector, rather than stopping at the first bad byte
+VerifyResult VerifyPattern (const uint8_t* buffer, size_t bufferSize, uint64_t seed, uint64_t offset, size_t sectorSize)
+{
+	//	The expected pattern is generated a piece at a time so we don't
+	//	need a second buffer the size of the one being checked
+	alignas(64) uint8_t expected [expectedBytes];
+
+	VerifyResult result;
+	result.firstMismatch	= bufferSize;
+	result.badSectors		= 0;
+
+	for (size_t sector = 0; sector < bufferSize; sector += sectorSize)
+	{
+		const size_t sectorEnd = bufferSize - sector < sectorSize ? bufferSize : sector + sectorSize;
+
+		//	Once a sector has a bad byte the rest of it can be skipped
+		for (size_t piece = sector; piece < sectorEnd; piece += expectedBytes)
+		{
+			const size_t pieceSize = sectorEnd - piece < expectedBytes ? sectorEnd - piece : expectedBytes;
+			FillPattern(expected, pieceSize, seed, offset + piece);
+
+			const size_t badByte = FindMismatch(buffer + piece, expected, pieceSize);
+			if (badByte != pieceSize)
+			{
+				if (result.badSectors == 0)
+				{
+					result.firstMismatch = piece + badByte;
+				}
+				result.badSectors ++;
+				break;
+			}
+		}
+	}
+
+	return result;
+}
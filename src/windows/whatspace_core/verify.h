@@ -0,0 +1,30 @@
+//	Buffer comparison used to check data read back from a device. The
+//	compare runs with AVX-512 or AVX2 when the processor has them, so a
+//	full content check keeps up with memory bandwidth
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//	What a content check found
+struct VerifyResult
+{
+	//	Byte position of the first mismatch, or the buffer size if
+	//	everything matched
+	size_t		firstMismatch;
+
+	//	Number of sectors with at least one bad byte
+	uint64_t	badSectors;
+};
+
+//	Compare two buffers. Returns the byte position of the first
+//	difference, or size if they are the same
+size_t FindMismatch (const uint8_t* actual, const uint8_t* expected, size_t size);
+
+//	Check a whole buffer against the pattern for its offset, sector by
+//	sector, rather than stopping at the first bad byte
+VerifyResult VerifyPattern (const uint8_t* buffer, size_t bufferSize, uint64_t seed, uint64_t offset, size_t sectorSize);
@@ -0,0 +1,180 @@
+//	Watchdog that cancels a read or write that has been in flight too
+//	long, so a device that stops answering, e.g. one that has dropped off
+//	the bus, fails its run instead of hanging it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#include "watchdog.h"
+#include "timing.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+//	How often the watchdog looks for requests that have run over, in ms
+constexpr DWORD	watchdogPoll	= 1000;
+
+//	A request being watched. A synchronous request has no overlapped, and
+//	is cancelled through the thread that made it
+struct WatchedRequest
+{
+	HANDLE		handle;
+	OVERLAPPED*	overlapped;
+	HANDLE		thread;
+	uint64_t	deadline;
+	bool		cancelled;
+};
+
+//	A handle to a thread that CancelSynchronousIo can use. Each thread
+//	makes its own the first time it is needed, and closes it on exit
+struct ThreadHandle
+{
+	HANDLE handle = nullptr;
+
+	~ThreadHandle ()
+	{
+		if (handle != nullptr)
+		{
+			CloseHandle(handle);
+		}
+	}
+};
+
+//	Everything the watchdog thread shares with the engines. It is never
+//	freed, as the thread runs until the process exits
+struct WatchdogState
+{
+	std::mutex										watchLock;
+	std::unordered_map<uint64_t, WatchedRequest>	watched;
+	uint64_t										nextTicket	= 1;
+	bool											running		= false;
+};
+
+//	Seconds a request can be in flight, for every engine in the process
+static std::atomic<DWORD>	ioTimeout(defaultIoTimeout);
+
+
+//	The watchdog's state, made the first time it is needed
+static WatchdogState& Watchdog ()
+{
+	static WatchdogState* state = new WatchdogState();
+	return *state;
+}
+
+
+//	A handle to the calling thread, or nullptr if one could not be made.
+//	GetCurrentThread only gives a pseudo handle, which would name the
+//	watchdog thread when it is used there
+static HANDLE CurrentThreadHandle ()
+{
+	static thread_local ThreadHandle thread;
+	if (thread.handle == nullptr
+	&&	!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &thread.handle, THREAD_TERMINATE, FALSE, 0))
+	{
+		thread.handle = nullptr;
+	}
+
+	return thread.handle;
+}
+
+
+//	Cancel every request that is past its deadline. The cancel is made
+//	with the lock held, so a request that has been unwatched, and whose
+//	OVERLAPPED structure or thread may be on to the next one, is never
+//	cancelled
+static void WatchdogThread (WatchdogState* state)
+{
+	for (;;)
+	{
+		Sleep(watchdogPoll);
+
+		std::lock_guard<std::mutex> lock(state->watchLock);
+		const uint64_t now = NowNanoseconds();
+		for (auto& entry : state->watched)
+		{
+			WatchedRequest& request = entry.second;
+			if (!request.cancelled && now >= request.deadline)
+			{
+				if (request.thread != nullptr)
+				{
+					CancelSynchronousIo(request.thread);
+				}
+				else
+				{
+					CancelIoEx(request.handle, request.overlapped);
+				}
+				request.cancelled = true;
+			}
+		}
+	}
+}
+
+
+//	Set how long a request can be in flight
+void SetIoTimeout (DWORD seconds)
+{
+	ioTimeout = seconds;
+}
+
+
+//	Seconds a request can be in flight
+DWORD IoTimeout ()
+{
+	return ioTimeout;
+}
+
+
+//	Start watching a request. The thread is only started once there is
+//	something to watch
+uint64_t WatchRequest (HANDLE handle, OVERLAPPED* overlapped)
+{
+	const DWORD timeout = ioTimeout;
+	if (timeout == 0)
+	{
+		return 0;
+	}
+
+	//	Without a handle to its thread, a synchronous request can't be
+	//	cancelled, so it isn't watched
+	HANDLE thread = nullptr;
+	if (overlapped == nullptr && (thread = CurrentThreadHandle()) == nullptr)
+	{
+		return 0;
+	}
+
+	WatchdogState& state = Watchdog();
+	std::lock_guard<std::mutex> lock(state.watchLock);
+	if (!state.running)
+	{
+		std::thread(WatchdogThread, &state).detach();
+		state.running = true;
+	}
+
+	const uint64_t ticket = state.nextTicket ++;
+	state.watched [ticket] = { handle, overlapped, thread, NowNanoseconds() + (uint64_t) timeout * 1000000000ULL, false };
+	return ticket;
+}
+
+
+//	Stop watching a request
+bool UnwatchRequest (uint64_t ticket)
+{
+	if (ticket == 0)
+	{
+		return false;
+	}
+
+	WatchdogState& state = Watchdog();
+	std::lock_guard<std::mutex> lock(state.watchLock);
+	const auto request = state.watched.find(ticket);
+	if (request == state.watched.end())
+	{
+		return false;
+	}
+
+	const bool cancelled = request->second.cancelled;
+	state.watched.erase(request);
+	return cancelled;
+}
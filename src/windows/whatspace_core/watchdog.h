@@ -0,0 +1,34 @@
+//	Watchdog that cancels a read or write that has been in flight too
+//	long, so a device that stops answering, e.g. one that has dropped off
+//	the bus, fails its run instead of hanging it
+//
+//	License: MIT. See the LICENSE file in the project root for more details.
+//
+
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+//	Seconds a request can be in flight unless the tool sets otherwise
+constexpr DWORD	defaultIoTimeout	= 60;
+
+//	Set how many seconds a request can be in flight before it is
+//	cancelled, or zero to let requests take as long as they take
+void SetIoTimeout (DWORD seconds);
+
+//	Seconds a request can be in flight, zero if there is no limit
+DWORD IoTimeout ();
+
+//	Start watching a request on a handle. A request on an overlapped
+//	handle is cancelled on its own. A nullptr overlapped is for a
+//	synchronous request made by the calling thread, and only that
+//	thread's I/O is cancelled, as CancelIoEx can't reach a synchronous
+//	handle's requests from another thread. Returns the ticket to stop
+//	watching it with, or zero if there is no limit. This is safe to call
+//	from more than one thread
+uint64_t WatchRequest (HANDLE handle, OVERLAPPED* overlapped);
+
+//	Stop watching a request once it has finished. Returns true if it was
+//	cancelled for taking too long
+bool UnwatchRequest (uint64_t ticket);